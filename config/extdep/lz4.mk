@@ -0,0 +1,15 @@
+ifndef lz4_mk__
+       lz4_mk__ = 1
+
+ifeq ($(SYSNAME),Linux)
+
+LIBS +=         -llz4
+
+endif
+
+# Local Variables:
+# mode: Makefile
+# tab-width: 4
+# End:
+
+endif # lz4_mk__
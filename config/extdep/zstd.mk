@@ -0,0 +1,15 @@
+ifndef zstd_mk__
+       zstd_mk__ = 1
+
+ifeq ($(SYSNAME),Linux)
+
+LIBS +=         -lzstd
+
+endif
+
+# Local Variables:
+# mode: Makefile
+# tab-width: 4
+# End:
+
+endif # zstd_mk__
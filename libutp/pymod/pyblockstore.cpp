@@ -7,6 +7,7 @@
 #include "pyblockstore.h"
 #include "pybsstat.h"
 #include "pyshe.h"
+#include "pystatset.h"
 #include "pyutpinit.h"
 
 using namespace std;
@@ -131,6 +132,24 @@ BlockStore_bs_sync(BlockStoreObject *self, PyObject *args)
     PYUTP_CATCH_ALL;
 }
 
+static PyObject *
+BlockStore_bs_get_stats(BlockStoreObject *self, PyObject *args)
+{
+    if (!PyArg_ParseTuple(args, ":bs_get_stats"))
+        return NULL;
+
+    StatSet ss;
+
+    PYUTP_TRY
+    {
+        PYUTP_THREADED_SCOPE scope;
+        self->m_bsh->bs_get_stats(ss);
+    }
+    PYUTP_CATCH_ALL;
+
+    return pystatset_fromstatset(ss);
+}
+
 static PyObject *
 BlockStore_bs_block_get(BlockStoreObject *self, PyObject *args)
 {
@@ -485,6 +504,7 @@ static PyMethodDef BlockStore_methods[] = {
     {"bs_close",		(PyCFunction)BlockStore_bs_close,		METH_VARARGS},
     {"bs_stat",			(PyCFunction)BlockStore_bs_stat,		METH_VARARGS},
     {"bs_sync",			(PyCFunction)BlockStore_bs_sync,		METH_VARARGS},
+    {"bs_get_stats",	(PyCFunction)BlockStore_bs_get_stats,	METH_VARARGS},
     {"bs_block_get",	(PyCFunction)BlockStore_bs_block_get,	METH_VARARGS},
     {"bs_block_put",	(PyCFunction)BlockStore_bs_block_put,	METH_VARARGS},
     {"bs_refresh_start",
@@ -12,6 +12,7 @@
 #include "pydirentryfunc.h"
 #include "pyfilesystem.h"
 #include "pystat.h"
+#include "pystatset.h"
 #include "pystatvfs.h"
 #include "pyutpinit.h"
 
@@ -388,6 +389,77 @@ FileSystem_fs_read(FileSystemObject *self, PyObject *args)
     return retobj;
 }
 
+// Gathers the pieces fs_read_vec passes, so the tests can compare
+// them with fs_read.
+//
+struct GatherReadVecFunc : public FileSystem::ReadVecFunc
+{
+    vector<unsigned char>	m_data;
+    bool					m_done;
+
+    GatherReadVecFunc() : m_done(false) {}
+
+    virtual void rv_segment(void const * i_data, size_t i_size)
+    {
+        unsigned char const * ptr = (unsigned char const *) i_data;
+        m_data.insert(m_data.end(), ptr, ptr + i_size);
+    }
+
+    virtual void rv_done()
+    {
+        m_done = true;
+    }
+};
+
+static PyObject *
+FileSystem_fs_read_vec(FileSystemObject *self, PyObject *args)
+{
+    char * path;
+    long int size;
+    long int offset = 0;
+    
+    if (!PyArg_ParseTuple(args, "sl|l:fs_read_vec", &path, &size, &offset))
+        return NULL;
+
+    GatherReadVecFunc grvf;
+
+    int retval;
+    PYUTP_TRY
+    {
+        PYUTP_THREADED_SCOPE scope;
+        retval = self->m_fsh->fs_read_vec(path,
+                                          size_t(size),
+                                          off_t(offset),
+                                          grvf);
+    }
+    PYUTP_CATCH_ALL;
+
+    // Was there an error?
+    if (retval < 0)
+    {
+        errno = -retval;
+        return PyErr_SetFromErrno(PyExc_OSError);
+    }
+
+    if (!grvf.m_done || grvf.m_data.size() != size_t(retval))
+    {
+        PyErr_SetString(FileSystemErrorObject,
+                        "fs_read_vec pieces don't match its return");
+        return NULL;
+    }
+
+    PyObject * retobj = PyBuffer_New(retval);
+    void * outptr;
+    Py_ssize_t outlen;
+    if (PyObject_AsWriteBuffer(retobj, &outptr, &outlen))
+        return NULL;
+
+    if (outlen)
+        memcpy(outptr, &grvf.m_data[0], outlen);
+
+    return retobj;
+}
+
 static PyObject *
 FileSystem_fs_write(FileSystemObject *self, PyObject *args)
 {
@@ -550,6 +622,24 @@ FileSystem_fs_sync(FileSystemObject *self, PyObject *args)
     return Py_None;
 }
 
+static PyObject *
+FileSystem_fs_get_stats(FileSystemObject *self, PyObject *args)
+{
+    if (!PyArg_ParseTuple(args, ":fs_get_stats"))
+        return NULL;
+
+    StatSet ss;
+
+    PYUTP_TRY
+    {
+        PYUTP_THREADED_SCOPE scope;
+        self->m_fsh->fs_get_stats(ss);
+    }
+    PYUTP_CATCH_ALL;
+
+    return pystatset_fromstatset(ss);
+}
+
 static PyMethodDef FileSystem_methods[] = {
     {"fs_umount",		(PyCFunction)FileSystem_fs_umount,		METH_VARARGS},
     {"fs_getattr",		(PyCFunction)FileSystem_fs_getattr,		METH_VARARGS},
@@ -566,6 +656,7 @@ static PyMethodDef FileSystem_methods[] = {
     {"fs_truncate",		(PyCFunction)FileSystem_fs_truncate,	METH_VARARGS},
     {"fs_open",			(PyCFunction)FileSystem_fs_open,		METH_VARARGS},
     {"fs_read",			(PyCFunction)FileSystem_fs_read,		METH_VARARGS},
+    {"fs_read_vec",		(PyCFunction)FileSystem_fs_read_vec,	METH_VARARGS},
     {"fs_write",		(PyCFunction)FileSystem_fs_write,		METH_VARARGS},
     {"fs_statfs",		(PyCFunction)FileSystem_fs_statfs,		METH_VARARGS},
     {"fs_readdir",		(PyCFunction)FileSystem_fs_readdir,		METH_VARARGS},
@@ -573,6 +664,7 @@ static PyMethodDef FileSystem_methods[] = {
     {"fs_utime",		(PyCFunction)FileSystem_fs_utime,		METH_VARARGS},
     {"fs_refresh",		(PyCFunction)FileSystem_fs_refresh,		METH_VARARGS},
     {"fs_sync",			(PyCFunction)FileSystem_fs_sync,		METH_VARARGS},
+    {"fs_get_stats",	(PyCFunction)FileSystem_fs_get_stats,	METH_VARARGS},
     {NULL,		NULL}		/* sentinel */
 };
 
@@ -0,0 +1,58 @@
+#include "pystatset.h"
+
+namespace utp {
+
+PyObject *
+pystatset_fromstatset(StatSet const & i_ss)
+{
+    PyObject * dict = PyDict_New();
+    if (!dict)
+        return NULL;
+
+    for (int i = 0; i < i_ss.rec_size(); ++i)
+    {
+        StatRec const & rec = i_ss.rec(i);
+        PyObject * val = PyLong_FromLongLong((PY_LONG_LONG) rec.value());
+        if (!val)
+        {
+            Py_DECREF(dict);
+            return NULL;
+        }
+        int rv = PyDict_SetItemString(dict, rec.name().c_str(), val);
+        Py_DECREF(val);
+        if (rv)
+        {
+            Py_DECREF(dict);
+            return NULL;
+        }
+    }
+
+    for (int i = 0; i < i_ss.subset_size(); ++i)
+    {
+        StatSet const & sub = i_ss.subset(i);
+        PyObject * val = pystatset_fromstatset(sub);
+        if (!val)
+        {
+            Py_DECREF(dict);
+            return NULL;
+        }
+        int rv = PyDict_SetItemString(dict, sub.name().c_str(), val);
+        Py_DECREF(val);
+        if (rv)
+        {
+            Py_DECREF(dict);
+            return NULL;
+        }
+    }
+
+    return dict;
+}
+
+} // end namespace utp
+
+// Local Variables:
+// mode: C++
+// tab-width: 4
+// c-basic-offset: 4
+// c-file-offsets: ((comment-intro . 0))
+// End:
@@ -0,0 +1,29 @@
+#ifndef pystatset_h__
+#define pystatset_h__
+
+#include "Stats.h"
+
+#if defined(LINUX)
+// Python and sys/features clash over this.
+# undef _POSIX_C_SOURCE
+# undef _XOPEN_SOURCE
+#endif
+
+#include <Python.h>             // CONFLICT: include this after ACE includes
+
+namespace utp {
+
+// Converts a StatSet to a dictionary.  Each record maps its name to
+// its value and each subset maps its name to a nested dictionary.
+PyObject * pystatset_fromstatset(StatSet const & i_ss);
+
+} // end namespace utp
+
+// Local Variables:
+// mode: C++
+// tab-width: 4
+// c-basic-offset: 4
+// c-file-offsets: ((comment-intro . 0))
+// End:
+
+#endif //  pystatset_h__
@@ -90,6 +90,17 @@ public:
                                off_t i_off) = 0;
     };
 
+    struct ReadVecFunc
+    {
+        // Called with the data read, in order, one piece at a time.
+        // The pieces are only valid until rv_done returns.
+        //
+        virtual void rv_segment(void const * i_data, size_t i_size) = 0;
+
+        // Called once all the pieces have been passed.
+        virtual void rv_done() = 0;
+    };
+
     /// Destructor
     ///
     virtual ~FileSystem();
@@ -340,6 +351,28 @@ public:
                         off_t i_off)
         throw (utp::InternalError) = 0;
 
+    /// Read data from an open file without copying it
+    ///
+    /// Passes the data to the functor in place, as it is held by the
+    /// filesystem, rather than copying it into a buffer.
+    ///
+    /// @param[in] i_path Path to the file.
+    /// @param[in] i_size Number of bytes to read.
+    /// @param[in] i_off Offset to read from.
+    /// @param[out] o_readfunc ReadVecFunc to call with the data.
+    ///
+    /// @return Returns the number of bytes read or -errno.  On
+    ///         failure rv_done isn't called and any pieces passed
+    ///         are to be dropped.
+    ///
+    /// @throw InternalError An non-recoverable error occurred.
+    ///
+    virtual int fs_read_vec(std::string const & i_path,
+                            size_t i_size,
+                            off_t i_off,
+                            ReadVecFunc & o_readfunc)
+        throw (utp::InternalError) = 0;
+
     /// Write data to an open file
     ///
     /// @param[in] i_path Path to the file.
@@ -0,0 +1,166 @@
+#include <vector>
+
+#include <lz4.h>
+#include <zstd.h>
+
+#include <ace/OS_NS_string.h>
+
+#include "Log.h"
+
+#include "utfslog.h"
+
+#include "BlockCodec.h"
+
+using namespace std;
+using namespace utp;
+
+namespace {
+
+size_t const HDRSZ = 8;
+size_t const CIPHERSZ = 16;
+
+// Compression level zstd uses by default.
+int const ZSTD_LEVEL = 3;
+
+} // end namespace
+
+namespace UTFS {
+
+BlockCodec::Method
+BlockCodec::parse(string const & i_name)
+    throw(ValueError)
+{
+    if (i_name == "none")
+        return NONE;
+    else if (i_name == "lz4")
+        return LZ4;
+    else if (i_name == "zstd")
+        return ZSTD;
+    else
+        throwstream(ValueError,
+                    "unknown compression method \"" << i_name << "\"");
+}
+
+char const *
+BlockCodec::name(Method i_method)
+{
+    switch (i_method)
+    {
+    case NONE:	return "none";
+    case LZ4:	return "lz4";
+    case ZSTD:	return "zstd";
+    }
+    return "unknown";
+}
+
+size_t
+BlockCodec::encode(uint8 const * i_data,
+                   size_t i_size,
+                   uint8 * o_blk) const
+{
+    // It's only worth it if we save a cipher block.
+    if (m_method != NONE && i_size > HDRSZ + CIPHERSZ)
+    {
+        size_t maxsz = i_size - CIPHERSZ - HDRSZ;
+        size_t compsz = 0;
+
+        if (m_method == LZ4)
+        {
+            int rv = LZ4_compress_default((char const *) i_data,
+                                          (char *) o_blk + HDRSZ,
+                                          int(i_size),
+                                          int(maxsz));
+            compsz = rv > 0 ? size_t(rv) : 0;
+        }
+        else if (m_method == ZSTD)
+        {
+            size_t rv = ZSTD_compress(o_blk + HDRSZ, maxsz,
+                                      i_data, i_size,
+                                      ZSTD_LEVEL);
+            compsz = ZSTD_isError(rv) ? 0 : rv;
+        }
+
+        if (compsz)
+        {
+            o_blk[0] = uint8(m_method);
+            o_blk[1] = o_blk[2] = o_blk[3] = 0;
+            o_blk[4] = uint8(compsz >> 24);
+            o_blk[5] = uint8(compsz >> 16);
+            o_blk[6] = uint8(compsz >> 8);
+            o_blk[7] = uint8(compsz);
+
+            // Pad out for the cipher.
+            size_t blksz = HDRSZ + compsz;
+            size_t padsz = (CIPHERSZ - blksz % CIPHERSZ) % CIPHERSZ;
+            ACE_OS::memset(o_blk + blksz, '\0', padsz);
+            return blksz + padsz;
+        }
+    }
+
+    ACE_OS::memcpy(o_blk, i_data, i_size);
+    return i_size;
+}
+
+void
+BlockCodec::decode(uint8 * io_data,
+                   size_t i_blksize,
+                   size_t i_size)
+    throw(VerificationError)
+{
+    if (i_blksize < HDRSZ)
+        throwstream(VerificationError,
+                    "compressed block too short: " << i_blksize);
+
+    size_t compsz =
+        (size_t(io_data[4]) << 24) |
+        (size_t(io_data[5]) << 16) |
+        (size_t(io_data[6]) << 8) |
+        size_t(io_data[7]);
+
+    if (compsz == 0 || compsz > i_blksize - HDRSZ)
+        throwstream(VerificationError,
+                    "compressed length " << compsz
+                    << " overruns block of " << i_blksize);
+
+    // The data expands over the block, decompress from a copy.
+    vector<uint8> comp(io_data + HDRSZ, io_data + HDRSZ + compsz);
+
+    size_t datasz = 0;
+    switch (io_data[0])
+    {
+    case LZ4:
+        {
+            int rv = LZ4_decompress_safe((char const *) &comp[0],
+                                         (char *) io_data,
+                                         int(compsz),
+                                         int(i_size));
+            datasz = rv > 0 ? size_t(rv) : 0;
+        }
+        break;
+
+    case ZSTD:
+        {
+            size_t rv = ZSTD_decompress(io_data, i_size, &comp[0], compsz);
+            datasz = ZSTD_isError(rv) ? 0 : rv;
+        }
+        break;
+
+    default:
+        throwstream(VerificationError,
+                    "unknown compression method " << int(io_data[0]));
+    }
+
+    if (datasz != i_size)
+        throwstream(VerificationError,
+                    name(Method(io_data[0])) << " block decompressed to "
+                    << datasz << " bytes, expected " << i_size);
+}
+
+} // namespace UTFS
+
+// Local Variables:
+// mode: C++
+// tab-width: 4
+// c-basic-offset: 4
+// c-file-offsets: ((comment-intro . 0))
+// End:
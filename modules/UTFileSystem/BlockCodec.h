@@ -0,0 +1,85 @@
+#ifndef UTFS_BlockCodec_h__
+#define UTFS_BlockCodec_h__
+
+/// @file BlockCodec.h
+/// Utopia FileSystem Block Compression.
+
+#include <string>
+
+#include "utpfwd.h"
+
+#include "Except.h"
+#include "Types.h"
+
+#include "utfsexp.h"
+#include "utfsfwd.h"
+
+namespace UTFS {
+
+// Compresses blocks before they are encrypted.
+//
+// A compressed block is stored shorter than the data it holds:
+//
+//   byte 0        method (LZ4 or ZSTD)
+//   bytes 1-3     zero
+//   bytes 4-7     compressed length, big endian
+//   bytes 8-      compressed data, zero padded to the cipher's 16
+//
+// A block stored at the full size of its data holds it as is.  Blocks
+// written before compression existed, and blocks which don't shrink
+// by at least a cipher block, are stored that way.  The method used
+// for new blocks is chosen at mkfs and recorded in the root
+// directory, blocks of any method read back regardless.
+//
+class UTFS_EXP BlockCodec
+{
+public:
+    enum Method
+    {
+        NONE	= 0,
+        LZ4		= 1,	// Fast
+        ZSTD	= 2,	// Smaller
+    };
+
+    BlockCodec() : m_method(NONE) {}
+
+    Method method() const { return m_method; }
+
+    void method(Method i_method) { m_method = i_method; }
+
+    // Parses a method name ("none", "lz4" or "zstd").
+    static Method parse(std::string const & i_name)
+        throw(utp::ValueError);
+
+    static char const * name(Method i_method);
+
+    // Encodes i_size bytes of data into o_blk, which has room for
+    // i_size bytes.  Returns the size of the block to store, i_size
+    // if the data is stored as is.
+    //
+    size_t encode(utp::uint8 const * i_data,
+                  size_t i_size,
+                  utp::uint8 * o_blk) const;
+
+    // Decodes a compressed block of i_blksize bytes in place into the
+    // i_size bytes of data it holds.
+    //
+    static void decode(utp::uint8 * io_data,
+                       size_t i_blksize,
+                       size_t i_size)
+        throw(utp::VerificationError);
+
+private:
+    Method						m_method;
+};
+
+} // namespace UTFS
+
+// Local Variables:
+// mode: C++
+// tab-width: 4
+// c-basic-offset: 4
+// c-file-offsets: ((comment-intro . 0))
+// End:
+
+#endif // UTFS_BlockCodec_h__
@@ -14,6 +14,8 @@
 #include "IndirectBlockNode.h"
 #include "DoubleIndBlockNode.h"
 #include "Context.h"
+#include "DedupIndex.h"
+#include "Flusher.h"
 
 using namespace std;
 using namespace utp;
@@ -23,12 +25,20 @@ namespace UTFS {
 
 BlockNode::BlockNode()
     : m_isdirty(true)
+    , m_gen(0)
+    , m_lprot(false)
+    , m_lref(false)
+    , m_lpre(false)
 {
 }
 
 BlockNode::BlockNode(BlockRef const & i_ref)
   : m_ref(i_ref)
   , m_isdirty(false)
+  , m_gen(0)
+  , m_lprot(false)
+  , m_lref(false)
+  , m_lpre(false)
 {
     LOG(lgr, 6, "CTOR " << i_ref);
 }
@@ -38,6 +48,135 @@ BlockNode::~BlockNode()
     LOG(lgr, 6, "DTOR " << bn_blkref());
 }
 
+BlockNodeHandle
+BlockNode::bn_clone() const
+{
+    throwstream(InternalError, FILELINE
+                << "can't freeze " << *this);
+}
+
+void
+BlockNode::bn_store(Context & i_ctxt,
+                    uint8 const * i_data,
+                    size_t i_size,
+                    bool i_convergent)
+{
+    // Only a convergent filesystem has a dedup index.
+    DedupIndex * ddp = i_convergent ? i_ctxt.m_dedupp : NULL;
+
+    // Blocks larger than an inode don't fit on the stack.
+    uint8 stkbuf[BLKSZ];
+    OctetSeq heapbuf;
+    uint8 * buf = stkbuf;
+    if (i_size > sizeof(stkbuf))
+    {
+        heapbuf.resize(i_size);
+        buf = &heapbuf[0];
+    }
+
+    size_t blksz = i_ctxt.m_codec.encode(i_data, i_size, buf);
+
+    // Construct an initvec.  A convergent one is a keyed digest of
+    // the data, so identical data encrypts to an identical block.
+    uint8 iv[16];
+    if (ddp)
+    {
+        Digest datadig(i_data, i_size);
+        uint8 keyed[64];	// Key digest, then data digest
+        ACE_OS::memcpy(keyed, i_ctxt.m_cvkey.data(), 32);
+        ACE_OS::memcpy(keyed + 32, datadig.data(), 32);
+        Digest ivdig(keyed, sizeof(keyed));
+        ACE_OS::memcpy(iv, ivdig.data(), sizeof(iv));
+    }
+    else
+    {
+        Random::fill(iv, sizeof(iv));
+    }
+
+    // Encrypt the entire block.
+    i_ctxt.m_cipher.encrypt(iv, buf, blksz);
+
+    // Set our reference value.
+    m_ref = BlockRef(Digest(buf, blksz), iv);
+
+    // Is it already in the blockstore?
+    if (ddp && ddp->contains(m_ref))
+    {
+        LOG(lgr, 6, "persist " << m_ref << " already stored");
+
+        ++i_ctxt.m_statsp->m_ndedups;
+        i_ctxt.m_statsp->m_ndedupbytes += blksz;
+        return;
+    }
+
+    LOG(lgr, 6, "persist " << m_ref << " sz=" << blksz);
+
+    // Write the block out to the block store.
+    i_ctxt.m_flusherp->put(i_ctxt,
+                           this,
+                           m_ref.data(),
+                           m_ref.size(),
+                           buf,
+                           blksz,
+                           ddp);
+
+    ++i_ctxt.m_statsp->m_npops;
+    i_ctxt.m_statsp->m_npbytes += blksz;
+    i_ctxt.m_statsp->m_npdbytes += i_size;
+}
+
+void
+BlockNode::bn_load(Context & i_ctxt,
+                   BlockRef const & i_ref,
+                   uint8 * o_data,
+                   size_t i_size)
+{
+    // Read the block from the blockstore.
+    size_t blksz = i_ctxt.m_bsh->bs_block_get(i_ref.data(), i_ref.size(),
+                                              o_data, i_size);
+
+    ++i_ctxt.m_statsp->m_ngops;
+    i_ctxt.m_statsp->m_ngbytes += blksz;
+
+    bn_decode(i_ctxt, i_ref, o_data, blksz, i_size);
+}
+
+void
+BlockNode::bn_decode(Context & i_ctxt,
+                     BlockRef const & i_ref,
+                     uint8 * io_data,
+                     size_t i_blksize,
+                     size_t i_size)
+{
+    // Validate the block.
+    i_ref.validate(io_data, i_blksize);
+
+    // Decrypt the block.
+    i_ctxt.m_cipher.decrypt(i_ref.iv(), io_data, i_blksize);
+
+    // Stored short, it's compressed.
+    if (i_blksize < i_size)
+        BlockCodec::decode(io_data, i_blksize, i_size);
+}
+
+void
+BlockNode::bn_writeback(Context & i_ctxt)
+{
+    // Nothing held back.
+}
+
+void
+BlockNode::bn_freeze(Generation & io_gen)
+{
+    // Leaves have no children.
+}
+
+void
+BlockNode::bn_thaw(Generation const & i_gen)
+{
+    // Leaves have no children.
+}
+
 void
 BlockNode::bn_tostream(std::ostream & ostrm) const
 {
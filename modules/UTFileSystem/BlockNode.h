@@ -27,9 +27,15 @@ namespace UTFS {
 class UTFS_EXP BlockNode : public virtual utp::RCObj
 {
 public:
-    // Fundamental block size of the filesystem.
+    // Size of an inode block.  It's also the default, and smallest,
+    // size of the data and indirect blocks, which a filesystem picks
+    // at mkfs (Context::m_blksz).
+    //
     static off_t const BLKSZ = 8192;
 
+    // Largest data and indirect block size.
+    static off_t const MAXBLKSZ = 1024 * 1024;
+
     // Default constructor.
     BlockNode();
 
@@ -49,17 +55,46 @@ public:
     virtual utp::uint8 * bn_data() = 0;
 
     // This is the size of contained data, not the size of the node
-    // itself.  Data blocks return BLKSZ.  INodes have a smaller
-    // initial block and return that size.
+    // itself.  Data blocks return the filesystem's block size.
+    // INodes have a smaller initial block and return that size.
     //
     virtual size_t bn_size() const = 0;
 
-    /// Set the dirty state of this object.
-    virtual void bn_isdirty(bool i_isdirty) { m_isdirty = i_isdirty; }
+    /// Set the dirty state of this object.  Marking it dirty also
+    /// advances its generation.
+    virtual void bn_isdirty(bool i_isdirty)
+    {
+        m_isdirty = i_isdirty;
+        if (i_isdirty)
+            ++m_gen;
+    }
 
     /// Returns the dirty state of this object.
     virtual bool bn_isdirty() const { return m_isdirty; }
 
+    // Counts the times the node has been marked dirty, a sync uses it
+    // to tell whether the node changed while it was being flushed.
+    //
+    utp::uint64 bn_gen() const { return m_gen; }
+
+    // Returns a copy of the node for a Generation.  The copy shares
+    // our dirty children until bn_freeze replaces them.
+    //
+    virtual BlockNodeHandle bn_clone() const;
+
+    // Apply any writes the node is still holding back.  Called
+    // before the node is flushed or truncated.
+    //
+    virtual void bn_writeback(Context & i_ctxt);
+
+    // Replace our dirty children with their frozen copies.
+    virtual void bn_freeze(Generation & io_gen);
+
+    // Replace our dirty children which haven't changed since the
+    // generation was frozen with their stored copies.
+    //
+    virtual void bn_thaw(Generation const & i_gen);
+
     // Persist the node to the blockstore and update the cached
     // reference.
     //
@@ -73,11 +108,42 @@ public:
     virtual void bn_tostream(std::ostream & ostrm) const;
 
 protected:
-    friend class BlockNodeCache;	// Needs to get/set m_lpos.
+    // Stores the node's data: compresses it as the filesystem does,
+    // encrypts it, sets our reference and puts the block.  A node
+    // which can be convergent is stored with an initvec following
+    // from its data if the filesystem is convergent, and isn't put
+    // again if the block is known to be stored.
+    //
+    void bn_store(Context & i_ctxt,
+                  utp::uint8 const * i_data,
+                  size_t i_size,
+                  bool i_convergent = false);
+
+    // Gets the block into the i_size bytes of data it holds.
+    static void bn_load(Context & i_ctxt,
+                        BlockRef const & i_ref,
+                        utp::uint8 * o_data,
+                        size_t i_size);
+
+    // Validates, decrypts and decompresses a block of i_blksize bytes
+    // in place.
+    //
+    static void bn_decode(Context & i_ctxt,
+                          BlockRef const & i_ref,
+                          utp::uint8 * io_data,
+                          size_t i_blksize,
+                          size_t i_size);
+
+    friend class BlockNodeCache;	// Needs to get/set the m_l* fields.
+    friend class Prefetcher;		// Completes a fetched node.
     
     BlockRef					m_ref;
     bool						m_isdirty;
+    utp::uint64					m_gen;
     BlockNodeList::iterator		m_lpos;
+    bool						m_lprot;	// m_lpos is in the protected list
+    bool						m_lref;		// Used since the hand passed
+    bool						m_lpre;		// Prefetched, not used yet
 };
 
 std::ostream & operator<<(std::ostream & ostrm, BlockNode const & i_bn);
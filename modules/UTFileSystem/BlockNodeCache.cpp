@@ -1,3 +1,5 @@
+#include "Except.h"
+
 #include "BlockRef.h"
 #include "BlockNode.h"
 
@@ -9,9 +11,38 @@
 using namespace std;
 using namespace utp;
 
+namespace {
+
+// Budget until the filesystem sets one.
+size_t const DEF_MAXBYTES = 64 * 1024 * 1024;
+
+// Percent of a shard's budget the protected list may hold.
+size_t const PROTECTED_PCT = 80;
+
+// Fewest blocks a shard's budget holds.
+size_t const SHARD_MINBLKS = 4;
+
+} // end namespace
+
 namespace UTFS {
 
+BlockNodeCache::Shard::Shard()
+    : m_cond(m_mutex)
+    , m_maxbytes(DEF_MAXBYTES / NSHARDS)
+    , m_probbytes(0)
+    , m_protbytes(0)
+    , m_nhits(0)
+    , m_nmisses(0)
+    , m_nevicts(0)
+    , m_nfaults(0)
+    , m_nfaultwaits(0)
+{
+}
+
 BlockNodeCache::BlockNodeCache()
+    : m_maxbytes(DEF_MAXBYTES)
+    , m_blksz(BlockNode::BLKSZ)
+    , m_nshards(NSHARDS)
 {
 }
 
@@ -20,101 +51,404 @@ BlockNodeCache::~BlockNodeCache()
 }
 
 void
+BlockNodeCache::maxbytes(size_t i_maxbytes)
+{
+    LOG(lgr, 4, "maxbytes " << i_maxbytes);
+
+    m_maxbytes = i_maxbytes;
+    budget();
+}
+
+void
+BlockNodeCache::blocksize(size_t i_blksz)
+{
+    // A node's shard depends on the count; cached nodes would be
+    // looked for in the wrong one.
+    for (unsigned i = 0; i < NSHARDS; ++i)
+    {
+        Shard const & sh = m_shards[i];
+        ACE_Guard<ACE_Thread_Mutex> guard(sh.m_mutex);
+        if (!sh.m_nodemap.empty() || !sh.m_faulting.empty())
+            throwstream(InternalError, FILELINE
+                        << "blocksize set on a cache in use");
+    }
+
+    m_blksz = i_blksz;
+
+    // Fewer shards with room for a few blocks each beat many which
+    // can't hold one.
+    size_t nshards = m_maxbytes / (SHARD_MINBLKS * m_blksz);
+    m_nshards = unsigned(max(size_t(1), min(size_t(NSHARDS), nshards)));
+
+    LOG(lgr, 4, "blocksize " << i_blksz << ", " << m_nshards << " shards");
+
+    budget();
+}
+
+BlockNodeHandle
 BlockNodeCache::insert(BlockNodeHandle const & i_bnh)
 {
 
     BlockRef const & ref = i_bnh->bn_blkref();
 
-    ACE_Guard<ACE_Thread_Mutex> guard(m_bncmutex);
+    Shard & sh = shard(ref);
+    ACE_Guard<ACE_Thread_Mutex> guard(sh.m_mutex);
 
     LOG(lgr, 6, "insert " << ref);
 
     // Is it already in the cache?
-    BlockNodeMap::const_iterator pos = m_nodemap.find(ref);
-    if (pos != m_nodemap.end())
+    BlockNodeMap::const_iterator pos = sh.m_nodemap.find(ref);
+    if (pos != sh.m_nodemap.end())
     {
         // LOG(lgr, 4, "already there " << ref);
 
-        // Update it in the MRU list.
-        touch(pos->second);
+        pos->second->m_lref = true;
+
+        return pos->second;
     }
     else
     {
-        m_nodemap.insert(make_pair(ref, i_bnh));
-        m_nodemru.push_front(i_bnh);
-        i_bnh->m_lpos = m_nodemru.begin();
+        link(sh, i_bnh);
+        evict(sh);
+
+        return i_bnh;
     }
 }
 
 BlockNodeHandle
-BlockNodeCache::lookup(BlockRef const & i_ref)
+BlockNodeCache::lookup(BlockRef const & i_ref, bool i_use)
 {
-    ACE_Guard<ACE_Thread_Mutex> guard(m_bncmutex);
+    Shard & sh = shard(i_ref);
+    ACE_Guard<ACE_Thread_Mutex> guard(sh.m_mutex);
 
-    BlockNodeMap::const_iterator pos = m_nodemap.find(i_ref);
+    BlockNodeHandle bnh = find(sh, i_ref, i_use);
 
     // Was this a cache miss?
-    if (pos == m_nodemap.end())
+    if (!bnh)
+        ++sh.m_nmisses;
+    else
+        ++sh.m_nhits;
+
+    return bnh;
+}
+
+BlockNodeHandle
+BlockNodeCache::fault(Context & i_ctxt,
+                      BlockRef const & i_ref,
+                      FaultFunc & i_func,
+                      bool i_insert)
+{
+    if (!i_insert)
+    {
+        BlockNodeHandle bnh = lookup(i_ref);
+        return bnh ? bnh : i_func.ff_fetch(i_ctxt, i_ref);
+    }
+
+    Shard & sh = shard(i_ref);
+
+    {
+        ACE_Guard<ACE_Thread_Mutex> guard(sh.m_mutex);
+
+        bool waited = false;
+        while (true)
+        {
+            BlockNodeHandle bnh = find(sh, i_ref);
+            if (bnh)
+            {
+                if (!waited)
+                    ++sh.m_nhits;
+                return bnh;
+            }
+
+            if (!waited)
+                ++sh.m_nmisses;
+            waited = true;
+
+            // Is someone else already fetching it?
+            if (sh.m_faulting.find(i_ref) == sh.m_faulting.end())
+                break;
+
+            ++sh.m_nfaultwaits;
+            sh.m_cond.wait();
+        }
+
+        // It's ours to fetch.
+        sh.m_faulting.insert(i_ref);
+        ++sh.m_nfaults;
+    }
+
+    LOG(lgr, 6, "fault " << i_ref);
+
+    BlockNodeHandle bnh;
+    try
+    {
+        bnh = i_func.ff_fetch(i_ctxt, i_ref);
+    }
+    catch (...)
+    {
+        fetch_end(i_ref, NULL);
+        throw;
+    }
+
+    return fetch_end(i_ref, bnh);
+}
+
+bool
+BlockNodeCache::fetch_begin(BlockRef const & i_ref)
+{
+    Shard & sh = shard(i_ref);
+    ACE_Guard<ACE_Thread_Mutex> guard(sh.m_mutex);
+
+    if (sh.m_nodemap.find(i_ref) != sh.m_nodemap.end())
+        return false;
+
+    if (sh.m_faulting.find(i_ref) != sh.m_faulting.end())
+        return false;
+
+    sh.m_faulting.insert(i_ref);
+    return true;
+}
+
+BlockNodeHandle
+BlockNodeCache::fetch_end(BlockRef const & i_ref,
+                          BlockNodeHandle const & i_bnh)
+{
+    Shard & sh = shard(i_ref);
+    ACE_Guard<ACE_Thread_Mutex> guard(sh.m_mutex);
+
+    sh.m_faulting.erase(i_ref);
+    sh.m_cond.broadcast();
+
+    if (!i_bnh)
         return NULL;
 
-    BlockNodeHandle bnh = pos->second;
+    // A plain insert may have beaten us; the resident node wins.
+    BlockNodeHandle bnh = find(sh, i_ref);
+    if (bnh)
+        return bnh;
 
-    // Move the node to the recent side of the MRU list.
-    touch(bnh);
+    link(sh, i_bnh);
+    evict(sh);
 
-    return bnh;
+    return i_bnh;
 }
 
 void
 BlockNodeCache::remove(BlockRef const & i_ref)
 {
-    ACE_Guard<ACE_Thread_Mutex> guard(m_bncmutex);
+    Shard & sh = shard(i_ref);
+    ACE_Guard<ACE_Thread_Mutex> guard(sh.m_mutex);
 
     LOG(lgr, 6, "remove " << i_ref);
 
     // Find the block node.
-    BlockNodeMap::const_iterator pos = m_nodemap.find(i_ref);
+    BlockNodeMap::const_iterator pos = sh.m_nodemap.find(i_ref);
 
     // If it's missing we're all done.
-    if (pos == m_nodemap.end())
+    if (pos == sh.m_nodemap.end())
         return;
 
-    // Make a copy of the reference.
+    // Make a copy of the reference, and take it off its list.
     BlockNodeHandle bnh = pos->second;
+    unlink(sh, bnh);
+}
 
-    // Erase it.
-    m_nodemap.erase(pos);
+void
+BlockNodeCache::get_stats(StatSet & o_ss) const
+{
+    size_t bncsz = 0;
+    size_t nbytes = 0;
+    int64 nhits = 0;
+    int64 nmisses = 0;
+    int64 nevicts = 0;
+    int64 nfaults = 0;
+    int64 nfaultwaits = 0;
+
+    for (unsigned i = 0; i < NSHARDS; ++i)
+    {
+        Shard const & sh = m_shards[i];
+        ACE_Guard<ACE_Thread_Mutex> guard(sh.m_mutex);
+        bncsz += sh.m_nodemap.size();
+        nbytes += sh.m_probbytes + sh.m_protbytes;
+        nhits += sh.m_nhits;
+        nmisses += sh.m_nmisses;
+        nevicts += sh.m_nevicts;
+        nfaults += sh.m_nfaults;
+        nfaultwaits += sh.m_nfaultwaits;
+    }
 
-    // Remove the node from the MRU list too.
-    m_nodemru.erase(bnh->m_lpos);
+    Stats::set(o_ss, "bncsz", bncsz, 1.0/1000, "%.1fk", SF_VALUE);
+    Stats::set(o_ss, "bncmb", nbytes, 1.0/(1024*1024), "%.1fMB", SF_VALUE);
+    Stats::set(o_ss, "bnchps", nhits, 1.0, "%.1f/s", SF_DELTA);
+    Stats::set(o_ss, "bncmps", nmisses, 1.0, "%.1f/s", SF_DELTA);
+    Stats::set(o_ss, "bnceps", nevicts, 1.0, "%.1f/s", SF_DELTA);
+    Stats::set(o_ss, "bncfps", nfaults, 1.0, "%.1f/s", SF_DELTA);
+    Stats::set(o_ss, "bncwps", nfaultwaits, 1.0, "%.1f/s", SF_DELTA);
+}
 
-    // For good measure set the iterator outside the list.
-    bnh->m_lpos = m_nodemru.end();
+BlockNodeCache::Shard &
+BlockNodeCache::shard(BlockRef const & i_ref)
+{
+    return m_shards[i_ref.hashval() % m_nshards];
 }
 
 void
-BlockNodeCache::get_stats(StatSet & o_ss) const
+BlockNodeCache::budget()
 {
-    size_t bncsz;
+    for (unsigned i = 0; i < m_nshards; ++i)
+    {
+        Shard & sh = m_shards[i];
+        ACE_Guard<ACE_Thread_Mutex> guard(sh.m_mutex);
+        sh.m_maxbytes = m_maxbytes / m_nshards;
+        evict(sh);
+    }
+}
+
+BlockNodeHandle
+BlockNodeCache::find(Shard & io_sh, BlockRef const & i_ref, bool i_use)
+{
+    BlockNodeMap::const_iterator pos = io_sh.m_nodemap.find(i_ref);
+    if (pos == io_sh.m_nodemap.end())
+        return NULL;
 
+    // A hit only marks the node, the eviction hand does the rest.
+    // The first use of a prefetched node is the one a fault would
+    // have made, it doesn't make the node any hotter.
+    //
+    BlockNode * bnp = &*pos->second;
+    if (i_use && bnp->m_lpre)
+        bnp->m_lpre = false;
+    else if (i_use)
+        bnp->m_lref = true;
+
+    return pos->second;
+}
+
+void
+BlockNodeCache::link(Shard & io_sh, BlockNodeHandle const & i_bnh)
+{
+    io_sh.m_nodemap.insert(make_pair(i_bnh->bn_blkref(), i_bnh));
+
+    io_sh.m_probation.push_front(i_bnh);
+    i_bnh->m_lpos = io_sh.m_probation.begin();
+    i_bnh->m_lprot = false;
+    i_bnh->m_lref = false;
+    io_sh.m_probbytes += i_bnh->bn_size();
+}
+
+void
+BlockNodeCache::unlink(Shard & io_sh, BlockNodeHandle const & i_bnh)
+{
+    io_sh.m_nodemap.erase(i_bnh->bn_blkref());
+
+    if (i_bnh->m_lprot)
+    {
+        io_sh.m_protected.erase(i_bnh->m_lpos);
+        io_sh.m_protbytes -= i_bnh->bn_size();
+    }
+    else
     {
-        ACE_Guard<ACE_Thread_Mutex> guard(m_bncmutex);
-        bncsz = m_nodemap.size();
+        io_sh.m_probation.erase(i_bnh->m_lpos);
+        io_sh.m_probbytes -= i_bnh->bn_size();
     }
 
-    Stats::set(o_ss, "bncsz", bncsz, 1.0/1000, "%.1fk", SF_VALUE);
+    // For good measure set the iterator outside the lists.
+    i_bnh->m_lpos = io_sh.m_probation.end();
+    i_bnh->m_lprot = false;
 }
 
 void
-BlockNodeCache::touch(BlockNodeHandle const & i_bnh)
+BlockNodeCache::move(Shard & io_sh, BlockNodeList::iterator i_pos)
 {
-    // IMPORTANT - The caller needs to be holding the mutex!
+    BlockNode * bnp = &**i_pos;
+    size_t sz = bnp->bn_size();
 
-    // IMPORTANT - The handle better already be in the list!
+    if (bnp->m_lprot)
+    {
+        io_sh.m_probation.splice(io_sh.m_probation.begin(),
+                                 io_sh.m_protected, i_pos);
+        io_sh.m_protbytes -= sz;
+        io_sh.m_probbytes += sz;
+    }
+    else
+    {
+        io_sh.m_protected.splice(io_sh.m_protected.begin(),
+                                 io_sh.m_probation, i_pos);
+        io_sh.m_probbytes -= sz;
+        io_sh.m_protbytes += sz;
+    }
+
+    bnp->m_lprot = !bnp->m_lprot;
+    bnp->m_lref = false;
+}
+
+void
+BlockNodeCache::evict(Shard & io_sh)
+{
+    size_t const protmax = io_sh.m_maxbytes / 100 * PROTECTED_PCT;
 
-    m_nodemru.erase(i_bnh->m_lpos);
-    m_nodemru.push_front(i_bnh);
-    i_bnh->m_lpos = m_nodemru.begin();
+    // Promotions can push the protected list over its share, and the
+    // nodes it demotes need another sweep of probation.
+    for (unsigned pass = 0; pass < 2; ++pass)
+    {
+        if (io_sh.m_probbytes + io_sh.m_protbytes <= io_sh.m_maxbytes)
+            return;
+
+        // Sweep probation from the cold end.
+        BlockNodeList::iterator it = io_sh.m_probation.end();
+        while (io_sh.m_probbytes + io_sh.m_protbytes > io_sh.m_maxbytes &&
+               it != io_sh.m_probation.begin())
+        {
+            BlockNodeList::iterator pos = --it;
+            BlockNode * bnp = &**pos;
+
+            // Step off it before it moves or goes.
+            ++it;
+
+            // Used again since it came in, promote it.
+            if (bnp->m_lref)
+            {
+                move(io_sh, pos);
+                continue;
+            }
+
+            // The map and the list hold a handle each, any more and
+            // someone is using the node.  Leave it where it is.
+            //
+            if (bnp->bn_isdirty() || bnp->rc_count() > 2)
+            {
+                --it;
+                continue;
+            }
+
+            LOG(lgr, 6, "evict " << bnp->bn_blkref());
+
+            unlink(io_sh, BlockNodeHandle(bnp));
+            ++io_sh.m_nevicts;
+        }
+
+        // Demote the protected list's coldest unreferenced nodes if
+        // it's outgrown its share, referenced ones get a second
+        // chance.  Each node is looked at once.
+        //
+        size_t nleft = io_sh.m_protected.size();
+        while (io_sh.m_protbytes > protmax && nleft--)
+        {
+            BlockNodeList::iterator last = --io_sh.m_protected.end();
+            BlockNode * bnp = &**last;
+
+            if (bnp->m_lref)
+            {
+                bnp->m_lref = false;
+                io_sh.m_protected.splice(io_sh.m_protected.begin(),
+                                         io_sh.m_protected, last);
+            }
+            else
+            {
+                move(io_sh, last);
+            }
+        }
+    }
 }
 
 } // namespace UTFS
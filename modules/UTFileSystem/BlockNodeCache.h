@@ -5,7 +5,9 @@
 /// Utopia FileSystem BlockNode Cache.
 
 #include <tr1/unordered_map>
+#include <tr1/unordered_set>
 
+#include <ace/Condition_Thread_Mutex.h>
 #include <ace/Thread_Mutex.h>
 
 #include "utpfwd.h"
@@ -21,20 +23,87 @@ namespace UTFS {
 
 // BlockNode Cache
 //
+// The cache is split by reference hash into shards, each with its own
+// lock, map and lists, so lookups of different blocks don't contend.
+// Each shard's budget holds at least a few blocks; a small budget is
+// split over fewer shards.
+//
+// Clean nodes are held within a byte budget by a segmented CLOCK.  A
+// node enters the probationary list.  A hit only sets the node's
+// reference bit; the lists are reordered by the eviction hand, not on
+// every hit.  The hand sweeps the probationary list from its cold end:
+// a node referenced since it came in is promoted to the protected
+// list, the others are evicted.  A scan which touches each block once
+// churns only the probationary list and leaves the working set in the
+// protected list alone.  When the protected list outgrows its share
+// its unreferenced nodes drop back into the probationary list, the
+// referenced ones get a second chance.
+//
+// Nodes which are dirty or held by someone besides the cache (an
+// in-flight traversal) are passed over by eviction.
+//
 class UTFS_EXP BlockNodeCache
 {
 public:
+    // Reads a node which isn't in the cache from the blockstore.
+    //
+    class UTFS_EXP FaultFunc
+    {
+    public:
+        virtual BlockNodeHandle ff_fetch(Context & i_ctxt,
+                                         BlockRef const & i_ref) = 0;
+    };
+
     // Default constructor.
     BlockNodeCache();
 
     // Destructor.
     ~BlockNodeCache();
 
-    // Insert Node.
-    void insert(BlockNodeHandle const & i_bnh);
-
-    // Lookup Node.
-    BlockNodeHandle lookup(BlockRef const & i_ref);
+    // Sets the byte budget, evicting down to it.
+    void maxbytes(size_t i_maxbytes);
+
+    // Sets the data block size, which decides how many shards the
+    // budget is split over.  Throws InternalError if anything is
+    // cached.
+    //
+    void blocksize(size_t i_blksz);
+
+    // Insert Node.  Returns the cached node, which is not the one
+    // passed in if the cache already had one for the reference.
+    BlockNodeHandle insert(BlockNodeHandle const & i_bnh);
+
+    // Lookup Node.  If i_use is false (readahead) the hit doesn't
+    // count as a use of the node.
+    BlockNodeHandle lookup(BlockRef const & i_ref, bool i_use = true);
+
+    // Returns the node for the reference, fetching it on a miss.
+    //
+    // Concurrent faults of the same reference wait for a single
+    // fetch, and the node is in the cache before any of them return,
+    // so a shared lock on the referencing node is all that's needed.
+    // If the fetch throws the waiters retry it themselves.
+    //
+    // If i_insert is false (refresh traversals) a miss is fetched
+    // privately and not cached.
+    //
+    BlockNodeHandle fault(Context & i_ctxt,
+                          BlockRef const & i_ref,
+                          FaultFunc & i_func,
+                          bool i_insert = true);
+
+    // Marks the reference in flight for a fetch made outside of
+    // fault (readahead).  Returns false if it is cached or already
+    // being fetched.  Faults of the reference wait for fetch_end.
+    //
+    bool fetch_begin(BlockRef const & i_ref);
+
+    // Completes a fetch_begin, inserting the node.  A NULL node means
+    // the fetch failed and the waiters fetch it themselves.  Returns
+    // the cached node.
+    //
+    BlockNodeHandle fetch_end(BlockRef const & i_ref,
+                              BlockNodeHandle const & i_bnh);
 
     // Remove Node.
     void remove(BlockRef const & i_ref);
@@ -42,18 +111,79 @@ public:
     // Supply stats.
     void get_stats(utp::StatSet & o_ss) const;
 
-protected:
-    // Move the node the front (recent) end of the MRU list.
-    void touch(BlockNodeHandle const & i_bnh);
-
 private:
     typedef std::tr1::unordered_map<BlockRef,
         							BlockNodeHandle,
         							BlockRef::hash> BlockNodeMap;
 
-    mutable ACE_Thread_Mutex	m_bncmutex;
-    BlockNodeMap				m_nodemap;
-    BlockNodeList				m_nodemru;
+    typedef std::tr1::unordered_set<BlockRef, BlockRef::hash> BlockRefSet;
+
+    static unsigned const NSHARDS = 16;
+
+    struct Shard
+    {
+        Shard();
+
+        mutable ACE_Thread_Mutex	m_mutex;
+        ACE_Condition_Thread_Mutex	m_cond;			// Signals fault completion
+        BlockNodeMap				m_nodemap;
+        BlockNodeList				m_probation;	// Newest first
+        BlockNodeList				m_protected;	// Promoted, newest first
+        BlockRefSet					m_faulting;		// Fetches in flight
+
+        size_t						m_maxbytes;
+        size_t						m_probbytes;
+        size_t						m_protbytes;
+
+        utp::int64					m_nhits;
+        utp::int64					m_nmisses;
+        utp::int64					m_nevicts;
+        utp::int64					m_nfaults;
+        utp::int64					m_nfaultwaits;	// Shared another's fetch
+    };
+
+    Shard & shard(BlockRef const & i_ref);
+
+    // Splits the budget over the shards in use.
+    void budget();
+
+    // IMPORTANT - The following need the shard's mutex held.
+
+    // Returns the cached node and marks it used, NULL on a miss.
+    BlockNodeHandle find(Shard & io_sh,
+                         BlockRef const & i_ref,
+                         bool i_use = true);
+
+    // Caches a node, at the front of the probationary list.
+    void link(Shard & io_sh, BlockNodeHandle const & i_bnh);
+
+    // Takes a node off its list.
+    void unlink(Shard & io_sh, BlockNodeHandle const & i_bnh);
+
+    // Moves the node at the iterator to the front of the other list.
+    void move(Shard & io_sh, BlockNodeList::iterator i_pos);
+
+    // Evicts until the shard is within budget, or only pinned nodes
+    // are left.
+    void evict(Shard & io_sh);
+
+    size_t						m_maxbytes;
+    size_t						m_blksz;
+    unsigned					m_nshards;	// Shards in use
+    Shard						m_shards[NSHARDS];
+};
+
+// Faults in a node type which has a (Context, BlockRef) constructor.
+//
+template <typename T>
+class NodeFaultFunc : public BlockNodeCache::FaultFunc
+{
+public:
+    virtual BlockNodeHandle ff_fetch(Context & i_ctxt,
+                                     BlockRef const & i_ref)
+    {
+        return new T(i_ctxt, i_ref);
+    }
 };
 
 } // namespace UTFS
@@ -10,7 +10,9 @@
 
 #include "BlockStore.h"
 #include "BlockCipher.h"
+#include "Digest.h"
 
+#include "BlockCodec.h"
 #include "UTStats.h"
 #include "utfsexp.h"
 #include "utfsfwd.h"
@@ -21,6 +23,11 @@ struct UTFS_EXP Context
 {
     utp::BlockStoreHandle		m_bsh;
     utp::BlockCipher			m_cipher;
+    BlockCodec					m_codec;
+    size_t						m_blksz;		// Data and indirect blocks
+    utp::Digest					m_cvkey;		// Keys convergent IVs
+    DedupIndex *				m_dedupp;		// NULL unless convergent
+    bool						m_extents;		// New files use extents
     DataBlockNodeHandle			m_zdatobj;
     IndirectBlockNodeHandle		m_zsinobj;
     DoubleIndBlockNodeHandle	m_zdinobj;
@@ -28,6 +35,10 @@ struct UTFS_EXP Context
 
     BlockNodeCache *			m_bncachep;
 
+    Flusher *					m_flusherp;
+
+    Prefetcher *				m_prefetchp;
+
     UTStats *					m_statsp;
 };
 
@@ -9,6 +9,7 @@
 
 #include "Context.h"
 #include "DataBlockNode.h"
+#include "DedupIndex.h"
 #include "DoubleIndBlockNode.h"
 #include "IndirectBlockNode.h"
 #include "UTFileSystem.h"
@@ -24,32 +25,40 @@ namespace {
 
 namespace UTFS {
 
-DataBlockNode::DataBlockNode()
+DataBlockNode::DataBlockNode(size_t i_blksz)
+    : m_data(i_blksz, '\0')
 {
     LOG(lgr, 6, "CTOR");
-
-    // Clear all the memory in the block.
-    ACE_OS::memset(m_data, '\0', sizeof(m_data));
 }
 
 DataBlockNode::DataBlockNode(Context & i_ctxt, BlockRef const & i_ref)
     : BlockNode(i_ref)
+    , m_data(i_ctxt.m_blksz)
 {
     LOG(lgr, 6, "CTOR " << i_ref);
 
-    size_t sz = sizeof(m_data);
+    uint64 const epoch = i_ctxt.m_dedupp ? i_ctxt.m_dedupp->epoch() : 0;
+
+    bn_load(i_ctxt, i_ref, &m_data[0], m_data.size());
 
-    // Read the block from the blockstore.
-    i_ctxt.m_bsh->bs_block_get(i_ref.data(), i_ref.size(), m_data, sz);
+    if (i_ctxt.m_dedupp)
+        i_ctxt.m_dedupp->insert(i_ref, epoch);
+}
+
+DataBlockNode::DataBlockNode(Context & i_ctxt,
+                             BlockRef const & i_ref,
+                             size_t i_size)
+    : BlockNode(i_ref)
+    , m_data(i_size)
+{
+    LOG(lgr, 6, "CTOR " << i_ref);
 
-    ++i_ctxt.m_statsp->m_ngops;
-    i_ctxt.m_statsp->m_ngbytes += sz;;
+    uint64 const epoch = i_ctxt.m_dedupp ? i_ctxt.m_dedupp->epoch() : 0;
 
-    // Validate the block.
-    i_ref.validate(m_data, sz);
+    bn_load(i_ctxt, i_ref, &m_data[0], m_data.size());
 
-    // Decrypt the block.
-    i_ctxt.m_cipher.decrypt(i_ref.iv(), m_data, sz);
+    if (i_ctxt.m_dedupp)
+        i_ctxt.m_dedupp->insert(i_ref, epoch);
 }
 
 DataBlockNode::~DataBlockNode()
@@ -60,30 +69,7 @@ DataBlockNode::~DataBlockNode()
 BlockRef const &
 DataBlockNode::bn_persist(Context & i_ctxt)
 {
-    // Copy the data into a buffer.
-    uint8 buf[sizeof(m_data)];
-    ACE_OS::memcpy(buf, m_data, sizeof(m_data));
-
-    // Construct an initvec.
-    utp::uint8 iv[16];
-    Random::fill(iv, sizeof(iv));
-
-    // Encrypt the entire block.
-    i_ctxt.m_cipher.encrypt(iv, buf, sizeof(buf));
-
-    // Set our reference value.
-    m_ref = BlockRef(Digest(buf, sizeof(buf)), iv);
-
-    LOG(lgr, 6, "persist " << bn_blkref());
-
-    // Write the block out to the block store.
-    i_ctxt.m_bsh->bs_block_put((void *) m_ref.data(),
-                               m_ref.size(),
-                               (void *) buf,
-                               sizeof(buf));
-
-    ++i_ctxt.m_statsp->m_npops;
-    i_ctxt.m_statsp->m_npbytes += sizeof(buf);
+    bn_store(i_ctxt, &m_data[0], m_data.size(), true);
 
     bn_isdirty(false);
 
@@ -96,6 +82,22 @@ DataBlockNode::bn_flush(Context & i_ctxt)
     return bn_persist(i_ctxt);
 }
 
+DataBlockNodeHandle
+DataBlockNode::modifiable(Context & i_ctxt, DataBlockNodeHandle const & i_dbh)
+{
+    if (!i_ctxt.m_dedupp || i_dbh->bn_isdirty())
+        return i_dbh;
+
+    LOG(lgr, 6, "unshare " << i_dbh->bn_blkref());
+    return new DataBlockNode(*i_dbh);
+}
+
+BlockNodeHandle
+DataBlockNode::bn_clone() const
+{
+    return new DataBlockNode(*this);
+}
+
 void
 DataBlockNode::bn_tostream(std::ostream & ostrm) const
 {
@@ -103,7 +105,8 @@ DataBlockNode::bn_tostream(std::ostream & ostrm) const
     ostrm << ' ' << "DataBlockNode";
 }
 
-ZeroDataBlockNode::ZeroDataBlockNode()
+ZeroDataBlockNode::ZeroDataBlockNode(size_t i_blksz)
+    : DataBlockNode(i_blksz)
 {
     LOG(lgr, 6, "CTOR " << "ZERO");
 
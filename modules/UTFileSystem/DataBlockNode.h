@@ -27,28 +27,44 @@ namespace UTFS {
 class UTFS_EXP DataBlockNode : public BlockNode
 {
 public:
-    // Default constructor.
-    DataBlockNode();
+    // Constructor for a zeroed block of i_blksz bytes.
+    DataBlockNode(size_t i_blksz);
 
     // Constructor from blockstore persisted data.
     DataBlockNode(Context & i_ctxt, BlockRef const & i_ref);
 
+    // Constructor from persisted data of i_size bytes, an extent's
+    // chunk (see ExtentNode).
+    DataBlockNode(Context & i_ctxt, BlockRef const & i_ref, size_t i_size);
+
     virtual ~DataBlockNode();
 
-    virtual utp::uint8 const * bn_data() const { return m_data; }
+    virtual utp::uint8 const * bn_data() const { return &m_data[0]; }
 
-    virtual utp::uint8 * bn_data() { return m_data; }
+    virtual utp::uint8 * bn_data() { return &m_data[0]; }
 
-    virtual size_t bn_size() const { return sizeof(m_data); }
+    virtual size_t bn_size() const { return m_data.size(); }
 
     virtual BlockRef const & bn_persist(Context & i_ctxt);
 
     virtual BlockRef const & bn_flush(Context & i_ctxt);
 
+    virtual BlockNodeHandle bn_clone() const;
+
     virtual void bn_tostream(std::ostream & ostrm) const;
 
+    // Changes the size of a chunk, added bytes are zero.
+    void resize(size_t i_size) { m_data.resize(i_size, '\0'); }
+
+    // Returns a clean block which is about to be modified, or a copy
+    // of it.  In a convergent filesystem files holding the same data
+    // share the cached block, each modifies a copy of its own.
+    //
+    static DataBlockNodeHandle modifiable(Context & i_ctxt,
+                                          DataBlockNodeHandle const & i_dbh);
+
 private:
-    utp::uint8				m_data[BLKSZ];
+    utp::OctetSeq			m_data;
 };
 
 // The ZeroDataBlockNode is a singleton which is used for read-only
@@ -58,8 +74,8 @@ private:
 class UTFS_EXP ZeroDataBlockNode : public DataBlockNode
 {
 public:
-    // Default constructor.
-    ZeroDataBlockNode();
+    // Constructor for a block of i_blksz bytes.
+    ZeroDataBlockNode(size_t i_blksz);
 
 #if 0
     // Debugging, where are we referenced?
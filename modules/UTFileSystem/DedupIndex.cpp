@@ -0,0 +1,134 @@
+#include <ace/Guard_T.h>
+
+#include "Log.h"
+
+#include "utfslog.h"
+
+#include "DedupIndex.h"
+
+using namespace std;
+using namespace utp;
+
+namespace {
+
+// Reference bound, 8 MB of references.
+size_t const MAXREFS = 1 << 18;
+
+} // end namespace
+
+namespace UTFS {
+
+DedupIndex::DedupIndex()
+    : m_suspended(false)
+    , m_epoch(0)
+    , m_nhits(0)
+    , m_nmisses(0)
+{
+}
+
+DedupIndex::~DedupIndex()
+{
+}
+
+bool
+DedupIndex::contains(BlockRef const & i_ref) const
+{
+    ACE_Guard<ACE_Thread_Mutex> guard(m_ddmutex);
+
+    if (m_suspended || m_refs.find(i_ref) == m_refs.end())
+    {
+        ++m_nmisses;
+        return false;
+    }
+
+    ++m_nhits;
+    return true;
+}
+
+uint64
+DedupIndex::epoch() const
+{
+    ACE_Guard<ACE_Thread_Mutex> guard(m_ddmutex);
+    return m_epoch;
+}
+
+void
+DedupIndex::insert(BlockRef const & i_ref, uint64 i_epoch)
+{
+    ACE_Guard<ACE_Thread_Mutex> guard(m_ddmutex);
+
+    if (m_suspended || i_epoch != m_epoch || !m_refs.insert(i_ref).second)
+        return;
+
+    m_fifo.push_back(i_ref);
+    if (m_fifo.size() > MAXREFS)
+    {
+        m_refs.erase(m_fifo.front());
+        m_fifo.pop_front();
+    }
+}
+
+void
+DedupIndex::clear()
+{
+    LOG(lgr, 6, "dedup clear");
+
+    ACE_Guard<ACE_Thread_Mutex> guard(m_ddmutex);
+
+    m_refs.clear();
+    m_fifo.clear();
+}
+
+void
+DedupIndex::suspend()
+{
+    LOG(lgr, 6, "dedup suspend");
+
+    ACE_Guard<ACE_Thread_Mutex> guard(m_ddmutex);
+
+    m_suspended = true;
+    ++m_epoch;
+    m_refs.clear();
+    m_fifo.clear();
+}
+
+void
+DedupIndex::resume()
+{
+    LOG(lgr, 6, "dedup resume");
+
+    ACE_Guard<ACE_Thread_Mutex> guard(m_ddmutex);
+
+    m_suspended = false;
+    ++m_epoch;
+    m_refs.clear();
+    m_fifo.clear();
+}
+
+void
+DedupIndex::get_stats(StatSet & o_ss) const
+{
+    size_t ddsz;
+    int64 nhits;
+    int64 nmisses;
+
+    {
+        ACE_Guard<ACE_Thread_Mutex> guard(m_ddmutex);
+        ddsz = m_refs.size();
+        nhits = m_nhits;
+        nmisses = m_nmisses;
+    }
+
+    Stats::set(o_ss, "ddsz", ddsz, 1.0, "%.0f", SF_VALUE);
+    Stats::set(o_ss, "ddhps", nhits, 1.0, "%.1f/s", SF_DELTA);
+    Stats::set(o_ss, "ddmps", nmisses, 1.0, "%.1f/s", SF_DELTA);
+}
+
+} // namespace UTFS
+
+// Local Variables:
+// mode: C++
+// tab-width: 4
+// c-basic-offset: 4
+// c-file-offsets: ((comment-intro . 0))
+// End:
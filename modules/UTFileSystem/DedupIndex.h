@@ -0,0 +1,99 @@
+#ifndef UTFS_DedupIndex_h__
+#define UTFS_DedupIndex_h__
+
+/// @file DedupIndex.h
+/// Utopia FileSystem Stored Block Index.
+
+#include <deque>
+#include <tr1/unordered_set>
+
+#include <ace/Thread_Mutex.h>
+
+#include "utpfwd.h"
+
+#include "Stats.h"
+#include "Types.h"
+
+#include "BlockRef.h"
+#include "utfsfwd.h"
+#include "utfsexp.h"
+
+namespace UTFS {
+
+// Index of data blocks known to be in the blockstore.
+//
+// In a convergent filesystem a data block's reference follows from
+// its contents, so a block with a reference we've already stored or
+// fetched is already in the blockstore and its put can be skipped.
+// The blockstore can't tell us which keys it has, we only remember
+// the ones we've seen.
+//
+// A reference is added once its put completes, or its get succeeds,
+// never before.  The index is bounded, the oldest references are
+// dropped first.
+//
+// A refresh may let the blockstore collect any block stored before
+// it started which the refresh doesn't reach.  A put skipped on
+// account of such a block could leave the tree referring to a block
+// the refresh has already passed by, so the index is suspended while
+// a refresh runs, and forgets everything when it's done.  A put or
+// get which straddles either edge isn't recorded; callers take the
+// epoch before they start and hand it to insert.
+//
+class UTFS_EXP DedupIndex
+{
+public:
+    // Default constructor.
+    DedupIndex();
+
+    // Destructor.
+    ~DedupIndex();
+
+    // Returns true if the block is known to be stored.  Always
+    // false while suspended.
+    bool contains(BlockRef const & i_ref) const;
+
+    // Returns the current epoch, which changes when the index is
+    // suspended or resumed.
+    utp::uint64 epoch() const;
+
+    // Records a stored block, whose put or get started in epoch
+    // i_epoch.  Ignored while suspended or if the epoch has passed.
+    void insert(BlockRef const & i_ref, utp::uint64 i_epoch);
+
+    // Forgets everything.
+    void clear();
+
+    // Suspends the index, for the length of a refresh.
+    void suspend();
+
+    // Resumes the index, empty.
+    void resume();
+
+    // Supply stats.
+    void get_stats(utp::StatSet & o_ss) const;
+
+private:
+    typedef std::tr1::unordered_set<BlockRef, BlockRef::hash> BlockRefSet;
+    typedef std::deque<BlockRef> BlockRefQueue;
+
+    mutable ACE_Thread_Mutex		m_ddmutex;
+    BlockRefSet						m_refs;
+    BlockRefQueue					m_fifo;			// Oldest first
+    bool							m_suspended;
+    utp::uint64						m_epoch;
+
+    mutable utp::int64				m_nhits;
+    mutable utp::int64				m_nmisses;
+};
+
+} // namespace UTFS
+
+// Local Variables:
+// mode: C++
+// tab-width: 4
+// c-basic-offset: 4
+// c-file-offsets: ((comment-intro . 0))
+// End:
+
+#endif // UTFS_DedupIndex_h__
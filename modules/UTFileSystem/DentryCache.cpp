@@ -0,0 +1,207 @@
+#include <ace/Guard_T.h>
+
+#include "Log.h"
+
+#include "utfslog.h"
+
+#include "DentryCache.h"
+#include "FileNode.h"
+
+using namespace std;
+using namespace utp;
+
+namespace {
+
+// Entry bound until the filesystem sets one.
+size_t const DEF_MAXENTRIES = 4096;
+
+} // end namespace
+
+namespace UTFS {
+
+DentryCache::DentryCache()
+    : m_maxentries(DEF_MAXENTRIES)
+    , m_seqno(0)
+    , m_nhits(0)
+    , m_nneghits(0)
+    , m_nmisses(0)
+    , m_ninvals(0)
+{
+}
+
+DentryCache::~DentryCache()
+{
+}
+
+void
+DentryCache::maxentries(size_t i_maxentries)
+{
+    LOG(lgr, 4, "dentry maxentries " << i_maxentries);
+
+    ACE_Guard<ACE_Thread_Mutex> guard(m_dcmutex);
+
+    m_maxentries = i_maxentries;
+    while (m_entries.size() > m_maxentries)
+        erase(m_lru.back());
+}
+
+bool
+DentryCache::lookup(string const & i_path, FileNodeHandle & o_fnh)
+{
+    if (!cacheable(i_path))
+        return false;
+
+    ACE_Guard<ACE_Thread_Mutex> guard(m_dcmutex);
+
+    EntryMap::iterator pos = m_entries.find(i_path);
+    if (pos == m_entries.end())
+    {
+        ++m_nmisses;
+        return false;
+    }
+
+    // Move to the front of the list.
+    m_lru.splice(m_lru.begin(), m_lru, pos->second.m_lpos);
+
+    o_fnh = pos->second.m_fnh;
+    if (o_fnh)
+        ++m_nhits;
+    else
+        ++m_nneghits;
+    return true;
+}
+
+uint64
+DentryCache::seqno() const
+{
+    ACE_Guard<ACE_Thread_Mutex> guard(m_dcmutex);
+    return m_seqno;
+}
+
+void
+DentryCache::insert(string const & i_path,
+                    FileNodeHandle const & i_fnh,
+                    uint64 i_seqno)
+{
+    if (!cacheable(i_path))
+        return;
+
+    ACE_Guard<ACE_Thread_Mutex> guard(m_dcmutex);
+
+    // The namespace changed while the traversal was out, what it
+    // found may be stale.
+    if (i_seqno != m_seqno || m_maxentries == 0)
+        return;
+
+    pair<EntryMap::iterator, bool> ins =
+        m_entries.insert(make_pair(i_path, Entry()));
+    if (!ins.second)
+    {
+        // Another traversal beat us to it.
+        m_lru.splice(m_lru.begin(), m_lru, ins.first->second.m_lpos);
+        ins.first->second.m_fnh = i_fnh;
+        return;
+    }
+
+    ins.first->second.m_fnh = i_fnh;
+    ins.first->second.m_lpos = m_lru.insert(m_lru.begin(), ins.first);
+
+    while (m_entries.size() > m_maxentries)
+        erase(m_lru.back());
+}
+
+void
+DentryCache::invalidate(string const & i_path)
+{
+    ACE_Guard<ACE_Thread_Mutex> guard(m_dcmutex);
+
+    ++m_seqno;
+    ++m_ninvals;
+
+    // Another spelling of a cached path, forget everything.
+    if (!cacheable(i_path))
+    {
+        m_lru.clear();
+        m_entries.clear();
+        return;
+    }
+
+    EntryMap::iterator pos = m_entries.find(i_path);
+    if (pos != m_entries.end())
+        erase(pos);
+
+    // The paths beneath sort together right after the path's
+    // trailing slash.
+    //
+    string prefix = i_path + '/';
+    pos = m_entries.lower_bound(prefix);
+    while (pos != m_entries.end() &&
+           pos->first.compare(0, prefix.size(), prefix) == 0)
+        erase(pos++);
+}
+
+void
+DentryCache::clear()
+{
+    LOG(lgr, 6, "dentry clear");
+
+    ACE_Guard<ACE_Thread_Mutex> guard(m_dcmutex);
+
+    ++m_seqno;
+
+    m_lru.clear();
+    m_entries.clear();
+}
+
+void
+DentryCache::get_stats(StatSet & o_ss) const
+{
+    size_t dcsz;
+    int64 nhits;
+    int64 nneghits;
+    int64 nmisses;
+    int64 ninvals;
+
+    {
+        ACE_Guard<ACE_Thread_Mutex> guard(m_dcmutex);
+        dcsz = m_entries.size();
+        nhits = m_nhits;
+        nneghits = m_nneghits;
+        nmisses = m_nmisses;
+        ninvals = m_ninvals;
+    }
+
+    Stats::set(o_ss, "dcsz", dcsz, 1.0, "%.0f", SF_VALUE);
+    Stats::set(o_ss, "dchps", nhits, 1.0, "%.1f/s", SF_DELTA);
+    Stats::set(o_ss, "dcnps", nneghits, 1.0, "%.1f/s", SF_DELTA);
+    Stats::set(o_ss, "dcmps", nmisses, 1.0, "%.1f/s", SF_DELTA);
+    Stats::set(o_ss, "dcips", ninvals, 1.0, "%.1f/s", SF_DELTA);
+}
+
+bool
+DentryCache::cacheable(string const & i_path)
+{
+    // Absolute, no empty components and no trailing slash.  The
+    // root itself isn't worth caching.
+    //
+    return i_path.size() > 1 &&
+        i_path[0] == '/' &&
+        i_path[i_path.size() - 1] != '/' &&
+        i_path.find("//") == string::npos;
+}
+
+void
+DentryCache::erase(EntryMap::iterator i_pos)
+{
+    m_lru.erase(i_pos->second.m_lpos);
+    m_entries.erase(i_pos);
+}
+
+} // namespace UTFS
+
+// Local Variables:
+// mode: C++
+// tab-width: 4
+// c-basic-offset: 4
+// c-file-offsets: ((comment-intro . 0))
+// End:
@@ -0,0 +1,126 @@
+#ifndef UTFS_DentryCache_h__
+#define UTFS_DentryCache_h__
+
+/// @file DentryCache.h
+/// Utopia FileSystem Path Resolution Cache.
+
+#include <list>
+#include <map>
+#include <string>
+
+#include <ace/Thread_Mutex.h>
+
+#include "utpfwd.h"
+
+#include "Stats.h"
+#include "Types.h"
+
+#include "utfsfwd.h"
+#include "utfsexp.h"
+
+namespace UTFS {
+
+// Path Resolution (dentry) Cache
+//
+// Maps a full path to the node a traversal found for it, or to
+// nothing if the traversal found it missing (ENOENT).  Operations
+// which only read their leaf resolve the path here and skip walking
+// the directories down to it.
+//
+// A cached node is the live node for the path until the namespace
+// changes.  Operations which add, remove or rename entries invalidate
+// the path and everything beneath it once they're done.  A sync which
+// replaces live nodes with their stored copies, and anything else
+// which replaces the tree, clears the cache.
+//
+// A traversal fills the cache after it returns, when it no longer
+// holds the path's directories, so an invalidation may already have
+// passed it by.  Each invalidation bumps a sequence number; a fill
+// made with the number from before the traversal is dropped if it
+// changed.
+//
+// The entries hold their nodes, which keeps them in the clean node
+// cache; the entry count is bounded and the least recently used
+// entry is dropped.
+//
+class UTFS_EXP DentryCache
+{
+public:
+    // Default constructor.
+    DentryCache();
+
+    // Destructor.
+    ~DentryCache();
+
+    // Sets the entry bound, zero disables the cache.
+    void maxentries(size_t i_maxentries);
+
+    // Returns true if the path is cached.  The node is NULL if the
+    // path doesn't exist.
+    //
+    bool lookup(std::string const & i_path, FileNodeHandle & o_fnh);
+
+    // Sequence number to pass to insert, taken before the traversal.
+    utp::uint64 seqno() const;
+
+    // Caches what a traversal which started at i_seqno found, NULL if
+    // it found nothing.
+    //
+    void insert(std::string const & i_path,
+                FileNodeHandle const & i_fnh,
+                utp::uint64 i_seqno);
+
+    // Forgets the path and the paths beneath it.  A path which isn't
+    // in canonical form forgets everything.
+    //
+    void invalidate(std::string const & i_path);
+
+    // Forgets everything.
+    void clear();
+
+    // Supply stats.
+    void get_stats(utp::StatSet & o_ss) const;
+
+private:
+    struct Entry;
+
+    typedef std::map<std::string, Entry> EntryMap;
+    typedef std::list<EntryMap::iterator> EntryList;
+
+    struct Entry
+    {
+        FileNodeHandle				m_fnh;		// NULL if missing
+        EntryList::iterator			m_lpos;
+    };
+
+    // Only paths in canonical form are cached, another spelling of
+    // the path wouldn't be invalidated.
+    //
+    static bool cacheable(std::string const & i_path);
+
+    // IMPORTANT - The following need m_dcmutex held.
+
+    void erase(EntryMap::iterator i_pos);
+
+    mutable ACE_Thread_Mutex		m_dcmutex;
+    EntryMap						m_entries;
+    EntryList						m_lru;			// Most recent first
+    size_t							m_maxentries;
+    utp::uint64						m_seqno;
+
+    utp::int64						m_nhits;
+    utp::int64						m_nneghits;
+    utp::int64						m_nmisses;
+    utp::int64						m_ninvals;
+};
+
+} // namespace UTFS
+
+// Local Variables:
+// mode: C++
+// tab-width: 4
+// c-basic-offset: 4
+// c-file-offsets: ((comment-intro . 0))
+// End:
+
+#endif // UTFS_DentryCache_h__
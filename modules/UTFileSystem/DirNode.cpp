@@ -1,5 +1,7 @@
 #include <sstream>
 
+#include <ace/Guard_T.h>
+
 #include <google/protobuf/io/coded_stream.h>
 #include <google/protobuf/io/zero_copy_stream_impl.h>
 
@@ -13,12 +15,77 @@
 #include "BlockNodeCache.h"
 #include "Context.h"
 #include "DirNode.h"
+#include "Generation.h"
 #include "SymlinkNode.h"
 
 using namespace std;
 using namespace utp;
 using namespace google::protobuf::io;
 
+namespace {
+
+using namespace UTFS;
+
+// Reads a FileNode and upgrades it to what it really is.
+//
+class FileNodeFaultFunc : public BlockNodeCache::FaultFunc
+{
+public:
+    virtual BlockNodeHandle ff_fetch(Context & i_ctxt,
+                                     BlockRef const & i_ref)
+    {
+        FileNodeHandle nh = new FileNode(i_ctxt, i_ref);
+
+        // Is it really a directory?  Upgrade object ...
+        if (S_ISDIR(nh->mode()))
+            nh = new DirNode(i_ctxt, *nh);
+
+        // Is it really a symlink?  Upgrade object ...
+        else if (S_ISLNK(nh->mode()))
+            nh = new SymlinkNode(*nh);
+
+        return nh;
+    }
+};
+
+// Largest serialized bucket which still fits in its BLKSZ slot
+// behind the length prefix.  Slots don't follow the filesystem's
+// block size, larger data blocks hold several of them.  A change to
+// one bucket still puts the whole data block around it, so with the
+// larger block sizes each entry made or removed costs a block's
+// worth of writing; write-behind gathers the changes to a block in
+// between writebacks.  Directories with a lot of churn are better
+// off in a filesystem with small blocks.
+size_t const BUCKET_MAXBYTES = BlockNode::BLKSZ - 16;
+
+// Bounds the slot doubling; entries whose names all hash alike
+// can't be split apart.
+size_t const MAXBUCKETS = 1 << 20;
+
+// FNV-1a.  Only the low bits are used, they're the same whatever
+// the width of uint32.
+//
+uint32
+namehash(string const & i_name)
+{
+    uint32 hv = 2166136261U;
+    for (string::const_iterator it = i_name.begin(); it != i_name.end(); ++it)
+    {
+        hv ^= (uint8) *it;
+        hv *= 16777619U;
+    }
+    return hv;
+}
+
+// Each bucket has a BLKSZ slot of its own.
+off_t
+bucketoff(size_t i_ndx)
+{
+    return FileNode::INLSZ + off_t(i_ndx) * BlockNode::BLKSZ;
+}
+
+} // end namespace
+
 namespace UTFS {
 
 pair<string, string>
@@ -68,6 +135,9 @@ DirNode::DirNode(mode_t i_mode,
                  string const & i_uname,
                  string const & i_gname)
     : FileNode(i_mode, i_uname, i_gname)
+    , m_buckets(1, new Bucket)
+    , m_hashed(false)
+    , m_nentries(0)
 {
     LOG(lgr, 6, "CTOR");
 
@@ -84,6 +154,9 @@ DirNode::DirNode(mode_t i_mode,
 
 DirNode::DirNode(Context & i_ctxt, FileNode const & i_fn)
     : FileNode(i_fn)
+    , m_buckets(1, new Bucket)
+    , m_hashed(false)
+    , m_nentries(0)
 {
     LOG(lgr, 6, "CTOR " << bn_blkref());
 
@@ -92,6 +165,9 @@ DirNode::DirNode(Context & i_ctxt, FileNode const & i_fn)
 
 DirNode::DirNode(Context & i_ctxt, BlockRef const & i_ref)
     : FileNode(i_ctxt, i_ref)
+    , m_buckets(1, new Bucket)
+    , m_hashed(false)
+    , m_nentries(0)
 {
     LOG(lgr, 6, "CTOR " << i_ref);
 
@@ -133,40 +209,133 @@ DirNode::bn_flush(Context & i_ctxt)
 
     if (lgr.is_enabled(6))
     {
-        for (int i = 0; i < m_dir.entry_size(); ++i)
+        for (size_t b = 0; b < m_buckets.size(); ++b)
         {
-            Directory::Entry const & ent = m_dir.entry(i);
-            LOG(lgr, 6, "[" << i << "]: "
-                << BlockRef(ent.blkref()) << " " << ent.name());
+            if (!m_buckets[b])
+                continue;
+
+            Directory const & dir = m_buckets[b]->m_dir;
+            for (int i = 0; i < dir.entry_size(); ++i)
+            {
+                Directory::Entry const & ent = dir.entry(i);
+                LOG(lgr, 6, "[" << b << "," << i << "]: "
+                    << BlockRef(ent.blkref()) << " " << ent.name());
+            }
         }
     }
 
-    // Note the old size first.
-    size_t oldsz = size();
+    if (!m_hashed)
+    {
+        Directory const & dir = m_buckets[0]->m_dir;
 
-    // Serialize the data to a stream.
-    ostringstream ostrm;
-    bool ok = m_dir.SerializeToOstream(&ostrm);
-    if (!ok)
-        throwstream(InternalError, FILELINE << "dir serialization error");
+        // Note the old size first.
+        size_t oldsz = size();
 
-    size_t newsz = ostrm.str().size();
+        // Serialize the data to a stream.
+        ostringstream ostrm;
+        bool ok = dir.SerializeToOstream(&ostrm);
+        if (!ok)
+            throwstream(InternalError, FILELINE << "dir serialization error");
 
-    // Write the stream to the underlying file.
-    int rv = FileNode::write(i_ctxt, ostrm.str().data(), newsz, 0);
-    if (rv < 0)
-        throwstream(InternalError, FILELINE
-                    << "Trouble writing directory data: "
-                    << ACE_OS::strerror(-rv));
+        size_t newsz = ostrm.str().size();
 
-    // Truncate the file size to the directory size.
-    if (newsz < oldsz)
-        FileNode::truncate(i_ctxt, ostrm.str().size());
+        // Write the stream to the underlying file.
+        int rv = write_through(i_ctxt, ostrm.str().data(), newsz, 0);
+        if (rv < 0)
+            throwstream(InternalError, FILELINE
+                        << "Trouble writing directory data: "
+                        << ACE_OS::strerror(-rv));
+
+        // Truncate the file size to the directory size.
+        if (newsz < oldsz)
+            FileNode::truncate(i_ctxt, ostrm.str().size());
+    }
+    else
+    {
+        // Converting from the single Directory, drop it.  Everything
+        // was loaded by the split, all of it gets written.
+        //
+        if (dirbuckets() == 0)
+        {
+            FileNode::truncate(i_ctxt, 0);
+            for (size_t b = 0; b < m_buckets.size(); ++b)
+                m_dirtybkts.insert(b);
+        }
+
+        for (BucketSet::const_iterator it = m_dirtybkts.begin();
+             it != m_dirtybkts.end();
+             ++it)
+        {
+            Directory const & dir = m_buckets[*it]->m_dir;
+
+            // Length prefixed, the rest of the block is zeroed.
+            string buf(BLKSZ, '\0');
+            {
+                ArrayOutputStream aos(&buf[0], buf.size());
+                CodedOutputStream cos(&aos);
+                cos.WriteVarint32(dir.ByteSize());
+                dir.SerializeWithCachedSizes(&cos);
+                if (cos.HadError())
+                    throwstream(InternalError, FILELINE
+                                << "dir bucket " << *it
+                                << " serialization error");
+            }
+
+            int rv = write_through(i_ctxt, buf.data(), buf.size(),
+                                   bucketoff(*it));
+            if (rv < 0)
+                throwstream(InternalError, FILELINE
+                            << "Trouble writing directory bucket: "
+                            << ACE_OS::strerror(-rv));
+        }
+
+        dirbuckets(m_buckets.size());
+        direntries(m_nentries);
+    }
+
+    m_dirtybkts.clear();
 
     // Let the FileNode do all the rest of the work ...
     return FileNode::bn_flush(i_ctxt);
 }
 
+BlockNodeHandle
+DirNode::bn_clone() const
+{
+    return new DirNode(*this);
+}
+
+void
+DirNode::bn_freeze(Generation & io_gen)
+{
+    FileNode::bn_freeze(io_gen);
+
+    for (EntryMap::iterator it = m_dirty.begin(); it != m_dirty.end(); ++it)
+        it->second = io_gen.freeze(it->second);
+}
+
+void
+DirNode::bn_thaw(Generation const & i_gen)
+{
+    FileNode::bn_thaw(i_gen);
+
+    EntryMap::iterator it = m_dirty.begin();
+    while (it != m_dirty.end())
+    {
+        BlockNodeHandle bnh = i_gen.thaw(it->second);
+        if (bnh)
+        {
+            // Stored as it is, take the stored reference.
+            update(it->first, bnh->bn_blkref());
+            m_dirty.erase(it++);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
+
 void
 DirNode::bn_tostream(std::ostream & ostrm) const
 {
@@ -179,46 +348,42 @@ DirNode::rb_refresh(Context & i_ctxt, uint64 i_rid)
 {
     size_t nblocks = 0;
 
-    for (int i = 0; i < m_dir.entry_size(); ++i)
+    for (size_t b = 0; b < m_buckets.size(); ++b)
     {
-        Directory::Entry const & ent = m_dir.entry(i);
-
-        // Do we have a cached dirty object?
-        EntryMap::iterator pos = m_dirty.find(ent.name());
-        if (pos != m_dirty.end())
-        {
-            nblocks += pos->second->rb_refresh(i_ctxt, i_rid);
-        }
-        else
+        Directory const & dir = bucket(i_ctxt, b);
+        for (int i = 0; i < dir.entry_size(); ++i)
         {
-            // Does the clean cache have one?
-            FileNodeHandle nh;
-            BlockNodeHandle bnh = i_ctxt.m_bncachep->lookup(ent.blkref());
-            if (bnh)
+            Directory::Entry const & ent = dir.entry(i);
+
+            // Do we have a cached dirty object?
+            FileNodeHandle dnh;
             {
-                // Upcast to FileNode, it is at least that.
-                nh = dynamic_cast<FileNode *>(&*bnh);
+                ACE_Guard<ACE_Thread_Mutex> guard(fn_mdmutex());
+                EntryMap::iterator pos = m_dirty.find(ent.name());
+                if (pos != m_dirty.end())
+                    dnh = pos->second;
+            }
+
+            if (dnh)
+            {
+                NodeGuard nguard(dnh->fn_rwmutex(), false);
+                nblocks += dnh->rb_refresh(i_ctxt, i_rid);
             }
             else
             {
-                nh = new FileNode(i_ctxt, ent.blkref());
-
-                // Is it really a directory?  Upgrade object ...
-                if (S_ISDIR(nh->mode()))
-                    nh = new DirNode(i_ctxt, *nh);
+                // Does the clean cache have one?  Seems like the refresh
+                // kinda wrecks the cache, so don't insert it if not.
+                //
+                FileNodeFaultFunc ff;
+                BlockNodeHandle bnh =
+                    i_ctxt.m_bncachep->fault(i_ctxt, ent.blkref(), ff, false);
 
-                // Is it really a symlink?  Upgrade object ...
-                else if (S_ISLNK(nh->mode()))
-                    nh = new SymlinkNode(*nh);
+                // Upcast to FileNode, it is at least that.
+                FileNodeHandle nh = dynamic_cast<FileNode *>(&*bnh);
 
-                // Should we insert it in the clean cache here?
-                //
-                // Seems like the refresh kinda wrecks the cache.
-                // Maybe let them evaporate when we are done
-                // traversing instead.
+                NodeGuard nguard(nh->fn_rwmutex(), false);
+                nblocks += nh->rb_refresh(i_ctxt, i_rid);
             }
-
-            nblocks += nh->rb_refresh(i_ctxt, i_rid);
         }
     }
 
@@ -232,7 +397,14 @@ DirNode::node_traverse(Context & i_ctxt,
                        string const & i_rmndr,
                        NodeTraverseFunc & i_trav)
 {
-    FileNodeHandle fnh = lookup(i_ctxt, i_entry, i_flags & NT_READONLY);
+    // We're held shared while the traversal passes through.  If we
+    // are the parent in a traversal which changes our entries we're
+    // held exclusively.  See the lock order in UTFileSystem.h.
+    //
+    bool const isparent = (i_flags & NT_PARENT) && i_rmndr.empty();
+    NodeGuard guard(fn_rwmutex(), isparent && (i_flags & NT_UPDATE));
+
+    FileNodeHandle fnh = lookup(i_ctxt, i_entry);
 
     if (i_flags & NT_PARENT)
     {
@@ -247,7 +419,7 @@ DirNode::node_traverse(Context & i_ctxt,
             if (i_flags & NT_UPDATE)
             {
                 // Need to redo the lookup because it might have changed.
-                fnh = lookup(i_ctxt, i_entry, i_flags & NT_READONLY);
+                fnh = lookup(i_ctxt, i_entry);
                 update(i_ctxt, i_entry, fnh);
             }
         }
@@ -278,7 +450,10 @@ DirNode::node_traverse(Context & i_ctxt,
 
         if (i_rmndr.empty())
         {
-            i_trav.nt_leaf(i_ctxt, *fnh);
+            {
+                NodeGuard lguard(fnh->fn_rwmutex(), i_flags & NT_UPDATE);
+                i_trav.nt_leaf(i_ctxt, *fnh);
+            }
 
             if (i_flags & NT_UPDATE)
                 update(i_ctxt, i_entry, fnh);
@@ -304,7 +479,7 @@ DirNode::node_traverse(Context & i_ctxt,
 size_t
 DirNode::numentries() const
 {
-    return m_dir.entry_size();
+    return m_nentries;
 }
 
 int
@@ -315,19 +490,21 @@ DirNode::mknod(Context & i_ctxt,
                string const & i_uname,
                string const & i_gname)
 {
-    FileNodeHandle fnh = lookup(i_ctxt, i_entry, false);
+    FileNodeHandle fnh = lookup(i_ctxt, i_entry);
     if (fnh)
         throw EEXIST;
 
+    // Insert a placeholder in the directory.
+    insert(i_ctxt, i_entry, BlockRef());
+
     // Create a new file.
     fnh = new FileNode(i_mode, i_uname, i_gname);
+    if (i_ctxt.m_extents)
+        fnh->use_extents();
 
     // Insert into the dirty cache.
     m_dirty.insert(make_pair(i_entry, fnh));
 
-    // Insert a placeholder in the directory.
-    update(i_entry, BlockRef());
-
     bn_isdirty(true);
 
     return 0;
@@ -341,19 +518,19 @@ DirNode::mkdir(Context & i_ctxt,
                string const & i_gname)
 {
     // The entry better not already exist.
-    FileNodeHandle fnh = lookup(i_ctxt, i_entry, false);
+    FileNodeHandle fnh = lookup(i_ctxt, i_entry);
     if (fnh)
         throw EEXIST;
 
+    // Insert a placeholder in the directory.
+    insert(i_ctxt, i_entry, BlockRef());
+
     // Create the new directory node.
     DirNodeHandle dnh = new DirNode(i_mode, i_uname, i_gname);
 
     // Insert into the dirty cache.
     m_dirty.insert(make_pair(i_entry, dnh));
 
-    // Insert a placeholder in the directory.
-    update(i_entry, BlockRef());
-
     // Increment our link count.
     nlink(nlink() + 1);
 
@@ -366,7 +543,7 @@ int
 DirNode::unlink(Context & i_ctxt, string const & i_entry, bool i_dirstoo)
 {
     // Lookup the entry.
-    FileNodeHandle fnh = lookup(i_ctxt, i_entry, false);
+    FileNodeHandle fnh = lookup(i_ctxt, i_entry);
 
     // It needs to exist.
     if (!fnh)
@@ -385,7 +562,7 @@ int
 DirNode::rmdir(Context & i_ctxt, string const & i_entry)
 {
     // Lookup the entry.
-    FileNodeHandle fnh = lookup(i_ctxt, i_entry, false);
+    FileNodeHandle fnh = lookup(i_ctxt, i_entry);
 
     // It needs to exist.
     if (!fnh)
@@ -410,21 +587,21 @@ DirNode::symlink(Context & i_ctxt,
                  string const & i_entry,
                  string const & i_opath)
 {
-    FileNodeHandle fnh = lookup(i_ctxt, i_entry, false);
+    FileNodeHandle fnh = lookup(i_ctxt, i_entry);
 
     // It needs to not exist.
     if (fnh)
         throw EEXIST;
 
+    // Insert a placeholder in the directory.
+    insert(i_ctxt, i_entry, BlockRef());
+
     // Create the symbolic link.
     fnh = new SymlinkNode(i_opath);
 
     // Insert into the dirty cache.
     m_dirty.insert(make_pair(i_entry, fnh));
 
-    // Insert a placeholder in the directory.
-    update(i_entry, BlockRef());
-
     bn_isdirty(true);
 
     return 0;
@@ -444,7 +621,7 @@ DirNode::linkdst(Context & i_ctxt,
                  BlockRef const & i_blkref,
                  bool i_force)
 {
-    FileNodeHandle fnh = lookup(i_ctxt, i_entry, false);
+    FileNodeHandle fnh = lookup(i_ctxt, i_entry);
 
     // Does the target path exist already?
     if (fnh)
@@ -456,9 +633,7 @@ DirNode::linkdst(Context & i_ctxt,
     }
 
     // Insert into our Directory collection.
-    Directory::Entry * de = m_dir.add_entry();
-    de->set_name(i_entry);
-    de->set_blkref(i_blkref);
+    insert(i_ctxt, i_entry, i_blkref);
 
     bn_isdirty(true);
 
@@ -468,7 +643,7 @@ DirNode::linkdst(Context & i_ctxt,
 int
 DirNode::open(Context & i_ctxt, string const & i_entry, int i_flags)
 {
-    FileNodeHandle fnh = lookup(i_ctxt, i_entry, false);
+    FileNodeHandle fnh = lookup(i_ctxt, i_entry);
 
     // The file needs to exist.
     if (!fnh)
@@ -483,8 +658,12 @@ DirNode::readdir(Context & i_ctxt,
                  FileSystem::DirEntryFunc & o_entryfunc)
 {
     // Add all the entries in our digest table.
-    for (int i = 0; i < m_dir.entry_size(); ++i)
-        o_entryfunc.def_entry(m_dir.entry(i).name(), NULL, 0);
+    for (size_t b = 0; b < m_buckets.size(); ++b)
+    {
+        Directory const & dir = bucket(i_ctxt, b);
+        for (int i = 0; i < dir.entry_size(); ++i)
+            o_entryfunc.def_entry(dir.entry(i).name(), NULL, 0);
+    }
 
     // Add some old favorites.
     o_entryfunc.def_entry(".", NULL, 0);
@@ -500,6 +679,9 @@ DirNode::update(Context & i_ctxt,
 {
     LOG(lgr, 6, "update " << i_entry);
 
+    // Our descendants call this holding only a shared lock on us.
+    ACE_Guard<ACE_Thread_Mutex> guard(fn_mdmutex());
+
     mtime(T64::now());
 
     // If it's not a removal, insert in the dirty cache.
@@ -510,54 +692,38 @@ DirNode::update(Context & i_ctxt,
 }
 
 FileNodeHandle
-DirNode::lookup(Context & i_ctxt,
-                string const & i_entry,
-                bool i_readonly)
+DirNode::lookup(Context & i_ctxt, string const & i_entry)
 {
     // Do we have a cached dirty object for this name?
-    EntryMap::const_iterator pos = m_dirty.find(i_entry);
-    if (pos != m_dirty.end())
     {
-        return pos->second;
+        ACE_Guard<ACE_Thread_Mutex> guard(fn_mdmutex());
+        EntryMap::const_iterator pos = m_dirty.find(i_entry);
+        if (pos != m_dirty.end())
+            return pos->second;
     }
-    else
+
     {
-        // Is it in the directories digest table?
-        for (int i = 0; i < m_dir.entry_size(); ++i)
+        // Is it in the directories digest table?  Only its bucket
+        // can have it.
+        //
+        Directory const & dir =
+            bucket(i_ctxt, bucketndx(i_ctxt, i_entry));
+        for (int i = 0; i < dir.entry_size(); ++i)
         {
-            Directory::Entry const & ent = m_dir.entry(i);
+            Directory::Entry const & ent = dir.entry(i);
 
             if (ent.name() == i_entry)
             {
-                // Is it in the clean cache?
-                FileNodeHandle nh;
-                BlockNodeHandle bnh = i_ctxt.m_bncachep->lookup(ent.blkref());
-                if (bnh)
-                {
-                    // Upcast to FileNode, it is at least that.
-                    nh = dynamic_cast<FileNode *>(&*bnh);
-                }
-                else
-                {
-                    // If we are read-only bail and come back with a
-                    // write lock ...
-                    //
-                    if (i_readonly)
-                        throw OperationError(i_entry);
-
-                    nh = new FileNode(i_ctxt, ent.blkref());
-
-                    // Is it really a directory?  Upgrade object ...
-                    if (S_ISDIR(nh->mode()))
-                        nh = new DirNode(i_ctxt, *nh);
-
-                    // Is it really a symlink?  Upgrade object ...
-                    else if (S_ISLNK(nh->mode()))
-                        nh = new SymlinkNode(*nh);
-
-                    // Insert this in the clean cache.
-                    i_ctxt.m_bncachep->insert(nh);
-                }
+                // Fault it in through the clean cache.  Another
+                // traversal holding us shared may be faulting it
+                // too, everyone has to use the same node.
+                //
+                FileNodeFaultFunc ff;
+                BlockNodeHandle bnh =
+                    i_ctxt.m_bncachep->fault(i_ctxt, ent.blkref(), ff);
+
+                // Upcast to FileNode, it is at least that.
+                FileNodeHandle nh = dynamic_cast<FileNode *>(&*bnh);
 
                 return nh;
             }
@@ -570,6 +736,8 @@ DirNode::lookup(Context & i_ctxt,
 BlockRef
 DirNode::find_blkref(Context & i_ctxt, string const & i_entry)
 {
+    Directory const & dir = bucket(i_ctxt, bucketndx(i_ctxt, i_entry));
+
     // If it is in the cache we need to flush it so we
     // have a valid block reference.
     EntryMap::iterator pos = m_dirty.find(i_entry);
@@ -577,8 +745,13 @@ DirNode::find_blkref(Context & i_ctxt, string const & i_entry)
     {
         FileNodeHandle fnh = pos->second;
 
-        // Flush the node to get a valid reference.
-        BlockRef ref = fnh->bn_flush(i_ctxt);
+        // Flush the node to get a valid reference.  It may also be
+        // reachable through another directory (a hard link).
+        BlockRef ref;
+        {
+            NodeGuard guard(fnh->fn_rwmutex(), true);
+            ref = fnh->bn_flush(i_ctxt);
+        }
 
         // Insert it into the clean cache.
         i_ctxt.m_bncachep->insert(fnh);
@@ -587,22 +760,19 @@ DirNode::find_blkref(Context & i_ctxt, string const & i_entry)
         m_dirty.erase(pos);
 
         // Update the ref in the entries table.
-        for (int i = 0; i < m_dir.entry_size(); ++i)
-        {
-            if (m_dir.entry(i).name() == i_entry)
-            {
-                m_dir.mutable_entry(i)->set_blkref(ref);
-                break;
-            }
-        }
+        update(i_entry, ref);
+
+        // Our entries changed, a sync in progress mustn't replace us
+        // with its frozen copy.
+        bn_isdirty(true);
         
         return ref;
     }
 
     // Is it in the directories digest table?
-    for (int i = 0; i < m_dir.entry_size(); ++i)
-        if (m_dir.entry(i).name() == i_entry)
-            return BlockRef(m_dir.entry(i).blkref());
+    for (int i = 0; i < dir.entry_size(); ++i)
+        if (dir.entry(i).name() == i_entry)
+            return BlockRef(dir.entry(i).blkref());
 
     // Not found, nil reference.
     return BlockRef();
@@ -611,6 +781,25 @@ DirNode::find_blkref(Context & i_ctxt, string const & i_entry)
 void
 DirNode::deserialize(Context & i_ctxt)
 {
+    // Hashed?  The buckets are read as they're needed.
+    size_t nbkts = dirbuckets();
+    if (nbkts)
+    {
+        if (nbkts > MAXBUCKETS || (nbkts & (nbkts - 1)))
+            throwstream(InternalError, FILELINE
+                        << "bad directory bucket count " << nbkts);
+
+        m_buckets.assign(nbkts, BucketHandle());
+        m_hashed = true;
+        m_nentries = direntries();
+
+        LOG(lgr, 6, "deserialize " << nbkts << " buckets, "
+            << m_nentries << " entries");
+        return;
+    }
+
+    Directory & dir = m_buckets[0]->m_dir;
+
     // Allocate a buffer for the directory entries.
     string buf(size(), '\0');
 
@@ -622,18 +811,20 @@ DirNode::deserialize(Context & i_ctxt)
                     << ACE_OS::strerror(-rv));
 
     // Parse the directory object.
-    int ok = m_dir.ParseFromString(buf);
+    int ok = dir.ParseFromString(buf);
     if (!ok)
         throwstream(InternalError, FILELINE
                     << "dir deserialization failed");
 
+    m_nentries = dir.entry_size();
+
     // Log our entries if logging is verbose.
     LOG(lgr, 6, "deserialize");
     if (lgr.is_enabled(6))
     {
-        for (int i = 0; i < m_dir.entry_size(); ++i)
+        for (int i = 0; i < dir.entry_size(); ++i)
         {
-            Directory::Entry const & ent = m_dir.entry(i);
+            Directory::Entry const & ent = dir.entry(i);
             LOG(lgr, 6, "[" << i << "]: "
                 << BlockRef(ent.blkref()) << " " << ent.name());
         }
@@ -645,25 +836,28 @@ DirNode::update(string const & i_entry, BlockRef const & i_blkref)
 {
     LOG(lgr, 6, "update " << i_entry << ' ' << i_blkref);
 
-    bool found = false;
+    // Only entries we've looked at are updated, their bucket is
+    // loaded.  Leave the bucket alone if the reference is the same,
+    // there's no point in rewriting it.
+    //
+    size_t ndx = bucketndx(i_entry);
 
-    for (int i = 0; i < m_dir.entry_size(); ++i)
+    Directory const & dir = m_buckets[ndx]->m_dir;
+    for (int i = 0; i < dir.entry_size(); ++i)
     {
-        Directory::Entry * entp = m_dir.mutable_entry(i);
-        if (entp->name() == i_entry)
+        if (dir.entry(i).name() == i_entry)
         {
-            entp->set_blkref(i_blkref);
-            found = true;
-            break;
+            string const data = i_blkref;
+            if (dir.entry(i).blkref() != data)
+                mutable_bucket(ndx).mutable_entry(i)->set_blkref(data);
+            return;
         }
     }
 
-    if (!found)
-    {
-        Directory::Entry * entp = m_dir.add_entry();
-        entp->set_name(i_entry);
-        entp->set_blkref(i_blkref);
-    }
+    Directory::Entry * entp = mutable_bucket(ndx).add_entry();
+    entp->set_name(i_entry);
+    entp->set_blkref(i_blkref);
+    ++m_nentries;
 }
 
 void
@@ -681,24 +875,28 @@ DirNode::remove(Context & i_ctxt, string const & i_entry)
     // No need to scan to the last item since we know the item is
     // in the list.
     //
+    size_t ndx = bucketndx(i_ctxt, i_entry);
+    Directory & dir = mutable_bucket(ndx);
+
     BlockRef ref;
-    for (int i = 0; i < m_dir.entry_size() - 1; ++i)
+    for (int i = 0; i < dir.entry_size() - 1; ++i)
     {
-        if (m_dir.entry(i).name() == i_entry)
+        if (dir.entry(i).name() == i_entry)
         {
-            ref = m_dir.entry(i).blkref();
+            ref = dir.entry(i).blkref();
 
             // Get mutable reference to this entry.
-            Directory::Entry * me = m_dir.mutable_entry(i);
+            Directory::Entry * me = dir.mutable_entry(i);
 
             // Copy last entry into this slot.
-            *me = m_dir.entry(m_dir.entry_size() - 1);
+            *me = dir.entry(dir.entry_size() - 1);
 
             // Deed is done ...
             break;
         }
     }
-    m_dir.mutable_entry()->RemoveLast();
+    dir.mutable_entry()->RemoveLast();
+    --m_nentries;
 
     // Remove from the dirty cache.
     m_dirty.erase(i_entry);
@@ -711,6 +909,192 @@ DirNode::remove(Context & i_ctxt, string const & i_entry)
     bn_isdirty(true);
 }
 
+size_t
+DirNode::bucketndx(Context & i_ctxt, string const & i_entry)
+{
+    if (!m_hashed)
+        return 0;
+
+    // A hashed directory's buckets are at least depth 1.
+    uint32 const hv = namehash(i_entry);
+    for (size_t nslots = m_buckets.size(); nslots > 1; nslots /= 2)
+    {
+        size_t ndx = hv & (nslots - 1);
+        if (bucket(i_ctxt, ndx).has_depth())
+            return ndx;
+    }
+
+    throwstream(InternalError, FILELINE
+                << "no dir bucket for " << i_entry);
+}
+
+size_t
+DirNode::bucketndx(string const & i_entry) const
+{
+    if (!m_hashed)
+        return 0;
+
+    uint32 const hv = namehash(i_entry);
+    for (size_t nslots = m_buckets.size(); nslots > 1; nslots /= 2)
+    {
+        size_t ndx = hv & (nslots - 1);
+        if (!m_buckets[ndx])
+            throwstream(InternalError, FILELINE
+                        << "dir bucket " << ndx << " for " << i_entry
+                        << " not loaded");
+        if (m_buckets[ndx]->m_dir.has_depth())
+            return ndx;
+    }
+
+    throwstream(InternalError, FILELINE
+                << "no dir bucket for " << i_entry);
+}
+
+Directory const &
+DirNode::bucket(Context & i_ctxt, size_t i_ndx)
+{
+    // Traversals holding us shared load buckets too.  Once loaded a
+    // bucket is only replaced while we're held exclusively.
+    //
+    ACE_Guard<ACE_Thread_Mutex> guard(m_bktmutex);
+
+    BucketHandle & bh = m_buckets[i_ndx];
+    if (bh)
+        return bh->m_dir;
+
+    string buf(BLKSZ, '\0');
+    int rv = FileNode::read(i_ctxt, &buf[0], buf.size(), bucketoff(i_ndx));
+    if (rv < 0)
+        throwstream(InternalError, FILELINE
+                    << "Trouble reading directory bucket: "
+                    << ACE_OS::strerror(-rv));
+
+    BucketHandle nbh = new Bucket;
+
+    // Unused slots past the last one written aren't in the file.
+    if (rv == 0)
+    {
+        bh = nbh;
+        return bh->m_dir;
+    }
+
+    CodedInputStream cis((uint8 const *) buf.data(), rv);
+    google::protobuf::uint32 len;
+    if (!cis.ReadVarint32(&len))
+        throwstream(InternalError, FILELINE
+                    << "dir bucket " << i_ndx << " length missing");
+
+    CodedInputStream::Limit lim = cis.PushLimit(len);
+    if (!nbh->m_dir.ParseFromCodedStream(&cis) ||
+        !cis.ConsumedEntireMessage())
+        throwstream(InternalError, FILELINE
+                    << "dir bucket " << i_ndx << " deserialization failed");
+    cis.PopLimit(lim);
+
+    LOG(lgr, 6, "bucket " << i_ndx << ": "
+        << nbh->m_dir.entry_size() << " entries");
+
+    bh = nbh;
+    return bh->m_dir;
+}
+
+Directory &
+DirNode::mutable_bucket(size_t i_ndx)
+{
+    BucketHandle & bh = m_buckets[i_ndx];
+    if (!bh)
+        throwstream(InternalError, FILELINE
+                    << "dir bucket " << i_ndx << " not loaded");
+
+    // A frozen copy of us still has it, make our own.
+    if (bh->rc_count() > 1)
+        bh = new Bucket(*bh);
+
+    m_dirtybkts.insert(i_ndx);
+
+    return bh->m_dir;
+}
+
+void
+DirNode::insert(Context & i_ctxt,
+                string const & i_entry,
+                BlockRef const & i_blkref)
+{
+    LOG(lgr, 6, "insert " << i_entry << ' ' << i_blkref);
+
+    Directory::Entry ent;
+    ent.set_name(i_entry);
+    ent.set_blkref(i_blkref);
+
+    // The entry's tag and length take a few bytes too.
+    size_t entsz = ent.ByteSize() + 4;
+
+    // Small directories are a single Directory until they
+    // outgrow a block.  The entry's side of a split may still be too
+    // full if the names went the same way.
+    //
+    size_t ndx = bucketndx(i_ctxt, i_entry);
+    while (bucket(i_ctxt, ndx).ByteSize() + entsz > BUCKET_MAXBYTES)
+        ndx = split(ndx, i_entry);
+
+    *mutable_bucket(ndx).add_entry() = ent;
+    ++m_nentries;
+}
+
+size_t
+DirNode::split(size_t i_ndx, string const & i_entry)
+{
+    // The single Directory of an unhashed directory splits like a
+    // bucket of depth 0.
+    Directory const & dir = m_buckets[i_ndx]->m_dir;
+    size_t const depth = m_hashed ? dir.depth() : 0;
+    size_t const half = size_t(1) << depth;
+
+    // We don't want to make a million empty slots because a few
+    // names collide.
+    if (half * 2 > MAXBUCKETS)
+    {
+        LOG(lgr, 2, "split " << i_entry << ": too many buckets");
+        throw ENOSPC;
+    }
+
+    // Only the deepest buckets need more slots.  The new ones are
+    // all unused, they can share an empty bucket.
+    if (half == m_buckets.size())
+    {
+        LOG(lgr, 4, "split " << m_buckets.size() << " -> "
+            << m_buckets.size() * 2 << " slots, "
+            << m_nentries << " entries");
+
+        m_buckets.resize(m_buckets.size() * 2, new Bucket);
+    }
+
+    // The next hash bit decides which half an entry goes in.
+    BucketHandle lo = new Bucket;
+    BucketHandle hi = new Bucket;
+    lo->m_dir.set_depth(depth + 1);
+    hi->m_dir.set_depth(depth + 1);
+
+    for (int i = 0; i < dir.entry_size(); ++i)
+    {
+        BucketHandle & bh = (namehash(dir.entry(i).name()) & half) ? hi : lo;
+        *bh->m_dir.add_entry() = dir.entry(i);
+    }
+
+    LOG(lgr, 6, "split " << i_ndx << " -> " << i_ndx + half
+        << ", depth " << depth + 1 << ", "
+        << lo->m_dir.entry_size() << "/" << hi->m_dir.entry_size());
+
+    // Anyone sharing the old bucket keeps it, dir is gone after this.
+    m_buckets[i_ndx] = lo;
+    m_buckets[i_ndx + half] = hi;
+    m_hashed = true;
+    m_dirtybkts.insert(i_ndx);
+    m_dirtybkts.insert(i_ndx + half);
+
+    return (namehash(i_entry) & half) ? i_ndx + half : i_ndx;
+}
+
 } // namespace UTFS
 
 // Local Variables:
@@ -7,7 +7,9 @@
 /// See README.txt for inheritance diagram.
 
 #include <map>
+#include <set>
 #include <string>
+#include <vector>
 
 #include "FileSystem.h"
 
@@ -20,6 +22,19 @@
 
 namespace UTFS {
 
+// Directory entries are stored in the node's data.  A small
+// directory is a single serialized Directory.  Once it outgrows a
+// data block the entries are hashed on their name into buckets, each
+// stored in its own data block; a lookup reads one bucket and a
+// change rewrites only the buckets it touched.
+//
+// The buckets are extendible hashed.  A bucket of depth d holds the
+// names whose low d hash bits are its slot number, so it lives in one
+// of the first 2^d slots and the slots whose low d bits match it are
+// unused.  An insert which overflows a bucket splits just that one,
+// into its own slot and the one 2^d above it.  The slot count only
+// doubles when the bucket split is as deep as the slots go.
+//
 class UTFS_EXP DirNode : public FileNode
 {
 public:
@@ -79,21 +94,26 @@ public:
     {
         NT_DEFAULT		= 0x0,	// Traverse to leaf, don't update.
         NT_PARENT		= 0x1,	// Stop at parent, leaf may be missing.
-        NT_UPDATE		= 0x2,	// Call the update method.
-        NT_READONLY		= 0x4	// OperationError instead of modifying.
+        NT_UPDATE		= 0x2	// Call the update method.
     };
 
     // Flush any dirty pages to the blockstore and return digest.
     virtual BlockRef const & bn_flush(Context & i_ctxt);
 
+    virtual BlockNodeHandle bn_clone() const;
+
+    virtual void bn_freeze(Generation & io_gen);
+
+    virtual void bn_thaw(Generation const & i_gen);
+
     virtual void bn_tostream(std::ostream & ostrm) const;
 
     virtual size_t rb_refresh(Context & i_ctxt, utp::uint64 i_rid);
                             
     // Traverse a path calling functor methods as appropriate.
     //
-    // If NT_READONLY is set throws OperationError if it would
-    // need to make any changes to the tree (even filling in nodes).
+    // Nodes which aren't in memory are faulted in along the way,
+    // this only needs the directories held shared.
     //
     virtual void node_traverse(Context & i_ctxt,
                                unsigned int i_flags,
@@ -150,8 +170,7 @@ protected:
                         FileNodeHandle const & i_fnh);
 
     virtual FileNodeHandle lookup(Context & i_ctxt,
-                                  std::string const & i_entry,
-                                  bool i_readonly);
+                                  std::string const & i_entry);
 
     virtual BlockRef find_blkref(Context & i_ctxt,
                                  std::string const & i_entry);
@@ -165,8 +184,51 @@ protected:
 private:
     typedef std::map<std::string, FileNodeHandle> EntryMap;
 
+    // A slice of the directory's entries.  Shared with the frozen
+    // copies of the node until one side changes it.
+    //
+    struct Bucket : public utp::RCObj
+    {
+        Directory			m_dir;
+    };
+
+    typedef utp::RCPtr<Bucket> BucketHandle;
+    typedef std::vector<BucketHandle> BucketSeq;
+    typedef std::set<size_t> BucketSet;
+
+    // Which slot holds the entry's bucket.  The slots are probed
+    // from the deepest down, the first in use is the one; the probed
+    // slots are read in along the way.
+    //
+    size_t bucketndx(Context & i_ctxt, std::string const & i_entry);
+
+    // The same, for an entry whose slots are already read in.
+    size_t bucketndx(std::string const & i_entry) const;
+
+    // Returns the bucket, reading it in if it isn't loaded yet.  An
+    // unused slot is an empty Directory without a depth.
+    //
+    Directory const & bucket(Context & i_ctxt, size_t i_ndx);
+
+    // Returns a loaded bucket for modification and marks it dirty.
+    Directory & mutable_bucket(size_t i_ndx);
+
+    // Adds a new entry, splitting the buckets if it doesn't fit.
+    void insert(Context & i_ctxt,
+                std::string const & i_entry,
+                BlockRef const & i_blkref);
+
+    // Splits the bucket in the slot, doubling the slots if it is as
+    // deep as they go.  Returns the slot the entry now belongs in.
+    //
+    size_t split(size_t i_ndx, std::string const & i_entry);
+
     // Name to digest mapppings (what is persisted).
-    Directory				m_dir;
+    BucketSeq				m_buckets;		// Power of two, NULL unloaded
+    bool					m_hashed;		// Single bucket otherwise
+    BucketSet				m_dirtybkts;
+    size_t					m_nentries;
+    mutable NodeMutex		m_bktmutex;		// Loading buckets
 
     // Name to dirty FileNodeHandle mappings (cached).
     EntryMap				m_dirty;
@@ -12,6 +12,7 @@
 #include "DataBlockNode.h"
 #include "DoubleIndBlockNode.h"
 #include "FileNode.h"
+#include "Prefetcher.h"
 
 using namespace std;
 using namespace utp;
@@ -24,7 +25,8 @@ namespace {
 
 namespace UTFS {
 
-DoubleIndBlockNode::DoubleIndBlockNode()
+DoubleIndBlockNode::DoubleIndBlockNode(size_t i_blksz)
+    : IndirectBlockNode(i_blksz)
 {
     LOG(lgr, 6, "CTOR");
 }
@@ -48,7 +50,7 @@ DoubleIndBlockNode::bn_flush(Context & i_ctxt)
     if (!bn_isdirty())
         return bn_blkref();
 
-    for (unsigned i = 0; i < NUMREF; ++i)
+    for (unsigned i = 0; i < numref(); ++i)
     {
         if (m_blkobj_X[i])
         {
@@ -69,6 +71,12 @@ DoubleIndBlockNode::bn_flush(Context & i_ctxt)
     return bn_persist(i_ctxt);
 }
 
+BlockNodeHandle
+DoubleIndBlockNode::bn_clone() const
+{
+    return new DoubleIndBlockNode(*this);
+}
+
 void
 DoubleIndBlockNode::bn_tostream(std::ostream & ostrm) const
 {
@@ -85,7 +93,7 @@ DoubleIndBlockNode::rb_traverse(Context & i_ctxt,
                                 size_t i_rngsize,
                                 BlockTraverseFunc & i_trav)
 {
-    static off_t const refspan = NUMREF * BLKSZ;
+    off_t refspan = off_t(numref()) * off_t(i_ctxt.m_blksz);
 
     off_t startoff = max(i_rngoff, i_base);
 
@@ -94,7 +102,7 @@ DoubleIndBlockNode::rb_traverse(Context & i_ctxt,
         goto done;
 
     // Figure out which index we start with.
-    for (off_t ndx = (startoff - i_base) / refspan; ndx < off_t(NUMREF); ++ndx)
+    for (off_t ndx = (startoff - i_base) / refspan; ndx < off_t(numref()); ++ndx)
     {
         off_t off = i_base + (ndx * refspan);
 
@@ -116,27 +124,31 @@ DoubleIndBlockNode::rb_traverse(Context & i_ctxt,
             // Nope, does it have a digest yet?
             if (m_blkref[ndx])
             {
-                // Does the clean cache have it?
-                BlockNodeHandle bnh = i_ctxt.m_bncachep->lookup(m_blkref[ndx]);
-                if (bnh)
+                if (i_flags & RB_PREFETCH)
                 {
-                    // Yes, better be a IndirectBlockNode ...
-                    nh = dynamic_cast<IndirectBlockNode *>(&*bnh);
+                    // Don't wait for it, a later pass finds it in the
+                    // cache.  Until then the zero node stands in.
+                    nh = i_ctxt.m_prefetchp->
+                        prefetch<IndirectBlockNode>(i_ctxt, m_blkref[ndx]);
+                    if (!nh)
+                        nh = i_ctxt.m_zsinobj;
                 }
                 else
                 {
-                    // Nope, read it from the blockstore.
-                    nh = new IndirectBlockNode(i_ctxt, m_blkref[ndx]);
+                    // Fault it in through the clean cache.
+                    NodeFaultFunc<IndirectBlockNode> ff;
+                    BlockNodeHandle bnh =
+                        i_ctxt.m_bncachep->fault(i_ctxt, m_blkref[ndx], ff,
+                                                 !(i_flags & RB_NOCACHE));
 
-                    // Insert it in the clean cache.
-                    if (!(i_flags & RB_NOCACHE))
-                        i_ctxt.m_bncachep->insert(nh);
+                    // Better be a IndirectBlockNode ...
+                    nh = dynamic_cast<IndirectBlockNode *>(&*bnh);
                 }
             }
             else if (i_flags & RB_MODIFY_X)
             {
                 // Nope, create new block.
-                nh = new IndirectBlockNode();
+                nh = new IndirectBlockNode(i_ctxt.m_blksz);
 
                 // Keep it in the dirty cache.
                 m_blkobj_X[ndx] = nh;
@@ -183,12 +195,12 @@ DoubleIndBlockNode::rb_truncate(Context & i_ctxt,
                                 off_t i_base,
                                 off_t i_size)
 {
-    static off_t const refspan = NUMREF * BLKSZ;
+    off_t refspan = off_t(numref()) * off_t(i_ctxt.m_blksz);
 
     size_t nblocks = 1;		// Start w/ this node.
     off_t off = i_base;
 
-    for (unsigned ndx = 0; ndx < NUMREF; ++ndx)
+    for (unsigned ndx = 0; ndx < numref(); ++ndx)
     {
         // Is it possibly overlapping the live portion of the file?
         if (off < i_size)
@@ -209,22 +221,15 @@ DoubleIndBlockNode::rb_truncate(Context & i_ctxt,
                     // Nope, does it have a digest yet?
                     if (m_blkref[ndx])
                     {
-                        // Does the clean cache have it?
+                        // Fault it in through the clean cache.
+                        NodeFaultFunc<IndirectBlockNode> ff;
                         BlockNodeHandle bnh =
-                            i_ctxt.m_bncachep->lookup(m_blkref[ndx]);
-                        if (bnh)
-                        {
-                            // Yes, better be a IndirectBlockNode ...
-                            nh = dynamic_cast<IndirectBlockNode *>(&*bnh);
-                        }
-                        else
-                        {
-                            // Nope, read it from the blockstore.
-                            nh = new IndirectBlockNode(i_ctxt, m_blkref[ndx]);
-
-                            // Insert it in the clean cache.
-                            i_ctxt.m_bncachep->insert(nh);
-                        }
+                            i_ctxt.m_bncachep->fault(i_ctxt,
+                                                     m_blkref[ndx],
+                                                     ff);
+
+                        // Better be a IndirectBlockNode ...
+                        nh = dynamic_cast<IndirectBlockNode *>(&*bnh);
                     }
                 }
 
@@ -290,7 +295,7 @@ DoubleIndBlockNode::rb_refresh(Context & i_ctxt, uint64 i_rid)
 
     BlockStore::KeySeq keys;
 
-    for (unsigned i = 0; i < NUMREF; ++i)
+    for (unsigned i = 0; i < numref(); ++i)
     {
         if (m_blkref[i])
         {
@@ -304,21 +309,14 @@ DoubleIndBlockNode::rb_refresh(Context & i_ctxt, uint64 i_rid)
             }
             else
             {
-                // Does the clean cache have it?
-                BlockNodeHandle bnh = i_ctxt.m_bncachep->lookup(m_blkref[i]);
-                if (bnh)
-                {
-                    // Yes, better be a IndirectBlockNode ...
-                    nh = dynamic_cast<IndirectBlockNode *>(&*bnh);
-                }
-                else
-                {
-                    // Nope, read it from the blockstore.
-                    nh = new IndirectBlockNode(i_ctxt, m_blkref[i]);
-
-                    // Let's not insert refresh blocks it in the clean
-                    // cache ...
-                }
+                // Fault it in, but let's not insert refresh blocks in
+                // the clean cache ...
+                NodeFaultFunc<IndirectBlockNode> ff;
+                BlockNodeHandle bnh =
+                    i_ctxt.m_bncachep->fault(i_ctxt, m_blkref[i], ff, false);
+
+                // Better be a IndirectBlockNode ...
+                nh = dynamic_cast<IndirectBlockNode *>(&*bnh);
             }
 
             nblocks += nh->rb_refresh(i_ctxt, i_rid);
@@ -334,11 +332,12 @@ DoubleIndBlockNode::rb_refresh(Context & i_ctxt, uint64 i_rid)
 }
 
 ZeroDoubleIndBlockNode::ZeroDoubleIndBlockNode(IndirectBlockNodeHandle const & i_nh)
+    : DoubleIndBlockNode(i_nh->bn_size())
 {
     LOG(lgr, 6, "CTOR " << "ZERO");
 
     // Initialize all of our references to the zero data block.
-    for (unsigned i = 0; i < NUMREF; ++i)
+    for (unsigned i = 0; i < numref(); ++i)
         m_blkobj_X[i] = i_nh;
 
     // We aren't ever dirty.
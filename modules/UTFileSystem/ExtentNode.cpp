@@ -0,0 +1,744 @@
+#include <algorithm>
+#include <limits>
+
+#include "BlockStore.h"
+#include "Except.h"
+#include "Log.h"
+
+#include "utfslog.h"
+
+#include "BlockNodeCache.h"
+#include "Context.h"
+#include "DataBlockNode.h"
+#include "ExtentNode.h"
+#include "FileNode.h"
+#include "Flusher.h"
+#include "Generation.h"
+#include "Prefetcher.h"
+
+using namespace std;
+using namespace utp;
+
+namespace {
+
+// The header and record fields are stored big-endian.
+uint64
+getfield(uint8 const * i_ptr)
+{
+    uint64 val = 0;
+    for (unsigned i = 0; i < 8; ++i)
+        val = (val << 8) | i_ptr[i];
+    return val;
+}
+
+void
+putfield(uint8 * o_ptr, uint64 i_val)
+{
+    for (int i = 7; i >= 0; --i)
+    {
+        o_ptr[i] = uint8(i_val & 0xff);
+        i_val >>= 8;
+    }
+}
+
+// Bytes of the chunk holding a run, whole blocks.
+size_t
+chunksz(UTFS::Context const & i_ctxt, off_t i_len)
+{
+    off_t const blksz = i_ctxt.m_blksz;
+    return (i_len + blksz - 1) / blksz * blksz;
+}
+
+// Faults in a chunk, which is a data block of its run's size.
+//
+class ChunkFaultFunc : public UTFS::BlockNodeCache::FaultFunc
+{
+public:
+    ChunkFaultFunc(size_t i_size) : m_size(i_size) {}
+
+    virtual UTFS::BlockNodeHandle ff_fetch(UTFS::Context & i_ctxt,
+                                           UTFS::BlockRef const & i_ref)
+    {
+        return new UTFS::DataBlockNode(i_ctxt, i_ref, m_size);
+    }
+
+private:
+    size_t		m_size;
+};
+
+} // end namespace
+
+namespace UTFS {
+
+ExtentNode::ExtentNode(size_t i_size)
+    : m_data(i_size, '\0')
+    , m_recobj_X((i_size - HDRSZ) / RECSZ)
+    , m_isroot(false)
+{
+    LOG(lgr, 6, "CTOR");
+}
+
+ExtentNode::ExtentNode(uint8 const * i_data, size_t i_size)
+    : m_data(i_size, '\0')
+    , m_recobj_X((i_size - HDRSZ) / RECSZ)
+    , m_isroot(true)
+{
+    LOG(lgr, 6, "CTOR " << "ROOT");
+
+    if (i_data)
+        ACE_OS::memcpy(&m_data[0], i_data, i_size);
+
+    // We're stored with the inode.
+    m_isdirty = false;
+}
+
+ExtentNode::ExtentNode(Context & i_ctxt, BlockRef const & i_ref)
+    : RefBlockNode(i_ref)
+    , m_data(i_ctxt.m_blksz)
+    , m_recobj_X((i_ctxt.m_blksz - HDRSZ) / RECSZ)
+    , m_isroot(false)
+{
+    LOG(lgr, 6, "CTOR " << i_ref);
+
+    bn_load(i_ctxt, i_ref, &m_data[0], m_data.size());
+
+    if (count() > capacity())
+        throwstream(InternalError, FILELINE
+                    << "extent node " << i_ref << " holds "
+                    << count() << " records");
+}
+
+ExtentNode::~ExtentNode()
+{
+    LOG(lgr, 6, "DTOR " << bn_blkref());
+}
+
+BlockRef const &
+ExtentNode::bn_persist(Context & i_ctxt)
+{
+    if (m_isroot)
+        throwstream(InternalError, FILELINE
+                    << "the extent root is persisted with its inode");
+
+    bn_store(i_ctxt, &m_data[0], m_data.size());
+
+    bn_isdirty(false);
+
+    return m_ref;
+}
+
+BlockRef const &
+ExtentNode::bn_flush(Context & i_ctxt)
+{
+    // If we aren't dirty then we just return our current reference.
+    if (!bn_isdirty())
+        return bn_blkref();
+
+    // A leaf's children are chunks, persist them in parallel.
+    if (depth() == 0)
+    {
+        Flusher::Batch batch(*i_ctxt.m_flusherp);
+        for (size_t i = 0; i < count(); ++i)
+            if (m_recobj_X[i])
+                batch.persist(i_ctxt, m_recobj_X[i]);
+        batch.wait();
+    }
+
+    for (size_t i = 0; i < count(); ++i)
+    {
+        if (m_recobj_X[i])
+        {
+            BlockRef ref = depth() == 0
+                ? m_recobj_X[i]->bn_blkref()
+                : m_recobj_X[i]->bn_flush(i_ctxt);
+
+            record(i, recoff(i), reclen(i), ref);
+
+            // Insert it in the clean cache.
+            i_ctxt.m_bncachep->insert(m_recobj_X[i]);
+
+            // Clear it in the dirty array.
+            m_recobj_X[i] = NULL;
+        }
+    }
+
+    // The root goes out with the inode.
+    if (m_isroot)
+    {
+        bn_isdirty(false);
+        return m_ref;
+    }
+
+    return bn_persist(i_ctxt);
+}
+
+BlockNodeHandle
+ExtentNode::bn_clone() const
+{
+    return new ExtentNode(*this);
+}
+
+void
+ExtentNode::bn_freeze(Generation & io_gen)
+{
+    for (size_t i = 0; i < count(); ++i)
+        if (m_recobj_X[i])
+            m_recobj_X[i] = io_gen.freeze(m_recobj_X[i]);
+}
+
+void
+ExtentNode::bn_thaw(Generation const & i_gen)
+{
+    for (size_t i = 0; i < count(); ++i)
+    {
+        if (m_recobj_X[i])
+        {
+            BlockNodeHandle bnh = i_gen.thaw(m_recobj_X[i]);
+            if (bnh)
+            {
+                record(i, recoff(i), reclen(i), bnh->bn_blkref());
+                m_recobj_X[i] = NULL;
+            }
+        }
+    }
+}
+
+void
+ExtentNode::bn_tostream(std::ostream & ostrm) const
+{
+    RefBlockNode::bn_tostream(ostrm);
+    ostrm << ' ' << "ExtentNode";
+}
+
+bool
+ExtentNode::rb_traverse(Context & i_ctxt,
+                        FileNode & i_fn,
+                        unsigned int i_flags,
+                        off_t i_base,
+                        off_t i_rngoff,
+                        size_t i_rngsize,
+                        BlockTraverseFunc & i_trav)
+{
+    off_t const rngend = i_rngoff + off_t(i_rngsize);
+
+    // The record before the range may reach into it.
+    size_t ndx = upper(i_rngoff);
+    if (ndx > 0)
+        --ndx;
+
+    for (; ndx < count() && recoff(ndx) < rngend; ++ndx)
+    {
+        off_t const off = recoff(ndx);
+
+        // Is the run all before the range?
+        if (off + reclen(ndx) <= i_rngoff)
+            continue;
+
+        BlockNodeHandle bnh = child(i_ctxt, ndx, i_flags);
+
+        // Still being fetched, a later pass finds it in the cache.
+        if (!bnh)
+            continue;
+
+        if (depth() > 0)
+        {
+            ExtentNodeHandle nh = dynamic_cast<ExtentNode *>(&*bnh);
+            if (nh->rb_traverse(i_ctxt, i_fn, i_flags, off,
+                                i_rngoff, i_rngsize, i_trav))
+            {
+                if (i_flags & RB_MODIFY_X)
+                    dirty(i_ctxt, ndx, nh);
+            }
+        }
+        else
+        {
+            // Visit the chunk, only as far as its run.
+            i_trav.bt_hold(bnh);
+            if (i_trav.bt_visit(i_ctxt, bnh->bn_data(), reclen(ndx),
+                                off, i_fn.size()))
+            {
+                if (!(i_flags & RB_MODIFY_X))
+                    throwstream(InternalError, FILELINE
+                                << "dirtied w/o RB_MODIFY");
+
+                bnh->bn_isdirty(true);
+                dirty(i_ctxt, ndx, bnh);
+            }
+        }
+    }
+
+    // Return our dirty state.
+    return bn_isdirty();
+}
+
+size_t
+ExtentNode::rb_truncate(Context & i_ctxt,
+                        off_t i_base,
+                        off_t i_size)
+{
+    // The root is counted with the inode.
+    size_t nblocks = m_isroot ? 0 : 1;
+
+    // Runs starting at or after the truncation go.
+    size_t const keep = upper(i_size - 1);
+    if (keep < count())
+        erase(i_ctxt, keep);
+
+    // An empty root is a leaf again.
+    if (count() == 0)
+        depth(0);
+
+    for (size_t ndx = 0; ndx < count(); ++ndx)
+    {
+        off_t const off = recoff(ndx);
+
+        if (depth() > 0)
+        {
+            // Only the last node can reach the truncation, but they
+            // all count their blocks.
+            BlockNodeHandle bnh = child(i_ctxt, ndx, RB_MODIFY_X);
+            ExtentNodeHandle nh = dynamic_cast<ExtentNode *>(&*bnh);
+
+            nblocks += nh->rb_truncate(i_ctxt, i_base, i_size);
+
+            if (nh->bn_isdirty())
+            {
+                record(ndx, nh->start(), nh->end() - nh->start(),
+                       recref(ndx));
+                dirty(i_ctxt, ndx, nh);
+            }
+        }
+        else
+        {
+            // Is the truncation inside this run?
+            if (off + reclen(ndx) > i_size)
+            {
+                BlockNodeHandle bnh = child(i_ctxt, ndx, RB_MODIFY_X);
+                off_t const len = i_size - off;
+
+                // Out of the clean cache before it changes size.
+                dirty(i_ctxt, ndx, bnh);
+
+                // Zero the data after the truncation.
+                ACE_OS::memset(bnh->bn_data() + len,
+                               '\0',
+                               bnh->bn_size() - len);
+
+                DataBlockNodeHandle dbh = dynamic_cast<DataBlockNode *>(&*bnh);
+                dbh->resize(chunksz(i_ctxt, len));
+                dbh->bn_isdirty(true);
+
+                record(ndx, off, len, recref(ndx));
+            }
+
+            nblocks += chunksz(i_ctxt, reclen(ndx)) / i_ctxt.m_blksz;
+        }
+    }
+
+    return nblocks;
+}
+
+size_t
+ExtentNode::rb_refresh(Context & i_ctxt, uint64 i_rid)
+{
+    size_t nblocks = 0;
+
+    BlockStore::KeySeq keys;
+
+    for (size_t i = 0; i < count(); ++i)
+    {
+        BlockRef const ref = recref(i);
+        if (!ref)
+            continue;
+
+        keys.push_back(ref);
+        ++nblocks;
+
+        if (depth() > 0)
+        {
+            ExtentNodeHandle nh;
+            if (m_recobj_X[i])
+            {
+                nh = dynamic_cast<ExtentNode *>(&*m_recobj_X[i]);
+            }
+            else
+            {
+                // Fault it in, but let's not insert refresh blocks in
+                // the clean cache ...
+                NodeFaultFunc<ExtentNode> ff;
+                BlockNodeHandle bnh =
+                    i_ctxt.m_bncachep->fault(i_ctxt, ref, ff, false);
+
+                // Better be an ExtentNode ...
+                nh = dynamic_cast<ExtentNode *>(&*bnh);
+            }
+
+            nblocks += nh->rb_refresh(i_ctxt, i_rid);
+        }
+    }
+
+    if (keys.empty())
+        return nblocks;
+
+    BlockStore::KeySeq missing;
+    i_ctxt.m_bsh->bs_refresh_blocks(i_rid, keys, missing);
+    if (!missing.empty())
+        throwstream(InternalError, FILELINE << "missing blocks encountered");
+
+    return nblocks;
+}
+
+off_t
+ExtentNode::ex_alloc(Context & i_ctxt,
+                     FileNode & i_fn,
+                     off_t i_base,
+                     off_t i_off,
+                     off_t i_end)
+{
+    // The root never splits, it moves its records down instead.
+    ExtentNodeHandle split;
+    return alloc(i_ctxt, i_fn, i_off, i_end,
+                 i_base, numeric_limits<off_t>::max(), split);
+}
+
+size_t
+ExtentNode::count() const
+{
+    return size_t(getfield(&m_data[0]));
+}
+
+void
+ExtentNode::count(size_t i_count)
+{
+    putfield(&m_data[0], i_count);
+}
+
+unsigned
+ExtentNode::depth() const
+{
+    return unsigned(getfield(&m_data[8]));
+}
+
+void
+ExtentNode::depth(unsigned i_depth)
+{
+    putfield(&m_data[8], i_depth);
+}
+
+off_t
+ExtentNode::recoff(size_t i_ndx) const
+{
+    return off_t(getfield(&m_data[HDRSZ + i_ndx * RECSZ]));
+}
+
+off_t
+ExtentNode::reclen(size_t i_ndx) const
+{
+    return off_t(getfield(&m_data[HDRSZ + i_ndx * RECSZ + 8]));
+}
+
+BlockRef
+ExtentNode::recref(size_t i_ndx) const
+{
+    BlockRef ref;
+    ACE_OS::memcpy(&ref, &m_data[HDRSZ + i_ndx * RECSZ + 16], sizeof(ref));
+    return ref;
+}
+
+void
+ExtentNode::record(size_t i_ndx,
+                   off_t i_off,
+                   off_t i_len,
+                   BlockRef const & i_ref)
+{
+    uint8 * ptr = &m_data[HDRSZ + i_ndx * RECSZ];
+    putfield(ptr, i_off);
+    putfield(ptr + 8, i_len);
+    ACE_OS::memcpy(ptr + 16, &i_ref, sizeof(i_ref));
+}
+
+size_t
+ExtentNode::upper(off_t i_off) const
+{
+    size_t lo = 0;
+    size_t hi = count();
+    while (lo < hi)
+    {
+        size_t mid = (lo + hi) / 2;
+        if (recoff(mid) <= i_off)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+BlockNodeHandle
+ExtentNode::child(Context & i_ctxt, size_t i_ndx, unsigned i_flags)
+{
+    // Do we have a dirty one?
+    if (m_recobj_X[i_ndx])
+        return m_recobj_X[i_ndx];
+
+    BlockRef const ref = recref(i_ndx);
+
+    if (depth() > 0)
+    {
+        if (i_flags & RB_PREFETCH)
+            return i_ctxt.m_prefetchp->prefetch<ExtentNode>(i_ctxt, ref);
+
+        // Fault it in through the clean cache.
+        NodeFaultFunc<ExtentNode> ff;
+        return i_ctxt.m_bncachep->fault(i_ctxt, ref, ff,
+                                        !(i_flags & RB_NOCACHE));
+    }
+
+    size_t const sz = chunksz(i_ctxt, reclen(i_ndx));
+
+    if (i_flags & RB_PREFETCH)
+        return i_ctxt.m_prefetchp->prefetch<DataBlockNode>(i_ctxt, ref, sz);
+
+    // Fault it in through the clean cache.
+    ChunkFaultFunc ff(sz);
+    BlockNodeHandle bnh =
+        i_ctxt.m_bncachep->fault(i_ctxt, ref, ff, !(i_flags & RB_NOCACHE));
+
+    // Better be a DataBlockNode ...
+    DataBlockNodeHandle dbh = dynamic_cast<DataBlockNode *>(&*bnh);
+
+    // Others may share it, modify our own.
+    if (i_flags & RB_MODIFY_X)
+        dbh = DataBlockNode::modifiable(i_ctxt, dbh);
+
+    return dbh;
+}
+
+void
+ExtentNode::dirty(Context & i_ctxt,
+                  size_t i_ndx,
+                  BlockNodeHandle const & i_bnh)
+{
+    // Remove it from the clean cache.
+    i_ctxt.m_bncachep->remove(i_bnh->bn_blkref());
+
+    // Insert it in the dirty collection.
+    m_recobj_X[i_ndx] = i_bnh;
+
+    // We're dirty too.
+    bn_isdirty(true);
+}
+
+off_t
+ExtentNode::alloc(Context & i_ctxt,
+                  FileNode & i_fn,
+                  off_t i_off,
+                  off_t i_end,
+                  off_t i_lo,
+                  off_t i_hi,
+                  ExtentNodeHandle & o_split)
+{
+    size_t const ndx = upper(i_off);
+
+    if (depth() > 0)
+    {
+        // The node whose records start before the offset takes it, or
+        // the first node if none do.
+        size_t const cn = ndx > 0 ? ndx - 1 : 0;
+        off_t const lo = cn > 0 ? recoff(cn - 1) + reclen(cn - 1) : i_lo;
+        off_t const hi = cn + 1 < count() ? recoff(cn + 1) : i_hi;
+
+        BlockNodeHandle bnh = child(i_ctxt, cn, RB_MODIFY_X);
+        ExtentNodeHandle nh = dynamic_cast<ExtentNode *>(&*bnh);
+
+        ExtentNodeHandle split;
+        off_t const runend =
+            nh->alloc(i_ctxt, i_fn, i_off, i_end, lo, hi, split);
+
+        if (nh->bn_isdirty())
+        {
+            record(cn, nh->start(), nh->end() - nh->start(), recref(cn));
+            dirty(i_ctxt, cn, nh);
+        }
+
+        if (split)
+            insert(i_ctxt, i_fn, cn + 1, split->start(),
+                   split->end() - split->start(), split, o_split);
+
+        return runend;
+    }
+
+    off_t const nextoff = ndx < count() ? recoff(ndx) : i_hi;
+    off_t lo = i_lo;
+
+    if (ndx > 0)
+    {
+        size_t const prev = ndx - 1;
+        off_t const prevoff = recoff(prev);
+        lo = prevoff + reclen(prev);
+
+        // Already covered?
+        if (i_off < lo)
+            return lo;
+
+        // Can the previous chunk reach us?  A sequential write grows
+        // its chunk until it's full.
+        if (i_off - prevoff < off_t(MAXCHUNK))
+        {
+            off_t const runend = min(min(i_end, prevoff + off_t(MAXCHUNK)),
+                                     nextoff);
+            grow(i_ctxt, i_fn, prev, runend - prevoff);
+            return runend;
+        }
+    }
+
+    // Start a new chunk, on a block boundary if there's room.
+    off_t const blksz = i_ctxt.m_blksz;
+    off_t const off = max(i_off - i_off % blksz, lo);
+    off_t const runend = min(min(i_end, off + off_t(MAXCHUNK)), nextoff);
+
+    DataBlockNodeHandle dbh =
+        new DataBlockNode(chunksz(i_ctxt, runend - off));
+    i_fn.blocks(i_fn.blocks() + dbh->bn_size() / blksz);
+
+    insert(i_ctxt, i_fn, ndx, off, runend - off, dbh, o_split);
+
+    return runend;
+}
+
+void
+ExtentNode::grow(Context & i_ctxt, FileNode & i_fn, size_t i_ndx, off_t i_len)
+{
+    BlockNodeHandle bnh = child(i_ctxt, i_ndx, RB_MODIFY_X);
+    DataBlockNodeHandle dbh = dynamic_cast<DataBlockNode *>(&*bnh);
+
+    // Out of the clean cache before it changes size.
+    dirty(i_ctxt, i_ndx, dbh);
+
+    // The chunk is zero beyond its run, growing within it exposes
+    // zeros.
+    size_t const oldsz = dbh->bn_size();
+    size_t const newsz = chunksz(i_ctxt, i_len);
+    if (newsz > oldsz)
+    {
+        dbh->resize(newsz);
+        i_fn.blocks(i_fn.blocks() + (newsz - oldsz) / i_ctxt.m_blksz);
+    }
+
+    dbh->bn_isdirty(true);
+
+    record(i_ndx, recoff(i_ndx), i_len, recref(i_ndx));
+}
+
+void
+ExtentNode::insert(Context & i_ctxt,
+                   FileNode & i_fn,
+                   size_t i_ndx,
+                   off_t i_off,
+                   off_t i_len,
+                   BlockNodeHandle const & i_bnh,
+                   ExtentNodeHandle & o_split)
+{
+    ExtentNodeHandle split;
+
+    if (count() == capacity())
+    {
+        if (m_isroot)
+        {
+            // Move our records down into a new node, which has room
+            // for them and the new one.
+            ExtentNodeHandle nh = new ExtentNode(i_ctxt.m_blksz);
+            nh->depth(depth());
+            nh->count(count());
+            ACE_OS::memcpy(&nh->m_data[HDRSZ],
+                           &m_data[HDRSZ],
+                           count() * RECSZ);
+            copy(m_recobj_X.begin(), m_recobj_X.end(),
+                 nh->m_recobj_X.begin());
+
+            nh->insert(i_ctxt, i_fn, i_ndx, i_off, i_len, i_bnh, split);
+
+            // We hold just the new node.
+            ACE_OS::memset(&m_data[HDRSZ], '\0', m_data.size() - HDRSZ);
+            fill(m_recobj_X.begin(), m_recobj_X.end(), BlockNodeHandle());
+            depth(depth() + 1);
+            count(1);
+            record(0, nh->start(), nh->end() - nh->start(), BlockRef());
+            m_recobj_X[0] = nh;
+
+            i_fn.blocks(i_fn.blocks() + 1);
+
+            bn_isdirty(true);
+            return;
+        }
+
+        // Move our upper half to a new sibling.
+        size_t const half = count() / 2;
+        size_t const nmove = count() - half;
+
+        o_split = new ExtentNode(i_ctxt.m_blksz);
+        o_split->depth(depth());
+        o_split->count(nmove);
+        ACE_OS::memcpy(&o_split->m_data[HDRSZ],
+                       &m_data[HDRSZ + half * RECSZ],
+                       nmove * RECSZ);
+        copy(m_recobj_X.begin() + half, m_recobj_X.begin() + count(),
+             o_split->m_recobj_X.begin());
+
+        ACE_OS::memset(&m_data[HDRSZ + half * RECSZ], '\0', nmove * RECSZ);
+        fill(m_recobj_X.begin() + half, m_recobj_X.begin() + count(),
+             BlockNodeHandle());
+        count(half);
+
+        i_fn.blocks(i_fn.blocks() + 1);
+
+        bn_isdirty(true);
+
+        // Neither half is full.
+        if (i_ndx > half)
+        {
+            o_split->insert(i_ctxt, i_fn, i_ndx - half,
+                            i_off, i_len, i_bnh, split);
+            return;
+        }
+    }
+
+    // Open a slot.
+    uint8 * ptr = &m_data[HDRSZ + i_ndx * RECSZ];
+    ACE_OS::memmove(ptr + RECSZ, ptr, (count() - i_ndx) * RECSZ);
+
+    m_recobj_X.insert(m_recobj_X.begin() + i_ndx, i_bnh);
+    m_recobj_X.pop_back();
+
+    count(count() + 1);
+    record(i_ndx, i_off, i_len, BlockRef());
+
+    bn_isdirty(true);
+}
+
+void
+ExtentNode::erase(Context & i_ctxt, size_t i_ndx)
+{
+    for (size_t i = i_ndx; i < count(); ++i)
+    {
+        // Remove from the clean cache.
+        i_ctxt.m_bncachep->remove(recref(i));
+
+        m_recobj_X[i] = NULL;
+    }
+
+    ACE_OS::memset(&m_data[HDRSZ + i_ndx * RECSZ],
+                   '\0',
+                   (count() - i_ndx) * RECSZ);
+    count(i_ndx);
+
+    bn_isdirty(true);
+}
+
+} // namespace UTFS
+
+// Local Variables:
+// mode: C++
+// tab-width: 4
+// c-basic-offset: 4
+// c-file-offsets: ((comment-intro . 0))
+// End:
@@ -0,0 +1,209 @@
+#ifndef UTFS_ExtentNode_h__
+#define UTFS_ExtentNode_h__
+
+/// @file ExtentNode.h
+/// Utopia FileSystem Extent Tree Node Object.
+///
+/// See README.txt for inheritance diagram.
+
+#include <vector>
+
+#include "utpfwd.h"
+
+#include "Types.h"
+
+#include "utfsfwd.h"
+#include "utfsexp.h"
+
+#include "BlockRef.h"
+#include "RefBlockNode.h"
+
+namespace UTFS {
+
+// A node of a file's extent tree, the alternative to the direct and
+// indirect references for files made in an "extents=1" filesystem.
+//
+// Each record maps a run of the file, (offset, length, reference).
+// In a leaf (depth 0) the reference is to a chunk, a DataBlockNode
+// holding the run rounded up to whole blocks, up to MAXCHUNK.  In the
+// nodes above it the reference is to the node one level down and the
+// run is the span of that node's records.  The records are in offset
+// order and don't overlap; the gaps between them are holes.
+//
+// The root is held in the inode in place of the block references.
+// When it fills its records move down into a new node beneath it.
+// The other nodes are the filesystem's block size and split in half
+// when they fill.
+//
+//    +--------------------------------+
+//    |      Count      |    Depth     |
+//    +--------------------------------+
+//    | Offset | Length |  Reference   |
+//    +--------------------------------+
+//    ~         .............          ~
+//    +--------------------------------+
+//
+class UTFS_EXP ExtentNode : public RefBlockNode
+{
+public:
+    // Largest run of the file a chunk holds.
+    //
+    // A chunk is written whole, so a write anywhere in it rewrites
+    // all of it.  A sequentially written file ends up in MAXCHUNK
+    // chunks, and a later small random write to it costs a MAXCHUNK
+    // put.  Files which are mostly rewritten in place are better off
+    // without extents.
+    //
+    static off_t const MAXCHUNK = BlockNode::MAXBLKSZ;
+
+    // Size of the node header and of a record.
+    static size_t const HDRSZ = 16;
+    static size_t const RECSZ = 16 + sizeof(BlockRef);
+
+    // Constructor for an empty node of i_size bytes.
+    ExtentNode(size_t i_size);
+
+    // Constructor for a root held in the i_size bytes of an inode.
+    ExtentNode(utp::uint8 const * i_data, size_t i_size);
+
+    // Constructor from blockstore persisted data.
+    ExtentNode(Context & i_ctxt, BlockRef const & i_ref);
+
+    virtual ~ExtentNode();
+
+    virtual utp::uint8 const * bn_data() const { return &m_data[0]; }
+
+    virtual utp::uint8 * bn_data() { return &m_data[0]; }
+
+    virtual size_t bn_size() const { return m_data.size(); }
+
+    virtual BlockRef const & bn_persist(Context & i_ctxt);
+
+    virtual BlockRef const & bn_flush(Context & i_ctxt);
+
+    virtual BlockNodeHandle bn_clone() const;
+
+    virtual void bn_freeze(Generation & io_gen);
+
+    virtual void bn_thaw(Generation const & i_gen);
+
+    virtual void bn_tostream(std::ostream & ostrm) const;
+
+    // Visits the chunks in the range, in order.  Holes aren't
+    // visited, a modifying traversal covers the range with ex_alloc
+    // first.
+    //
+    virtual bool rb_traverse(Context & i_ctxt,
+                             FileNode & i_fn,
+                             unsigned i_flags,
+                             off_t i_base,
+                             off_t i_rngoff,
+                             size_t i_rngsize,
+                             BlockTraverseFunc & i_trav);
+
+    virtual size_t rb_truncate(Context & i_ctxt,
+                               off_t i_base,
+                               off_t i_size);
+
+    virtual size_t rb_refresh(Context & i_ctxt, utp::uint64 i_rid);
+
+    // Makes sure a chunk covers i_off, growing the one before it or
+    // starting a new one no lower than i_base and, where the records
+    // allow, reaching i_end.  Returns the end of the chunk's run.
+    // Only called on the root.
+    //
+    off_t ex_alloc(Context & i_ctxt,
+                   FileNode & i_fn,
+                   off_t i_base,
+                   off_t i_off,
+                   off_t i_end);
+
+protected:
+    // Number of records, and how many fit.
+    size_t count() const;
+
+    void count(size_t i_count);
+
+    size_t capacity() const { return (m_data.size() - HDRSZ) / RECSZ; }
+
+    // Levels of nodes beneath us, 0 in a leaf.
+    unsigned depth() const;
+
+    void depth(unsigned i_depth);
+
+    // Record fields.
+    off_t recoff(size_t i_ndx) const;
+
+    off_t reclen(size_t i_ndx) const;
+
+    BlockRef recref(size_t i_ndx) const;
+
+    void record(size_t i_ndx,
+                off_t i_off,
+                off_t i_len,
+                BlockRef const & i_ref);
+
+    // Index of the first record starting after i_off.
+    size_t upper(off_t i_off) const;
+
+    // Where our records start and end, the run a parent records.
+    off_t start() const { return recoff(0); }
+
+    off_t end() const { return recoff(count() - 1) + reclen(count() - 1); }
+
+    // Returns the chunk or node the record refers to.  A prefetching
+    // traversal gets NULL until it's been fetched.  A modifying
+    // traversal gets a chunk of its own.
+    //
+    BlockNodeHandle child(Context & i_ctxt, size_t i_ndx, unsigned i_flags);
+
+    // Keeps a changed child in the dirty collection.
+    void dirty(Context & i_ctxt, size_t i_ndx, BlockNodeHandle const & i_bnh);
+
+    // ex_alloc within the records between i_lo and i_hi.  If we had
+    // to split, our new sibling is returned in o_split.
+    //
+    off_t alloc(Context & i_ctxt,
+                FileNode & i_fn,
+                off_t i_off,
+                off_t i_end,
+                off_t i_lo,
+                off_t i_hi,
+                ExtentNodeHandle & o_split);
+
+    // Grows a leaf record's run, and its chunk if need be.
+    void grow(Context & i_ctxt, FileNode & i_fn, size_t i_ndx, off_t i_len);
+
+    // Inserts a record, splitting us or, in the root, moving our
+    // records down a level if we're full.
+    //
+    void insert(Context & i_ctxt,
+                FileNode & i_fn,
+                size_t i_ndx,
+                off_t i_off,
+                off_t i_len,
+                BlockNodeHandle const & i_bnh,
+                ExtentNodeHandle & o_split);
+
+    // Removes the records from i_ndx on.
+    void erase(Context & i_ctxt, size_t i_ndx);
+
+    // Record contents.
+    utp::OctetSeq					m_data;
+
+    // Cached Dirty Objects
+    std::vector<BlockNodeHandle>	m_recobj_X;
+
+    bool							m_isroot;
+};
+
+} // namespace UTFS
+
+// Local Variables:
+// mode: C++
+// tab-width: 4
+// c-basic-offset: 4
+// c-file-offsets: ((comment-intro . 0))
+// End:
+
+#endif // UTFS_ExtentNode_h__
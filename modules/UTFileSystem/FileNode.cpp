@@ -7,6 +7,8 @@
 
 #include <cassert>
 
+#include <ace/Guard_T.h>
+
 #include <google/protobuf/io/coded_stream.h>
 #include <google/protobuf/io/zero_copy_stream_impl.h>
 
@@ -23,6 +25,8 @@
 #include "BlockRef.h"
 #include "Context.h"
 #include "FileNode.h"
+#include "Flusher.h"
+#include "Generation.h"
 #include "UTFileSystem.h"
 
 using namespace std;
@@ -56,6 +60,56 @@ uid_t mapgname(string const & i_gname)
     return gp ? gp->gr_gid : 0;
 }
 #endif
+
+// Readahead window bounds in blocks, it doubles with each sequential
+// read.
+off_t const RA_MINBLKS = 4;
+off_t const RA_MAXBLKS = 64;
+
+// Write-behind bounds in blocks of the filesystem's block size.  A
+// file writes back once it buffers WB_FILEBLKS, and larger writes
+// aren't buffered at all.
+size_t const WB_FILEBLKS = 32;
+
+// Most the filesystem as a whole buffers, in blocks and in bytes; the
+// larger block sizes are held to the byte cap.
+size_t const WB_TOTALBLKS = 2048;
+long const WB_TOTALCAP = 256 * 1024 * 1024;
+
+size_t
+wb_filemax(UTFS::Context const & i_ctxt)
+{
+    return WB_FILEBLKS * i_ctxt.m_blksz;
+}
+
+long
+wb_totalmax(UTFS::Context const & i_ctxt)
+{
+    return min(long(WB_TOTALBLKS * i_ctxt.m_blksz), WB_TOTALCAP);
+}
+
+// Bytes of the file covered by a block i_level indirect blocks below
+// the inode, 0 being a data block.  The triple indirect span of the
+// larger block sizes doesn't fit an off_t; no file gets that far, so
+// it's clamped well clear of overflowing when added to an offset.
+//
+off_t
+levelspan(UTFS::Context const & i_ctxt, unsigned i_level)
+{
+    off_t const maxspan = off_t(1) << 62;
+    off_t const nrefs = UTFS::IndirectBlockNode::numref(i_ctxt);
+
+    off_t span = i_ctxt.m_blksz;
+    for (unsigned i = 0; i < i_level; ++i)
+        span = span > maxspan / nrefs ? maxspan : span * nrefs;
+    return span;
+}
+
+// The inode bytes an extent file's root takes, in place of the
+// direct and indirect references.
+size_t const EXTROOTSZ =
+    (UTFS::FileNode::NDIRECT + 4) * sizeof(UTFS::BlockRef);
+
 } // end namespace
 
 namespace UTFS {
@@ -63,6 +117,11 @@ namespace UTFS {
 FileNode::FileNode(mode_t i_mode,
                    string const & i_uname,
                    string const & i_gname)
+    : m_ranext(0)
+    , m_raend(0)
+    , m_rawin(0)
+    , m_wbbytes(0)
+    , m_wbtotalp(NULL)
 {
     LOG(lgr, 6, "CTOR");
 
@@ -78,31 +137,30 @@ FileNode::FileNode(mode_t i_mode,
     m_inode.set_ctime(now.usec());
     m_inode.set_blocks(1);
 
+    // Zero means the file has no ID.
+    uint64 fileid = 0;
+    while (!fileid)
+        Random::fill(&fileid, sizeof(fileid));
+    m_inode.set_fileid(fileid);
+
     ACE_OS::memset(m_inl, '\0', sizeof(m_inl));
 }
 
 FileNode::FileNode(Context & i_ctxt, BlockRef const & i_ref)
     : RefBlockNode(i_ref)
+    , m_ranext(0)
+    , m_raend(0)
+    , m_rawin(0)
+    , m_wbbytes(0)
+    , m_wbtotalp(NULL)
 {
     LOG(lgr, 6, "CTOR " << i_ref);
 
     uint8 buf[BlockNode::BLKSZ];
-    size_t bsz = sizeof(buf);
 
-    ACE_OS::memset(buf, '\0', bsz);
-
-    // Read the block from the blockstore.
-    i_ctxt.m_bsh->bs_block_get(i_ref.data(), i_ref.size(),
-                               buf, bsz);
-
-    ++i_ctxt.m_statsp->m_ngops;
-    i_ctxt.m_statsp->m_ngbytes += bsz;
-
-    // Validate the block.
-    i_ref.validate(buf, bsz);
+    ACE_OS::memset(buf, '\0', sizeof(buf));
 
-    // Decrypt the block.
-    i_ctxt.m_cipher.decrypt(i_ref.iv(), buf, bsz);
+    bn_load(i_ctxt, i_ref, buf, sizeof(buf));
 
     // Compute the size of fixed fields after the inode.
     size_t fixedsz = fixed_field_size();
@@ -127,21 +185,29 @@ FileNode::FileNode(Context & i_ctxt, BlockRef const & i_ref)
     ACE_OS::memcpy(m_inl, ptr, sizeof(m_inl));
     ptr += sizeof(m_inl);
 
-    // Copy the block references.
-    ACE_OS::memcpy(m_dirref, ptr, sizeof(m_dirref));
-    ptr += sizeof(m_dirref);
+    // Copy the block references, or the extent root in their place.
+    if (m_inode.extents())
+    {
+        m_extroot = new ExtentNode(ptr, EXTROOTSZ);
+        ptr += EXTROOTSZ;
+    }
+    else
+    {
+        ACE_OS::memcpy(m_dirref, ptr, sizeof(m_dirref));
+        ptr += sizeof(m_dirref);
 
-    ACE_OS::memcpy(&m_sinref, ptr, sizeof(m_sinref));
-    ptr += sizeof(m_sinref);
+        ACE_OS::memcpy(&m_sinref, ptr, sizeof(m_sinref));
+        ptr += sizeof(m_sinref);
 
-    ACE_OS::memcpy(&m_dinref, ptr, sizeof(m_dinref));
-    ptr += sizeof(m_dinref);
-    
-    ACE_OS::memcpy(&m_tinref, ptr, sizeof(m_tinref));
-    ptr += sizeof(m_tinref);
-    
-    ACE_OS::memcpy(&m_qinref, ptr, sizeof(m_qinref));
-    ptr += sizeof(m_qinref);
+        ACE_OS::memcpy(&m_dinref, ptr, sizeof(m_dinref));
+        ptr += sizeof(m_dinref);
+
+        ACE_OS::memcpy(&m_tinref, ptr, sizeof(m_tinref));
+        ptr += sizeof(m_tinref);
+
+        ACE_OS::memcpy(&m_qinref, ptr, sizeof(m_qinref));
+        ptr += sizeof(m_qinref);
+    }
 
 #ifdef DEBUG
     assert(ptr == buf + BLKSZ);
@@ -151,6 +217,10 @@ FileNode::FileNode(Context & i_ctxt, BlockRef const & i_ref)
 FileNode::~FileNode()
 {
     LOG(lgr, 6, "DTOR " << bn_blkref());
+
+    // Buffered writes die with an unlinked file.
+    if (m_wbtotalp)
+        *m_wbtotalp -= long(m_wbbytes);
 }
 
 BlockRef const &
@@ -179,45 +249,35 @@ FileNode::bn_persist(Context & i_ctxt)
     ACE_OS::memcpy(ptr, m_inl, sizeof(m_inl));
     ptr += sizeof(m_inl);
 
-    // Copy the block references.
-    ACE_OS::memcpy(ptr, m_dirref, sizeof(m_dirref));
-    ptr += sizeof(m_dirref);
+    // Copy the block references, or the extent root in their place.
+    if (m_extroot)
+    {
+        ACE_OS::memcpy(ptr, m_extroot->bn_data(), EXTROOTSZ);
+        ptr += EXTROOTSZ;
+    }
+    else
+    {
+        ACE_OS::memcpy(ptr, m_dirref, sizeof(m_dirref));
+        ptr += sizeof(m_dirref);
+
+        ACE_OS::memcpy(ptr, &m_sinref, sizeof(m_sinref));
+        ptr += sizeof(m_sinref);
 
-    ACE_OS::memcpy(ptr, &m_sinref, sizeof(m_sinref));
-    ptr += sizeof(m_sinref);
+        ACE_OS::memcpy(ptr, &m_dinref, sizeof(m_dinref));
+        ptr += sizeof(m_dinref);
 
-    ACE_OS::memcpy(ptr, &m_dinref, sizeof(m_dinref));
-    ptr += sizeof(m_dinref);
-    
-    ACE_OS::memcpy(ptr, &m_tinref, sizeof(m_tinref));
-    ptr += sizeof(m_tinref);
-    
-    ACE_OS::memcpy(ptr, &m_qinref, sizeof(m_qinref));
-    ptr += sizeof(m_qinref);
+        ACE_OS::memcpy(ptr, &m_tinref, sizeof(m_tinref));
+        ptr += sizeof(m_tinref);
+
+        ACE_OS::memcpy(ptr, &m_qinref, sizeof(m_qinref));
+        ptr += sizeof(m_qinref);
+    }
 
 #ifdef DEBUG
     assert(ptr == buf + BLKSZ);
 #endif
 
-    uint8 iv[16];
-    Random::fill(iv, sizeof(iv));
-
-    // Encrypt the entire block.
-    i_ctxt.m_cipher.encrypt(iv, buf, sizeof(buf));
-
-    // Update our reference.
-    m_ref = BlockRef(Digest(buf, sizeof(buf)), iv);
-
-    LOG(lgr, 6, "persist " << m_ref);
-
-    // Write the block out to the block store.
-    i_ctxt.m_bsh->bs_block_put((void *) m_ref.data(),
-                               m_ref.size(),
-                               (void *) buf,
-                               sizeof(buf));
-
-    ++i_ctxt.m_statsp->m_npops;
-    i_ctxt.m_statsp->m_npbytes += sizeof(buf);
+    bn_store(i_ctxt, buf, sizeof(buf));
 
     bn_isdirty(false);
 
@@ -227,24 +287,18 @@ FileNode::bn_persist(Context & i_ctxt)
 BlockRef const &
 FileNode::bn_flush(Context & i_ctxt)
 {
+    bn_writeback(i_ctxt);
+
     // If we aren't dirty then we just return our current reference.
     if (!bn_isdirty())
         return bn_blkref();
 
+    // The direct blocks are leaves, persist them on the flusher's
+    // workers while we flush the indirect blocks.
+    Flusher::Batch batch(*i_ctxt.m_flusherp);
     for (unsigned i = 0; i < NDIRECT; ++i)
-    {
         if (m_dirobj_X[i])
-        {
-            // Flush the object.
-            m_dirref[i] = m_dirobj_X[i]->bn_flush(i_ctxt);
-
-            // Insert it in the clean cache.
-            i_ctxt.m_bncachep->insert(m_dirobj_X[i]);
-
-            // Clear it in the dirty array.
-            m_dirobj_X[i] = NULL;
-        }
-    }
+            batch.persist(i_ctxt, m_dirobj_X[i]);
 
     if (m_sinobj_X)
     {
@@ -267,6 +321,10 @@ FileNode::bn_flush(Context & i_ctxt)
         m_tinobj_X = NULL;
     }
 
+    // The extent root is stored with us, it stores what's beneath it.
+    if (m_extroot)
+        m_extroot->bn_flush(i_ctxt);
+
 #if 0
     if (m_qinobj_X)
     {
@@ -276,9 +334,128 @@ FileNode::bn_flush(Context & i_ctxt)
     }
 #endif
 
+    // They are stored, and their references known, once the batch
+    // is done.
+    batch.wait();
+
+    for (unsigned i = 0; i < NDIRECT; ++i)
+    {
+        if (m_dirobj_X[i])
+        {
+            m_dirref[i] = m_dirobj_X[i]->bn_blkref();
+
+            // Insert it in the clean cache.
+            i_ctxt.m_bncachep->insert(m_dirobj_X[i]);
+
+            // Clear it in the dirty array.
+            m_dirobj_X[i] = NULL;
+        }
+    }
+
     return bn_persist(i_ctxt);
 }
 
+void
+FileNode::bn_writeback(Context & i_ctxt)
+{
+    if (m_wbmap.empty())
+        return;
+
+    LOG(lgr, 6, "writeback " << m_wbmap.size() << " extents, "
+        << m_wbbytes << " bytes");
+
+    // One traversal per extent.  Each leaves the buffer only once it
+    // is in the blocks, if one fails the rest are still buffered and
+    // the next writeback tries them again.
+    //
+    while (!m_wbmap.empty())
+    {
+        WriteMap::iterator it = m_wbmap.begin();
+        int rv = write_through(i_ctxt,
+                               &it->second[0],
+                               it->second.size(),
+                               it->first);
+        if (rv < 0)
+            throwstream(InternalError, FILELINE
+                        << "Trouble writing back buffered data: "
+                        << ACE_OS::strerror(-rv));
+
+        size_t const nbytes = it->second.size();
+        m_wbmap.erase(it);
+        m_wbbytes -= nbytes;
+        if (m_wbtotalp)
+            *m_wbtotalp -= long(nbytes);
+    }
+}
+
+BlockNodeHandle
+FileNode::bn_clone() const
+{
+    FileNodeHandle fnh = new FileNode(*this);
+
+    // The copy takes the buffered writes with it and applies them as
+    // it is flushed.  They stay charged to the live node until it is
+    // written back or released.
+    fnh->m_wbtotalp = NULL;
+
+    // The extent root is part of the inode, the copy needs its own.
+    if (m_extroot)
+        fnh->m_extroot = dynamic_cast<ExtentNode *>(&*m_extroot->bn_clone());
+
+    return fnh;
+}
+
+void
+FileNode::bn_freeze(Generation & io_gen)
+{
+    for (unsigned i = 0; i < NDIRECT; ++i)
+        if (m_dirobj_X[i])
+            m_dirobj_X[i] = io_gen.freeze(m_dirobj_X[i]);
+
+    m_sinobj_X = io_gen.freeze(m_sinobj_X);
+    m_dinobj_X = io_gen.freeze(m_dinobj_X);
+    m_tinobj_X = io_gen.freeze(m_tinobj_X);
+
+    if (m_extroot)
+        m_extroot->bn_freeze(io_gen);
+}
+
+void
+FileNode::bn_thaw(Generation const & i_gen)
+{
+    BlockNodeHandle bnh;
+
+    for (unsigned i = 0; i < NDIRECT; ++i)
+    {
+        if (m_dirobj_X[i] && (bnh = i_gen.thaw(m_dirobj_X[i])))
+        {
+            m_dirref[i] = bnh->bn_blkref();
+            m_dirobj_X[i] = NULL;
+        }
+    }
+
+    if (m_sinobj_X && (bnh = i_gen.thaw(m_sinobj_X)))
+    {
+        m_sinref = bnh->bn_blkref();
+        m_sinobj_X = NULL;
+    }
+
+    if (m_dinobj_X && (bnh = i_gen.thaw(m_dinobj_X)))
+    {
+        m_dinref = bnh->bn_blkref();
+        m_dinobj_X = NULL;
+    }
+
+    if (m_tinobj_X && (bnh = i_gen.thaw(m_tinobj_X)))
+    {
+        m_tinref = bnh->bn_blkref();
+        m_tinobj_X = NULL;
+    }
+
+    if (m_extroot)
+        m_extroot->bn_thaw(i_gen);
+}
+
 void
 FileNode::bn_tostream(std::ostream & ostrm) const
 {
@@ -286,6 +463,57 @@ FileNode::bn_tostream(std::ostream & ostrm) const
     ostrm << ' ' << "FileNode";
 }
 
+// Passes the holes between an extent file's chunks to a reading
+// functor as the zero block, so it sees the range in order as it
+// would in a file of blocks.
+//
+class HoleBTF : public RefBlockNode::BlockTraverseFunc
+{
+public:
+    HoleBTF(RefBlockNode::BlockTraverseFunc & i_trav, off_t i_off)
+        : m_trav(i_trav)
+        , m_off(i_off)
+    {}
+
+    virtual void bt_hold(BlockNodeHandle const & i_bnh)
+    {
+        m_trav.bt_hold(i_bnh);
+    }
+
+    virtual bool bt_visit(Context & i_ctxt,
+                          void * i_blkdata,
+                          size_t i_blksize,
+                          off_t i_blkoff,
+                          size_t i_filesz)
+    {
+        bt_fill(i_ctxt, i_blkoff, i_filesz);
+
+        bool rv = m_trav.bt_visit(i_ctxt, i_blkdata, i_blksize,
+                                  i_blkoff, i_filesz);
+
+        m_off = max(m_off, off_t(i_blkoff + i_blksize));
+        return rv;
+    }
+
+    // Visits the zero block up to i_end, or the end of the file.
+    void bt_fill(Context & i_ctxt, off_t i_end, size_t i_filesz)
+    {
+        DataBlockNodeHandle const & zdbh = i_ctxt.m_zdatobj;
+
+        i_end = min(i_end, off_t(i_filesz));
+        while (m_off < i_end)
+        {
+            size_t sz = min(i_end - m_off, off_t(zdbh->bn_size()));
+            m_trav.bt_visit(i_ctxt, zdbh->bn_data(), sz, m_off, i_filesz);
+            m_off += sz;
+        }
+    }
+
+private:
+    RefBlockNode::BlockTraverseFunc &	m_trav;
+    off_t								m_off;	// Visited up to here
+};
+
 bool
 FileNode::rb_traverse(Context & i_ctxt,
                       FileNode & i_fn,
@@ -330,12 +558,49 @@ FileNode::rb_traverse(Context & i_ctxt,
     if (off >= i_rngoff + off_t(i_rngsize))
         goto done;
 
+    // ----------------------------------------------------------------
+    // Extent Tree
+    // ----------------------------------------------------------------
+
+    if (m_extroot)
+    {
+        off_t const rngoff = max(i_rngoff, off);
+        off_t const rngend = i_rngoff + off_t(i_rngsize);
+
+        // Cover the range with chunks before writing to it.
+        if (i_flags & RB_MODIFY_X)
+            for (off_t pos = rngoff; pos < rngend; )
+                pos = m_extroot->ex_alloc(i_ctxt, *this, off, pos, rngend);
+
+        bool modified;
+        if (i_flags & (RB_MODIFY_X | RB_PREFETCH))
+        {
+            modified = m_extroot->rb_traverse(i_ctxt, *this, i_flags, off,
+                                              rngoff, rngend - rngoff,
+                                              i_trav);
+        }
+        else
+        {
+            // Reads see zeros in the holes.
+            HoleBTF hbtf(i_trav, rngoff);
+            modified = m_extroot->rb_traverse(i_ctxt, *this, i_flags, off,
+                                              rngoff, rngend - rngoff,
+                                              hbtf);
+            hbtf.bt_fill(i_ctxt, rngend, size());
+        }
+
+        if (modified && (i_flags & RB_MODIFY_X))
+            bn_isdirty(true);
+
+        goto done;
+    }
+
     // ----------------------------------------------------------------
     // Direct References
     // ----------------------------------------------------------------
 
     // Does this region intersect the direct blocks?
-    sz = NDIRECT * BLKSZ;
+    sz = NDIRECT * levelspan(i_ctxt, 0);
     if (i_rngoff >= off + sz)
     {
         // Skip past the direct blocks.
@@ -351,7 +616,7 @@ FileNode::rb_traverse(Context & i_ctxt,
                 goto done;
 
             // Does the range intersect this block?
-            if (i_rngoff < off_t(off + BlockNode::BLKSZ))
+            if (i_rngoff < off + off_t(i_ctxt.m_blksz))
             {
                 // Find the block object to use.
                 DataBlockNodeHandle dbh;
@@ -367,28 +632,37 @@ FileNode::rb_traverse(Context & i_ctxt,
                     // Nope, does it have a digest yet?
                     if (m_dirref[i])
                     {
-                        // Does the clean cache have it?
-                        BlockNodeHandle bnh =
-                            i_ctxt.m_bncachep->lookup(m_dirref[i]);
-                        if (bnh)
+                        if (i_flags & RB_PREFETCH)
                         {
-                            // Yes, better be a DataBlockNode ...
-                            dbh = dynamic_cast<DataBlockNode *>(&*bnh);
+                            // Don't wait for it, a later pass finds it
+                            // in the cache.  Until then the zero node
+                            // stands in.
+                            dbh = i_ctxt.m_prefetchp->
+                                prefetch<DataBlockNode>(i_ctxt, m_dirref[i]);
+                            if (!dbh)
+                                dbh = i_ctxt.m_zdatobj;
                         }
                         else
                         {
-                            // Nope, read it from the blockstore.
-                            dbh = new DataBlockNode(i_ctxt, m_dirref[i]);
+                            // Fault it in through the clean cache.
+                            NodeFaultFunc<DataBlockNode> ff;
+                            BlockNodeHandle bnh =
+                                i_ctxt.m_bncachep->fault(
+                                    i_ctxt, m_dirref[i], ff,
+                                    !(i_flags & RB_NOCACHE));
+
+                            // Better be a DataBlockNode ...
+                            dbh = dynamic_cast<DataBlockNode *>(&*bnh);
 
-                            // Insert it in the clean cache.
-                            if (!(i_flags & RB_NOCACHE))
-                                i_ctxt.m_bncachep->insert(dbh);
+                            // Others may share it, modify our own.
+                            if (i_flags & RB_MODIFY_X)
+                                dbh = DataBlockNode::modifiable(i_ctxt, dbh);
                         }
                     }
                     else if (i_flags & RB_MODIFY_X)
                     {
                         // Nope, create new block.
-                        dbh = new DataBlockNode();
+                        dbh = new DataBlockNode(i_ctxt.m_blksz);
 
                         // Keep it in the dirty tree.
                         m_dirobj_X[i] = dbh;
@@ -405,6 +679,8 @@ FileNode::rb_traverse(Context & i_ctxt,
                     }
                 }
 
+                // Visit the node.
+                i_trav.bt_hold(dbh);
                 if (i_trav.bt_visit(i_ctxt,
                                     dbh->bn_data(),
                                     dbh->bn_size(),
@@ -429,7 +705,7 @@ FileNode::rb_traverse(Context & i_ctxt,
             }
 
             // Move to the next direct block.
-            off += BlockNode::BLKSZ;
+            off += i_ctxt.m_blksz;
         }
     }
 
@@ -442,7 +718,7 @@ FileNode::rb_traverse(Context & i_ctxt,
     // ----------------------------------------------------------------
 
     // Does this region intersect the single indirect block?
-    sz = IndirectBlockNode::NUMREF * BlockNode::BLKSZ;
+    sz = levelspan(i_ctxt, 1);
     if (i_rngoff < off + sz)
     {
         // Find the block object to use.
@@ -459,27 +735,31 @@ FileNode::rb_traverse(Context & i_ctxt,
             // Nope, does it have a digest yet?
             if (m_sinref)
             {
-                // Does the clean cache have it?
-                BlockNodeHandle bnh = i_ctxt.m_bncachep->lookup(m_sinref);
-                if (bnh)
+                if (i_flags & RB_PREFETCH)
                 {
-                    // Yes, better be a IndirectBlockNode ...
-                    ibh = dynamic_cast<IndirectBlockNode *>(&*bnh);
+                    // Don't wait for it, a later pass finds it in the
+                    // cache.  Until then the zero node stands in.
+                    ibh = i_ctxt.m_prefetchp->
+                        prefetch<IndirectBlockNode>(i_ctxt, m_sinref);
+                    if (!ibh)
+                        ibh = i_ctxt.m_zsinobj;
                 }
                 else
                 {
-                    // Nope, read it from the blockstore.
-                    ibh = new IndirectBlockNode(i_ctxt, m_sinref);
+                    // Fault it in through the clean cache.
+                    NodeFaultFunc<IndirectBlockNode> ff;
+                    BlockNodeHandle bnh =
+                        i_ctxt.m_bncachep->fault(i_ctxt, m_sinref, ff,
+                                                 !(i_flags & RB_NOCACHE));
 
-                    // Insert it in the clean cache.
-                    if (!(i_flags & RB_NOCACHE))
-                        i_ctxt.m_bncachep->insert(ibh);
+                    // Better be a IndirectBlockNode ...
+                    ibh = dynamic_cast<IndirectBlockNode *>(&*bnh);
                 }
             }
             else if (i_flags & RB_MODIFY_X)
             {
                 // Nope, create a new one.
-                ibh = new IndirectBlockNode();
+                ibh = new IndirectBlockNode(i_ctxt.m_blksz);
 
                 // Keep it in the cache.
                 m_sinobj_X = ibh;
@@ -527,10 +807,7 @@ FileNode::rb_traverse(Context & i_ctxt,
     // ----------------------------------------------------------------
 
     // Does this region intersect the double indirect block?
-    sz =
-        IndirectBlockNode::NUMREF *
-        IndirectBlockNode::NUMREF *
-        BlockNode::BLKSZ;
+    sz = levelspan(i_ctxt, 2);
 
     if (i_rngoff < off + sz)
     {
@@ -548,27 +825,31 @@ FileNode::rb_traverse(Context & i_ctxt,
             // Nope, does it have a digest yet?
             if (m_dinref)
             {
-                // Does the clean cache have it?
-                BlockNodeHandle bnh = i_ctxt.m_bncachep->lookup(m_dinref);
-                if (bnh)
+                if (i_flags & RB_PREFETCH)
                 {
-                    // Yes, better be a DoubleIndBlockNode ...
-                    nh = dynamic_cast<DoubleIndBlockNode *>(&*bnh);
+                    // Don't wait for it, a later pass finds it in the
+                    // cache.  Until then the zero node stands in.
+                    nh = i_ctxt.m_prefetchp->
+                        prefetch<DoubleIndBlockNode>(i_ctxt, m_dinref);
+                    if (!nh)
+                        nh = i_ctxt.m_zdinobj;
                 }
                 else
                 {
-                    // Nope, read it from the blockstore.
-                    nh = new DoubleIndBlockNode(i_ctxt, m_dinref);
+                    // Fault it in through the clean cache.
+                    NodeFaultFunc<DoubleIndBlockNode> ff;
+                    BlockNodeHandle bnh =
+                        i_ctxt.m_bncachep->fault(i_ctxt, m_dinref, ff,
+                                                 !(i_flags & RB_NOCACHE));
 
-                    // Insert it in the clean cache.
-                    if (!(i_flags & RB_NOCACHE))
-                        i_ctxt.m_bncachep->insert(nh);
+                    // Better be a DoubleIndBlockNode ...
+                    nh = dynamic_cast<DoubleIndBlockNode *>(&*bnh);
                 }
             }
             else if (i_flags & RB_MODIFY_X)
             {
                 // Nope, create a new one.
-                nh = new DoubleIndBlockNode();
+                nh = new DoubleIndBlockNode(i_ctxt.m_blksz);
 
                 // Keep it in the cache.
                 m_dinobj_X = nh;
@@ -616,11 +897,7 @@ FileNode::rb_traverse(Context & i_ctxt,
     // ----------------------------------------------------------------
 
     // Does this region intersect the triple indirect block?
-    sz =
-        IndirectBlockNode::NUMREF *
-        IndirectBlockNode::NUMREF *
-        IndirectBlockNode::NUMREF *
-        BlockNode::BLKSZ;
+    sz = levelspan(i_ctxt, 3);
 
     if (i_rngoff < off + sz)
     {
@@ -638,27 +915,31 @@ FileNode::rb_traverse(Context & i_ctxt,
             // Nope, does it have a digest yet?
             if (m_tinref)
             {
-                // Does the clean cache have it?
-                BlockNodeHandle bnh = i_ctxt.m_bncachep->lookup(m_tinref);
-                if (bnh)
+                if (i_flags & RB_PREFETCH)
                 {
-                    // Yes, better be a TripleIndBlockNode ...
-                    nh = dynamic_cast<TripleIndBlockNode *>(&*bnh);
+                    // Don't wait for it, a later pass finds it in the
+                    // cache.  Until then the zero node stands in.
+                    nh = i_ctxt.m_prefetchp->
+                        prefetch<TripleIndBlockNode>(i_ctxt, m_tinref);
+                    if (!nh)
+                        nh = i_ctxt.m_ztinobj;
                 }
                 else
                 {
-                    // Nope, read it from the blockstore.
-                    nh = new TripleIndBlockNode(i_ctxt, m_tinref);
+                    // Fault it in through the clean cache.
+                    NodeFaultFunc<TripleIndBlockNode> ff;
+                    BlockNodeHandle bnh =
+                        i_ctxt.m_bncachep->fault(i_ctxt, m_tinref, ff,
+                                                 !(i_flags & RB_NOCACHE));
 
-                    // Insert it in the clean cache.
-                    if (!(i_flags & RB_NOCACHE))
-                        i_ctxt.m_bncachep->insert(nh);
+                    // Better be a TripleIndBlockNode ...
+                    nh = dynamic_cast<TripleIndBlockNode *>(&*bnh);
                 }
             }
             else if (i_flags & RB_MODIFY_X)
             {
                 // Nope, create a new one.
-                nh = new TripleIndBlockNode();
+                nh = new TripleIndBlockNode(i_ctxt.m_blksz);
 
                 // Keep it in the cache.
                 m_tinobj_X = nh;
@@ -750,12 +1031,24 @@ FileNode::rb_truncate(Context & i_ctxt,
 
     off += INLSZ;
 
+    // ---------------- Extent Tree ----------------
+
+    if (m_extroot)
+    {
+        nblocks += m_extroot->rb_truncate(i_ctxt, INLSZ, i_size);
+
+        if (m_extroot->bn_isdirty())
+            bn_isdirty(true);
+
+        return nblocks;
+    }
+
     // ---------------- Direct Blocks ----------------
 
     for (unsigned ndx = 0; ndx < NDIRECT; ++ndx)
     {
         // Is this block prior to the truncation?
-        if (off + BLKSZ <= i_size)
+        if (off + off_t(i_ctxt.m_blksz) <= i_size)
         {
             // Increment the block counter if there is a data
             // block.
@@ -780,22 +1073,16 @@ FileNode::rb_truncate(Context & i_ctxt,
                 // Nope, does it have a digest yet?
                 if (m_dirref[ndx])
                 {
-                    // Does the clean cache have it?
+                    // Fault it in through the clean cache.
+                    NodeFaultFunc<DataBlockNode> ff;
                     BlockNodeHandle bnh =
-                        i_ctxt.m_bncachep->lookup(m_dirref[ndx]);
-                    if (bnh)
-                    {
-                        // Yes, better be a DataBlockNode ...
-                        dbh = dynamic_cast<DataBlockNode *>(&*bnh);
-                    }
-                    else
-                    {
-                        // Nope, read it from the blockstore.
-                        dbh = new DataBlockNode(i_ctxt, m_dirref[ndx]);
+                        i_ctxt.m_bncachep->fault(i_ctxt, m_dirref[ndx], ff);
 
-                        // Insert it in the clean cache.
-                        i_ctxt.m_bncachep->insert(dbh);
-                    }
+                    // Better be a DataBlockNode ...
+                    dbh = dynamic_cast<DataBlockNode *>(&*bnh);
+
+                    // Others may share it, modify our own.
+                    dbh = DataBlockNode::modifiable(i_ctxt, dbh);
                 }
                 else
                 {
@@ -849,12 +1136,12 @@ FileNode::rb_truncate(Context & i_ctxt,
             bn_isdirty(true);
         }
 
-        off += BLKSZ;
+        off += i_ctxt.m_blksz;
     }
 
     // ---------------- Single Indirect ----------------
 
-    sz = IndirectBlockNode::NUMREF * BLKSZ;
+    sz = levelspan(i_ctxt, 1);
 
     // Is there an indirect block?
     if (m_sinobj_X || m_sinref)
@@ -872,21 +1159,13 @@ FileNode::rb_truncate(Context & i_ctxt,
             }
             else
             {
-                // Does the clean cache have it?
-                BlockNodeHandle bnh = i_ctxt.m_bncachep->lookup(m_sinref);
-                if (bnh)
-                {
-                    // Yes, better be a IndirectBlockNode ...
-                    nh = dynamic_cast<IndirectBlockNode *>(&*bnh);
-                }
-                else
-                {
-                    // Nope, read it from the blockstore.
-                    nh = new IndirectBlockNode(i_ctxt, m_sinref);
+                // Fault it in through the clean cache.
+                NodeFaultFunc<IndirectBlockNode> ff;
+                BlockNodeHandle bnh =
+                    i_ctxt.m_bncachep->fault(i_ctxt, m_sinref, ff);
 
-                    // Insert it in the clean cache.
-                    i_ctxt.m_bncachep->insert(nh);
-                }
+                // Better be a IndirectBlockNode ...
+                nh = dynamic_cast<IndirectBlockNode *>(&*bnh);
             }
 
             // Traverse the indirect block.
@@ -977,21 +1256,14 @@ FileNode::rb_refresh(Context & i_ctxt, uint64 i_rid)
         }
         else
         {
-            // Does the clean cache have it?
-            BlockNodeHandle bnh = i_ctxt.m_bncachep->lookup(m_sinref);
-            if (bnh)
-            {
-                // Yes, better be a IndirectBlockNode ...
-                nh = dynamic_cast<IndirectBlockNode *>(&*bnh);
-            }
-            else
-            {
-                // Nope, read it from the blockstore.
-                nh = new IndirectBlockNode(i_ctxt, m_sinref);
-
-                // Let's not insert refresh blocks it in the clean
-                // cache ...
-            }
+            // Fault it in, but let's not insert refresh blocks in
+            // the clean cache ...
+            NodeFaultFunc<IndirectBlockNode> ff;
+            BlockNodeHandle bnh =
+                i_ctxt.m_bncachep->fault(i_ctxt, m_sinref, ff, false);
+
+            // Better be a IndirectBlockNode ...
+            nh = dynamic_cast<IndirectBlockNode *>(&*bnh);
         }
 
         nblocks += nh->rb_refresh(i_ctxt, i_rid);
@@ -1009,21 +1281,14 @@ FileNode::rb_refresh(Context & i_ctxt, uint64 i_rid)
         }
         else
         {
-            // Does the clean cache have it?
-            BlockNodeHandle bnh = i_ctxt.m_bncachep->lookup(m_dinref);
-            if (bnh)
-            {
-                // Yes, better be a DoubleIndBlockNode ...
-                nh = dynamic_cast<DoubleIndBlockNode *>(&*bnh);
-            }
-            else
-            {
-                // Nope, read it from the blockstore.
-                nh = new DoubleIndBlockNode(i_ctxt, m_dinref);
-
-                // Let's not insert refresh blocks it in the clean
-                // cache ...
-            }
+            // Fault it in, but let's not insert refresh blocks in
+            // the clean cache ...
+            NodeFaultFunc<DoubleIndBlockNode> ff;
+            BlockNodeHandle bnh =
+                i_ctxt.m_bncachep->fault(i_ctxt, m_dinref, ff, false);
+
+            // Better be a DoubleIndBlockNode ...
+            nh = dynamic_cast<DoubleIndBlockNode *>(&*bnh);
         }
 
         nblocks += nh->rb_refresh(i_ctxt, i_rid);
@@ -1041,21 +1306,14 @@ FileNode::rb_refresh(Context & i_ctxt, uint64 i_rid)
         }
         else
         {
-            // Does the clean cache have it?
-            BlockNodeHandle bnh = i_ctxt.m_bncachep->lookup(m_tinref);
-            if (bnh)
-            {
-                // Yes, better be a TripleIndBlockNode ...
-                nh = dynamic_cast<TripleIndBlockNode *>(&*bnh);
-            }
-            else
-            {
-                // Nope, read it from the blockstore.
-                nh = new TripleIndBlockNode(i_ctxt, m_tinref);
-
-                // Let's not insert refresh blocks it in the clean
-                // cache ...
-            }
+            // Fault it in, but let's not insert refresh blocks in
+            // the clean cache ...
+            NodeFaultFunc<TripleIndBlockNode> ff;
+            BlockNodeHandle bnh =
+                i_ctxt.m_bncachep->fault(i_ctxt, m_tinref, ff, false);
+
+            // Better be a TripleIndBlockNode ...
+            nh = dynamic_cast<TripleIndBlockNode *>(&*bnh);
         }
 
         nblocks += nh->rb_refresh(i_ctxt, i_rid);
@@ -1074,27 +1332,23 @@ FileNode::rb_refresh(Context & i_ctxt, uint64 i_rid)
         }
         else
         {
-            // Does the clean cache have it?
-            BlockNodeHandle bnh = i_ctxt.m_bncachep->lookup(m_qinref);
-            if (bnh)
-            {
-                // Yes, better be a QuadIndBlockNode ...
-                nh = dynamic_cast<QuadIndBlockNode *>(&*bnh);
-            }
-            else
-            {
-                // Nope, read it from the blockstore.
-                nh = new QuadIndBlockNode(i_ctxt, m_qinref);
-
-                // Let's not insert refresh blocks it in the clean
-                // cache ...
-            }
+            // Fault it in, but let's not insert refresh blocks in
+            // the clean cache ...
+            NodeFaultFunc<QuadIndBlockNode> ff;
+            BlockNodeHandle bnh =
+                i_ctxt.m_bncachep->fault(i_ctxt, m_qinref, ff, false);
+
+            // Better be a QuadIndBlockNode ...
+            nh = dynamic_cast<QuadIndBlockNode *>(&*bnh);
         }
 
         nblocks += nh->rb_refresh(i_ctxt, i_rid);
     }
 #endif
 
+    if (m_extroot)
+        nblocks += m_extroot->rb_refresh(i_ctxt, i_rid);
+
     BlockStore::KeySeq missing;
     i_ctxt.m_bsh->bs_refresh_blocks(i_rid, keys, missing);
     if (!missing.empty())
@@ -1111,9 +1365,11 @@ FileNode::getattr(Context & i_ctxt, struct statstb * o_statbuf)
 {
     ACE_OS::memset(o_statbuf, '\0', sizeof(*o_statbuf));
 
-    
+    // Directories have their times updated under a shared lock.
+    ACE_Guard<ACE_Thread_Mutex> guard(m_fnmdmutex);
 
     o_statbuf->st_mode = m_inode.mode();
+    o_statbuf->st_ino = m_inode.fileid();
 #if !defined (WIN32)
     o_statbuf->st_uid = mapuname(m_inode.uname());
     o_statbuf->st_gid = mapgname(m_inode.gname());
@@ -1123,7 +1379,7 @@ FileNode::getattr(Context & i_ctxt, struct statstb * o_statbuf)
     o_statbuf->st_atime = m_inode.atime() / 1000000;
     o_statbuf->st_mtime = m_inode.mtime() / 1000000;
     o_statbuf->st_ctime = m_inode.ctime() / 1000000;
-    o_statbuf->st_blocks = m_inode.blocks() * 16;	// *= 8192 / 512
+    o_statbuf->st_blocks = m_inode.blocks() * (i_ctxt.m_blksz / 512);
 
     return 0;
 }
@@ -1168,9 +1424,19 @@ FileNode::chown(Context & i_ctxt,
     return 0;
 }
 
+void
+FileNode::use_extents()
+{
+    m_inode.set_extents(true);
+    m_extroot = new ExtentNode(NULL, EXTROOTSZ);
+}
+
 int
 FileNode::truncate(Context & i_ctxt, off_t i_size)
 {
+    // Anything buffered beyond the new size has to go too.
+    bn_writeback(i_ctxt);
+
     // Traverse adjusting block references.
     size_t nblocks = rb_truncate(i_ctxt, 0, i_size);
 
@@ -1260,9 +1526,39 @@ FileNode::read(Context & i_ctxt,
 {
     try
     {
+        // Get the fetches going before we wait on any of them.
+        if (!(i_flags & RB_NOCACHE))
+            readahead(i_ctxt, i_off, i_size);
+
         ReadBTF rbtf(o_bufptr, i_size, i_off);
         rb_traverse(i_ctxt, *this, i_flags, 0, i_off, i_size, rbtf);
-        return rbtf.bt_retval();
+        int rv = rbtf.bt_retval();
+
+        // Buffered writes are newer than the blocks.  The size
+        // already covers them, so they are within what we read.
+        if (!m_wbmap.empty() && rv > 0)
+        {
+            off_t const rdend = i_off + rv;
+
+            WriteMap::const_iterator it = m_wbmap.upper_bound(i_off);
+            if (it != m_wbmap.begin())
+                --it;
+
+            for (; it != m_wbmap.end() && it->first < rdend; ++it)
+            {
+                off_t minoff = max(i_off, it->first);
+                off_t maxoff = min(rdend,
+                                   off_t(it->first + it->second.size()));
+                if (minoff >= maxoff)
+                    continue;
+
+                ACE_OS::memcpy((uint8 *) o_bufptr + (minoff - i_off),
+                               &it->second[minoff - it->first],
+                               maxoff - minoff);
+            }
+        }
+
+        return rv;
     }
     catch (NotFoundError const & ex)
     {
@@ -1276,6 +1572,168 @@ FileNode::read(Context & i_ctxt,
     }
 }
 
+// Passes the block data to a ReadVecFunc in place, holding the nodes
+// until the traversal is done with.
+//
+class ReadVecBTF : public RefBlockNode::BlockTraverseFunc
+{
+public:
+    ReadVecBTF(FileSystem::ReadVecFunc & i_readfunc,
+               size_t i_rdsize,
+               off_t i_rdoff)
+        : m_readfunc(i_readfunc)
+        , m_rdsize(i_rdsize)
+        , m_rdoff(i_rdoff)
+    {}
+
+    virtual void bt_hold(BlockNodeHandle const & i_bnh)
+    {
+        m_held.push_back(i_bnh);
+    }
+
+    virtual bool bt_visit(Context & i_ctxt,
+                          void * i_blkdata,
+                          size_t i_blksize,
+                          off_t i_blkoff,
+                          size_t i_filesz)
+    {
+        // Same range arithmetic as ReadBTF.
+        off_t minoff = max(m_rdoff, i_blkoff);
+        off_t maxoff = min(m_rdoff + m_rdsize, i_blkoff + i_blksize);
+        if (maxoff > off_t(i_filesz))
+            maxoff = i_filesz;
+        if (minoff >= maxoff)
+            return false;
+
+        size_t sz = maxoff - minoff;
+        m_readfunc.rv_segment((uint8 const *) i_blkdata + (minoff - i_blkoff),
+                              sz);
+        m_retval += sz;
+        return false;
+    }
+
+private:
+    FileSystem::ReadVecFunc &	m_readfunc;
+    size_t						m_rdsize;
+    off_t						m_rdoff;
+    BlockNodeList				m_held;
+};
+
+int
+FileNode::read_vec(Context & i_ctxt,
+                   size_t i_size,
+                   off_t i_off,
+                   FileSystem::ReadVecFunc & o_readfunc)
+{
+    if (i_size == 0)
+    {
+        o_readfunc.rv_done();
+        return 0;
+    }
+
+    // Buffered writes would have to be laid over the blocks, read
+    // those the usual way.
+    if (!m_wbmap.empty())
+    {
+        OctetSeq buf(i_size);
+        int rv = read(i_ctxt, &buf[0], i_size, i_off);
+        if (rv < 0)
+            return rv;
+
+        if (rv > 0)
+            o_readfunc.rv_segment(&buf[0], rv);
+        o_readfunc.rv_done();
+        return rv;
+    }
+
+    try
+    {
+        readahead(i_ctxt, i_off, i_size);
+
+        ReadVecBTF rvbtf(o_readfunc, i_size, i_off);
+        rb_traverse(i_ctxt, *this, 0, 0, i_off, i_size, rvbtf);
+
+        // Our lock and the held nodes keep the data in place.
+        o_readfunc.rv_done();
+        return rvbtf.bt_retval();
+    }
+    catch (NotFoundError const & ex)
+    {
+        LOG(lgr, 1, "IO ERROR: " << ex.what());
+        return -EIO;
+    }
+    catch (int const & i_errno)
+    {
+        return -i_errno;
+    }
+}
+
+// Readahead traversals only want the blocks fetched.
+//
+class PrefetchBTF : public RefBlockNode::BlockTraverseFunc
+{
+public:
+    virtual bool bt_visit(Context & i_ctxt,
+                          void * i_blkdata,
+                          size_t i_blksize,
+                          off_t i_blkoff,
+                          size_t i_filesz)
+    {
+        return false;
+    }
+};
+
+void
+FileNode::readahead(Context & i_ctxt, off_t i_off, size_t i_size)
+{
+    off_t rngoff;
+    off_t rngend;
+    {
+        ACE_Guard<ACE_Thread_Mutex> guard(m_fnmdmutex);
+
+        // A read which carries on where the last one stopped is
+        // sequential and grows the window, anything else resets it.
+        bool const seq = i_off == m_ranext;
+        if (seq)
+        {
+            off_t const blksz = i_ctxt.m_blksz;
+            m_rawin = min(max(m_rawin * 2, RA_MINBLKS * blksz),
+                          RA_MAXBLKS * blksz);
+        }
+        else
+        {
+            m_rawin = 0;
+            m_raend = 0;
+        }
+
+        m_ranext = i_off + i_size;
+
+        // Only what hasn't been requested already.
+        rngoff = max(i_off, m_raend);
+        rngend = min(off_t(i_off + i_size) + m_rawin, off_t(size()));
+
+        // A small random read waits for its block either way.
+        if (rngend - rngoff <= (seq ? 0 : off_t(i_ctxt.m_blksz)))
+            return;
+
+        m_raend = rngend;
+    }
+
+    LOG(lgr, 6, "readahead " << rngoff << " - " << rngend);
+
+    try
+    {
+        PrefetchBTF pbtf;
+        rb_traverse(i_ctxt, *this, RB_PREFETCH,
+                    0, rngoff, rngend - rngoff, pbtf);
+    }
+    catch (Exception const & ex)
+    {
+        // The read finds out for itself.
+        LOG(lgr, 2, "readahead: " << ex.what());
+    }
+}
+
 class WriteBTF : public RefBlockNode::BlockTraverseFunc
 {
 public:
@@ -1341,6 +1799,102 @@ FileNode::write(Context & i_ctxt,
                 void const * i_data,
                 size_t i_size,
                 off_t i_off)
+{
+    if (i_size == 0)
+        return 0;
+
+    try
+    {
+        // Large writes gain nothing from buffering, and once the
+        // filesystem holds its fill every write goes straight through.
+        if (i_size >= wb_filemax(i_ctxt) ||
+            i_ctxt.m_statsp->m_nwbbytes.value() + long(i_size) >
+            wb_totalmax(i_ctxt))
+        {
+            // Keep the writes in order.
+            bn_writeback(i_ctxt);
+            return write_through(i_ctxt, i_data, i_size, i_off);
+        }
+
+        wb_insert(i_ctxt, i_data, i_size, i_off);
+
+        // Reads and getattr see the new size right away.
+        size(max(i_off + i_size, size()));
+
+        bn_isdirty(true);
+
+        if (m_wbbytes >= wb_filemax(i_ctxt))
+            bn_writeback(i_ctxt);
+
+        return i_size;
+    }
+    catch (int const & i_errno)
+    {
+        return -i_errno;
+    }
+}
+
+void
+FileNode::wb_insert(Context & i_ctxt,
+                    void const * i_data,
+                    size_t i_size,
+                    off_t i_off)
+{
+    off_t begin = i_off;
+    off_t end = i_off + i_size;
+
+    // Find the extents which overlap or abut the write, starting
+    // with the one before it if it reaches us.
+    WriteMap::iterator first = m_wbmap.lower_bound(begin);
+    if (first != m_wbmap.begin())
+    {
+        WriteMap::iterator prev = first;
+        --prev;
+        if (prev->first + off_t(prev->second.size()) >= begin)
+            first = prev;
+    }
+
+    WriteMap::iterator last = first;
+    for (; last != m_wbmap.end() && last->first <= end; ++last)
+        end = max(end, off_t(last->first + last->second.size()));
+
+    // The merged extent grows in place from the first one, so a run
+    // of appends doesn't copy what is already buffered.
+    if (first == last || first->first > begin)
+        first = m_wbmap.insert(first, make_pair(begin, OctetSeq()));
+    else
+        begin = first->first;
+
+    OctetSeq & buf = first->second;
+    size_t oldbytes = buf.size();
+    buf.resize(end - begin);
+
+    WriteMap::iterator it = first;
+    for (++it; it != last; ++it)
+    {
+        ACE_OS::memcpy(&buf[it->first - begin],
+                       &it->second[0],
+                       it->second.size());
+        oldbytes += it->second.size();
+    }
+
+    ++first;
+    m_wbmap.erase(first, last);
+
+    // The write itself goes on top.
+    ACE_OS::memcpy(&buf[i_off - begin], i_data, i_size);
+
+    size_t const added = (end - begin) - oldbytes;
+    m_wbbytes += added;
+    m_wbtotalp = &i_ctxt.m_statsp->m_nwbbytes;
+    *m_wbtotalp += long(added);
+}
+
+int
+FileNode::write_through(Context & i_ctxt,
+                        void const * i_data,
+                        size_t i_size,
+                        off_t i_off)
 {
     try
     {
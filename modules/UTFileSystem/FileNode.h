@@ -6,6 +6,7 @@
 ///
 /// See README.txt for inheritance diagram.
 
+#include <map>
 #include <string>
 
 #include "utpfwd.h"
@@ -23,10 +24,12 @@
 
 #include "RefBlockNode.h"
 #include "DataBlockNode.h"
+#include "ExtentNode.h"
 #include "IndirectBlockNode.h"
 #include "DoubleIndBlockNode.h"
 #include "TripleIndBlockNode.h"
 #include "BlockRef.h"
+#include "NodeLock.h"
 
 namespace UTFS {
 
@@ -60,6 +63,14 @@ public:
 
     virtual BlockRef const & bn_flush(Context & i_ctxt);
 
+    virtual void bn_writeback(Context & i_ctxt);
+
+    virtual BlockNodeHandle bn_clone() const;
+
+    virtual void bn_freeze(Generation & io_gen);
+
+    virtual void bn_thaw(Generation const & i_gen);
+
     virtual void bn_tostream(std::ostream & ostrm) const;
 
     virtual bool rb_traverse(Context & i_ctxt,
@@ -99,6 +110,13 @@ public:
                      off_t i_off,
                      unsigned i_flags = 0);
 
+    // Reads without copying, passing the block data to the functor
+    // in place.  The caller holds the node's lock until it returns.
+    virtual int read_vec(Context & i_ctxt,
+                         size_t i_size,
+                         off_t i_off,
+                         utp::FileSystem::ReadVecFunc & o_readfunc);
+
     virtual int write(Context & i_ctxt,
                       void const * i_data,
                       size_t i_size,
@@ -131,10 +149,68 @@ public:
 
     void blocks(size_t i_blocks) { m_inode.set_blocks(i_blocks); }
 
+    // The filesystem's mkfs settings, only the root's inode has them.
+    FSParams const & fsparams() const { return m_inode.fsparams(); }
+
+    FSParams * mutable_fsparams() { return m_inode.mutable_fsparams(); }
+
+    // Keeps the data after the inline block in an extent tree (see
+    // ExtentNode) instead of the block references.  Only for a new,
+    // empty file.
+    //
+    void use_extents();
+
+    // Protects the node's contents.  Shared while reading the node
+    // or traversing through it, exclusive while modifying it.
+    //
+    ACE_RW_Thread_Mutex & fn_rwmutex() const { return m_fnrwmutex; }
+
+    // Protects the state a descendant's traversal changes while it
+    // only holds the shared lock: times, the dirty flag, a
+    // directory's dirty entries and the readahead state.
+    //
+    ACE_Thread_Mutex & fn_mdmutex() const { return m_fnmdmutex; }
+
 protected:
     size_t fixed_field_size() const;
 
+    // Hashed directory format, see DirNode.
+    size_t dirbuckets() const { return m_inode.dirbuckets(); }
+
+    void dirbuckets(size_t i_n) { m_inode.set_dirbuckets(i_n); }
+
+    size_t direntries() const { return m_inode.direntries(); }
+
+    void direntries(size_t i_n) { m_inode.set_direntries(i_n); }
+
+    // Starts fetching the blocks a read at this offset, and the
+    // sequential reads expected to follow it, will need.
+    //
+    void readahead(Context & i_ctxt, off_t i_off, size_t i_size);
+
+    // Writes straight into the blocks, bypassing the write-behind
+    // buffer.  Callers must have written back anything buffered
+    // which overlaps.
+    //
+    int write_through(Context & i_ctxt,
+                      void const * i_data,
+                      size_t i_size,
+                      off_t i_off);
+
 private:
+    // Buffered writes by file offset.  Overlapping and adjacent
+    // writes are merged, so the extents are disjoint.
+    typedef std::map<off_t, utp::OctetSeq> WriteMap;
+
+    // Merges a write into the write-behind buffer.
+    void wb_insert(Context & i_ctxt,
+                   void const * i_data,
+                   size_t i_size,
+                   off_t i_off);
+
+    mutable NodeRWMutex			m_fnrwmutex;
+    mutable NodeMutex			m_fnmdmutex;
+
     INode						m_inode;
 
  	utp::uint8					m_inl[INLSZ];
@@ -151,6 +227,19 @@ private:
     IndirectBlockNodeHandle		m_sinobj_X;
     DoubleIndBlockNodeHandle	m_dinobj_X;
     TripleIndBlockNodeHandle	m_tinobj_X;
+
+    // Extent Tree, in place of the references
+    ExtentNodeHandle			m_extroot;	// NULL unless extents
+
+    // Readahead State
+    off_t						m_ranext;	// Where a sequential read starts
+    off_t						m_raend;	// End of the blocks requested
+    off_t						m_rawin;	// Window beyond the read
+
+    // Write-behind Buffer
+    WriteMap					m_wbmap;
+    size_t						m_wbbytes;	// Bytes in m_wbmap
+    utp::AtomicLong *			m_wbtotalp;	// Filesystem's total
 };
 
 } // namespace UTFS
@@ -0,0 +1,380 @@
+#include <memory>
+
+#include <ace/Guard_T.h>
+
+#include "Log.h"
+
+#include "utfslog.h"
+
+#include "BlockNode.h"
+#include "Context.h"
+#include "DedupIndex.h"
+#include "Flusher.h"
+
+using namespace std;
+using namespace utp;
+
+namespace {
+
+// Owns the copies of a block while its put is in flight.
+//
+struct PutRequest
+{
+    OctetSeq					m_key;
+    OctetSeq					m_data;
+    UTFS::Flusher::Batch *		m_batchp;
+    UTFS::DedupIndex *			m_dedupp;	// Records it when stored
+    utp::uint64					m_ddepoch;	// Dedup epoch at the put
+};
+
+} // end namespace
+
+namespace UTFS {
+
+Flusher::Batch::Batch(Flusher & i_flusher)
+    : m_flusher(i_flusher)
+    , m_btcond(m_btmutex)
+    , m_npending(0)
+    , m_except(NULL)
+{
+}
+
+Flusher::Batch::~Batch()
+{
+    // The workers and completions refer to us, wait for them even
+    // if we're unwinding.
+    ACE_Guard<ACE_Thread_Mutex> guard(m_btmutex);
+    while (m_npending)
+        m_btcond.wait();
+
+    if (m_except)
+        delete m_except;
+}
+
+void
+Flusher::Batch::persist(Context & i_ctxt, BlockNodeHandle const & i_bnh)
+{
+    {
+        ACE_Guard<ACE_Thread_Mutex> bguard(m_btmutex);
+        ++m_npending;
+    }
+
+    Job job;
+    job.m_batchp = this;
+    job.m_ctxtp = &i_ctxt;
+    job.m_bnh = i_bnh;
+
+    {
+        ACE_Guard<ACE_Thread_Mutex> guard(m_flusher.m_flmutex);
+
+        m_flusher.m_batched[&*i_bnh] = this;
+
+        if (m_flusher.m_running && m_flusher.m_nthreads)
+        {
+            m_flusher.m_jobs.push_back(job);
+            m_flusher.m_flcond.broadcast();
+            return;
+        }
+    }
+
+    // No workers, do it ourselves.  The put still doesn't block.
+    m_flusher.run(job);
+}
+
+void
+Flusher::Batch::wait()
+{
+    ACE_Guard<ACE_Thread_Mutex> guard(m_btmutex);
+
+    while (m_npending)
+        m_btcond.wait();
+
+    if (m_except)
+    {
+        Exception * exp = m_except;
+        m_except = NULL;
+        guard.release();
+
+        auto_ptr<Exception> owner(exp);
+        exp->rethrow();
+    }
+}
+
+void
+Flusher::Batch::done(Exception const * i_exp)
+{
+    ACE_Guard<ACE_Thread_Mutex> guard(m_btmutex);
+
+    if (i_exp && !m_except)
+        m_except = i_exp->clone();
+
+    if (--m_npending == 0)
+        m_btcond.broadcast();
+}
+
+Flusher::Flusher()
+    : m_flcond(m_flmutex)
+    , m_running(false)
+    , m_nthreads(0)
+    , m_maxputs(1)
+    , m_nputs(0)
+    , m_nasync(0)
+    , m_nputwaits(0)
+{
+    LOG(lgr, 4, "Flusher CTOR");
+}
+
+Flusher::~Flusher()
+{
+    // Don't try and log here, see UTFileSystem::~UTFileSystem.  We
+    // weren't term'd if the filesystem wasn't unmounted.
+    {
+        ACE_Guard<ACE_Thread_Mutex> guard(m_flmutex);
+        m_running = false;
+        m_flcond.broadcast();
+    }
+    wait();
+}
+
+void
+Flusher::init(int i_nthreads, size_t i_maxputs)
+{
+    LOG(lgr, 4, "Flusher init threads=" << i_nthreads
+        << " maxputs=" << i_maxputs);
+
+    {
+        ACE_Guard<ACE_Thread_Mutex> guard(m_flmutex);
+        if (m_running)
+            return;
+        m_running = true;
+        m_nthreads = i_nthreads;
+        m_maxputs = i_maxputs ? i_maxputs : 1;
+    }
+
+    if (i_nthreads && activate(THR_NEW_LWP | THR_JOINABLE, i_nthreads) != 0)
+        throwstream(InternalError, FILELINE
+                    << "trouble activating Flusher");
+}
+
+void
+Flusher::term()
+{
+    LOG(lgr, 4, "Flusher term");
+
+    {
+        ACE_Guard<ACE_Thread_Mutex> guard(m_flmutex);
+        m_running = false;
+        m_flcond.broadcast();
+    }
+
+    wait();
+}
+
+int
+Flusher::svc(void)
+{
+    LOG(lgr, 4, "Flusher thread starting");
+
+    while (true)
+    {
+        Job job;
+        {
+            ACE_Guard<ACE_Thread_Mutex> guard(m_flmutex);
+
+            while (m_running && m_jobs.empty())
+                m_flcond.wait();
+
+            // Batches wait for their jobs, so finish them even if
+            // we're being stopped.
+            if (m_jobs.empty())
+                break;
+
+            job = m_jobs.front();
+            m_jobs.pop_front();
+        }
+
+        run(job);
+    }
+
+    LOG(lgr, 4, "Flusher thread finished");
+    return 0;
+}
+
+void
+Flusher::put(Context & i_ctxt,
+             BlockNode const * i_bnp,
+             void const * i_keydata,
+             size_t i_keysize,
+             void const * i_blkdata,
+             size_t i_blksize,
+             DedupIndex * i_dedupp)
+{
+    Batch * batchp = unbatch(i_bnp);
+
+    uint64 const epoch = i_dedupp ? i_dedupp->epoch() : 0;
+
+    if (!batchp)
+    {
+        i_ctxt.m_bsh->bs_block_put(i_keydata, i_keysize,
+                                   i_blkdata, i_blksize);
+        if (i_dedupp)
+            i_dedupp->insert(BlockRef(string((char const *) i_keydata,
+                                             i_keysize)),
+                             epoch);
+        return;
+    }
+
+    PutRequest * prp = new PutRequest;
+    prp->m_key.assign((uint8 const *) i_keydata,
+                      (uint8 const *) i_keydata + i_keysize);
+    prp->m_data.assign((uint8 const *) i_blkdata,
+                       (uint8 const *) i_blkdata + i_blksize);
+    prp->m_batchp = batchp;
+    prp->m_dedupp = i_dedupp;
+    prp->m_ddepoch = epoch;
+
+    {
+        ACE_Guard<ACE_Thread_Mutex> guard(m_flmutex);
+
+        if (m_nputs >= m_maxputs)
+        {
+            ++m_nputwaits;
+            while (m_nputs >= m_maxputs)
+                m_flcond.wait();
+        }
+
+        ++m_nputs;
+        ++m_nasync;
+    }
+
+    // From here on the completion finishes the node in the batch.
+    try
+    {
+        i_ctxt.m_bsh->bs_block_put_async(&prp->m_key[0],
+                                         prp->m_key.size(),
+                                         &prp->m_data[0],
+                                         prp->m_data.size(),
+                                         *this,
+                                         prp);
+    }
+    catch (Exception const & ex)
+    {
+        bp_error(i_keydata, i_keysize, prp, ex);
+    }
+}
+
+void
+Flusher::bp_complete(void const * i_keydata,
+                     size_t i_keysize,
+                     void const * i_argp)
+{
+    PutRequest * prp = (PutRequest *) i_argp;
+    Batch * batchp = prp->m_batchp;
+
+    // It's stored, a later put of the same block can be skipped.
+    if (prp->m_dedupp)
+        prp->m_dedupp->insert(BlockRef(string(prp->m_key.begin(),
+                                              prp->m_key.end())),
+                              prp->m_ddepoch);
+
+    delete prp;
+
+    {
+        ACE_Guard<ACE_Thread_Mutex> guard(m_flmutex);
+        --m_nputs;
+        m_flcond.broadcast();
+    }
+
+    batchp->done(NULL);
+}
+
+void
+Flusher::bp_error(void const * i_keydata,
+                  size_t i_keysize,
+                  void const * i_argp,
+                  Exception const & i_exp)
+{
+    LOG(lgr, 2, "Flusher put failed: " << i_exp.what());
+
+    PutRequest * prp = (PutRequest *) i_argp;
+    Batch * batchp = prp->m_batchp;
+    delete prp;
+
+    {
+        ACE_Guard<ACE_Thread_Mutex> guard(m_flmutex);
+        --m_nputs;
+        m_flcond.broadcast();
+    }
+
+    batchp->done(&i_exp);
+}
+
+void
+Flusher::get_stats(StatSet & o_ss) const
+{
+    size_t nputs;
+    size_t njobs;
+    int64 nasync;
+    int64 nputwaits;
+
+    {
+        ACE_Guard<ACE_Thread_Mutex> guard(m_flmutex);
+        nputs = m_nputs;
+        njobs = m_jobs.size();
+        nasync = m_nasync;
+        nputwaits = m_nputwaits;
+    }
+
+    Stats::set(o_ss, "flput", nputs, 1.0, "%.0f", SF_VALUE);
+    Stats::set(o_ss, "fljob", njobs, 1.0, "%.0f", SF_VALUE);
+    Stats::set(o_ss, "flaps", nasync, 1.0, "%.1f/s", SF_DELTA);
+    Stats::set(o_ss, "flwps", nputwaits, 1.0, "%.1f/s", SF_DELTA);
+}
+
+void
+Flusher::run(Job const & i_job)
+{
+    try
+    {
+        i_job.m_bnh->bn_persist(*i_job.m_ctxtp);
+
+        // Normally the put finishes the node, if persist didn't get
+        // that far we finish it here.
+        if (unbatch(&*i_job.m_bnh))
+            i_job.m_batchp->done(NULL);
+    }
+    catch (Exception const & ex)
+    {
+        if (unbatch(&*i_job.m_bnh))
+            i_job.m_batchp->done(&ex);
+    }
+    catch (exception const & ex)
+    {
+        InternalError iex(ex.what());
+        if (unbatch(&*i_job.m_bnh))
+            i_job.m_batchp->done(&iex);
+    }
+}
+
+Flusher::Batch *
+Flusher::unbatch(BlockNode const * i_bnp)
+{
+    ACE_Guard<ACE_Thread_Mutex> guard(m_flmutex);
+
+    BatchMap::iterator pos = m_batched.find(i_bnp);
+    if (pos == m_batched.end())
+        return NULL;
+
+    Batch * batchp = pos->second;
+    m_batched.erase(pos);
+    return batchp;
+}
+
+} // namespace UTFS
+
+// Local Variables:
+// mode: C++
+// tab-width: 4
+// c-basic-offset: 4
+// c-file-offsets: ((comment-intro . 0))
+// End:
@@ -0,0 +1,156 @@
+#ifndef UTFS_Flusher_h__
+#define UTFS_Flusher_h__
+
+/// @file Flusher.h
+/// Utopia FileSystem Pipelined Block Flusher.
+
+#include <deque>
+#include <map>
+
+#include <ace/Condition_Thread_Mutex.h>
+#include <ace/Task.h>
+#include <ace/Thread_Mutex.h>
+
+#include "utpfwd.h"
+
+#include "BlockStore.h"
+#include "Except.h"
+#include "Stats.h"
+#include "Types.h"
+
+#include "utfsexp.h"
+#include "utfsfwd.h"
+
+namespace UTFS {
+
+// Pipelines the persisting of dirty blocks during a flush.
+//
+// A flush walks the dirty tree bottom-up.  The data blocks under a
+// node are handed to a Batch, which encrypts and hashes them on the
+// worker threads and writes them with the non-blocking put.  At most
+// a fixed number of puts are in flight, further puts wait for one to
+// complete.  The node waits for the batch, at which point all of its
+// children are stored and their references known, and persists
+// itself.
+//
+// A batch which fails leaves the node dirty with its children still
+// in the dirty tree, so the next flush persists them again.
+//
+// Puts of blocks which aren't in a batch (the interior nodes) are
+// blocking, as they always were.
+//
+// The workers take no node locks, the nodes they are handed are
+// covered by the locks of the thread waiting on the batch.
+//
+class UTFS_EXP Flusher
+    : public ACE_Task_Base
+    , public utp::BlockStore::BlockPutCompletion
+{
+public:
+    // A group of nodes persisted in parallel.
+    //
+    class UTFS_EXP Batch
+    {
+    public:
+        Batch(Flusher & i_flusher);
+
+        ~Batch();
+
+        // Persist the node, on a worker if there are any.
+        void persist(Context & i_ctxt, BlockNodeHandle const & i_bnh);
+
+        // Wait until all the nodes in the batch are stored, rethrows
+        // the first error seen.
+        void wait();
+
+    private:
+        friend class Flusher;
+
+        void done(utp::Exception const * i_exp);
+
+        Flusher &					m_flusher;
+        ACE_Thread_Mutex			m_btmutex;
+        ACE_Condition_Thread_Mutex	m_btcond;
+        size_t						m_npending;
+        utp::Exception *			m_except;
+    };
+
+    Flusher();
+
+    virtual ~Flusher();
+
+    // Start the workers.  Zero threads persists on the caller.
+    void init(int i_nthreads, size_t i_maxputs);
+
+    // Stop the workers.
+    void term();
+
+    // ACE_Task_Base
+    virtual int svc(void);
+
+    // Write a persisted block.  If the node is being persisted by a
+    // batch the put is non-blocking and the key and data are copied.
+    // The block is recorded in i_dedupp, if there is one, once it's
+    // stored.
+    //
+    void put(Context & i_ctxt,
+             BlockNode const * i_bnp,
+             void const * i_keydata,
+             size_t i_keysize,
+             void const * i_blkdata,
+             size_t i_blksize,
+             DedupIndex * i_dedupp = NULL);
+
+    // BlockPutCompletion
+    virtual void bp_complete(void const * i_keydata,
+                             size_t i_keysize,
+                             void const * i_argp);
+
+    virtual void bp_error(void const * i_keydata,
+                          size_t i_keysize,
+                          void const * i_argp,
+                          utp::Exception const & i_exp);
+
+    void get_stats(utp::StatSet & o_ss) const;
+
+private:
+    struct Job
+    {
+        Batch *					m_batchp;
+        Context *				m_ctxtp;
+        BlockNodeHandle			m_bnh;
+    };
+
+    typedef std::deque<Job> JobQueue;
+
+    typedef std::map<BlockNode const *, Batch *> BatchMap;
+
+    // Runs a job on the current thread.
+    void run(Job const & i_job);
+
+    // Removes the node's batch entry, returns NULL if there isn't one.
+    Batch * unbatch(BlockNode const * i_bnp);
+
+    mutable ACE_Thread_Mutex	m_flmutex;
+    ACE_Condition_Thread_Mutex	m_flcond;		// Jobs or put slots
+    bool						m_running;
+    int							m_nthreads;
+    size_t						m_maxputs;
+    size_t						m_nputs;		// Puts in flight
+    JobQueue					m_jobs;
+    BatchMap					m_batched;		// Nodes awaiting their put
+
+    utp::int64					m_nasync;		// Non-blocking puts
+    utp::int64					m_nputwaits;	// Puts which waited
+};
+
+} // namespace UTFS
+
+// Local Variables:
+// mode: C++
+// tab-width: 4
+// c-basic-offset: 4
+// c-file-offsets: ((comment-intro . 0))
+// End:
+
+#endif // UTFS_Flusher_h__
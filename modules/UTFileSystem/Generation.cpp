@@ -0,0 +1,74 @@
+#include "Log.h"
+
+#include "utfslog.h"
+
+#include "BlockNode.h"
+#include "Generation.h"
+
+using namespace std;
+using namespace utp;
+
+namespace UTFS {
+
+Generation::Generation()
+{
+    LOG(lgr, 6, "Generation CTOR");
+}
+
+Generation::~Generation()
+{
+    LOG(lgr, 6, "Generation DTOR");
+}
+
+BlockNodeHandle
+Generation::freeze(BlockNodeHandle const & i_bnh)
+{
+    // A node can be reachable more than once (hard links), it gets a
+    // single copy.
+    FrozenMap::const_iterator pos = m_frozen.find(&*i_bnh);
+    if (pos != m_frozen.end())
+        return pos->second.m_copy;
+
+    Frozen fz;
+    fz.m_live = i_bnh;
+    fz.m_copy = i_bnh->bn_clone();
+    fz.m_gen = i_bnh->bn_gen();
+
+    m_frozen.insert(make_pair(&*i_bnh, fz));
+
+    // The copy still shares the live node's dirty children, give it
+    // copies of its own.
+    fz.m_copy->bn_freeze(*this);
+
+    return fz.m_copy;
+}
+
+BlockNodeHandle
+Generation::thaw(BlockNodeHandle const & i_bnh) const
+{
+    // Created since the freeze.
+    FrozenMap::const_iterator pos = m_frozen.find(&*i_bnh);
+    if (pos == m_frozen.end())
+        return NULL;
+
+    // Everything which changes a node marks it dirty, and on the way
+    // back up marks every node above it dirty.  If we haven't been
+    // marked since the freeze nothing beneath us has changed either.
+    //
+    Frozen const & fz = pos->second;
+    if (i_bnh->bn_gen() == fz.m_gen)
+        return fz.m_copy;
+
+    // Adopt whatever is unchanged beneath us.
+    i_bnh->bn_thaw(*this);
+    return NULL;
+}
+
+} // namespace UTFS
+
+// Local Variables:
+// mode: C++
+// tab-width: 4
+// c-basic-offset: 4
+// c-file-offsets: ((comment-intro . 0))
+// End:
@@ -0,0 +1,90 @@
+#ifndef UTFS_Generation_h__
+#define UTFS_Generation_h__
+
+/// @file Generation.h
+/// Utopia FileSystem Frozen Dirty Tree.
+
+#include <map>
+
+#include "utpfwd.h"
+
+#include "Types.h"
+
+#include "utfsexp.h"
+#include "utfsfwd.h"
+
+namespace UTFS {
+
+// A copy of the dirty tree taken at a sync point.
+//
+// The sync freezes the tree while it holds the filesystem lock
+// exclusively; the copy is only as expensive as copying the dirty
+// nodes in memory.  The frozen copy is flushed with no filesystem
+// lock held while operations go on changing the live tree.  Writes a
+// file still buffers are copied with it and applied to the copy as
+// it is flushed, so the freeze itself does no blockstore I/O.
+//
+// Once the copy is stored the live tree is thawed, again under the
+// exclusive lock.  A live node which hasn't been marked dirty since
+// the freeze (see BlockNode::bn_gen) is identical to its stored copy
+// and is replaced by it.  Nodes which changed stay dirty for the next
+// sync.
+//
+class UTFS_EXP Generation
+{
+public:
+    Generation();
+
+    ~Generation();
+
+    // Returns the frozen copy of the node, copying it and the dirty
+    // nodes beneath it the first time.
+    BlockNodeHandle freeze(BlockNodeHandle const & i_bnh);
+
+    template <typename T>
+    utp::RCPtr<T> freeze(utp::RCPtr<T> const & i_nh)
+    {
+        if (!i_nh)
+            return NULL;
+
+        BlockNodeHandle bnh = freeze(BlockNodeHandle(i_nh));
+        return dynamic_cast<T *>(&*bnh);
+    }
+
+    // Thaws a live node once the frozen copies are stored.  Returns
+    // the stored copy, which the flush left in the clean cache, if the
+    // node hasn't changed since the freeze.  Otherwise thaws the
+    // node's dirty children and returns NULL.
+    //
+    BlockNodeHandle thaw(BlockNodeHandle const & i_bnh) const;
+
+    // Number of nodes frozen.
+    size_t size() const { return m_frozen.size(); }
+
+private:
+    struct Frozen
+    {
+        BlockNodeHandle			m_live;		// Keeps the address unique
+        BlockNodeHandle			m_copy;
+        utp::uint64				m_gen;		// Live node's at the freeze
+    };
+
+    typedef std::map<BlockNode const *, Frozen> FrozenMap;
+
+    // Not copyable.
+    Generation(Generation const &);
+    Generation & operator=(Generation const &);
+
+    FrozenMap					m_frozen;
+};
+
+} // namespace UTFS
+
+// Local Variables:
+// mode: C++
+// tab-width: 4
+// c-basic-offset: 4
+// c-file-offsets: ((comment-intro . 0))
+// End:
+
+#endif // UTFS_Generation_h__
@@ -10,6 +10,8 @@
 #include "Context.h"
 #include "DataBlockNode.h"
 #include "FileNode.h"
+#include "Flusher.h"
+#include "Generation.h"
 #include "IndirectBlockNode.h"
 #include "UTFileSystem.h"
 
@@ -24,7 +26,15 @@ namespace {
 
 namespace UTFS {
 
-IndirectBlockNode::IndirectBlockNode()
+size_t
+IndirectBlockNode::numref(Context const & i_ctxt)
+{
+    return i_ctxt.m_blksz / sizeof(BlockRef);
+}
+
+IndirectBlockNode::IndirectBlockNode(size_t i_blksz)
+    : m_blkref(i_blksz / sizeof(BlockRef))
+    , m_blkobj_X(i_blksz / sizeof(BlockRef))
 {
     LOG(lgr, 6, "CTOR");
 }
@@ -32,23 +42,12 @@ IndirectBlockNode::IndirectBlockNode()
 IndirectBlockNode::IndirectBlockNode(Context & i_ctxt,
                                      BlockRef const & i_ref)
     : RefBlockNode(i_ref)
+    , m_blkref(numref(i_ctxt))
+    , m_blkobj_X(numref(i_ctxt))
 {
     LOG(lgr, 6, "CTOR " << i_ref);
 
-    uint8 * ptr = (uint8 *) m_blkref;
-    size_t sz = BLKSZ;
-
-    // Read the block from the blockstore.
-    i_ctxt.m_bsh->bs_block_get(i_ref.data(), i_ref.size(), ptr, sz);
-
-    ++i_ctxt.m_statsp->m_ngops;
-    i_ctxt.m_statsp->m_ngbytes += sz;
-
-    // Validate the block.
-    i_ref.validate(ptr, sz);
-
-    // Decrypt the block.
-    i_ctxt.m_cipher.decrypt(i_ref.iv(), ptr, sz);
+    bn_load(i_ctxt, i_ref, bn_data(), bn_size());
 }
 
 IndirectBlockNode::~IndirectBlockNode()
@@ -59,31 +58,7 @@ IndirectBlockNode::~IndirectBlockNode()
 BlockRef const &
 IndirectBlockNode::bn_persist(Context & i_ctxt)
 {
-    // Copy the data into a buffer.
-    uint8 buf[BlockNode::BLKSZ];
-    ACE_OS::memset(buf, '\0', BlockNode::BLKSZ);
-    ACE_OS::memcpy(buf, m_blkref, sizeof(m_blkref));
-
-    // Construct an initvec.
-    utp::uint8 iv[16];
-    Random::fill(iv, sizeof(iv));
-
-    // Encrypt the entire block.
-    i_ctxt.m_cipher.encrypt(iv, buf, sizeof(buf));
-
-    // Set our reference value.
-    m_ref = BlockRef(Digest(buf, sizeof(buf)), iv);
-
-    LOG(lgr, 6, "persist " << bn_blkref());
-
-    // Write the block out to the block store.
-    i_ctxt.m_bsh->bs_block_put((void *) m_ref.data(),
-                               m_ref.size(),
-                               (void *) buf,
-                               sizeof(buf));
-
-    ++i_ctxt.m_statsp->m_npops;
-    i_ctxt.m_statsp->m_npbytes += sizeof(buf);
+    bn_store(i_ctxt, bn_data(), bn_size());
 
     bn_isdirty(false);
 
@@ -97,18 +72,23 @@ IndirectBlockNode::bn_flush(Context & i_ctxt)
     if (!bn_isdirty())
         return bn_blkref();
 
-    for (unsigned i = 0; i < NUMREF; ++i)
+    // Our children are data blocks, persist them in parallel.
+    {
+        Flusher::Batch batch(*i_ctxt.m_flusherp);
+        for (unsigned i = 0; i < numref(); ++i)
+            if (m_blkobj_X[i])
+                batch.persist(i_ctxt, m_blkobj_X[i]);
+        batch.wait();
+    }
+
+    for (unsigned i = 0; i < numref(); ++i)
     {
         if (m_blkobj_X[i])
         {
-            DataBlockNodeHandle nh =
-                dynamic_cast<DataBlockNode *>(&*m_blkobj_X[i]);
-
-            // Flush the object.
-            m_blkref[i] = nh->bn_flush(i_ctxt);
+            m_blkref[i] = m_blkobj_X[i]->bn_blkref();
 
             // Insert it in the clean cache.
-            i_ctxt.m_bncachep->insert(nh);
+            i_ctxt.m_bncachep->insert(m_blkobj_X[i]);
 
             // Clear it in the dirty array.
             m_blkobj_X[i] = NULL;
@@ -118,6 +98,37 @@ IndirectBlockNode::bn_flush(Context & i_ctxt)
     return bn_persist(i_ctxt);
 }
 
+BlockNodeHandle
+IndirectBlockNode::bn_clone() const
+{
+    return new IndirectBlockNode(*this);
+}
+
+void
+IndirectBlockNode::bn_freeze(Generation & io_gen)
+{
+    for (unsigned i = 0; i < numref(); ++i)
+        if (m_blkobj_X[i])
+            m_blkobj_X[i] = io_gen.freeze(m_blkobj_X[i]);
+}
+
+void
+IndirectBlockNode::bn_thaw(Generation const & i_gen)
+{
+    for (unsigned i = 0; i < numref(); ++i)
+    {
+        if (m_blkobj_X[i])
+        {
+            BlockNodeHandle bnh = i_gen.thaw(m_blkobj_X[i]);
+            if (bnh)
+            {
+                m_blkref[i] = bnh->bn_blkref();
+                m_blkobj_X[i] = NULL;
+            }
+        }
+    }
+}
+
 void
 IndirectBlockNode::bn_tostream(std::ostream & ostrm) const
 {
@@ -134,7 +145,7 @@ IndirectBlockNode::rb_traverse(Context & i_ctxt,
                                size_t i_rngsize,
                                BlockTraverseFunc & i_trav)
 {
-    static size_t refspan = BLKSZ;
+    off_t refspan = i_ctxt.m_blksz;
 
     off_t startoff = max(i_rngoff, i_base);
 
@@ -143,7 +154,7 @@ IndirectBlockNode::rb_traverse(Context & i_ctxt,
         goto done;
 
     // Figure out which index we start with.
-    for (off_t ndx = (startoff - i_base) / refspan; ndx < off_t(NUMREF); ++ndx)
+    for (off_t ndx = (startoff - i_base) / refspan; ndx < off_t(numref()); ++ndx)
     {
         off_t off = i_base + (ndx * refspan);
 
@@ -165,27 +176,35 @@ IndirectBlockNode::rb_traverse(Context & i_ctxt,
             // Nope, does it have a digest yet?
             if (m_blkref[ndx])
             {
-                // Does the clean cache have it?
-                BlockNodeHandle bnh = i_ctxt.m_bncachep->lookup(m_blkref[ndx]);
-                if (bnh)
+                if (i_flags & RB_PREFETCH)
                 {
-                    // Yes, better be a DataBlockNode ...
-                    nh = dynamic_cast<DataBlockNode *>(&*bnh);
+                    // Don't wait for it, a later pass finds it in the
+                    // cache.  Until then the zero node stands in.
+                    nh = i_ctxt.m_prefetchp->
+                        prefetch<DataBlockNode>(i_ctxt, m_blkref[ndx]);
+                    if (!nh)
+                        nh = i_ctxt.m_zdatobj;
                 }
                 else
                 {
-                    // Nope, read it from the blockstore.
-                    nh = new DataBlockNode(i_ctxt, m_blkref[ndx]);
+                    // Fault it in through the clean cache.
+                    NodeFaultFunc<DataBlockNode> ff;
+                    BlockNodeHandle bnh =
+                        i_ctxt.m_bncachep->fault(i_ctxt, m_blkref[ndx], ff,
+                                                 !(i_flags & RB_NOCACHE));
+
+                    // Better be a DataBlockNode ...
+                    nh = dynamic_cast<DataBlockNode *>(&*bnh);
 
-                    // Insert it in the clean cache.
-                    if (!(i_flags & RB_NOCACHE))
-                        i_ctxt.m_bncachep->insert(nh);
+                    // Others may share it, modify our own.
+                    if (i_flags & RB_MODIFY_X)
+                        nh = DataBlockNode::modifiable(i_ctxt, nh);
                 }
             }
             else if (i_flags & RB_MODIFY_X)
             {
                 // Nope, create new block.
-                nh = new DataBlockNode();
+                nh = new DataBlockNode(i_ctxt.m_blksz);
 
                 // Keep it in the dirty cache.
                 m_blkobj_X[ndx] = nh;
@@ -203,6 +222,7 @@ IndirectBlockNode::rb_traverse(Context & i_ctxt,
         }
 
         // Visit the node.
+        i_trav.bt_hold(nh);
         if (i_trav.bt_visit(i_ctxt, nh->bn_data(), nh->bn_size(),
                             off, i_fn.size()))
         {
@@ -236,10 +256,10 @@ IndirectBlockNode::rb_truncate(Context & i_ctxt,
     size_t nblocks = 1;		// Start w/ this node.
     off_t off = i_base;
 
-    for (unsigned ndx = 0; ndx < NUMREF; ++ndx)
+    for (unsigned ndx = 0; ndx < numref(); ++ndx)
     {
         // Is this block prior to the truncation?
-        if (off + BLKSZ <= i_size)
+        if (off + off_t(i_ctxt.m_blksz) <= i_size)
         {
             // Increment the block counter if there is a data
             // block.
@@ -264,22 +284,16 @@ IndirectBlockNode::rb_truncate(Context & i_ctxt,
                 // Nope, does it have a digest yet?
                 if (m_blkref[ndx])
                 {
-                    // Does the clean cache have it?
+                    // Fault it in through the clean cache.
+                    NodeFaultFunc<DataBlockNode> ff;
                     BlockNodeHandle bnh =
-                        i_ctxt.m_bncachep->lookup(m_blkref[ndx]);
-                    if (bnh)
-                    {
-                        // Yes, better be a DataBlockBlockNode ...
-                        dbh = dynamic_cast<DataBlockNode *>(&*bnh);
-                    }
-                    else
-                    {
-                        // Nope, read it from the blockstore.
-                        dbh = new DataBlockNode(i_ctxt, m_blkref[ndx]);
-
-                        // Insert it in the clean cache.
-                        i_ctxt.m_bncachep->insert(dbh);
-                    }
+                        i_ctxt.m_bncachep->fault(i_ctxt, m_blkref[ndx], ff);
+
+                    // Better be a DataBlockBlockNode ...
+                    dbh = dynamic_cast<DataBlockNode *>(&*bnh);
+
+                    // Others may share it, modify our own.
+                    dbh = DataBlockNode::modifiable(i_ctxt, dbh);
                 }
                 else
                 {
@@ -334,7 +348,7 @@ IndirectBlockNode::rb_truncate(Context & i_ctxt,
             bn_isdirty(true);
         }
 
-        off += BLKSZ;
+        off += i_ctxt.m_blksz;
     }
 
     return nblocks;
@@ -347,7 +361,7 @@ IndirectBlockNode::rb_refresh(Context & i_ctxt, uint64 i_rid)
 
     BlockStore::KeySeq keys;
 
-    for (unsigned i = 0; i < NUMREF; ++i)
+    for (unsigned i = 0; i < numref(); ++i)
     {
         if (m_blkref[i])
         {
@@ -365,11 +379,12 @@ IndirectBlockNode::rb_refresh(Context & i_ctxt, uint64 i_rid)
 }
 
 ZeroIndirectBlockNode::ZeroIndirectBlockNode(DataBlockNodeHandle const & i_dbnh)
+    : IndirectBlockNode(i_dbnh->bn_size())
 {
     LOG(lgr, 6, "CTOR " << "ZERO");
 
     // Initialize all of our references to the zero data block.
-    for (unsigned i = 0; i < NUMREF; ++i)
+    for (unsigned i = 0; i < numref(); ++i)
         m_blkobj_X[i] = i_dbnh;
 
     // We aren't ever dirty.
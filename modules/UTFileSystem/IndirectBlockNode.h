@@ -25,11 +25,11 @@ namespace UTFS {
 class UTFS_EXP IndirectBlockNode : public RefBlockNode
 {
 public:
-    // How many digests fit in a packed block.
-    static off_t const NUMREF = (BLKSZ / sizeof(BlockRef));
+    // How many digests fit in one of the filesystem's blocks.
+    static size_t numref(Context const & i_ctxt);
 
-    // Default constructor.
-    IndirectBlockNode();
+    // Constructor for a block of i_blksz bytes.
+    IndirectBlockNode(size_t i_blksz);
 
     // Constructor from blockstore persisted data.
     IndirectBlockNode(Context & i_ctxt, BlockRef const & i_ref);
@@ -43,12 +43,21 @@ public:
 
     virtual utp::uint8 * bn_data() { return (utp::uint8 *) &m_blkref[0]; }
 
-    virtual size_t bn_size() const { return BLKSZ; }
+    virtual size_t bn_size() const
+    {
+        return m_blkref.size() * sizeof(BlockRef);
+    }
 
     virtual BlockRef const & bn_persist(Context & i_ctxt);
 
     virtual BlockRef const & bn_flush(Context & i_ctxt);
 
+    virtual BlockNodeHandle bn_clone() const;
+
+    virtual void bn_freeze(Generation & io_gen);
+
+    virtual void bn_thaw(Generation const & i_gen);
+
     virtual void bn_tostream(std::ostream & ostrm) const;
 
     virtual bool rb_traverse(Context & i_ctxt,
@@ -66,11 +75,14 @@ public:
     virtual size_t rb_refresh(Context & i_ctxt, utp::uint64 i_rid);
                             
 protected:
+    // How many digests this block holds.
+    size_t numref() const { return m_blkref.size(); }
+
     // Block References
-    BlockRef				m_blkref[NUMREF];
+    std::vector<BlockRef>			m_blkref;
 
     // Cached Dirty Objects
-    BlockNodeHandle			m_blkobj_X[NUMREF];
+    std::vector<BlockNodeHandle>	m_blkobj_X;
 };
 
 // The ZeroIndirectBlockNode is a singleton which is used for
@@ -0,0 +1,76 @@
+#ifndef UTFS_NodeLock_h__
+#define UTFS_NodeLock_h__
+
+/// @file NodeLock.h
+/// Utopia FileSystem Per-Node Locks.
+///
+/// See UTFileSystem.h for the lock order.
+
+#include <ace/RW_Thread_Mutex.h>
+#include <ace/Thread_Mutex.h>
+
+#include "utfsexp.h"
+
+namespace UTFS {
+
+// The nodes are copied when they are upgraded to their real type
+// (FileNode to DirNode, for example).  A copy gets its own unlocked
+// mutex instead of trying to copy the original's.
+//
+class UTFS_EXP NodeRWMutex : public ACE_RW_Thread_Mutex
+{
+public:
+    NodeRWMutex() {}
+
+    NodeRWMutex(NodeRWMutex const &) : ACE_RW_Thread_Mutex() {}
+
+    NodeRWMutex & operator=(NodeRWMutex const &) { return *this; }
+};
+
+class UTFS_EXP NodeMutex : public ACE_Thread_Mutex
+{
+public:
+    NodeMutex() {}
+
+    NodeMutex(NodeMutex const &) : ACE_Thread_Mutex() {}
+
+    NodeMutex & operator=(NodeMutex const &) { return *this; }
+};
+
+// Holds a node's RW mutex, shared or exclusive, for the scope.
+//
+class UTFS_EXP NodeGuard
+{
+public:
+    NodeGuard(ACE_RW_Thread_Mutex & i_mutex, bool i_exclusive)
+        : m_mutex(i_mutex)
+    {
+        if (i_exclusive)
+            m_mutex.acquire_write();
+        else
+            m_mutex.acquire_read();
+    }
+
+    ~NodeGuard()
+    {
+        m_mutex.release();
+    }
+
+private:
+    // Not copyable.
+    NodeGuard(NodeGuard const &);
+    NodeGuard & operator=(NodeGuard const &);
+
+    ACE_RW_Thread_Mutex &		m_mutex;
+};
+
+} // namespace UTFS
+
+// Local Variables:
+// mode: C++
+// tab-width: 4
+// c-basic-offset: 4
+// c-file-offsets: ((comment-intro . 0))
+// End:
+
+#endif // UTFS_NodeLock_h__
@@ -0,0 +1,227 @@
+#include <memory>
+
+#include <ace/Guard_T.h>
+
+#include "Log.h"
+
+#include "utfslog.h"
+
+#include "BlockNode.h"
+#include "DataBlockNode.h"
+#include "DedupIndex.h"
+#include "Prefetcher.h"
+
+using namespace std;
+using namespace utp;
+
+namespace {
+
+// Owns the node and its reference while the get is in flight.
+//
+struct GetRequest
+{
+    UTFS::Context *				m_ctxtp;
+    UTFS::BlockRef				m_ref;
+    UTFS::BlockNodeHandle		m_bnh;
+    utp::uint64					m_ddepoch;	// Dedup epoch at the get
+};
+
+} // end namespace
+
+namespace UTFS {
+
+Prefetcher::Prefetcher()
+    : m_pfcond(m_pfmutex)
+    , m_running(false)
+    , m_maxgets(0)
+    , m_ngets(0)
+    , m_nissued(0)
+    , m_nskipped(0)
+    , m_nfailed(0)
+{
+    LOG(lgr, 4, "Prefetcher CTOR");
+}
+
+Prefetcher::~Prefetcher()
+{
+    // Don't try and log here, see UTFileSystem::~UTFileSystem.
+}
+
+void
+Prefetcher::init(size_t i_maxgets)
+{
+    LOG(lgr, 4, "Prefetcher init maxgets=" << i_maxgets);
+
+    ACE_Guard<ACE_Thread_Mutex> guard(m_pfmutex);
+    m_running = true;
+    m_maxgets = i_maxgets;
+}
+
+void
+Prefetcher::term()
+{
+    LOG(lgr, 4, "Prefetcher term");
+
+    // The completions use the context, which is about to go away.
+    ACE_Guard<ACE_Thread_Mutex> guard(m_pfmutex);
+    m_running = false;
+    while (m_ngets)
+        m_pfcond.wait();
+}
+
+void
+Prefetcher::bg_complete(void const * i_keydata,
+                        size_t i_keysize,
+                        void const * i_argp,
+                        size_t i_blksize)
+{
+    auto_ptr<GetRequest> grp((GetRequest *) i_argp);
+    Context & ctxt = *grp->m_ctxtp;
+
+    ++ctxt.m_statsp->m_ngops;
+    ctxt.m_statsp->m_ngbytes += i_blksize;
+
+    BlockNodeHandle bnh;
+    try
+    {
+        // Decode it, as the node's constructor would have.
+        BlockNode::bn_decode(ctxt,
+                             grp->m_ref,
+                             grp->m_bnh->bn_data(),
+                             i_blksize,
+                             grp->m_bnh->bn_size());
+
+        grp->m_bnh->m_ref = grp->m_ref;
+        grp->m_bnh->m_isdirty = false;
+
+        // The reader's first hit isn't a second use.
+        grp->m_bnh->m_lpre = true;
+
+        bnh = grp->m_bnh;
+
+        // Data blocks are the ones a convergent filesystem dedups.
+        if (ctxt.m_dedupp && dynamic_cast<DataBlockNode *>(&*bnh))
+            ctxt.m_dedupp->insert(grp->m_ref, grp->m_ddepoch);
+    }
+    catch (Exception const & ex)
+    {
+        LOG(lgr, 2, "Prefetcher " << grp->m_ref << ": " << ex.what());
+
+        ACE_Guard<ACE_Thread_Mutex> guard(m_pfmutex);
+        ++m_nfailed;
+    }
+
+    ctxt.m_bncachep->fetch_end(grp->m_ref, bnh);
+
+    release();
+}
+
+void
+Prefetcher::bg_error(void const * i_keydata,
+                     size_t i_keysize,
+                     void const * i_argp,
+                     Exception const & i_exp)
+{
+    auto_ptr<GetRequest> grp((GetRequest *) i_argp);
+
+    LOG(lgr, 6, "Prefetcher " << grp->m_ref << ": " << i_exp.what());
+
+    {
+        ACE_Guard<ACE_Thread_Mutex> guard(m_pfmutex);
+        ++m_nfailed;
+    }
+
+    // Whoever is waiting for it fetches it themselves.
+    grp->m_ctxtp->m_bncachep->fetch_end(grp->m_ref, NULL);
+
+    release();
+}
+
+void
+Prefetcher::get_stats(StatSet & o_ss) const
+{
+    size_t ngets;
+    int64 nissued;
+    int64 nskipped;
+    int64 nfailed;
+
+    {
+        ACE_Guard<ACE_Thread_Mutex> guard(m_pfmutex);
+        ngets = m_ngets;
+        nissued = m_nissued;
+        nskipped = m_nskipped;
+        nfailed = m_nfailed;
+    }
+
+    Stats::set(o_ss, "raget", ngets, 1.0, "%.0f", SF_VALUE);
+    Stats::set(o_ss, "rains", nissued, 1.0, "%.1f/s", SF_DELTA);
+    Stats::set(o_ss, "raskp", nskipped, 1.0, "%.1f/s", SF_DELTA);
+    Stats::set(o_ss, "raerr", nfailed, 1.0, "%.1f/s", SF_DELTA);
+}
+
+bool
+Prefetcher::reserve()
+{
+    ACE_Guard<ACE_Thread_Mutex> guard(m_pfmutex);
+
+    if (!m_running || m_ngets >= m_maxgets)
+    {
+        ++m_nskipped;
+        return false;
+    }
+
+    ++m_ngets;
+    return true;
+}
+
+void
+Prefetcher::release()
+{
+    ACE_Guard<ACE_Thread_Mutex> guard(m_pfmutex);
+
+    if (--m_ngets == 0)
+        m_pfcond.broadcast();
+}
+
+void
+Prefetcher::fetch(Context & i_ctxt,
+                  BlockRef const & i_ref,
+                  BlockNodeHandle const & i_bnh)
+{
+    LOG(lgr, 6, "prefetch " << i_ref);
+
+    GetRequest * grp = new GetRequest;
+    grp->m_ctxtp = &i_ctxt;
+    grp->m_ref = i_ref;
+    grp->m_bnh = i_bnh;
+    grp->m_ddepoch = i_ctxt.m_dedupp ? i_ctxt.m_dedupp->epoch() : 0;
+
+    {
+        ACE_Guard<ACE_Thread_Mutex> guard(m_pfmutex);
+        ++m_nissued;
+    }
+
+    // From here on the completion releases the reference.
+    try
+    {
+        i_ctxt.m_bsh->bs_block_get_async(grp->m_ref.data(),
+                                         grp->m_ref.size(),
+                                         i_bnh->bn_data(),
+                                         i_bnh->bn_size(),
+                                         *this,
+                                         grp);
+    }
+    catch (Exception const & ex)
+    {
+        bg_error(i_ref.data(), i_ref.size(), grp, ex);
+    }
+}
+
+} // namespace UTFS
+
+// Local Variables:
+// mode: C++
+// tab-width: 4
+// c-basic-offset: 4
+// c-file-offsets: ((comment-intro . 0))
+// End:
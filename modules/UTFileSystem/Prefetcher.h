@@ -0,0 +1,126 @@
+#ifndef UTFS_Prefetcher_h__
+#define UTFS_Prefetcher_h__
+
+/// @file Prefetcher.h
+/// Utopia FileSystem Readahead Block Fetcher.
+
+#include <ace/Condition_Thread_Mutex.h>
+#include <ace/Thread_Mutex.h>
+
+#include "utpfwd.h"
+
+#include "BlockStore.h"
+#include "Stats.h"
+#include "Types.h"
+
+#include "utfsexp.h"
+#include "utfsfwd.h"
+
+#include "BlockNodeCache.h"
+#include "BlockRef.h"
+#include "Context.h"
+
+namespace UTFS {
+
+// Fetches blocks ahead of a sequential reader.
+//
+// Readahead traversals (RB_PREFETCH) hand us the references of the
+// blocks they don't find in the clean cache.  The block is read with
+// the non-blocking get straight into a new node, which is decrypted
+// and inserted in the cache on completion.  The reference is marked
+// in flight in the cache while we fetch it, so a reader which gets
+// there first waits for our fetch instead of issuing its own.
+//
+// Readahead is best effort: beyond a fixed number of gets in flight
+// the blocks are skipped, and a failed get is left for the reader to
+// retry.
+//
+class UTFS_EXP Prefetcher : public utp::BlockStore::BlockGetCompletion
+{
+public:
+    Prefetcher();
+
+    virtual ~Prefetcher();
+
+    void init(size_t i_maxgets);
+
+    // Stop issuing gets and wait for those in flight.
+    void term();
+
+    // Returns the node if it's in the clean cache.  Otherwise starts
+    // fetching it, if it isn't already being fetched, and returns
+    // NULL.  T needs a constructor taking the block size and must
+    // persist exactly its bn_data().
+    //
+    template <typename T>
+    utp::RCPtr<T> prefetch(Context & i_ctxt, BlockRef const & i_ref)
+    {
+        return prefetch<T>(i_ctxt, i_ref, i_ctxt.m_blksz);
+    }
+
+    // The same for a node of i_size bytes.
+    template <typename T>
+    utp::RCPtr<T> prefetch(Context & i_ctxt,
+                           BlockRef const & i_ref,
+                           size_t i_size)
+    {
+        BlockNodeHandle bnh = i_ctxt.m_bncachep->lookup(i_ref, false);
+        if (bnh)
+            return dynamic_cast<T *>(&*bnh);
+
+        if (reserve())
+        {
+            if (i_ctxt.m_bncachep->fetch_begin(i_ref))
+                fetch(i_ctxt, i_ref, new T(i_size));
+            else
+                release();
+        }
+
+        return NULL;
+    }
+
+    // BlockGetCompletion
+    virtual void bg_complete(void const * i_keydata,
+                             size_t i_keysize,
+                             void const * i_argp,
+                             size_t i_blksize);
+
+    virtual void bg_error(void const * i_keydata,
+                          size_t i_keysize,
+                          void const * i_argp,
+                          utp::Exception const & i_exp);
+
+    void get_stats(utp::StatSet & o_ss) const;
+
+private:
+    // Takes a get slot, false if we're full or stopped.
+    bool reserve();
+
+    void release();
+
+    // Gets the reserved block into the node.
+    void fetch(Context & i_ctxt,
+               BlockRef const & i_ref,
+               BlockNodeHandle const & i_bnh);
+
+    mutable ACE_Thread_Mutex	m_pfmutex;
+    ACE_Condition_Thread_Mutex	m_pfcond;		// Gets drained
+    bool						m_running;
+    size_t						m_maxgets;
+    size_t						m_ngets;		// Gets in flight
+
+    utp::int64					m_nissued;
+    utp::int64					m_nskipped;		// No slot available
+    utp::int64					m_nfailed;
+};
+
+} // namespace UTFS
+
+// Local Variables:
+// mode: C++
+// tab-width: 4
+// c-basic-offset: 4
+// c-file-offsets: ((comment-intro . 0))
+// End:
+
+#endif // UTFS_Prefetcher_h__
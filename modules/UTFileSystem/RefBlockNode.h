@@ -49,6 +49,12 @@ public:
                               off_t i_blkoff,
                               size_t i_filesz) = 0;
 
+        // Called with the block's node ahead of visiting a block
+        // which isn't part of the file node itself.  Functors which
+        // use the block data after the visit hold the node here.
+        //
+        virtual void bt_hold(BlockNodeHandle const & i_bnh) {}
+
         int bt_retval() const { return m_retval; }
 
     protected:
@@ -91,6 +97,7 @@ public:
     {
         RB_MODIFY_X		= 0x1,	// write-lock required, can dirty nodes
         RB_NOCACHE		= 0x2,	// don't insert in clean cache (refresh)
+        RB_PREFETCH		= 0x4,	// start fetching missing nodes, don't wait
     };
 
     // Traverse range calling functor methods.
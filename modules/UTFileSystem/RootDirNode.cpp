@@ -29,11 +29,25 @@ RootDirNode::RootDirNode(Context & i_ctxt, BlockRef const & i_ref)
     m_sdh = new SpecialDirNode;
 }
 
+RootDirNode::RootDirNode(Context & i_ctxt, FileNode const & i_fn)
+    : DirNode(i_ctxt, i_fn)
+{
+    LOG(lgr, 6, "CTOR");
+
+    m_sdh = new SpecialDirNode;
+}
+
 RootDirNode::~RootDirNode()
 {
     LOG(lgr, 6, "DTOR");
 }
 
+BlockNodeHandle
+RootDirNode::bn_clone() const
+{
+    return new RootDirNode(*this);
+}
+
 void
 RootDirNode::node_traverse(Context & i_ctxt,
                            unsigned int i_flags,
@@ -48,6 +62,7 @@ RootDirNode::node_traverse(Context & i_ctxt,
         if (i_flags & NT_PARENT)
             throw ENOENT;
 
+        NodeGuard guard(fn_rwmutex(), i_flags & NT_UPDATE);
         i_trav.nt_leaf(i_ctxt, *this);
 
         // I think our caller has to do any required update.
@@ -22,8 +22,13 @@ public:
 
     RootDirNode(Context & i_ctxt, BlockRef const & i_ref);
 
+    // Constructor from the root's inode, already fetched.
+    RootDirNode(Context & i_ctxt, FileNode const & i_fn);
+
     virtual ~RootDirNode();
 
+    virtual BlockNodeHandle bn_clone() const;
+
     // Traverse a path.
     virtual void node_traverse(Context & i_ctxt,
                                unsigned int i_flags,
@@ -38,6 +38,12 @@ SymlinkNode::~SymlinkNode()
     LOG(lgr, 6, "DTOR " << bn_blkref());
 }
 
+BlockNodeHandle
+SymlinkNode::bn_clone() const
+{
+    return new SymlinkNode(*this);
+}
+
 int
 SymlinkNode::readlink(Context & i_ctxt,
                       char * o_obuf,
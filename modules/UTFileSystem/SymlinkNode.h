@@ -27,6 +27,8 @@ public:
 
     virtual ~SymlinkNode();
 
+    virtual BlockNodeHandle bn_clone() const;
+
     virtual int readlink(Context & i_ctxt,
                          char * o_obuf,
                          size_t i_size);
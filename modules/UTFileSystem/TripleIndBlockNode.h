@@ -25,11 +25,8 @@ namespace UTFS {
 class UTFS_EXP TripleIndBlockNode : public IndirectBlockNode
 {
 public:
-    // How many digests fit in a packed block.
-    static off_t const NUMREF = (BLKSZ / sizeof(BlockRef));
-
-    // Default constructor.
-    TripleIndBlockNode();
+    // Constructor for a block of i_blksz bytes.
+    TripleIndBlockNode(size_t i_blksz);
 
     // Constructor from blockstore persisted data.
     TripleIndBlockNode(Context & i_ctxt, BlockRef const & i_ref);
@@ -38,6 +35,8 @@ public:
 
     virtual BlockRef const & bn_flush(Context & i_ctxt);
 
+    virtual BlockNodeHandle bn_clone() const;
+
     virtual void bn_tostream(std::ostream & ostrm) const;
 
     virtual bool rb_traverse(Context & i_ctxt,
@@ -1,7 +1,9 @@
+#include <cstdlib>
 #include <sstream>
 #include <string>
 
 #include <ace/Guard_T.h>
+#include <ace/OS_NS_unistd.h>
 
 #include "Base32.h"
 #include "BlockStoreFactory.h"
@@ -13,6 +15,7 @@
 
 #include "DirNode.h"
 #include "FileNode.h"
+#include "Generation.h"
 #include "RootDirNode.h"
 #include "UTFileSystem.h"
 #include "UTStats.h"
@@ -20,9 +23,157 @@
 using namespace std;
 using namespace utp;
 
+namespace {
+
+// Most puts a flush keeps in flight.
+size_t const FLUSH_MAXPUTS = 64;
+
+// Most gets readahead keeps in flight.
+size_t const READAHEAD_MAXGETS = 64;
+
+// Derives the key a convergent filesystem hashes data blocks with
+// from the passphrase's digest.  It's kept apart from the cipher key
+// so the references don't say anything about the key.
+//
+utp::Digest
+convergent_key(utp::Digest const & i_passdig)
+{
+    string buf((char const *) i_passdig.data(), i_passdig.size());
+    buf += "convergent";
+    return utp::Digest(buf.data(), buf.size());
+}
+
+// Applies the filesystem arguments, each of the form name=value:
+//
+//   cachesize=<bytes>   Byte budget of the clean node cache.  A K, M
+//                       or G suffix scales it.
+//
+//   dcachesize=<n>      Most paths the dentry cache holds, 0 turns it
+//                       off.
+//
+//   compress=<method>   Compresses blocks with none (the default), lz4
+//                       or zstd.  Only at mkfs, o_fsparams is NULL
+//                       otherwise.
+//
+//   convergent=<0|1>    Encrypts data blocks so identical blocks are
+//                       stored once.  Only at mkfs.
+//
+//   blocksize=<bytes>   Size of the data and indirect blocks, a power
+//                       of two from 8K (the default) to 1M.  A K or M
+//                       suffix scales it.  Only at mkfs.
+//
+//   extents=<0|1>       Files keep their data in extent trees of
+//                       chunks instead of blocks.  Only at mkfs.
+//
+void
+apply_args(StringSeq const & i_args,
+           UTFS::BlockNodeCache & o_bncache,
+           UTFS::DentryCache & o_dcache,
+           UTFS::FSParams * o_fsparams)
+{
+    for (size_t i = 0; i < i_args.size(); ++i)
+    {
+        string const & arg = i_args[i];
+        string::size_type eq = arg.find('=');
+        string name = arg.substr(0, eq);
+        string value = eq == string::npos ? string() : arg.substr(eq + 1);
+
+        if (name == "cachesize")
+        {
+            char * endp;
+            unsigned long long nbytes = strtoull(value.c_str(), &endp, 0);
+            switch (*endp)
+            {
+            case 'G': case 'g': nbytes *= 1024;		// fall through
+            case 'M': case 'm': nbytes *= 1024;		// fall through
+            case 'K': case 'k': nbytes *= 1024; ++endp;
+            }
+
+            if (value.empty() || *endp != '\0')
+                throwstream(ValueError,
+                            "bad cachesize argument \"" << value << "\"");
+
+            o_bncache.maxbytes(nbytes);
+        }
+        else if (name == "dcachesize")
+        {
+            char * endp;
+            unsigned long nentries = strtoul(value.c_str(), &endp, 0);
+            if (value.empty() || *endp != '\0')
+                throwstream(ValueError,
+                            "bad dcachesize argument \"" << value << "\"");
+
+            o_dcache.maxentries(nentries);
+        }
+        else if (name == "compress")
+        {
+            if (!o_fsparams)
+                throwstream(ValueError,
+                            "compress is only a mkfs argument");
+
+            o_fsparams->set_compression(UTFS::BlockCodec::parse(value));
+        }
+        else if (name == "blocksize")
+        {
+            if (!o_fsparams)
+                throwstream(ValueError,
+                            "blocksize is only a mkfs argument");
+
+            char * endp;
+            unsigned long nbytes = strtoul(value.c_str(), &endp, 0);
+            switch (*endp)
+            {
+            case 'M': case 'm': nbytes *= 1024;		// fall through
+            case 'K': case 'k': nbytes *= 1024; ++endp;
+            }
+
+            if (value.empty() || *endp != '\0' ||
+                nbytes < size_t(UTFS::BlockNode::BLKSZ) ||
+                nbytes > size_t(UTFS::BlockNode::MAXBLKSZ) ||
+                (nbytes & (nbytes - 1)) != 0)
+                throwstream(ValueError,
+                            "bad blocksize argument \"" << value << "\"");
+
+            o_fsparams->set_blocksize(nbytes);
+        }
+        else if (name == "convergent")
+        {
+            if (!o_fsparams)
+                throwstream(ValueError,
+                            "convergent is only a mkfs argument");
+
+            if (value != "0" && value != "1")
+                throwstream(ValueError,
+                            "bad convergent argument \"" << value << "\"");
+
+            o_fsparams->set_convergent(value == "1");
+        }
+        else if (name == "extents")
+        {
+            if (!o_fsparams)
+                throwstream(ValueError,
+                            "extents is only a mkfs argument");
+
+            if (value != "0" && value != "1")
+                throwstream(ValueError,
+                            "bad extents argument \"" << value << "\"");
+
+            o_fsparams->set_extents(value == "1");
+        }
+        else
+        {
+            throwstream(ValueError,
+                        "unknown filesystem argument \"" << arg << "\"");
+        }
+    }
+}
+
+} // end namespace
+
 namespace UTFS {
 
 UTFileSystem::UTFileSystem()
+    : m_syncing(false)
 {
     LOG(lgr, 4, "CTOR");
 }
@@ -47,7 +198,13 @@ UTFileSystem::fs_mkfs(BlockStoreHandle const & i_bsh,
 
     ACE_Write_Guard<ACE_RW_Thread_Mutex> guard(m_utfsrwmutex);
 
+    FSParams fsparams;
+    apply_args(i_args, m_bncache, m_dcache, &fsparams);
+
     m_ctxt.m_bsh = i_bsh;
+    m_ctxt.m_codec.method(BlockCodec::Method(fsparams.compression()));
+    m_ctxt.m_blksz = fsparams.blocksize();
+    m_bncache.blocksize(m_ctxt.m_blksz);
 
     // Save the digest of the fsid.
     m_fsiddig = Digest(i_fsid.data(), i_fsid.size());
@@ -56,16 +213,26 @@ UTFileSystem::fs_mkfs(BlockStoreHandle const & i_bsh,
     Digest dig(i_passphrase.data(), i_passphrase.size());
     m_ctxt.m_cipher.set_key(dig.data(), dig.size());
 
+    m_ctxt.m_cvkey = convergent_key(dig);
+    m_ctxt.m_dedupp = fsparams.convergent() ? &m_dedup : NULL;
+    m_ctxt.m_extents = fsparams.extents();
+
     // Create zero blocks for sparse file reads.
-    m_ctxt.m_zdatobj = new ZeroDataBlockNode();
-    m_ctxt.m_zsinobj = new ZeroIndirectBlockNode(m_ctxt.m_zdatobj);
-    m_ctxt.m_zdinobj = new ZeroDoubleIndBlockNode(m_ctxt.m_zsinobj);
-    m_ctxt.m_ztinobj = new ZeroTripleIndBlockNode(m_ctxt.m_zdinobj);
+    zeroblocks();
 
     m_ctxt.m_bncachep = &m_bncache;
+    m_ctxt.m_flusherp = &m_flusher;
+    m_ctxt.m_prefetchp = &m_prefetcher;
     m_ctxt.m_statsp = &m_stats;
 
-    m_rdh = new RootDirNode(i_uname, i_gname);
+    m_flusher.init(ACE_OS::num_processors_online(), FLUSH_MAXPUTS);
+    m_prefetcher.init(READAHEAD_MAXGETS);
+
+    m_dcache.clear();
+    m_dedup.clear();
+    RootDirNode * rdp = new RootDirNode(i_uname, i_gname);
+    *rdp->mutable_fsparams() = fsparams;
+    m_rdh = rdp;
 
     m_rbr.clear();
 
@@ -85,8 +252,16 @@ UTFileSystem::fs_mount(BlockStoreHandle const & i_bsh,
 
     ACE_Write_Guard<ACE_RW_Thread_Mutex> guard(m_utfsrwmutex);
 
+    apply_args(i_args, m_bncache, m_dcache, NULL);
+
     m_ctxt.m_bsh = i_bsh;
 
+    // Blocks say whether they're compressed, the root's settings
+    // only matter for writing.
+    m_ctxt.m_codec.method(BlockCodec::NONE);
+    m_ctxt.m_dedupp = NULL;
+    m_ctxt.m_extents = false;
+
     // Save the digest of the fsid.
     m_fsiddig = Digest(i_fsid.data(), i_fsid.size());
 
@@ -98,18 +273,64 @@ UTFileSystem::fs_mount(BlockStoreHandle const & i_bsh,
     Digest dig(i_passphrase.data(), i_passphrase.size());
     m_ctxt.m_cipher.set_key(dig.data(), dig.size());
 
-    // Create zero blocks for sparse file reads.
-    m_ctxt.m_zdatobj = new ZeroDataBlockNode();
-    m_ctxt.m_zsinobj = new ZeroIndirectBlockNode(m_ctxt.m_zdatobj);
-    m_ctxt.m_zdinobj = new ZeroDoubleIndBlockNode(m_ctxt.m_zsinobj);
+    m_ctxt.m_cvkey = convergent_key(dig);
 
     m_ctxt.m_bncachep = &m_bncache;
+    m_ctxt.m_flusherp = &m_flusher;
+    m_ctxt.m_prefetchp = &m_prefetcher;
     m_ctxt.m_statsp = &m_stats;
 
+    m_flusher.init(ACE_OS::num_processors_online(), FLUSH_MAXPUTS);
+    m_prefetcher.init(READAHEAD_MAXGETS);
+
+    m_dcache.clear();
+    m_dedup.clear();
+
     try
     {
         LOG(lgr, 6, "before it's " << mkstring(m_hn));
-        m_rdh = new RootDirNode(m_ctxt, rootref());
+
+        // The root's inode is a fixed size.  It holds the block size
+        // the root directory's entries need to be read.
+        FileNodeHandle fnh = new FileNode(m_ctxt, rootref());
+        FSParams const & fsparams = fnh->fsparams();
+
+        unsigned compression = fsparams.compression();
+        if (compression > BlockCodec::ZSTD)
+            throwstream(InternalError, FILELINE
+                        << "unknown compression method " << compression);
+
+        m_ctxt.m_codec.method(BlockCodec::Method(compression));
+        LOG(lgr, 4, "fs_mount compression "
+            << BlockCodec::name(m_ctxt.m_codec.method()));
+
+        if (fsparams.convergent())
+        {
+            LOG(lgr, 4, "fs_mount convergent");
+            m_ctxt.m_dedupp = &m_dedup;
+        }
+
+        if (fsparams.extents())
+        {
+            LOG(lgr, 4, "fs_mount extents");
+            m_ctxt.m_extents = true;
+        }
+
+        size_t blksz = fsparams.blocksize();
+        if (blksz < size_t(BlockNode::BLKSZ) ||
+            blksz > size_t(BlockNode::MAXBLKSZ) ||
+            (blksz & (blksz - 1)) != 0)
+            throwstream(InternalError, FILELINE
+                        << "bad block size " << blksz);
+
+        m_ctxt.m_blksz = blksz;
+        m_bncache.blocksize(blksz);
+        LOG(lgr, 4, "fs_mount blocksize " << blksz);
+
+        // Create zero blocks for sparse file reads.
+        zeroblocks();
+
+        m_rdh = new RootDirNode(m_ctxt, *fnh);
         LOG(lgr, 6, "after it's " << mkstring(m_hn));
     }
     catch (utp::NotFoundError const & ex)
@@ -128,75 +349,180 @@ UTFileSystem::fs_umount()
 {
     LOG(lgr, 4, "fs_umount ");
 
+    ACE_Guard<ACE_Thread_Mutex> sguard(m_syncmutex);
     ACE_Write_Guard<ACE_RW_Thread_Mutex> guard(m_utfsrwmutex);
 
     rootref(m_rdh->bn_flush(m_ctxt));
 
+    m_prefetcher.term();
+    m_flusher.term();
+
+    m_dcache.clear();
+    m_dedup.clear();
     m_rdh = NULL;
     m_ctxt.m_bsh = NULL;
     m_ctxt.m_cipher.unset_key();
+    m_ctxt.m_cvkey = Digest();
+    m_ctxt.m_dedupp = NULL;
     m_fsiddig = Digest();
 }
 
-class GetAttrTraverseFunc : public DirNode::NodeTraverseFunc
+// Notes the leaf a traversal reaches on its way to the real
+// traversal's leaf routine.
+//
+class DentryTraverseFunc : public DirNode::NodeTraverseFunc
 {
 public:
-    GetAttrTraverseFunc(struct statstb * o_stbuf) : m_sbp(o_stbuf) {}
+    DentryTraverseFunc(DirNode::NodeTraverseFunc & i_trav) : m_trav(i_trav) {}
 
     virtual void nt_leaf(Context & i_ctxt, FileNode & i_fn)
     {
-        nt_retval(i_fn.getattr(i_ctxt, m_sbp));
+        m_fnh = &i_fn;
+        m_trav.nt_leaf(i_ctxt, i_fn);
     }
 
+    FileNodeHandle const & fnh() const { return m_fnh; }
+
 private:
-    struct statstb *	m_sbp;
+    DirNode::NodeTraverseFunc &		m_trav;
+    FileNodeHandle					m_fnh;
 };
 
-int
-UTFileSystem::fs_getattr(string const & i_path,
-                         struct statstb * o_stbuf)
-    throw (InternalError)
+namespace {
+
+// Calls the leaf routine of a traversal which doesn't update the
+// tree.  The leaf is resolved through the dentry cache; on a miss the
+// path is traversed from the root and what it finds is cached.
+//
+void
+leaf_traverse(Context & i_ctxt,
+              DentryCache & i_dcache,
+              DirNodeHandle const & i_rdh,
+              string const & i_path,
+              DirNode::NodeTraverseFunc & i_trav)
 {
-    LOG(lgr, 6, "fs_getattr " << i_path);
+    FileNodeHandle fnh;
+    if (i_dcache.lookup(i_path, fnh))
+    {
+        if (!fnh)
+            throw ENOENT;
 
-    // Try first with only a read lock, if we can't resolve everything
-    // with what's already faulted in memory we catch an
-    // OperationError and try again with a write lock ...
+        NodeGuard guard(fnh->fn_rwmutex(), false);
 
+        // A clean node is only still the live one while the clean
+        // cache has it.  Removing another link to it drops it from
+        // there, and the directories will fault in a fresh copy.
+        //
+        BlockNodeHandle bnh;
+        if (!fnh->bn_isdirty())
+            bnh = i_ctxt.m_bncachep->lookup(fnh->bn_blkref());
+
+        if (fnh->bn_isdirty() || (bnh && &*bnh == &*fnh))
+        {
+            i_trav.nt_leaf(i_ctxt, *fnh);
+            return;
+        }
+    }
+
+    uint64 seqno = i_dcache.seqno();
+    DentryTraverseFunc dtf(i_trav);
     try
     {
-        ACE_Read_Guard<ACE_RW_Thread_Mutex> guard(m_utfsrwmutex);
-
         pair<string, string> ps = DirNode::pathsplit(i_path);
-        GetAttrTraverseFunc gatf(o_stbuf);
-        m_rdh->node_traverse(m_ctxt,
-                             DirNode::NT_DEFAULT | DirNode::NT_READONLY,
-                             ps.first, ps.second, gatf);
-
-        LOG(lgr, 6, "fs_getattr " << i_path << " -> " << gatf.nt_retval());
-        return gatf.nt_retval();
+        i_rdh->node_traverse(i_ctxt,
+                             DirNode::NT_DEFAULT,
+                             ps.first, ps.second, dtf);
     }
-    catch (OperationError const & ex)
+    catch (int const & i_errno)
     {
-        LOG(lgr, 6, "fs_getattr " << i_path << " needs write lock");
-        // Fall through to retry w/ write lock ...
+        // Only a missing path is remembered, not the leaf's errors.
+        if (i_errno == ENOENT && !dtf.fnh())
+            i_dcache.insert(i_path, NULL, seqno);
+        throw;
     }
-    catch (int const & i_errno)
+
+    i_dcache.insert(i_path, dtf.fnh(), seqno);
+}
+
+// Calls the leaf routine of a traversal which updates only its leaf.
+//
+// A regular file which is already dirty and has a single link is in
+// its directory's dirty entries, and that directory in its parent's,
+// up to the root.  Passing back through them only marks them dirty
+// again, so such a file found in the dentry cache is updated in
+// place.  Not while a sync stores its freeze (i_direct false): the
+// directories have to be marked changed since the freeze or the thaw
+// would replace them with copies which don't have the update.
+//
+void
+update_traverse(Context & i_ctxt,
+                DentryCache & i_dcache,
+                DirNodeHandle const & i_rdh,
+                bool i_direct,
+                string const & i_path,
+                DirNode::NodeTraverseFunc & i_trav)
+{
+    FileNodeHandle fnh;
+    if (i_direct && i_dcache.lookup(i_path, fnh) && fnh)
     {
-        LOG(lgr, 6, "fs_getattr " << i_path
-            << ": " << ACE_OS::strerror(i_errno));
-        return -i_errno;
+        NodeGuard guard(fnh->fn_rwmutex(), true);
+        if (fnh->bn_isdirty() && fnh->nlink() == 1 && S_ISREG(fnh->mode()))
+        {
+            i_trav.nt_leaf(i_ctxt, *fnh);
+            return;
+        }
     }
 
+    pair<string, string> ps = DirNode::pathsplit(i_path);
+    i_rdh->node_traverse(i_ctxt, DirNode::NT_UPDATE,
+                         ps.first, ps.second, i_trav);
+}
+
+// Invalidates a path in the dentry cache once the operation changing
+// it is done, however it ends.
+//
+class DentryInvalidator
+{
+public:
+    DentryInvalidator(DentryCache & i_dcache, string const & i_path)
+        : m_dcache(i_dcache), m_path(i_path) {}
+
+    ~DentryInvalidator() { m_dcache.invalidate(m_path); }
+
+private:
+    DentryCache &	m_dcache;
+    string const &	m_path;
+};
+
+} // end namespace
+
+class GetAttrTraverseFunc : public DirNode::NodeTraverseFunc
+{
+public:
+    GetAttrTraverseFunc(struct statstb * o_stbuf) : m_sbp(o_stbuf) {}
+
+    virtual void nt_leaf(Context & i_ctxt, FileNode & i_fn)
+    {
+        nt_retval(i_fn.getattr(i_ctxt, m_sbp));
+    }
+
+private:
+    struct statstb *	m_sbp;
+};
+
+int
+UTFileSystem::fs_getattr(string const & i_path,
+                         struct statstb * o_stbuf)
+    throw (InternalError)
+{
+    LOG(lgr, 6, "fs_getattr " << i_path);
+
     try
     {
-        ACE_Write_Guard<ACE_RW_Thread_Mutex> guard(m_utfsrwmutex);
+        ACE_Read_Guard<ACE_RW_Thread_Mutex> guard(m_utfsrwmutex);
 
-        pair<string, string> ps = DirNode::pathsplit(i_path);
         GetAttrTraverseFunc gatf(o_stbuf);
-        m_rdh->node_traverse(m_ctxt,
-                             DirNode::NT_DEFAULT,
-                             ps.first, ps.second, gatf);
+        leaf_traverse(m_ctxt, m_dcache, m_rdh, i_path, gatf);
 
         LOG(lgr, 6, "fs_getattr " << i_path << " -> " << gatf.nt_retval());
         return gatf.nt_retval();
@@ -233,44 +559,12 @@ UTFileSystem::fs_readlink(string const & i_path,
 {
     LOG(lgr, 6, "fs_readlink " << i_path);
 
-    // Try first with only a read lock, if we can't resolve everything
-    // with what's already faulted in memory we catch an
-    // OperationError and try again with a write lock ...
-
     try
     {
         ACE_Read_Guard<ACE_RW_Thread_Mutex> guard(m_utfsrwmutex);
 
-        pair<string, string> ps = DirNode::pathsplit(i_path);
         ReadLinkTraverseFunc rltf(o_obuf, i_size);
-        m_rdh->node_traverse(m_ctxt,
-                             DirNode::NT_DEFAULT | DirNode::NT_READONLY,
-                             ps.first, ps.second, rltf);
-
-        LOG(lgr, 6, "fs_readlink " << i_path << " -> " << rltf.nt_retval());
-        return rltf.nt_retval();
-    }
-    catch (OperationError const & ex)
-    {
-        LOG(lgr, 6, "fs_readlink " << i_path << " needs write lock");
-        // Fall through to retry w/ write lock ...
-    }
-    catch (int const & i_errno)
-    {
-        LOG(lgr, 6, "fs_readlink " << i_path
-            << ": " << ACE_OS::strerror(i_errno));
-        return -i_errno;
-    }
-
-    try
-    {
-        ACE_Write_Guard<ACE_RW_Thread_Mutex> guard(m_utfsrwmutex);
-
-        pair<string, string> ps = DirNode::pathsplit(i_path);
-        ReadLinkTraverseFunc rltf(o_obuf, i_size);
-        m_rdh->node_traverse(m_ctxt,
-                             DirNode::NT_DEFAULT,
-                             ps.first, ps.second, rltf);
+        leaf_traverse(m_ctxt, m_dcache, m_rdh, i_path, rltf);
 
         LOG(lgr, 6, "fs_readlink " << i_path << " -> " << rltf.nt_retval());
         return rltf.nt_retval();
@@ -316,10 +610,12 @@ UTFileSystem::fs_mknod(string const & i_path,
 {
     LOG(lgr, 6, "fs_mknod " << i_path);
 
-    ACE_Write_Guard<ACE_RW_Thread_Mutex> guard(m_utfsrwmutex);
+    ACE_Read_Guard<ACE_RW_Thread_Mutex> guard(m_utfsrwmutex);
 
     try
     {
+        DentryInvalidator dinv(m_dcache, i_path);
+
         pair<string, string> ps = DirNode::pathsplit(i_path);
         MknodTraverseFunc otf(i_mode, i_dev, i_uname, i_gname);
         m_rdh->node_traverse(m_ctxt, DirNode::NT_PARENT | DirNode::NT_UPDATE,
@@ -366,10 +662,12 @@ UTFileSystem::fs_mkdir(string const & i_path,
 {
     LOG(lgr, 6, "fs_mkdir " << i_path);
 
-    ACE_Write_Guard<ACE_RW_Thread_Mutex> guard(m_utfsrwmutex);
+    ACE_Read_Guard<ACE_RW_Thread_Mutex> guard(m_utfsrwmutex);
 
     try
     {
+        DentryInvalidator dinv(m_dcache, i_path);
+
         pair<string, string> ps = DirNode::pathsplit(i_path);
         MkdirTraverseFunc otf(i_mode, i_uname, i_gname);
         m_rdh->node_traverse(m_ctxt, DirNode::NT_PARENT | DirNode::NT_UPDATE,
@@ -408,10 +706,12 @@ UTFileSystem::fs_unlink(string const & i_path)
 {
     LOG(lgr, 6, "fs_unlink " << i_path);
 
-    ACE_Write_Guard<ACE_RW_Thread_Mutex> guard(m_utfsrwmutex);
+    ACE_Read_Guard<ACE_RW_Thread_Mutex> guard(m_utfsrwmutex);
 
     try
     {
+        DentryInvalidator dinv(m_dcache, i_path);
+
         pair<string, string> ps = DirNode::pathsplit(i_path);
         UnlinkTraverseFunc utf(false);
         m_rdh->node_traverse(m_ctxt, DirNode::NT_PARENT | DirNode::NT_UPDATE,
@@ -449,10 +749,12 @@ UTFileSystem::fs_rmdir(string const & i_path)
 {
     LOG(lgr, 6, "fs_rmdir " << i_path);
 
-    ACE_Write_Guard<ACE_RW_Thread_Mutex> guard(m_utfsrwmutex);
+    ACE_Read_Guard<ACE_RW_Thread_Mutex> guard(m_utfsrwmutex);
 
     try
     {
+        DentryInvalidator dinv(m_dcache, i_path);
+
         pair<string, string> ps = DirNode::pathsplit(i_path);
         RmdirTraverseFunc rtf;
         m_rdh->node_traverse(m_ctxt, DirNode::NT_PARENT | DirNode::NT_UPDATE,
@@ -491,10 +793,12 @@ UTFileSystem::fs_symlink(string const & i_opath, string const & i_npath)
 {
     LOG(lgr, 6, "fs_symlink " << i_opath << ' ' << i_npath);
 
-    ACE_Write_Guard<ACE_RW_Thread_Mutex> guard(m_utfsrwmutex);
+    ACE_Read_Guard<ACE_RW_Thread_Mutex> guard(m_utfsrwmutex);
 
     try
     {
+        DentryInvalidator dinv(m_dcache, i_npath);
+
         pair<string, string> ps = DirNode::pathsplit(i_npath);
         SymlinkTraverseFunc stf(i_opath);
         m_rdh->node_traverse(m_ctxt, DirNode::NT_PARENT | DirNode::NT_UPDATE,
@@ -550,16 +854,116 @@ private:
     bool		m_force;
 };
 
+// Renames or links within a single directory, which only needs that
+// directory's lock.
+//
+class SameDirLinkTraverseFunc : public DirNode::NodeTraverseFunc
+{
+public:
+    SameDirLinkTraverseFunc(string const & i_nentry, bool i_isrename)
+        : m_nentry(i_nentry)
+        , m_isrename(i_isrename)
+    {}
+
+    virtual void nt_parent(Context & i_ctxt,
+                           DirNode & i_dn,
+                           string const & i_entry)
+    {
+        BlockRef blkref = i_dn.linksrc(i_ctxt, i_entry);
+        if (!blkref)
+            throw ENOENT;
+
+        // Renaming something to itself does nothing.
+        if (i_entry == m_nentry)
+        {
+            if (!m_isrename)
+                throw EEXIST;
+            nt_retval(0);
+            return;
+        }
+
+        int rv = i_dn.linkdst(i_ctxt, m_nentry, blkref, m_isrename);
+        if (rv == 0 && m_isrename)
+            rv = i_dn.unlink(i_ctxt, i_entry, true);
+        nt_retval(rv);
+    }
+
+private:
+    string		m_nentry;
+    bool		m_isrename;
+};
+
+namespace {
+
+// Splits off the final component, returns false if the two paths
+// aren't in the same directory.
+//
+bool
+samedir(string const & i_opath,
+        string const & i_npath,
+        string & o_nentry)
+{
+    string::size_type opos = i_opath.rfind('/');
+    string::size_type npos = i_npath.rfind('/');
+
+    if (opos == string::npos || npos == string::npos)
+        return false;
+
+    if (i_opath.compare(0, opos, i_npath, 0, npos) != 0)
+        return false;
+
+    o_nentry = i_npath.substr(npos + 1);
+    return !o_nentry.empty() && opos + 1 < i_opath.size();
+}
+
+} // end namespace
+
 int
 UTFileSystem::fs_rename(string const & i_opath, string const & i_npath)
     throw (InternalError)
 {
     LOG(lgr, 6, "fs_rename " << i_opath << ' ' << i_npath);
 
+    // Within one directory we only need to hold the directory.
+    string nentry;
+    if (samedir(i_opath, i_npath, nentry))
+    {
+        ACE_Read_Guard<ACE_RW_Thread_Mutex> guard(m_utfsrwmutex);
+
+        try
+        {
+            DentryInvalidator odinv(m_dcache, i_opath);
+            DentryInvalidator ndinv(m_dcache, i_npath);
+
+            pair<string, string> ops = DirNode::pathsplit(i_opath);
+            SameDirLinkTraverseFunc sdtf(nentry, true);
+            m_rdh->node_traverse(m_ctxt,
+                                 DirNode::NT_PARENT | DirNode::NT_UPDATE,
+                                 ops.first, ops.second, sdtf);
+
+            LOG(lgr, 6, "fs_rename " << i_opath << ' ' << i_npath
+                << " -> " << sdtf.nt_retval());
+            return sdtf.nt_retval();
+        }
+        catch (int const & i_errno)
+        {
+            LOG(lgr, 6, "fs_rename " << i_opath << ' ' << i_npath
+                << ": " << ACE_OS::strerror(i_errno));
+            return -i_errno;
+        }
+    }
+
+    // Between directories the three steps below have to appear
+    // atomic, which holding the tree exclusively guarantees without
+    // ordering locks across two paths.
+    //
     ACE_Write_Guard<ACE_RW_Thread_Mutex> guard(m_utfsrwmutex);
 
     try
     {
+        DentryInvalidator odinv(m_dcache, i_opath);
+        DentryInvalidator ndinv(m_dcache, i_npath);
+
         pair<string, string> ops = DirNode::pathsplit(i_opath);
         pair<string, string> nps = DirNode::pathsplit(i_npath);
 
@@ -596,10 +1000,41 @@ UTFileSystem::fs_link(string const & i_opath, string const & i_npath)
 {
     LOG(lgr, 6, "fs_link " << i_opath << ' ' << i_npath);
 
+    // Within one directory we only need to hold the directory.
+    string nentry;
+    if (samedir(i_opath, i_npath, nentry))
+    {
+        ACE_Read_Guard<ACE_RW_Thread_Mutex> guard(m_utfsrwmutex);
+
+        try
+        {
+            DentryInvalidator ndinv(m_dcache, i_npath);
+
+            pair<string, string> ops = DirNode::pathsplit(i_opath);
+            SameDirLinkTraverseFunc sdtf(nentry, false);
+            m_rdh->node_traverse(m_ctxt,
+                                 DirNode::NT_PARENT | DirNode::NT_UPDATE,
+                                 ops.first, ops.second, sdtf);
+
+            LOG(lgr, 6, "fs_link " << i_opath << ' ' << i_npath
+                << " -> " << sdtf.nt_retval());
+            return sdtf.nt_retval();
+        }
+        catch (int const & i_errno)
+        {
+            LOG(lgr, 6, "fs_link " << i_opath << ' ' << i_npath
+                << ": " << ACE_OS::strerror(i_errno));
+            return -i_errno;
+        }
+    }
+
+    // See fs_rename.
     ACE_Write_Guard<ACE_RW_Thread_Mutex> guard(m_utfsrwmutex);
 
     try
     {
+        DentryInvalidator ndinv(m_dcache, i_npath);
+
         pair<string, string> ops = DirNode::pathsplit(i_opath);
         pair<string, string> nps = DirNode::pathsplit(i_npath);
 
@@ -645,14 +1080,12 @@ UTFileSystem::fs_chmod(string const & i_path, mode_t i_mode)
 {
     LOG(lgr, 6, "fs_chmod " << i_path);
 
-    ACE_Write_Guard<ACE_RW_Thread_Mutex> guard(m_utfsrwmutex);
+    ACE_Read_Guard<ACE_RW_Thread_Mutex> guard(m_utfsrwmutex);
 
     try
     {
-        pair<string, string> ps = DirNode::pathsplit(i_path);
         ChmodTraverseFunc ctf(i_mode);
-        m_rdh->node_traverse(m_ctxt, DirNode::NT_UPDATE,
-                             ps.first, ps.second, ctf);
+        update_traverse(m_ctxt, m_dcache, m_rdh, !m_syncing, i_path, ctf);
 
         LOG(lgr, 6, "fs_chmod " << i_path << " -> " << ctf.nt_retval());
         return ctf.nt_retval();
@@ -689,14 +1122,12 @@ UTFileSystem::fs_chown(string const & i_path,
 {
     LOG(lgr, 6, "fs_chown " << i_path);
 
-    ACE_Write_Guard<ACE_RW_Thread_Mutex> guard(m_utfsrwmutex);
+    ACE_Read_Guard<ACE_RW_Thread_Mutex> guard(m_utfsrwmutex);
 
     try
     {
-        pair<string, string> ps = DirNode::pathsplit(i_path);
         ChownTraverseFunc ctf(i_uname, i_gname);
-        m_rdh->node_traverse(m_ctxt, DirNode::NT_UPDATE,
-                             ps.first, ps.second, ctf);
+        update_traverse(m_ctxt, m_dcache, m_rdh, !m_syncing, i_path, ctf);
 
         LOG(lgr, 6, "fs_chown " << i_path << " -> " << ctf.nt_retval());
         return ctf.nt_retval();
@@ -729,14 +1160,12 @@ UTFileSystem::fs_truncate(string const & i_path, off_t i_size)
 {
     LOG(lgr, 6, "fs_truncate " << i_path << ' ' << i_size);
 
-    ACE_Write_Guard<ACE_RW_Thread_Mutex> guard(m_utfsrwmutex);
+    ACE_Read_Guard<ACE_RW_Thread_Mutex> guard(m_utfsrwmutex);
 
     try
     {
-        pair<string, string> ps = DirNode::pathsplit(i_path);
         TruncateTraverseFunc ttf(i_size);
-        m_rdh->node_traverse(m_ctxt, DirNode::NT_UPDATE,
-                             ps.first, ps.second, ttf);
+        update_traverse(m_ctxt, m_dcache, m_rdh, !m_syncing, i_path, ttf);
 
         LOG(lgr, 6, "fs_truncate " << i_path << " -> " << ttf.nt_retval());
         return ttf.nt_retval();
@@ -771,38 +1200,10 @@ UTFileSystem::fs_open(string const & i_path, int i_flags)
 {
     LOG(lgr, 6, "fs_open " << i_path);
 
-    // Try first with only a read lock, if we can't resolve everything
-    // with what's already faulted in memory we catch an
-    // OperationError and try again with a write lock ...
-
     try
     {
         ACE_Read_Guard<ACE_RW_Thread_Mutex> guard(m_utfsrwmutex);
 
-        pair<string, string> ps = DirNode::pathsplit(i_path);
-        OpenTraverseFunc otf(i_flags);
-        m_rdh->node_traverse(m_ctxt,
-                             DirNode::NT_PARENT | DirNode::NT_READONLY,
-                             ps.first, ps.second, otf);
-        LOG(lgr, 6, "fs_open " << i_path << " -> " << otf.nt_retval());
-        return otf.nt_retval();
-    }
-    catch (OperationError const & ex)
-    {
-        LOG(lgr, 6, "fs_open " << i_path << " needs write lock");
-        // Fall through to retry w/ write lock ...
-    }
-    catch (int const & i_errno)
-    {
-        LOG(lgr, 6, "fs_open " << i_path
-            << ": " << ACE_OS::strerror(i_errno));
-        return -i_errno;
-    }
-
-    try
-    {
-        ACE_Write_Guard<ACE_RW_Thread_Mutex> guard(m_utfsrwmutex);
-
         pair<string, string> ps = DirNode::pathsplit(i_path);
         OpenTraverseFunc otf(i_flags);
         m_rdh->node_traverse(m_ctxt,
@@ -845,19 +1246,12 @@ UTFileSystem::fs_read(string const & i_path,
 {
     LOG(lgr, 6, "fs_read " << i_path << " sz=" << i_size << " off=" << i_off);
 
-    // Try first with only a read lock, if we can't resolve everything
-    // with what's already faulted in memory we catch an
-    // OperationError and try again with a write lock ...
-
     try
     {
         ACE_Read_Guard<ACE_RW_Thread_Mutex> guard(m_utfsrwmutex);
 
-        pair<string, string> ps = DirNode::pathsplit(i_path);
         ReadTraverseFunc wtf(o_bufptr, i_size, i_off);
-        m_rdh->node_traverse(m_ctxt,
-                             DirNode::NT_DEFAULT | DirNode::NT_READONLY,
-                             ps.first, ps.second, wtf);
+        leaf_traverse(m_ctxt, m_dcache, m_rdh, i_path, wtf);
         LOG(lgr, 6, "fs_read " << i_path << " -> " << wtf.nt_retval());
 
         m_stats.m_nrdops += 1;
@@ -865,37 +1259,59 @@ UTFileSystem::fs_read(string const & i_path,
 
         return wtf.nt_retval();
     }
-    catch (OperationError const & ex)
-    {
-        LOG(lgr, 6, "fs_read " << i_path << " needs write lock");
-        // Fall through to retry w/ write lock ...
-    }
     catch (int const & i_errno)
     {
         LOG(lgr, 6, "fs_read " << i_path
             << ": " << ACE_OS::strerror(i_errno));
         return -i_errno;
     }
+}
+
+class ReadVecTraverseFunc : public DirNode::NodeTraverseFunc
+{
+public:
+    ReadVecTraverseFunc(size_t i_size,
+                        off_t i_off,
+                        FileSystem::ReadVecFunc & i_readfunc)
+        : m_size(i_size), m_off(i_off), m_readfunc(i_readfunc) {}
+
+    virtual void nt_leaf(Context & i_ctxt, FileNode & i_fn)
+    {
+        nt_retval(i_fn.read_vec(i_ctxt, m_size, m_off, m_readfunc));
+    }
+
+private:
+    size_t						m_size;
+    off_t						m_off;
+    FileSystem::ReadVecFunc &	m_readfunc;
+};
+
+int
+UTFileSystem::fs_read_vec(string const & i_path,
+                          size_t i_size,
+                          off_t i_off,
+                          ReadVecFunc & o_readfunc)
+    throw (InternalError)
+{
+    LOG(lgr, 6, "fs_read_vec " << i_path
+        << " sz=" << i_size << " off=" << i_off);
 
     try
     {
-        ACE_Write_Guard<ACE_RW_Thread_Mutex> guard(m_utfsrwmutex);
+        ACE_Read_Guard<ACE_RW_Thread_Mutex> guard(m_utfsrwmutex);
 
-        pair<string, string> ps = DirNode::pathsplit(i_path);
-        ReadTraverseFunc wtf(o_bufptr, i_size, i_off);
-        m_rdh->node_traverse(m_ctxt,
-                             DirNode::NT_DEFAULT,
-                             ps.first, ps.second, wtf);
-        LOG(lgr, 6, "fs_read " << i_path << " -> " << wtf.nt_retval());
+        ReadVecTraverseFunc rvtf(i_size, i_off, o_readfunc);
+        leaf_traverse(m_ctxt, m_dcache, m_rdh, i_path, rvtf);
+        LOG(lgr, 6, "fs_read_vec " << i_path << " -> " << rvtf.nt_retval());
 
         m_stats.m_nrdops += 1;
         m_stats.m_nrdbytes += i_size;
 
-        return wtf.nt_retval();
+        return rvtf.nt_retval();
     }
     catch (int const & i_errno)
     {
-        LOG(lgr, 6, "fs_read " << i_path
+        LOG(lgr, 6, "fs_read_vec " << i_path
             << ": " << ACE_OS::strerror(i_errno));
         return -i_errno;
     }
@@ -927,14 +1343,12 @@ UTFileSystem::fs_write(string const & i_path,
 {
     LOG(lgr, 6, "fs_write " << i_path << " sz=" << i_size << " off=" << i_off);
 
-    ACE_Write_Guard<ACE_RW_Thread_Mutex> guard(m_utfsrwmutex);
+    ACE_Read_Guard<ACE_RW_Thread_Mutex> guard(m_utfsrwmutex);
 
     try
     {
-        pair<string, string> ps = DirNode::pathsplit(i_path);
         WriteTraverseFunc wtf(i_data, i_size, i_off);
-        m_rdh->node_traverse(m_ctxt, DirNode::NT_UPDATE,
-                             ps.first, ps.second, wtf);
+        update_traverse(m_ctxt, m_dcache, m_rdh, !m_syncing, i_path, wtf);
 
         LOG(lgr, 6, "fs_write " << i_path << " -> " << wtf.nt_retval());
 
@@ -982,43 +1396,12 @@ UTFileSystem::fs_readdir(string const & i_path,
 {
     LOG(lgr, 6, "fs_readdir " << i_path);
 
-    // Try first with only a read lock, if we can't resolve everything
-    // with what's already faulted in memory we catch an
-    // OperationError and try again with a write lock ...
-
     try
     {
         ACE_Read_Guard<ACE_RW_Thread_Mutex> guard(m_utfsrwmutex);
 
-        pair<string, string> ps = DirNode::pathsplit(i_path);
-        ReadDirTraverseFunc rdtf(i_offset, o_entryfunc);
-        m_rdh->node_traverse(m_ctxt,
-                             DirNode::NT_DEFAULT | DirNode::NT_READONLY,
-                             ps.first, ps.second, rdtf);
-        LOG(lgr, 6, "fs_readdir " << i_path << " -> " << rdtf.nt_retval());
-        return rdtf.nt_retval();
-    }
-    catch (OperationError const & ex)
-    {
-        LOG(lgr, 6, "fs_readdir " << i_path << " needs write lock");
-        // Fall through to retry w/ write lock ...
-    }
-    catch (int const & i_errno)
-    {
-        LOG(lgr, 6, "fs_readdir " << i_path
-            << ": " << ACE_OS::strerror(i_errno));
-        return -i_errno;
-    }
-
-    try
-    {
-        ACE_Write_Guard<ACE_RW_Thread_Mutex> guard(m_utfsrwmutex);
-
-        pair<string, string> ps = DirNode::pathsplit(i_path);
         ReadDirTraverseFunc rdtf(i_offset, o_entryfunc);
-        m_rdh->node_traverse(m_ctxt,
-                             DirNode::NT_DEFAULT,
-                             ps.first, ps.second, rdtf);
+        leaf_traverse(m_ctxt, m_dcache, m_rdh, i_path, rdtf);
         LOG(lgr, 6, "fs_readdir " << i_path << " -> " << rdtf.nt_retval());
         return rdtf.nt_retval();
     }
@@ -1079,43 +1462,12 @@ UTFileSystem::fs_access(string const & i_path, int i_mode)
 {
     LOG(lgr, 6, "fs_access " << i_path);
 
-    // Try first with only a read lock, if we can't resolve everything
-    // with what's already faulted in memory we catch an
-    // OperationError and try again with a write lock ...
-
     try
     {
         ACE_Read_Guard<ACE_RW_Thread_Mutex> guard(m_utfsrwmutex);
 
-        pair<string, string> ps = DirNode::pathsplit(i_path);
         AccessTraverseFunc atf(i_mode);
-        m_rdh->node_traverse(m_ctxt,
-                             DirNode::NT_DEFAULT | DirNode::NT_READONLY,
-                             ps.first, ps.second, atf);
-        LOG(lgr, 6, "fs_access " << i_path << " -> " << atf.nt_retval());
-        return atf.nt_retval();
-    }
-    catch (OperationError const & ex)
-    {
-        LOG(lgr, 6, "fs_access " << i_path << " needs write lock");
-        // Fall through to retry w/ write lock ...
-    }
-    catch (int const & i_errno)
-    {
-        LOG(lgr, 6, "fs_access " << i_path
-            << ": " << ACE_OS::strerror(i_errno));
-        return -i_errno;
-    }
-
-    try
-    {
-        ACE_Write_Guard<ACE_RW_Thread_Mutex> guard(m_utfsrwmutex);
-
-        pair<string, string> ps = DirNode::pathsplit(i_path);
-        AccessTraverseFunc atf(i_mode);
-        m_rdh->node_traverse(m_ctxt,
-                             DirNode::NT_DEFAULT,
-                             ps.first, ps.second, atf);
+        leaf_traverse(m_ctxt, m_dcache, m_rdh, i_path, atf);
         LOG(lgr, 6, "fs_access " << i_path << " -> " << atf.nt_retval());
         return atf.nt_retval();
     }
@@ -1153,14 +1505,12 @@ UTFileSystem::fs_utime(string const & i_path,
 {
     LOG(lgr, 6, "fs_utime " << i_path << ' ' << i_atime << ' ' << i_mtime);
 
-    ACE_Write_Guard<ACE_RW_Thread_Mutex> guard(m_utfsrwmutex);
+    ACE_Read_Guard<ACE_RW_Thread_Mutex> guard(m_utfsrwmutex);
 
     try
     {
-        pair<string, string> ps = DirNode::pathsplit(i_path);
         UtimeTraverseFunc otf(i_atime, i_mtime);
-        m_rdh->node_traverse(m_ctxt, DirNode::NT_UPDATE,
-                             ps.first, ps.second, otf);
+        update_traverse(m_ctxt, m_dcache, m_rdh, !m_syncing, i_path, otf);
 
         LOG(lgr, 6, "fs_utime " << i_path << " -> " << otf.nt_retval());
         return otf.nt_retval();
@@ -1177,6 +1527,10 @@ size_t
 UTFileSystem::fs_refresh()
     throw (InternalError)
 {
+    // The refresh flushes the live tree directly, so that it matches
+    // the published root while the refresh walks it.  Keep syncs out.
+    ACE_Guard<ACE_Thread_Mutex> sguard(m_syncmutex);
+
     {
         ACE_Write_Guard<ACE_RW_Thread_Mutex> guard(m_utfsrwmutex);
 
@@ -1193,22 +1547,47 @@ UTFileSystem::fs_refresh()
         }
     }
 
-    ACE_Read_Guard<ACE_RW_Thread_Mutex> guard(m_utfsrwmutex);
-    
     // Generate a random refresh id.
     uint64 rid;
     Random::fill(&rid, sizeof(rid));
 
-    LOG(lgr, 4, "fs_refresh starting RID=" << rid);
+    size_t nb;
+    {
+        // The refresh holds each node shared as it passes through,
+        // so operations elsewhere in the tree can continue.
+        ACE_Read_Guard<ACE_RW_Thread_Mutex> guard(m_utfsrwmutex);
 
-    // Perform the refresh cycle.
-    m_ctxt.m_bsh->bs_refresh_start(rid);
-    size_t nb = m_rdh->rb_refresh(m_ctxt, rid);
-    m_ctxt.m_bsh->bs_refresh_finish(rid);
+        LOG(lgr, 4, "fs_refresh starting RID=" << rid);
 
-    LOG(lgr, 6, "fs_refresh -> " << nb);
+        // Operations carry on during the refresh and may flush
+        // blocks; none may be skipped on the strength of a block the
+        // refresh could collect.  Afterwards whatever the tree holds
+        // was refreshed, but the index may remember others.
+        m_dedup.suspend();
+
+        // Perform the refresh cycle.
+        try
+        {
+            m_ctxt.m_bsh->bs_refresh_start(rid);
+            {
+                NodeGuard rguard(m_rdh->fn_rwmutex(), false);
+                nb = m_rdh->rb_refresh(m_ctxt, rid);
+            }
+            m_ctxt.m_bsh->bs_refresh_finish(rid);
+        }
+        catch (...)
+        {
+            m_dedup.resume();
+            throw;
+        }
+
+        m_dedup.resume();
+
+        LOG(lgr, 6, "fs_refresh -> " << nb);
+    }
 
     // If we failed to sync earlier try again here..
+    ACE_Write_Guard<ACE_RW_Thread_Mutex> guard(m_utfsrwmutex);
     if (m_rdh->bn_isdirty())
         rootref(m_rdh->bn_flush(m_ctxt));
 
@@ -1224,16 +1603,55 @@ UTFileSystem::fs_sync()
 {
     LOG(lgr, 6, "fs_sync");
 
-    // Yes, we think this is a non-modifying function!
-    //
-    // This function takes a long time when the tree is heavily
-    // written; it's a major improvement allowing other read-only
-    // operations to take place concurrently ...
+    // One sync at a time, each publishes a newer root than the last.
+    ACE_Guard<ACE_Thread_Mutex> sguard(m_syncmutex);
+
+    // Freeze the dirty tree.  Copying it in memory is all we do with
+    // the tree to ourselves.
+    Generation gen;
+    DirNodeHandle fdh;
+    {
+        ACE_Write_Guard<ACE_RW_Thread_Mutex> guard(m_utfsrwmutex);
+
+        if (!m_rdh->bn_isdirty())
+            return;
+
+        fdh = gen.freeze(m_rdh);
+        m_syncing = true;
+    }
+
+    LOG(lgr, 6, "fs_sync froze " << gen.size() << " nodes");
+
+    // Store the frozen copy while operations carry on with the live
+    // tree.  If this throws the live tree is still dirty and the next
+    // sync stores it again.
     //
-    ACE_Write_Guard<ACE_RW_Thread_Mutex> guard(m_utfsrwmutex);
+    BlockRef ref;
+    try
+    {
+        ref = fdh->bn_flush(m_ctxt);
+    }
+    catch (...)
+    {
+        ACE_Write_Guard<ACE_RW_Thread_Mutex> guard(m_utfsrwmutex);
+        m_syncing = false;
+        throw;
+    }
 
-    if (m_rdh->bn_isdirty())
-        rootref(m_rdh->bn_flush(m_ctxt));
+    {
+        ACE_Write_Guard<ACE_RW_Thread_Mutex> guard(m_utfsrwmutex);
+        m_syncing = false;
+
+        // Whatever hasn't changed since the freeze is now clean.
+        BlockNodeHandle bnh = gen.thaw(m_rdh);
+        if (bnh)
+            m_rdh = dynamic_cast<DirNode *>(&*bnh);
+
+        // The cached paths may lead to the nodes just replaced.
+        m_dcache.clear();
+    }
+
+    rootref(ref);
 }
 
 void
@@ -1253,13 +1671,38 @@ UTFileSystem::fs_get_stats(StatSet & o_ss) const
 
     Stats::set(o_ss, "gbps", m_stats.m_ngbytes.value(), 1.0/1024.0, "%.1fKB/s", SF_DELTA);
     Stats::set(o_ss, "pbps", m_stats.m_npbytes.value(), 1.0/1024.0, "%.1fKB/s", SF_DELTA);
+    Stats::set(o_ss, "pdps", m_stats.m_npdbytes.value(), 1.0/1024.0, "%.1fKB/s", SF_DELTA);
+
+    Stats::set(o_ss, "ddps", m_stats.m_ndedups.value(), 1.0, "%.1f/s", SF_DELTA);
+    Stats::set(o_ss, "ddbps", m_stats.m_ndedupbytes.value(), 1.0/1024.0, "%.1fKB/s", SF_DELTA);
+
+    Stats::set(o_ss, "wbuf", m_stats.m_nwbbytes.value(), 1.0/1024.0, "%.0fKB", SF_VALUE);
 
     m_bncache.get_stats(o_ss);
+
+    m_dcache.get_stats(o_ss);
+
+    m_flusher.get_stats(o_ss);
+
+    m_prefetcher.get_stats(o_ss);
+
+    m_dedup.get_stats(o_ss);
+}
+
+void
+UTFileSystem::zeroblocks()
+{
+    m_ctxt.m_zdatobj = new ZeroDataBlockNode(m_ctxt.m_blksz);
+    m_ctxt.m_zsinobj = new ZeroIndirectBlockNode(m_ctxt.m_zdatobj);
+    m_ctxt.m_zdinobj = new ZeroDoubleIndBlockNode(m_ctxt.m_zsinobj);
+    m_ctxt.m_ztinobj = new ZeroTripleIndBlockNode(m_ctxt.m_zdinobj);
 }
 
 void
 UTFileSystem::rootref(BlockRef const & i_blkref)
 {
+    ACE_Guard<ACE_Thread_Mutex> guard(m_rootmutex);
+
     LOG(lgr, 6, "rootref set " << m_rbr << " -> " << i_blkref);
 
     // If this block reference is the same as the last ignore it.
@@ -1312,6 +1755,8 @@ UTFileSystem::rootref(BlockRef const & i_blkref)
 BlockRef
 UTFileSystem::rootref()
 {
+    ACE_Guard<ACE_Thread_Mutex> guard(m_rootmutex);
+
     HeadNodeSeq hns;
     m_ctxt.m_bsh->bs_head_furthest(m_hn, hns);
 
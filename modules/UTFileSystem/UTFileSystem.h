@@ -8,6 +8,7 @@
 #include <string>
 
 #include <ace/RW_Thread_Mutex.h>
+#include <ace/Thread_Mutex.h>
 
 #include "utpfwd.h"
 
@@ -19,6 +20,10 @@
 
 #include "BlockNodeCache.h"
 #include "Context.h"
+#include "DedupIndex.h"
+#include "DentryCache.h"
+#include "Flusher.h"
+#include "Prefetcher.h"
 
 #include "utfsexp.h"
 #include "utfsfwd.h"
@@ -118,6 +123,12 @@ public:
                         off_t i_off)
         throw (utp::InternalError);
 
+    virtual int fs_read_vec(std::string const & i_path,
+                            size_t i_size,
+                            off_t i_off,
+                            ReadVecFunc & o_readfunc)
+        throw (utp::InternalError);
+
     virtual int fs_write(std::string const & i_path,
                          void const * i_data,
                          size_t i_size,
@@ -156,24 +167,80 @@ protected:
 
     BlockRef rootref();
 
+    // Creates the zero blocks for the filesystem's block size.
+    void zeroblocks();
+
 private:
     utp::Digest								m_fsiddig;
 
-    // This mutex is used to protect the structure of the filesystem.
-    // Almost all operations need it ...
+    // Lock order, a thread only acquires locks further down the list
+    // than the ones it holds:
+    //
+    // 0. m_syncmutex serializes syncs, refreshes and unmounts so the
+    //    roots they publish are in order.  A sync holds it, and no
+    //    other lock, while it stores its frozen Generation.
+    //
+    // 1. m_utfsrwmutex protects the tree as a whole.  Operations hold
+    //    it shared.  Freezing and thawing a sync, flushing the live
+    //    tree (unmount, refresh), mounting and renames or links
+    //    between two directories hold it exclusively.
+    //
+    // 2. Each node's fn_rwmutex, parent before child, down the path
+    //    being traversed.  Directories are held shared as the
+    //    traversal passes through them; the directory whose entries
+    //    are changed and a leaf which is modified are held
+    //    exclusively.  Locks are never taken up the tree, so two
+    //    traversals can't wait on each other.
+    //
+    // 2a. A hashed directory's bucket mutex, held while a traversal
+    //    holding the directory shared reads in one of its buckets.
+    //
+    // 3. A node's fn_mdmutex, held briefly to mark a directory dirty
+    //    on the way back up or to read its dirty entries.
+    //
+    // 4. The BlockNodeCache mutex.  It isn't held while a node is
+    //    fetched; a traversal faulting in a node which another is
+    //    already fetching waits for that fetch instead of issuing
+    //    its own, so faulting never needs more than a shared lock.
+    //
+    // 5. The DentryCache mutex, only held within the cache's own
+    //    methods.  Paths are resolved through it and invalidated
+    //    with no node locks held.
     //
+    // 6. The DedupIndex mutex, only held within the index's own
+    //    methods.  Flush workers and put completions take it with
+    //    nothing else held.
+    //
+    // m_rootmutex protects the head node and root reference and is
+    // only held around their update and the blockstore calls which
+    // publish them.
+    //
+    ACE_Thread_Mutex						m_syncmutex;
+
     mutable ACE_RW_Thread_Mutex				m_utfsrwmutex;
 
+    ACE_Thread_Mutex						m_rootmutex;
+
     Context									m_ctxt;
 
     DirNodeHandle							m_rdh;
 
+    bool									m_syncing;	// Storing a freeze
+
     utp::HeadNode							m_hn;
 
     BlockRef								m_rbr;
 
     BlockNodeCache							m_bncache;
 
+    DentryCache								m_dcache;
+
+    DedupIndex								m_dedup;
+
+    Flusher									m_flusher;
+
+    Prefetcher								m_prefetcher;
+
     UTStats									m_stats;
 };
 
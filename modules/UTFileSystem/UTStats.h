@@ -29,6 +29,14 @@ struct UTFS_EXP UTStats
     utp::AtomicLong 			m_npops;
     utp::AtomicLong 			m_ngbytes;
     utp::AtomicLong 			m_npbytes;
+    utp::AtomicLong				m_npdbytes;		// Before compression
+
+    // Puts skipped, the block was already stored (convergent).
+    utp::AtomicLong				m_ndedups;
+    utp::AtomicLong				m_ndedupbytes;
+
+    // Write-behind bytes buffered in FileNodes.
+    utp::AtomicLong				m_nwbbytes;
 
     // Constructor clears.
     UTStats()
@@ -40,6 +48,10 @@ struct UTFS_EXP UTStats
         , m_npops(0)
         , m_ngbytes(0)
         , m_npbytes(0)
+        , m_npdbytes(0)
+        , m_ndedups(0)
+        , m_ndedupbytes(0)
+        , m_nwbbytes(0)
     {
     }
 
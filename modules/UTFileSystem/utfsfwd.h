@@ -24,6 +24,10 @@ class IndirectBlockNode;
 /// Handle to IndirectBlockNode object.
 typedef utp::RCPtr<IndirectBlockNode> IndirectBlockNodeHandle;
 
+class ExtentNode;
+/// Handle to ExtentNode object.
+typedef utp::RCPtr<ExtentNode> ExtentNodeHandle;
+
 class RefBlockNode;
 /// Handle to RefBlockNode object.
 typedef utp::RCPtr<RefBlockNode> RefBlockNodeHandle;
@@ -52,6 +56,13 @@ typedef std::list<BlockNodeHandle> BlockNodeList;
 
 class BlockNodeCache;
 
+class BlockCodec;
+class DedupIndex;
+class DentryCache;
+class Flusher;
+class Generation;
+class Prefetcher;
+
 } // end namespace utp
 
 // Local Variables:
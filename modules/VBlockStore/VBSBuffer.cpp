@@ -0,0 +1,121 @@
+#include <vector>
+
+#include <ace/Thread_Mutex.h>
+
+#include "Except.h"
+#include "Log.h"
+
+#include "VBSBuffer.h"
+#include "vbslog.h"
+
+using namespace std;
+using namespace utp;
+
+namespace {
+
+// Most blocks are the same size so a handful of buffers cover the
+// requests in flight; anything beyond this is freed.
+size_t const MAXPOOLED = 64;
+
+// Very large buffers aren't worth holding on to.
+size_t const MAXPOOLSIZE = 1024 * 1024;
+
+ACE_Thread_Mutex g_poolmutex;
+vector<OctetSeq> g_pool;
+int64 g_nhits = 0;
+int64 g_nmisses = 0;
+
+} // end namespace
+
+namespace VBS {
+
+VBSBufferHandle
+VBSBuffer::alloc(size_t i_size)
+{
+    return new VBSBuffer(i_size);
+}
+
+VBSBufferHandle
+VBSBuffer::copy(void const * i_data, size_t i_size)
+{
+    VBSBufferHandle bh = alloc(i_size);
+    if (i_size)
+        ACE_OS::memcpy(bh->data(), i_data, i_size);
+    return bh;
+}
+
+void
+VBSBuffer::pool_stats(int64 & o_nhits, int64 & o_nmisses, size_t & o_npooled)
+{
+    ACE_Guard<ACE_Thread_Mutex> guard(g_poolmutex);
+    o_nhits = g_nhits;
+    o_nmisses = g_nmisses;
+    o_npooled = g_pool.size();
+}
+
+VBSBuffer::VBSBuffer(size_t i_size)
+    : m_size(i_size)
+{
+    if (i_size)
+    {
+        ACE_Guard<ACE_Thread_Mutex> guard(g_poolmutex);
+
+        // Take the most recently returned buffer which fits without
+        // wasting more than half of it; it is the most likely to
+        // still be in cache.  The pooled vectors are only ever
+        // swapped, never copied.
+        for (size_t ii = g_pool.size(); ii > 0; --ii)
+        {
+            size_t const sz = g_pool[ii - 1].size();
+            if (sz >= i_size && sz / 2 <= i_size)
+            {
+                g_pool[ii - 1].swap(g_pool.back());
+                m_data.swap(g_pool.back());
+                g_pool.pop_back();
+                break;
+            }
+        }
+
+        if (m_data.size() >= i_size)
+            ++g_nhits;
+        else
+            ++g_nmisses;
+    }
+
+    if (m_data.size() < i_size)
+        m_data.resize(i_size);
+}
+
+VBSBuffer::~VBSBuffer()
+{
+    if (m_data.empty() || m_data.size() > MAXPOOLSIZE)
+        return;
+
+    ACE_Guard<ACE_Thread_Mutex> guard(g_poolmutex);
+    if (g_pool.capacity() < MAXPOOLED)
+        g_pool.reserve(MAXPOOLED);
+    if (g_pool.size() < MAXPOOLED)
+    {
+        g_pool.push_back(OctetSeq());
+        g_pool.back().swap(m_data);
+    }
+}
+
+void
+VBSBuffer::truncate(size_t i_size)
+{
+    if (i_size > m_size)
+        throwstream(InternalError, FILELINE
+                    << "can't grow buffer from " << m_size
+                    << " to " << i_size);
+    m_size = i_size;
+}
+
+} // namespace VBS
+
+// Local Variables:
+// mode: C++
+// tab-width: 4
+// c-basic-offset: 4
+// c-file-offsets: ((comment-intro . 0))
+// End:
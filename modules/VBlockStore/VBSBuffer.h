@@ -0,0 +1,62 @@
+#ifndef VBSBuffer_h__
+#define VBSBuffer_h__
+
+/// @file VBSBuffer.h
+/// Virtual BlockStore Pooled Block Buffer
+
+#include "RC.h"
+#include "Types.h"
+
+#include "vbsexp.h"
+#include "vbsfwd.h"
+
+namespace VBS {
+
+// Reference counted block buffer shared between the requests working
+// on the same block.  The storage is returned to a small free pool
+// when the last reference goes away so the request path doesn't
+// allocate a new block for each get and put.
+//
+class VBS_EXP VBSBuffer : public virtual utp::RCObj
+{
+public:
+    // Returns a buffer of i_size bytes, reusing pooled storage when
+    // there is some.  The contents are undefined.
+    static VBSBufferHandle alloc(size_t i_size);
+
+    // Returns a buffer holding a copy of the data.
+    static VBSBufferHandle copy(void const * i_data, size_t i_size);
+
+    // Pool activity counters, for stats.
+    static void pool_stats(utp::int64 & o_nhits,
+                           utp::int64 & o_nmisses,
+                           size_t & o_npooled);
+
+    virtual ~VBSBuffer();
+
+    utp::uint8 * data() { return m_size ? &m_data[0] : NULL; }
+
+    utp::uint8 const * data() const { return m_size ? &m_data[0] : NULL; }
+
+    size_t size() const { return m_size; }
+
+    // Shrinks the valid length, the storage is kept.
+    void truncate(size_t i_size);
+
+private:
+    VBSBuffer(size_t i_size);
+
+    utp::OctetSeq						m_data;		// Storage, may be larger
+    size_t								m_size;		// Valid length
+};
+
+} // namespace VBS
+
+// Local Variables:
+// mode: C++
+// tab-width: 4
+// c-basic-offset: 4
+// c-file-offsets: ((comment-intro . 0))
+// End:
+
+#endif // VBSBuffer_h__
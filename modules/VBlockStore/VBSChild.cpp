@@ -1,3 +1,5 @@
+#include <algorithm>
+
 #include <ace/Reactor.h>
 
 #include "BlockStoreFactory.h"
@@ -15,6 +17,32 @@
 using namespace std;
 using namespace utp;
 
+namespace {
+
+// Pass increment for a class of weight one.
+int64 const STRIDE = 1 << 20;
+
+// How far late gets may run the get class's pass ahead of the class
+// which is due.  Gets of weight w may jump the queue w times before
+// the due class is served again.
+int64 const MAXLEAD = STRIDE;
+
+// Smoothing factor for the breaker's error rate and latency.
+double const EWMA_ALPHA = 0.1;
+
+// Don't judge a child on fewer completions than this.
+long const MINSAMPLES = 20;
+
+// Wait before the first probe, doubled each time a probe fails.
+double const COOLDOWN_MIN = 5.0;
+double const COOLDOWN_MAX = 60.0;
+
+// Probes ask for a key which shouldn't exist; NotFound means the
+// child is answering.
+char const PROBEKEY[] = "VBS health probe";
+
+} // end namespace
+
 namespace VBS {
 
 VBSChild::VBSChild(VBlockStore & i_vbs,
@@ -28,9 +56,24 @@ VBSChild::VBSChild(VBlockStore & i_vbs,
     , m_getbytes(0)
     , m_putcount(0)
     , m_putbytes(0)
+    , m_vtime(0)
+    , m_ndeadline(0)
+    , m_running(true)
+    , m_brkstate(BS_CLOSED)
+    , m_errewma(0.0)
+    , m_latewma(0.0)
+    , m_nsamples(0)
+    , m_cooldown(COOLDOWN_MIN)
+    , m_ntrips(0)
 {
     LOG(lgr, 4, m_instname << ' ' << "CTOR");
 
+    for (int sc = 0; sc < SC_NCLASSES; ++sc)
+    {
+        m_pass[sc] = 0;
+        m_served[sc] = 0;
+    }
+
     m_bsh = BlockStoreFactory::lookup(i_instname);
 
     m_bsh->bs_register_unsathandler(this, NULL);
@@ -71,6 +114,22 @@ VBSChild::handle_exception(ACE_HANDLE fd)
     return 0;
 }
 
+int
+VBSChild::handle_timeout(ACE_Time_Value const & current_time,
+                         void const * act)
+{
+    {
+        ACE_Guard<ACE_Thread_Mutex> guard(m_chldmutex);
+        if (!m_running || m_brkstate != BS_OPEN)
+            return 0;
+        m_brkstate = BS_PROBING;
+    }
+
+    breaker_probe();
+
+    return 0;
+}
+
 void
 VBSChild::uh_unsaturated(void const * i_argp)
 {
@@ -85,7 +144,24 @@ VBSChild::enqueue_get(VBSGetRequestHandle const & i_grh)
 
     ACE_Guard<ACE_Thread_Mutex> guard(m_chldmutex);
 
-    m_getreqs.push_back(i_grh);
+    if (m_getreqs.empty())
+        activate(SC_GET);
+
+    // Keep the queue ordered by priority and then deadline.  New
+    // requests almost always belong at the back so search from there.
+    //
+    std::deque<VBSGetRequestHandle>::iterator pos = m_getreqs.end();
+    while (pos != m_getreqs.begin())
+    {
+        VBSGetRequestHandle const & prev = *(pos - 1);
+        if (prev->priority() > i_grh->priority())
+            break;
+        if (prev->priority() == i_grh->priority() &&
+            prev->deadline() <= i_grh->deadline())
+            break;
+        --pos;
+    }
+    m_getreqs.insert(pos, i_grh);
 
     if (!m_notified)
     {
@@ -101,6 +177,9 @@ VBSChild::enqueue_put(VBSPutRequestHandle const & i_prh)
 
     ACE_Guard<ACE_Thread_Mutex> guard(m_chldmutex);
 
+    if (m_putreqs.empty())
+        activate(SC_PUT);
+
     m_putreqs.push_back(i_prh);
 
     if (!m_notified)
@@ -117,6 +196,9 @@ VBSChild::enqueue_refresh(VBSRequestHandle const & i_rh)
 
     ACE_Guard<ACE_Thread_Mutex> guard(m_chldmutex);
 
+    if (m_refreqs.empty())
+        activate(SC_REFRESH);
+
     m_refreqs.push_back(i_rh);
 
     if (!m_notified)
@@ -133,6 +215,9 @@ VBSChild::enqueue_headnode(VBSRequestHandle const & i_rh)
 
     ACE_Guard<ACE_Thread_Mutex> guard(m_chldmutex);
 
+    if (m_shereqs.empty())
+        activate(SC_HEADNODE);
+
     m_shereqs.push_back(i_rh);
 
     if (!m_notified)
@@ -185,6 +270,157 @@ VBSChild::report_put(size_t i_nbytes)
     m_putbytes += i_nbytes;
 }
 
+void
+VBSChild::bg_complete(void const * i_keydata,
+                      size_t i_keysize,
+                      void const * i_argp,
+                      size_t i_blksize)
+{
+    // Odd that the probe key exists, but the child is answering.
+    breaker_reset();
+}
+
+void
+VBSChild::bg_error(void const * i_keydata,
+                   size_t i_keysize,
+                   void const * i_argp,
+                   Exception const & i_exp)
+{
+    if (i_exp.type() == Exception::T_NOTFOUND)
+    {
+        breaker_reset();
+        return;
+    }
+
+    LOG(lgr, 2, m_instname << ' ' << "probe failed: " << i_exp.what());
+
+    // Opening again counts as another trip.
+    {
+        ACE_Guard<ACE_Thread_Mutex> guard(m_chldmutex);
+        m_cooldown = min(m_cooldown * 2.0, COOLDOWN_MAX);
+        ++m_ntrips;
+    }
+
+    breaker_trip();
+}
+
+void
+VBSChild::report_done(VBSSchedClass i_sc, VBSRequest & i_req, bool i_failed)
+{
+    T64 const dt = i_req.elapsed(this);
+
+    // Requests canceled before they were started don't count.
+    if (dt.usec() < 0)
+        return;
+
+    m_latency[i_sc].record(dt.usec());
+
+    // Only the data path feeds the breaker.
+    if (i_sc != SC_GET && i_sc != SC_PUT)
+        return;
+
+    double errlimit;
+    T64 latlimit;
+    m_vbs.breaker_limits(errlimit, latlimit);
+
+    bool do_trip = false;
+    {
+        ACE_Guard<ACE_Thread_Mutex> guard(m_chldmutex);
+
+        m_errewma += EWMA_ALPHA * ((i_failed ? 1.0 : 0.0) - m_errewma);
+        m_latewma += EWMA_ALPHA * (double(dt.usec()) - m_latewma);
+        ++m_nsamples;
+
+        if (m_running &&
+            m_brkstate == BS_CLOSED &&
+            m_nsamples >= MINSAMPLES &&
+            ((errlimit > 0.0 && m_errewma > errlimit) ||
+             (latlimit.usec() > 0 && m_latewma > double(latlimit.usec()))))
+        {
+            LOG(lgr, 2, m_instname << ' ' << "circuit breaker tripped:"
+                << " errors " << m_errewma
+                << " latency " << m_latewma << " usec");
+
+            ++m_ntrips;
+            do_trip = true;
+        }
+    }
+
+    if (do_trip)
+        breaker_trip();
+}
+
+bool
+VBSChild::healthy() const
+{
+    ACE_Guard<ACE_Thread_Mutex> guard(m_chldmutex);
+    return m_brkstate == BS_CLOSED;
+}
+
+void
+VBSChild::term()
+{
+    {
+        ACE_Guard<ACE_Thread_Mutex> guard(m_chldmutex);
+        if (!m_running)
+            return;
+        m_running = false;
+    }
+
+    m_reactor->cancel_timer(this, DONT_CALL);
+}
+
+void
+VBSChild::breaker_trip()
+{
+    ACE_Time_Value delay;
+    {
+        ACE_Guard<ACE_Thread_Mutex> guard(m_chldmutex);
+        if (!m_running)
+            return;
+        m_brkstate = BS_OPEN;
+        delay.set(m_cooldown);
+    }
+
+    // Probe once the cooldown has passed.
+    m_reactor->schedule_timer(this, NULL, delay);
+}
+
+void
+VBSChild::breaker_reset()
+{
+    LOG(lgr, 2, m_instname << ' ' << "probe succeeded, back in service");
+
+    ACE_Guard<ACE_Thread_Mutex> guard(m_chldmutex);
+    m_brkstate = BS_CLOSED;
+    m_errewma = 0.0;
+    m_latewma = 0.0;
+    m_nsamples = 0;
+    m_cooldown = COOLDOWN_MIN;
+}
+
+void
+VBSChild::breaker_probe()
+{
+    LOG(lgr, 4, m_instname << ' ' << "probing");
+
+    VBSGetRequestHandle grh = new VBSGetRequest(m_vbs,
+                                                1,
+                                                PROBEKEY,
+                                                sizeof(PROBEKEY) - 1,
+                                                NULL,
+                                                64 * 1024,
+                                                this,
+                                                NULL);
+    grh->background();
+    grh->norepair();
+
+    // Registered so bs_sync waits for it like any other request.
+    m_vbs.insert_req(grh);
+
+    enqueue_get(grh);
+}
+
 void
 VBSChild::get_stats(StatSet & o_ss) const
 {
@@ -199,6 +435,10 @@ VBSChild::get_stats(StatSet & o_ss) const
     int64 getb;
     int64 nput;
     int64 putb;
+    int64 served[SC_NCLASSES];
+    int64 ndeadline;
+    int brkstate;
+    int64 ntrips;
     {
         ACE_Guard<ACE_Thread_Mutex> guard(m_chldmutex);
         getq = m_getreqs.size();
@@ -210,6 +450,11 @@ VBSChild::get_stats(StatSet & o_ss) const
         getb = m_getbytes;
         nput = m_putcount;
         putb = m_putbytes;
+        for (int sc = 0; sc < SC_NCLASSES; ++sc)
+            served[sc] = m_served[sc];
+        ndeadline = m_ndeadline;
+        brkstate = m_brkstate;
+        ntrips = m_ntrips;
     }
 
     // Report queue lengths.
@@ -224,6 +469,31 @@ VBSChild::get_stats(StatSet & o_ss) const
     Stats::set(o_ss, "gbps", getb, 1.0/1024.0, "%.1fKB/s", SF_DELTA);
     Stats::set(o_ss, "prps", nput, 1.0, "%.1f/s", SF_DELTA);
     Stats::set(o_ss, "pbps", putb, 1.0/1024.0, "%.1fKB/s", SF_DELTA);
+
+    // Report how the scheduler is dividing the requests.
+    Stats::set(o_ss, "srps", served[SC_REFRESH], 1.0, "%.1f/s", SF_DELTA);
+    Stats::set(o_ss, "shps", served[SC_HEADNODE], 1.0, "%.1f/s", SF_DELTA);
+    Stats::set(o_ss, "sgps", served[SC_GET], 1.0, "%.1f/s", SF_DELTA);
+    Stats::set(o_ss, "spps", served[SC_PUT], 1.0, "%.1f/s", SF_DELTA);
+    Stats::set(o_ss, "gdlm", ndeadline, 1.0, "%.0f", SF_VALUE);
+
+    // Report latency percentiles.
+    Stats::set(o_ss, "glp50", m_latency[SC_GET].percentile(50.0),
+               1.0/1000.0, "%.1fms", SF_VALUE);
+    Stats::set(o_ss, "glp99", m_latency[SC_GET].percentile(99.0),
+               1.0/1000.0, "%.1fms", SF_VALUE);
+    Stats::set(o_ss, "plp50", m_latency[SC_PUT].percentile(50.0),
+               1.0/1000.0, "%.1fms", SF_VALUE);
+    Stats::set(o_ss, "plp99", m_latency[SC_PUT].percentile(99.0),
+               1.0/1000.0, "%.1fms", SF_VALUE);
+    Stats::set(o_ss, "rlp99", m_latency[SC_REFRESH].percentile(99.0),
+               1.0/1000.0, "%.1fms", SF_VALUE);
+    Stats::set(o_ss, "hlp99", m_latency[SC_HEADNODE].percentile(99.0),
+               1.0/1000.0, "%.1fms", SF_VALUE);
+
+    // Report circuit breaker state (0 closed, 1 open, 2 probing).
+    Stats::set(o_ss, "brk", brkstate, 1.0, "%.0f", SF_VALUE);
+    Stats::set(o_ss, "btrip", ntrips, 1.0, "%.0f", SF_VALUE);
 }
 
 void
@@ -241,19 +511,35 @@ VBSChild::needed_keys_size()
     return m_neededkeys.size();
 }
 
+bool
+VBSChild::needed_keys_pop(OctetSeq & o_key)
+{
+    ACE_Guard<ACE_Thread_Mutex> guard(m_chldmutex);
+    if (m_neededkeys.empty())
+        return false;
+
+    o_key = m_neededkeys.front();
+    m_neededkeys.pop_front();
+    return true;
+}
+
+void
+VBSChild::needed_keys_copy(vector<OctetSeq> & o_keys)
+{
+    ACE_Guard<ACE_Thread_Mutex> guard(m_chldmutex);
+    o_keys.assign(m_neededkeys.begin(), m_neededkeys.end());
+}
+
 void
 VBSChild::initiate_requests()
 {
     LOG(lgr, 6, m_instname << ' ' << "initiate_requests starting");
 
-    // NOTE - This loop handles requests in the following order:
-    //
-    // 1) Refresh requests
-    // 2) Signed HeadNode requests
-    // 3) Get requests
-    // 4) Put requests
+    // NOTE - The queues are served in proportion to their weights
+    // (see schedule), except that an interactive get whose deadline
+    // has passed goes next.
     //
-    // Maybe this is on purpose ...
+    // Needed keys are drained separately by the VBSRepairer.
     //
     while (true)
     {
@@ -271,49 +557,43 @@ VBSChild::initiate_requests()
         VBSGetRequestHandle grh = NULL;
         VBSPutRequestHandle prh = NULL;
         VBSRequestHandle rrh = NULL;
-        OctetSeq nk;
         {
             ACE_Guard<ACE_Thread_Mutex> guard(m_chldmutex);
 
-            if (!m_refreqs.empty())
+            switch (schedule())
             {
+            case SC_REFRESH:
                 LOG(lgr, 6, m_instname << ' '
                     << "initiate refresh request starting");
                 rrh = m_refreqs.front();
                 m_refreqs.pop_front();
-            }
-            else if (!m_shereqs.empty())
-            {
+                break;
+
+            case SC_HEADNODE:
                 LOG(lgr, 6, m_instname << ' '
                     << "initiate headnode request starting");
                 rrh = m_shereqs.front();
                 m_shereqs.pop_front();
-            }
-            else if (!m_getreqs.empty())
-            {
+                break;
+
+            case SC_GET:
                 LOG(lgr, 6, m_instname << ' '
                     << "initiate get request starting");
                 grh = m_getreqs.front();
                 m_getreqs.pop_front();
-            }
-            else if (!m_putreqs.empty())
-            {
+                break;
+
+            case SC_PUT:
                 LOG(lgr, 6, m_instname << ' '
                     << "initiate put request starting");
                 prh = m_putreqs.front();
                 m_putreqs.pop_front();
-            }
-            else if (!m_neededkeys.empty())
-            {
-                LOG(lgr, 6, m_instname << ' '
-                    << "initiate needed key request starting");
-                nk = m_neededkeys.front();
-                m_neededkeys.pop_front();
-            }
-            else
-            {
+                break;
+
+            default:
                 // If we get here we're done.
                 m_notified = false;
+                break;
             }
         }
 
@@ -321,40 +601,25 @@ VBSChild::initiate_requests()
         //
         if (grh)
         {
+            grh->started(this);
             grh->initiate(this, m_bsh);
             LOG(lgr, 6, m_instname << ' '
                     << "initiate get request finished");
         }
         else if (prh)
         {
+            prh->started(this);
             prh->initiate(this, m_bsh);
             LOG(lgr, 6, m_instname << ' '
                     << "initiate put request finished");
         }
         else if (rrh)
         {
+            rrh->started(this);
             rrh->initiate(this, m_bsh);
             LOG(lgr, 6, m_instname << ' '
                     << "initiate refresh/headnode request finished");
         }
-        else if (!nk.empty())
-        {
-            VBSGetRequestHandle grh = new VBSGetRequest(m_vbs,
-                                                        1,
-                                                        &nk[0],
-                                                        nk.size(),
-                                                        NULL,
-                                                        32 * 1024,
-                                                        NULL,
-                                                        NULL);
-            grh->needy(this);
-
-            // Enqueue in all other children.
-            m_vbs.enqueue_needy_get(grh, this);
-
-            LOG(lgr, 6, m_instname << ' '
-                    << "initiate needed key request finished");
-        }
         else
         {
             // We're done, break out of loop.
@@ -365,6 +630,56 @@ VBSChild::initiate_requests()
     LOG(lgr, 6, m_instname << ' ' << "initiate_requests finished");
 }
 
+VBSSchedClass
+VBSChild::schedule()
+{
+    size_t qlen[SC_NCLASSES];
+    qlen[SC_REFRESH] = m_refreqs.size();
+    qlen[SC_HEADNODE] = m_shereqs.size();
+    qlen[SC_GET] = m_getreqs.size();
+    qlen[SC_PUT] = m_putreqs.size();
+
+    // The non-empty class with the smallest pass.
+    VBSSchedClass next = SC_NCLASSES;
+    for (int sc = 0; sc < SC_NCLASSES; ++sc)
+        if (qlen[sc] && (next == SC_NCLASSES || m_pass[sc] < m_pass[next]))
+            next = VBSSchedClass(sc);
+
+    // An interactive get which has waited past its deadline jumps
+    // ahead of the fair share, as long as the gets haven't already
+    // run too far ahead of the class that is due.  It is still
+    // charged below so the other classes catch up afterwards.
+    //
+    if (next != SC_NCLASSES && next != SC_GET && qlen[SC_GET])
+    {
+        VBSGetRequestHandle const & grh = m_getreqs.front();
+        if (grh->priority() == VBSGetRequest::PRI_INTERACTIVE &&
+            grh->deadline() <= T64::now() &&
+            m_pass[SC_GET] - m_pass[next] < MAXLEAD)
+        {
+            ++m_ndeadline;
+            next = SC_GET;
+        }
+    }
+
+    if (next != SC_NCLASSES)
+    {
+        m_vtime = max(m_vtime, m_pass[next]);
+        m_pass[next] += STRIDE / m_vbs.sched_weight(next);
+        ++m_served[next];
+    }
+
+    return next;
+}
+
+void
+VBSChild::activate(VBSSchedClass i_sc)
+{
+    // A class which has been idle doesn't get to bank credit, it
+    // rejoins at the current virtual time.
+    m_pass[i_sc] = max(m_pass[i_sc], m_vtime);
+}
+
 } // namespace VBS
 
 // Local Variables:
@@ -6,6 +6,7 @@
 
 #include <deque>
 #include <string>
+#include <vector>
 
 #include <ace/Event_Handler.h>
 #include <ace/Thread_Mutex.h>
@@ -18,6 +19,7 @@
 
 #include "vbsexp.h"
 #include "vbsfwd.h"
+#include "VBSLatency.h"
 
 namespace VBS {
 
@@ -26,6 +28,7 @@ namespace VBS {
 class VBS_EXP VBSChild
     : public ACE_Event_Handler
     , public utp::BlockStore::UnsaturatedHandler
+    , public utp::BlockStore::BlockGetCompletion
     , public virtual utp::RCObj
 {
 public:
@@ -43,10 +46,25 @@ public:
 
     virtual int handle_exception(ACE_HANDLE fd);
 
+    virtual int handle_timeout(ACE_Time_Value const & current_time,
+                               void const * act);
+
     // UnsaturatedHandler
 
     virtual void uh_unsaturated(void const * i_argp);
 
+    // BlockGetCompletion, for health probes
+
+    virtual void bg_complete(void const * i_keydata,
+                             size_t i_keysize,
+                             void const * i_argp,
+                             size_t i_blksize);
+
+    virtual void bg_error(void const * i_keydata,
+                          size_t i_keysize,
+                          void const * i_argp,
+                          utp::Exception const & i_exp);
+
     // VBSChild
 
     std::string const & instname() const { return m_instname; }
@@ -67,18 +85,56 @@ public:
 
     void report_put(size_t i_nbytes);
 
+    // Records the latency of a request this child has finished and
+    // feeds the circuit breaker.  Failures don't include NotFound.
+    void report_done(VBSSchedClass i_sc, VBSRequest & i_req, bool i_failed);
+
+    // False while the circuit breaker has the child out of read
+    // routing.
+    bool healthy() const;
+
+    // Stop probing, called when the VBS is closed.
+    void term();
+
     void get_stats(utp::StatSet & o_ss) const;
 
     void needed_keys_append(void const * i_keydata, size_t i_keysize);
 
     size_t needed_keys_size();
 
+    // Pops the next needed key, returns false if there are none.
+    bool needed_keys_pop(utp::OctetSeq & o_key);
+
+    // Copies the needed keys.
+    void needed_keys_copy(std::vector<utp::OctetSeq> & o_keys);
+
 protected:
     void initiate_requests();
 
+    void breaker_trip();
+
+    void breaker_probe();
+
+    void breaker_reset();
+
+    // Picks the class to serve next, returns SC_NCLASSES if all the
+    // queues are empty.  Called with the mutex held.
+    VBSSchedClass schedule();
+
+    // Called with the mutex held when a class's queue goes from empty
+    // to non-empty.
+    void activate(VBSSchedClass i_sc);
+
 private:
     typedef std::deque<utp::OctetSeq> KeyQueue;
 
+    enum BreakerState
+    {
+        BS_CLOSED,		// Healthy, in routing
+        BS_OPEN,		// Tripped, waiting to probe
+        BS_PROBING		// Probe outstanding
+    };
+
     VBlockStore &						m_vbs;
     ACE_Reactor *						m_reactor;
     std::string							m_instname;
@@ -93,6 +149,23 @@ private:
 
     KeyQueue							m_neededkeys;
 
+    // Stride scheduling state; the class with the smallest pass is
+    // served next and its pass advances inversely to its weight.
+    utp::int64							m_pass[SC_NCLASSES];
+    utp::int64							m_vtime;	// Pass of last served
+    utp::int64							m_served[SC_NCLASSES];
+    utp::int64							m_ndeadline;	// Gets run late
+
+    VBSLatency							m_latency[SC_NCLASSES];
+
+    bool								m_running;
+    BreakerState						m_brkstate;
+    double								m_errewma;	// Smoothed error fraction
+    double								m_latewma;	// Smoothed latency, usec
+    long								m_nsamples;
+    double								m_cooldown;	// Seconds until probe
+    utp::int64							m_ntrips;	// Times opened
+
     utp::int64							m_getcount;
     utp::int64							m_getbytes;
     utp::int64							m_putcount;
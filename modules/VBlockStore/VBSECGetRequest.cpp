@@ -0,0 +1,435 @@
+#include <iostream>
+
+#include "Log.h"
+
+#include "VBlockStore.h"
+#include "VBSBuffer.h"
+#include "VBSChild.h"
+#include "VBSECGetRequest.h"
+#include "VBSGetRequest.h"
+#include "vbslog.h"
+#include "VBSPutRequest.h"
+#include "VBSRequest.h"
+
+using namespace std;
+using namespace utp;
+
+namespace {
+
+// Each fragment starts with the length of the original block.
+size_t const HDRSZ = 4;
+
+} // end namespace
+
+namespace VBS {
+
+VBSECGetRequest::VBSECGetRequest(VBlockStore & i_vbs,
+                                 VBSErasureCode const & i_ec,
+                                 void const * i_keydata,
+                                 size_t i_keysize,
+                                 void * o_buffdata,
+                                 size_t i_buffsize,
+                                 BlockStore::BlockGetCompletion * i_cmpl,
+                                 void const * i_argp)
+    : VBSRequest(i_vbs, i_ec.n())
+    , m_ec(i_ec)
+    , m_key((uint8 const *) i_keydata, (uint8 const *) i_keydata + i_keysize)
+    , m_buffdata(o_buffdata)
+    , m_buffsize(i_buffsize)
+    , m_cmpl(i_cmpl)
+    , m_argp(i_argp)
+    , m_index(i_ec.n())
+    , m_frags(i_ec.n())
+    , m_fragsize(i_ec.n(), 0)
+    , m_notfound(i_ec.n(), false)
+    , m_nfound(0)
+    , m_nfailed(0)
+    , m_nnotfound(0)
+    , m_upcalled(false)
+{
+    LOG(lgr, 6, "ECGET @" << (void *) this << ' ' << keystr(m_key) << " CTOR");
+}
+
+VBSECGetRequest::~VBSECGetRequest()
+{
+    LOG(lgr, 6, "ECGET @" << (void *) this << ' ' << keystr(m_key) << " DTOR");
+}
+
+void
+VBSECGetRequest::stream_insert(std::ostream & ostrm) const
+{
+    ostrm << "ECGET @" << (void *) this << ' ' << keystr(m_key);
+}
+
+void
+VBSECGetRequest::initiate(VBSChild * i_cp,
+                          BlockStoreHandle const & i_bsh)
+{
+    // This should never be called, the fragment requests are the
+    // ones enqueued on the children.
+    throwstream(InternalError, FILELINE << "shouldn't be here");
+}
+
+void
+VBSECGetRequest::bg_complete(void const * i_keydata,
+                             size_t i_keysize,
+                             void const * i_argp,
+                             size_t i_blksize)
+{
+    size_t const ndx = *(size_t const *) i_argp;
+
+    LOG(lgr, 6, *this << " fragment " << ndx << " bg_complete");
+
+    bool do_decode = false;
+    bool do_done = false;
+    {
+        ACE_Guard<ACE_Thread_Mutex> guard(m_vbsreqmutex);
+
+        m_fragsize[ndx] = i_blksize;
+        ++m_nfound;
+
+        // Do we have enough fragments to rebuild the block?
+        if (!m_upcalled && m_nfound == m_ec.k())
+        {
+            do_decode = true;
+            m_upcalled = true;
+            m_succeeded = true;
+        }
+
+        // Are we the last completion?
+        --m_outstanding;
+        if (m_outstanding == 0)
+            do_done = true;
+    }
+
+    if (do_decode)
+    {
+        // Canceling the rest may finish us, hang on until we're
+        // through.
+        VBSRequestHandle hold = this;
+        decode_and_complete();
+    }
+
+    // This likely results in our destruction, do it last and
+    // don't touch anything afterwards!
+    //
+    if (do_done)
+    {
+        LOG(lgr, 6, *this << ' ' << "DONE");
+        done();
+    }
+}
+
+void
+VBSECGetRequest::bg_error(void const * i_keydata,
+                          size_t i_keysize,
+                          void const * i_argp,
+                          Exception const & i_exp)
+{
+    size_t const ndx = *(size_t const *) i_argp;
+
+    LOG(lgr, 6, *this << " fragment " << ndx << " bg_error");
+
+    bool do_complete = false;
+    bool allnotfound = false;
+    bool do_done = false;
+    {
+        ACE_Guard<ACE_Thread_Mutex> guard(m_vbsreqmutex);
+
+        ++m_nfailed;
+        if (i_exp.type() == Exception::T_NOTFOUND)
+        {
+            ++m_nnotfound;
+            m_notfound[ndx] = true;
+        }
+
+        // Have we lost too many fragments to rebuild the block?
+        if (!m_upcalled && m_nfailed > m_ec.m())
+        {
+            do_complete = true;
+            m_upcalled = true;
+            allnotfound = m_nnotfound == m_nfailed;
+        }
+
+        // Are we the last completion?
+        --m_outstanding;
+        if (m_outstanding == 0)
+            do_done = true;
+    }
+
+    if (do_complete && m_cmpl)
+    {
+        LOG(lgr, 6, *this << ' ' << "UPCALL ERROR");
+        if (allnotfound)
+        {
+            NotFoundError err("block not found");
+            m_cmpl->bg_error(&m_key[0], m_key.size(), m_argp, err);
+        }
+        else
+        {
+            m_cmpl->bg_error(&m_key[0], m_key.size(), m_argp, i_exp);
+        }
+    }
+
+    // This likely results in our destruction, do it last and
+    // don't touch anything afterwards!
+    //
+    if (do_done)
+    {
+        LOG(lgr, 6, *this << ' ' << "DONE");
+        done();
+    }
+}
+
+void
+VBSECGetRequest::init(VBSChildSeq const & i_owners,
+                      VBSChildSeq const & i_others)
+{
+    LOG(lgr, 6, *this << " init");
+
+    m_owners = i_owners;
+
+    size_t const fragsz = HDRSZ + m_ec.shard_size(m_buffsize);
+
+    vector<VBSGetRequestHandle> reqs;
+    for (size_t ii = 0; ii < m_ec.n(); ++ii)
+    {
+        m_index[ii] = ii;
+        m_frags[ii].resize(fragsz);
+
+        // The fragment key is the block key plus the fragment index.
+        OctetSeq fragkey(m_key);
+        fragkey.push_back(uint8(ii));
+
+        VBSGetRequestHandle grh = new VBSGetRequest(m_vbs,
+                                                    1,
+                                                    &fragkey[0],
+                                                    fragkey.size(),
+                                                    &m_frags[ii][0],
+                                                    fragsz,
+                                                    this,
+                                                    &m_index[ii]);
+
+        // A missing fragment can't be copied from a sibling.
+        grh->norepair();
+
+        // It may still be on a child which owned it before the
+        // children changed.
+        VBSChildSeq fallback(i_others);
+        for (size_t jj = 0; jj < i_owners.size(); ++jj)
+            if (jj != ii)
+                fallback.push_back(i_owners[jj]);
+        grh->fallback(fallback);
+
+        reqs.push_back(grh);
+    }
+
+    // Keep the fragment gets so the ones still outstanding can be
+    // canceled.  They must be in place before any are enqueued.
+    m_reqs = reqs;
+
+    // All of the fragment requests need to be registered before any
+    // are enqueued since they may complete synchronously.
+    for (size_t ii = 0; ii < reqs.size(); ++ii)
+        m_vbs.insert_req(reqs[ii]);
+
+    for (size_t ii = 0; ii < reqs.size(); ++ii)
+        i_owners[ii]->enqueue_get(reqs[ii]);
+}
+
+void
+VBSECGetRequest::decode_and_complete()
+{
+    // Take the fragments which have arrived.  The buffers of the
+    // ones still outstanding are left in place since their requests
+    // will still be copying into them.
+    //
+    VBSErasureCode::ShardSeq shards(m_ec.n());
+    {
+        ACE_Guard<ACE_Thread_Mutex> guard(m_vbsreqmutex);
+        for (size_t ii = 0; ii < m_ec.n(); ++ii)
+        {
+            if (m_fragsize[ii])
+            {
+                shards[ii].swap(m_frags[ii]);
+                shards[ii].resize(m_fragsize[ii]);
+            }
+        }
+    }
+
+    // Recover the original block size from the first header.
+    size_t blksize = 0;
+    string errstr;
+    try
+    {
+        for (size_t ii = 0; ii < shards.size(); ++ii)
+        {
+            if (shards[ii].empty())
+                continue;
+
+            if (shards[ii].size() < HDRSZ)
+                throwstream(InternalError, FILELINE
+                            << "short fragment " << ii << ": "
+                            << shards[ii].size() << " bytes");
+
+            blksize = (size_t(shards[ii][0]) << 24) |
+                      (size_t(shards[ii][1]) << 16) |
+                      (size_t(shards[ii][2]) << 8) |
+                      (size_t(shards[ii][3]));
+            break;
+        }
+
+        if (blksize > m_buffsize)
+            throwstream(InternalError, FILELINE
+                        << "unexpected return of " << blksize
+                        << " bytes into buffer of size " << m_buffsize);
+
+        // Strip the headers, they all must agree on the size.
+        size_t const fragsz = HDRSZ + m_ec.shard_size(blksize);
+        for (size_t ii = 0; ii < shards.size(); ++ii)
+        {
+            if (shards[ii].empty())
+                continue;
+
+            if (shards[ii].size() != fragsz)
+                throwstream(InternalError, FILELINE
+                            << "fragment " << ii << " is "
+                            << shards[ii].size() << " bytes, expected "
+                            << fragsz);
+
+            shards[ii].erase(shards[ii].begin(),
+                             shards[ii].begin() + HDRSZ);
+        }
+
+        // The caller may not need the data (eg. a repair).
+        if (m_buffdata)
+            m_ec.decode(shards, blksize, m_buffdata);
+    }
+    catch (Exception const & ex)
+    {
+        errstr = ex.what();
+        LOG(lgr, 2, *this << ' ' << "decode failed: " << errstr);
+    }
+
+    // We have all we need.
+    cancel_rest();
+
+    // Put back what the owners are missing while we still have the
+    // block, the caller may reuse its buffer once called.
+    if (errstr.empty() && m_buffdata)
+        rebuild(m_buffdata, blksize);
+
+    if (!m_cmpl)
+        return;
+
+    if (errstr.empty())
+    {
+        LOG(lgr, 6, *this << ' ' << "UPCALL GOOD");
+        m_cmpl->bg_complete(&m_key[0], m_key.size(), m_argp, blksize);
+    }
+    else
+    {
+        LOG(lgr, 6, *this << ' ' << "UPCALL ERROR");
+        InternalError err(errstr);
+        m_cmpl->bg_error(&m_key[0], m_key.size(), m_argp, err);
+    }
+}
+
+void
+VBSECGetRequest::cancel_rest()
+{
+    vector<size_t> pending;
+    {
+        ACE_Guard<ACE_Thread_Mutex> guard(m_vbsreqmutex);
+        for (size_t ii = 0; ii < m_ec.n(); ++ii)
+            if (!m_fragsize[ii] && !m_notfound[ii])
+                pending.push_back(ii);
+    }
+
+    // The canceled gets complete with an error, which may be the
+    // last completion.  The caller holds a reference to us.
+    for (size_t jj = 0; jj < pending.size(); ++jj)
+    {
+        VBSGetRequestHandle const & grh = m_reqs[pending[jj]];
+        grh->nofallback();
+        m_vbs.cancel_get(NULL, grh->key());
+    }
+}
+
+void
+VBSECGetRequest::rebuild(void const * i_blkdata, size_t i_blksize)
+{
+    // Fragments which weren't anywhere, or were found on a child
+    // other than their owner, need to be put back.  Ones canceled
+    // before their owner answered are left for a later get.
+    //
+    vector<size_t> ndxs;
+    for (size_t ii = 0; ii < m_ec.n(); ++ii)
+    {
+        bool notfound;
+        {
+            ACE_Guard<ACE_Thread_Mutex> guard(m_vbsreqmutex);
+            notfound = m_notfound[ii];
+        }
+        if (notfound || m_reqs[ii]->infallback())
+            ndxs.push_back(ii);
+    }
+
+    if (ndxs.empty())
+        return;
+
+    VBSErasureCode::ShardSeq shards;
+    m_ec.encode(i_blkdata, i_blksize, shards);
+
+    uint8 hdr[HDRSZ];
+    hdr[0] = uint8(i_blksize >> 24);
+    hdr[1] = uint8(i_blksize >> 16);
+    hdr[2] = uint8(i_blksize >> 8);
+    hdr[3] = uint8(i_blksize);
+
+    vector<VBSPutRequestHandle> reqs;
+    for (size_t jj = 0; jj < ndxs.size(); ++jj)
+    {
+        size_t const ii = ndxs[jj];
+
+        LOG(lgr, 6, *this << " rebuilding fragment " << ii
+            << " on " << m_owners[ii]->instname());
+
+        VBSBufferHandle bh = VBSBuffer::alloc(HDRSZ + shards[ii].size());
+        ACE_OS::memcpy(bh->data(), hdr, HDRSZ);
+        if (!shards[ii].empty())
+            ACE_OS::memcpy(bh->data() + HDRSZ,
+                           &shards[ii][0],
+                           shards[ii].size());
+
+        OctetSeq fragkey(m_key);
+        fragkey.push_back(uint8(ii));
+
+        reqs.push_back(new VBSPutRequest(m_vbs,
+                                         1,
+                                         1,
+                                         &fragkey[0],
+                                         fragkey.size(),
+                                         bh,
+                                         bh->size(),
+                                         NULL,
+                                         NULL));
+    }
+
+    for (size_t jj = 0; jj < reqs.size(); ++jj)
+        m_vbs.insert_req(reqs[jj]);
+
+    for (size_t jj = 0; jj < reqs.size(); ++jj)
+        m_owners[ndxs[jj]]->enqueue_put(reqs[jj]);
+
+    m_vbs.fragments_rebuilt(reqs.size());
+}
+
+} // namespace VBS
+
+// Local Variables:
+// mode: C++
+// tab-width: 4
+// c-basic-offset: 4
+// c-file-offsets: ((comment-intro . 0))
+// End:
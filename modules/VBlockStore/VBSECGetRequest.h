@@ -0,0 +1,103 @@
+#ifndef VBSECGetRequest_h__
+#define VBSECGetRequest_h__
+
+/// @file VBSECGetRequest.h
+/// Virtual BlockStore Erasure Coded Get Request
+
+#include <vector>
+
+#include "VBSErasure.h"
+#include "VBSRequest.h"
+
+#include "vbsexp.h"
+#include "vbsfwd.h"
+
+namespace VBS {
+
+// Fetches the fragments of an erasure coded block from their
+// children and reassembles the block as soon as any k have arrived.
+// The fragment gets still outstanding are then canceled.  Fragments
+// their owner was missing are rebuilt from the block and put back.
+//
+class VBS_EXP VBSECGetRequest
+    : public VBSRequest
+    , public utp::BlockStore::BlockGetCompletion
+{
+public:
+    VBSECGetRequest(VBlockStore & i_vbs,
+                    VBSErasureCode const & i_ec,
+                    void const * i_keydata,
+                    size_t i_keysize,
+                    void * o_buffdata,
+                    size_t i_buffsize,
+                    utp::BlockStore::BlockGetCompletion * i_cmpl,
+                    void const * i_argp);
+
+    virtual ~VBSECGetRequest();
+
+    // VBSRequest
+
+    virtual void stream_insert(std::ostream & ostrm) const;
+
+    virtual void initiate(VBSChild * i_cp,
+                          utp::BlockStoreHandle const & i_bsh);
+
+    // BlockGetCompletion
+
+    virtual void bg_complete(void const * i_keydata,
+                             size_t i_keysize,
+                             void const * i_argp,
+                             size_t i_blksize);
+
+    virtual void bg_error(void const * i_keydata,
+                          size_t i_keysize,
+                          void const * i_argp,
+                          utp::Exception const & i_exp);
+
+    // VBSECGetRequest
+
+    // Issue a fragment get to each of the owning children, fragment
+    // i goes to i_owners[i].  A fragment its owner doesn't have is
+    // looked for on the rest, it may have been placed there before
+    // the children changed.
+    void init(VBSChildSeq const & i_owners, VBSChildSeq const & i_others);
+
+private:
+    void decode_and_complete();
+
+    // Cancel the fragment gets which haven't completed.
+    void cancel_rest();
+
+    // Encode the block again and put the fragments whose owners
+    // missed back to them.
+    void rebuild(void const * i_blkdata, size_t i_blksize);
+
+    VBSErasureCode const &					m_ec;
+    utp::OctetSeq							m_key;
+    void *									m_buffdata;
+    size_t									m_buffsize;
+    utp::BlockStore::BlockGetCompletion *	m_cmpl;
+    void const *							m_argp;
+
+    VBSChildSeq								m_owners;
+    std::vector<VBSGetRequestHandle>		m_reqs;		// Fragment gets
+    std::vector<size_t>						m_index;	// argp per fragment
+    VBSErasureCode::ShardSeq				m_frags;	// Raw fragments
+    std::vector<size_t>						m_fragsize;	// 0 if missing
+    std::vector<bool>						m_notfound;	// Not anywhere
+    size_t									m_nfound;
+    size_t									m_nfailed;
+    size_t									m_nnotfound;
+    bool									m_upcalled;
+};
+
+} // namespace VBS
+
+// Local Variables:
+// mode: C++
+// tab-width: 4
+// c-basic-offset: 4
+// c-file-offsets: ((comment-intro . 0))
+// End:
+
+#endif // VBSECGetRequest_h__
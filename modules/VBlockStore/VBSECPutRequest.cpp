@@ -0,0 +1,246 @@
+#include <iostream>
+
+#include "Log.h"
+
+#include "VBlockStore.h"
+#include "VBSBuffer.h"
+#include "VBSChild.h"
+#include "VBSECPutRequest.h"
+#include "vbslog.h"
+#include "VBSPutRequest.h"
+#include "VBSRequest.h"
+
+using namespace std;
+using namespace utp;
+
+namespace {
+
+// Each fragment starts with the length of the original block.
+size_t const HDRSZ = 4;
+
+} // end namespace
+
+namespace VBS {
+
+VBSECPutRequest::VBSECPutRequest(VBlockStore & i_vbs,
+                                 VBSErasureCode const & i_ec,
+                                 long i_quorum,
+                                 void const * i_keydata,
+                                 size_t i_keysize,
+                                 void const * i_blkdata,
+                                 size_t i_blksize,
+                                 BlockStore::BlockPutCompletion * i_cmpl,
+                                 void const * i_argp)
+    : VBSRequest(i_vbs, i_ec.n())
+    , m_key((uint8 const *) i_keydata, (uint8 const *) i_keydata + i_keysize)
+    , m_cmpl(i_cmpl)
+    , m_argp(i_argp)
+    , m_quorum(i_quorum)
+    , m_index(i_ec.n())
+    , m_nacked(0)
+    , m_upcalled(false)
+    , m_catchup(false)
+{
+    LOG(lgr, 6, "ECPUT @" << (void *) this << ' ' << keystr(m_key) << " CTOR");
+
+    VBSErasureCode::ShardSeq shards;
+    i_ec.encode(i_blkdata, i_blksize, shards);
+
+    // Prefix each shard with the original block size so the get
+    // knows how much of the last data shard is padding.
+    //
+    uint8 hdr[HDRSZ];
+    hdr[0] = uint8(i_blksize >> 24);
+    hdr[1] = uint8(i_blksize >> 16);
+    hdr[2] = uint8(i_blksize >> 8);
+    hdr[3] = uint8(i_blksize);
+
+    for (size_t ii = 0; ii < shards.size(); ++ii)
+    {
+        VBSBufferHandle bh = VBSBuffer::alloc(HDRSZ + shards[ii].size());
+        ACE_OS::memcpy(bh->data(), hdr, HDRSZ);
+        if (!shards[ii].empty())
+            ACE_OS::memcpy(bh->data() + HDRSZ,
+                           &shards[ii][0],
+                           shards[ii].size());
+        m_frags.push_back(bh);
+    }
+}
+
+VBSECPutRequest::~VBSECPutRequest()
+{
+    LOG(lgr, 6, "ECPUT @" << (void *) this << ' ' << keystr(m_key) << " DTOR");
+}
+
+void
+VBSECPutRequest::stream_insert(std::ostream & ostrm) const
+{
+    ostrm << "ECPUT @" << (void *) this << ' ' << keystr(m_key);
+}
+
+void
+VBSECPutRequest::initiate(VBSChild * i_cp,
+                          BlockStoreHandle const & i_bsh)
+{
+    // This should never be called, the fragment requests are the
+    // ones enqueued on the children.
+    throwstream(InternalError, FILELINE << "shouldn't be here");
+}
+
+void
+VBSECPutRequest::bp_complete(void const * i_keydata,
+                             size_t i_keysize,
+                             void const * i_argp)
+{
+    size_t const ndx = *(size_t const *) i_argp;
+
+    LOG(lgr, 6, *this << " fragment " << ndx << " bp_complete");
+
+    bool do_complete = false;
+    bool do_done = false;
+
+    {
+        ACE_Guard<ACE_Thread_Mutex> guard(m_vbsreqmutex);
+
+        ++m_nacked;
+
+        // Does this completion satisfy the write quorum?
+        if (!m_upcalled && m_nacked >= m_quorum)
+        {
+            do_complete = true;
+            m_succeeded = true;
+            m_upcalled = true;
+        }
+
+        // Are we the last completion?
+        --m_outstanding;
+        if (m_outstanding == 0)
+            do_done = true;
+
+        // Once the caller is satisfied the remaining fragments are
+        // catching up in the background.
+        if (do_complete && !do_done)
+        {
+            m_vbs.catchup_begin();
+            m_catchup = true;
+        }
+        else if (do_done && m_catchup)
+        {
+            m_vbs.catchup_end();
+            m_catchup = false;
+        }
+    }
+
+    if (do_complete && m_cmpl)
+    {
+        LOG(lgr, 6, *this << ' ' << "UPCALL GOOD");
+        m_cmpl->bp_complete(&m_key[0], m_key.size(), m_argp);
+    }
+
+    // This likely results in our destruction, do it last and
+    // don't touch anything afterwards!
+    //
+    if (do_done)
+    {
+        LOG(lgr, 6, *this << ' ' << "DONE");
+        done();
+    }
+}
+
+void
+VBSECPutRequest::bp_error(void const * i_keydata,
+                          size_t i_keysize,
+                          void const * i_argp,
+                          Exception const & i_exp)
+{
+    size_t const ndx = *(size_t const *) i_argp;
+
+    LOG(lgr, 6, *this << " fragment " << ndx << " bp_error");
+
+    bool do_complete = false;
+    bool do_done = false;
+
+    {
+        ACE_Guard<ACE_Thread_Mutex> guard(m_vbsreqmutex);
+
+        // Are we the last completion?
+        --m_outstanding;
+        if (m_outstanding == 0)
+            do_done = true;
+
+        // If too many fragments have failed to ever reach the quorum
+        // send our status.
+        if (!m_upcalled && m_nacked + m_outstanding < m_quorum)
+        {
+            do_complete = true;
+            m_upcalled = true;
+        }
+
+        if (do_done && m_catchup)
+        {
+            m_vbs.catchup_end();
+            m_catchup = false;
+        }
+    }
+
+    if (do_complete && m_cmpl)
+    {
+        LOG(lgr, 6, *this << ' ' << "UPCALL ERROR");
+        m_cmpl->bp_error(&m_key[0], m_key.size(), m_argp, i_exp);
+    }
+
+    // This likely results in our destruction, do it last and
+    // don't touch anything afterwards!
+    //
+    if (do_done)
+    {
+        LOG(lgr, 6, *this << ' ' << "DONE");
+        done();
+    }
+}
+
+void
+VBSECPutRequest::init(VBSChildSeq const & i_owners)
+{
+    LOG(lgr, 6, *this << " init");
+
+    vector<VBSPutRequestHandle> reqs;
+    for (size_t ii = 0; ii < m_frags.size(); ++ii)
+    {
+        m_index[ii] = ii;
+
+        // The fragment key is the block key plus the fragment index.
+        OctetSeq fragkey(m_key);
+        fragkey.push_back(uint8(ii));
+
+        reqs.push_back(new VBSPutRequest(m_vbs,
+                                         1,
+                                         1,
+                                         &fragkey[0],
+                                         fragkey.size(),
+                                         m_frags[ii],
+                                         m_frags[ii]->size(),
+                                         this,
+                                         &m_index[ii]));
+    }
+
+    // The put requests hold the fragments now.
+    m_frags.clear();
+
+    // All of the fragment requests need to be registered before any
+    // are enqueued since they may complete synchronously.
+    for (size_t ii = 0; ii < reqs.size(); ++ii)
+        m_vbs.insert_req(reqs[ii]);
+
+    for (size_t ii = 0; ii < reqs.size(); ++ii)
+        i_owners[ii]->enqueue_put(reqs[ii]);
+}
+
+} // namespace VBS
+
+// Local Variables:
+// mode: C++
+// tab-width: 4
+// c-basic-offset: 4
+// c-file-offsets: ((comment-intro . 0))
+// End:
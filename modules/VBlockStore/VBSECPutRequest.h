@@ -0,0 +1,83 @@
+#ifndef VBSECPutRequest_h__
+#define VBSECPutRequest_h__
+
+/// @file VBSECPutRequest.h
+/// Virtual BlockStore Erasure Coded Put Request
+
+#include <vector>
+
+#include "VBSErasure.h"
+#include "VBSRequest.h"
+
+#include "vbsexp.h"
+#include "vbsfwd.h"
+
+namespace VBS {
+
+// Encodes a block into k data and m parity fragments and puts each
+// fragment to its own child.
+//
+class VBS_EXP VBSECPutRequest
+    : public VBSRequest
+    , public utp::BlockStore::BlockPutCompletion
+{
+public:
+    VBSECPutRequest(VBlockStore & i_vbs,
+                    VBSErasureCode const & i_ec,
+                    long i_quorum,
+                    void const * i_keydata,
+                    size_t i_keysize,
+                    void const * i_blkdata,
+                    size_t i_blksize,
+                    utp::BlockStore::BlockPutCompletion * i_cmpl,
+                    void const * i_argp);
+
+    virtual ~VBSECPutRequest();
+
+    // VBSRequest
+
+    virtual void stream_insert(std::ostream & ostrm) const;
+
+    virtual void initiate(VBSChild * i_cp,
+                          utp::BlockStoreHandle const & i_bsh);
+
+    // BlockPutCompletion
+
+    virtual void bp_complete(void const * i_keydata,
+                             size_t i_keysize,
+                             void const * i_argp);
+
+    virtual void bp_error(void const * i_keydata,
+                          size_t i_keysize,
+                          void const * i_argp,
+                          utp::Exception const & i_exp);
+
+    // VBSECPutRequest
+
+    // Issue a fragment put to each of the owning children, fragment
+    // i goes to i_owners[i].
+    void init(VBSChildSeq const & i_owners);
+
+private:
+    utp::OctetSeq							m_key;
+    utp::BlockStore::BlockPutCompletion *	m_cmpl;
+    void const *							m_argp;
+    long									m_quorum;	// Fragment acks before upcall
+
+    std::vector<size_t>						m_index;	// argp per fragment
+    std::vector<VBSBufferHandle>			m_frags;	// Until init
+    long									m_nacked;
+    bool									m_upcalled;
+    bool									m_catchup;
+};
+
+} // namespace VBS
+
+// Local Variables:
+// mode: C++
+// tab-width: 4
+// c-basic-offset: 4
+// c-file-offsets: ((comment-intro . 0))
+// End:
+
+#endif // VBSECPutRequest_h__
@@ -0,0 +1,192 @@
+#include <iostream>
+
+#include "Log.h"
+
+#include "VBlockStore.h"
+#include "VBSChild.h"
+#include "VBSECRefreshReq.h"
+#include "vbslog.h"
+#include "VBSRefreshBlockRequest.h"
+#include "VBSRequest.h"
+
+using namespace std;
+using namespace utp;
+
+namespace VBS {
+
+VBSECRefreshReq::VBSECRefreshReq(VBlockStore & i_vbs,
+                                 VBSErasureCode const & i_ec,
+                                 uint64 i_rid,
+                                 void const * i_keydata,
+                                 size_t i_keysize,
+                                 RefreshBlockCompletion & i_cmpl,
+                                 void const * i_argp)
+    : VBSRequest(i_vbs, i_ec.n())
+    , m_ec(i_ec)
+    , m_rid(i_rid)
+    , m_key((uint8 const *) i_keydata, (uint8 const *) i_keydata + i_keysize)
+    , m_cmpl(i_cmpl)
+    , m_argp(i_argp)
+    , m_index(i_ec.n())
+    , m_npresent(0)
+    , m_nmissing(0)
+    , m_upcalled(false)
+{
+    LOG(lgr, 6, "ECRFRSH @" << (void *) this << " CTOR");
+}
+
+VBSECRefreshReq::~VBSECRefreshReq()
+{
+    LOG(lgr, 6, "ECRFRSH @" << (void *) this << " DTOR");
+}
+
+void
+VBSECRefreshReq::stream_insert(std::ostream & ostrm) const
+{
+    ostrm << "ECRFRSH @" << (void *) this;
+}
+
+void
+VBSECRefreshReq::initiate(VBSChild * i_cp,
+                          BlockStoreHandle const & i_bsh)
+{
+    // This should never be called, the fragment requests are the
+    // ones enqueued on the children.
+    throwstream(InternalError, FILELINE << "shouldn't be here");
+}
+
+void
+VBSECRefreshReq::rb_complete(void const * i_keydata,
+                             size_t i_keysize,
+                             void const * i_argp)
+{
+    size_t const ndx = *(size_t const *) i_argp;
+
+    LOG(lgr, 6, *this << " fragment " << ndx << " rb_complete");
+
+    bool do_complete = false;
+    bool do_done = false;
+    {
+        ACE_Guard<ACE_Thread_Mutex> guard(m_vbsreqmutex);
+
+        // Are there enough fragments left to rebuild the block?
+        ++m_npresent;
+        if (!m_upcalled && m_npresent == m_ec.k())
+        {
+            do_complete = true;
+            m_succeeded = true;
+            m_upcalled = true;
+        }
+
+        // Are we the last completion?
+        --m_outstanding;
+        if (m_outstanding == 0)
+            do_done = true;
+    }
+
+    if (do_complete)
+    {
+        LOG(lgr, 6, *this << ' ' << "UPCALL GOOD");
+        m_cmpl.rb_complete(&m_key[0], m_key.size(), m_argp);
+    }
+
+    // This likely results in our destruction, do it last and
+    // don't touch anything afterwards!
+    //
+    if (do_done)
+    {
+        LOG(lgr, 6, *this << ' ' << "DONE");
+        done();
+    }
+}
+
+void
+VBSECRefreshReq::rb_missing(void const * i_keydata,
+                            size_t i_keysize,
+                            void const * i_argp)
+{
+    size_t const ndx = *(size_t const *) i_argp;
+
+    LOG(lgr, 6, *this << " fragment " << ndx << " rb_missing");
+
+    bool do_complete = false;
+    bool do_done = false;
+    {
+        ACE_Guard<ACE_Thread_Mutex> guard(m_vbsreqmutex);
+
+        // Have we lost too many fragments to rebuild the block?
+        ++m_nmissing;
+        if (!m_upcalled && m_nmissing > m_ec.m())
+        {
+            do_complete = true;
+            m_upcalled = true;
+        }
+
+        // Are we the last completion?
+        --m_outstanding;
+        if (m_outstanding == 0)
+            do_done = true;
+    }
+
+    if (do_complete)
+    {
+        LOG(lgr, 6, *this << ' ' << "UPCALL MISSING");
+        m_cmpl.rb_missing(&m_key[0], m_key.size(), m_argp);
+    }
+
+    // This likely results in our destruction, do it last and
+    // don't touch anything afterwards!
+    //
+    if (do_done)
+    {
+        LOG(lgr, 6, *this << ' ' << "DONE");
+        done();
+    }
+}
+
+void
+VBSECRefreshReq::init(VBSChildSeq const & i_owners)
+{
+    LOG(lgr, 6, *this << " init");
+
+    // The fragment requests don't record needed keys since a missing
+    // fragment can't be copied from a sibling, nor fall back to it.
+    VBSChildSeq noowners;
+
+    vector<VBSRefreshBlockRequestHandle> reqs;
+    for (size_t ii = 0; ii < m_ec.n(); ++ii)
+    {
+        m_index[ii] = ii;
+
+        // The fragment key is the block key plus the fragment index.
+        OctetSeq fragkey(m_key);
+        fragkey.push_back(uint8(ii));
+
+        reqs.push_back(new VBSRefreshBlockRequest(m_vbs,
+                                                  1,
+                                                  m_rid,
+                                                  &fragkey[0],
+                                                  fragkey.size(),
+                                                  noowners,
+                                                  noowners,
+                                                  *this,
+                                                  &m_index[ii]));
+    }
+
+    // All of the fragment requests need to be registered before any
+    // are enqueued since they may complete synchronously.
+    for (size_t ii = 0; ii < reqs.size(); ++ii)
+        m_vbs.insert_req(reqs[ii]);
+
+    for (size_t ii = 0; ii < reqs.size(); ++ii)
+        i_owners[ii]->enqueue_refresh(reqs[ii]);
+}
+
+} // namespace VBS
+
+// Local Variables:
+// mode: C++
+// tab-width: 4
+// c-basic-offset: 4
+// c-file-offsets: ((comment-intro . 0))
+// End:
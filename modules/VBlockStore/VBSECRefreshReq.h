@@ -0,0 +1,82 @@
+#ifndef VBSECRefreshReq_h__
+#define VBSECRefreshReq_h__
+
+/// @file VBSECRefreshReq.h
+/// Virtual BlockStore Erasure Coded Refresh Block Request
+
+#include <vector>
+
+#include "BlockStore.h"
+
+#include "VBSErasure.h"
+#include "VBSRequest.h"
+
+#include "vbsexp.h"
+#include "vbsfwd.h"
+
+namespace VBS {
+
+// Refreshes each fragment of an erasure coded block on its child.
+// The block is present as long as any k fragments are.
+//
+class VBS_EXP VBSECRefreshReq
+    : public VBSRequest
+    , public utp::BlockStore::RefreshBlockCompletion
+{
+public:
+    VBSECRefreshReq(VBlockStore & i_vbs,
+                    VBSErasureCode const & i_ec,
+                    utp::uint64 i_rid,
+                    void const * i_keydata,
+                    size_t i_keysize,
+                    utp::BlockStore::RefreshBlockCompletion & i_cmpl,
+                    void const * i_argp);
+
+    virtual ~VBSECRefreshReq();
+
+    // VBSRequest
+
+    virtual void stream_insert(std::ostream & ostrm) const;
+
+    virtual void initiate(VBSChild * i_cp,
+                          utp::BlockStoreHandle const & i_bsh);
+
+    // RefreshBlockCompletion
+
+    virtual void rb_complete(void const * i_keydata,
+                             size_t i_keysize,
+                             void const * i_argp);
+
+    virtual void rb_missing(void const * i_keydata,
+                            size_t i_keysize,
+                            void const * i_argp);
+
+    // VBSECRefreshReq
+
+    // Issue a fragment refresh to each of the owning children,
+    // fragment i goes to i_owners[i].
+    void init(VBSChildSeq const & i_owners);
+
+private:
+    VBSErasureCode const &						m_ec;
+    utp::uint64									m_rid;
+    utp::OctetSeq								m_key;
+    utp::BlockStore::RefreshBlockCompletion	&	m_cmpl;
+    void const *								m_argp;
+
+    std::vector<size_t>							m_index;	// argp per fragment
+    size_t										m_npresent;
+    size_t										m_nmissing;
+    bool										m_upcalled;
+};
+
+} // namespace VBS
+
+// Local Variables:
+// mode: C++
+// tab-width: 4
+// c-basic-offset: 4
+// c-file-offsets: ((comment-intro . 0))
+// End:
+
+#endif // VBSECRefreshReq_h__
@@ -0,0 +1,321 @@
+#include <algorithm>
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSSE3__)
+#include <tmmintrin.h>
+#endif
+
+#include "VBSErasure.h"
+
+using namespace std;
+using namespace utp;
+
+namespace {
+
+// Log and anti-log tables for GF(2^8) with polynomial 0x11d.  The
+// exp table is doubled so products don't need a modulo.
+//
+struct GFTables
+{
+    uint8	m_exp[512];
+    uint8	m_log[256];
+
+    GFTables()
+    {
+        unsigned x = 1;
+        for (unsigned ii = 0; ii < 255; ++ii)
+        {
+            m_exp[ii] = uint8(x);
+            m_log[x] = uint8(ii);
+            x <<= 1;
+            if (x & 0x100)
+                x ^= 0x11d;
+        }
+        for (unsigned ii = 255; ii < 512; ++ii)
+            m_exp[ii] = m_exp[ii - 255];
+        m_log[0] = 0;
+    }
+};
+
+GFTables const g_gf;
+
+inline uint8
+gf_mul(uint8 a, uint8 b)
+{
+    if (a == 0 || b == 0)
+        return 0;
+    return g_gf.m_exp[g_gf.m_log[a] + g_gf.m_log[b]];
+}
+
+inline uint8
+gf_inv(uint8 a)
+{
+    return g_gf.m_exp[255 - g_gf.m_log[a]];
+}
+
+// dst ^= c * src over a region.
+void
+gf_muladd(uint8 c, uint8 const * src, uint8 * dst, size_t len)
+{
+    if (c == 0)
+        return;
+
+    // Products of c with every low and every high nibble.  The
+    // product of a byte is the xor of its two nibble products.
+    uint8 lo[16];
+    uint8 hi[16];
+    for (unsigned ii = 0; ii < 16; ++ii)
+    {
+        lo[ii] = gf_mul(c, uint8(ii));
+        hi[ii] = gf_mul(c, uint8(ii << 4));
+    }
+
+    size_t ii = 0;
+
+#if defined(__AVX2__)
+    __m256i const tlo =
+        _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i const *) lo));
+    __m256i const thi =
+        _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i const *) hi));
+    __m256i const mask = _mm256_set1_epi8(0x0f);
+    for (; ii + 32 <= len; ii += 32)
+    {
+        __m256i s = _mm256_loadu_si256((__m256i const *) (src + ii));
+        __m256i d = _mm256_loadu_si256((__m256i const *) (dst + ii));
+        __m256i l = _mm256_shuffle_epi8(tlo, _mm256_and_si256(s, mask));
+        __m256i h = _mm256_shuffle_epi8(thi,
+                        _mm256_and_si256(_mm256_srli_epi64(s, 4), mask));
+        d = _mm256_xor_si256(d, _mm256_xor_si256(l, h));
+        _mm256_storeu_si256((__m256i *) (dst + ii), d);
+    }
+#elif defined(__SSSE3__)
+    __m128i const tlo = _mm_loadu_si128((__m128i const *) lo);
+    __m128i const thi = _mm_loadu_si128((__m128i const *) hi);
+    __m128i const mask = _mm_set1_epi8(0x0f);
+    for (; ii + 16 <= len; ii += 16)
+    {
+        __m128i s = _mm_loadu_si128((__m128i const *) (src + ii));
+        __m128i d = _mm_loadu_si128((__m128i const *) (dst + ii));
+        __m128i l = _mm_shuffle_epi8(tlo, _mm_and_si128(s, mask));
+        __m128i h = _mm_shuffle_epi8(thi,
+                        _mm_and_si128(_mm_srli_epi64(s, 4), mask));
+        d = _mm_xor_si128(d, _mm_xor_si128(l, h));
+        _mm_storeu_si128((__m128i *) (dst + ii), d);
+    }
+#endif
+
+    // Whatever is left (or everything without SIMD).
+    for (; ii < len; ++ii)
+        dst[ii] ^= lo[src[ii] & 0x0f] ^ hi[src[ii] >> 4];
+}
+
+// Inverts the square matrix in place with Gauss-Jordan elimination.
+// Returns false if it is singular.
+bool
+gf_invert(vector<uint8> & io_mat, size_t i_dim)
+{
+    vector<uint8> inv(i_dim * i_dim, 0);
+    for (size_t ii = 0; ii < i_dim; ++ii)
+        inv[ii * i_dim + ii] = 1;
+
+    for (size_t col = 0; col < i_dim; ++col)
+    {
+        // Find a pivot.
+        size_t piv = col;
+        while (piv < i_dim && io_mat[piv * i_dim + col] == 0)
+            ++piv;
+        if (piv == i_dim)
+            return false;
+
+        if (piv != col)
+        {
+            for (size_t jj = 0; jj < i_dim; ++jj)
+            {
+                swap(io_mat[piv * i_dim + jj], io_mat[col * i_dim + jj]);
+                swap(inv[piv * i_dim + jj], inv[col * i_dim + jj]);
+            }
+        }
+
+        // Scale the pivot row to one.
+        uint8 const scale = gf_inv(io_mat[col * i_dim + col]);
+        for (size_t jj = 0; jj < i_dim; ++jj)
+        {
+            io_mat[col * i_dim + jj] = gf_mul(io_mat[col * i_dim + jj], scale);
+            inv[col * i_dim + jj] = gf_mul(inv[col * i_dim + jj], scale);
+        }
+
+        // Eliminate the column from the other rows.
+        for (size_t row = 0; row < i_dim; ++row)
+        {
+            uint8 const f = io_mat[row * i_dim + col];
+            if (row == col || f == 0)
+                continue;
+            for (size_t jj = 0; jj < i_dim; ++jj)
+            {
+                io_mat[row * i_dim + jj] ^= gf_mul(f, io_mat[col * i_dim + jj]);
+                inv[row * i_dim + jj] ^= gf_mul(f, inv[col * i_dim + jj]);
+            }
+        }
+    }
+
+    io_mat.swap(inv);
+    return true;
+}
+
+} // end namespace
+
+namespace VBS {
+
+VBSErasureCode::VBSErasureCode(size_t i_k, size_t i_m)
+    : m_k(i_k)
+    , m_m(i_m)
+    , m_matrix((i_k + i_m) * i_k, 0)
+{
+    // Identity on top, the data shards are stored as is.
+    for (size_t ii = 0; ii < m_k; ++ii)
+        m_matrix[ii * m_k + ii] = 1;
+
+    // Cauchy rows below: 1 / (x_i + y_j) with x_i = k + i, y_j = j.
+    for (size_t ii = 0; ii < m_m; ++ii)
+        for (size_t jj = 0; jj < m_k; ++jj)
+            m_matrix[(m_k + ii) * m_k + jj] =
+                gf_inv(uint8((m_k + ii) ^ jj));
+}
+
+size_t
+VBSErasureCode::shard_size(size_t i_blksize) const
+{
+    return (i_blksize + m_k - 1) / m_k;
+}
+
+void
+VBSErasureCode::encode(void const * i_data,
+                       size_t i_size,
+                       ShardSeq & o_shards) const
+{
+    size_t const shsz = shard_size(i_size);
+    uint8 const * data = (uint8 const *) i_data;
+
+    o_shards.assign(n(), OctetSeq(shsz, 0));
+
+    // Data shards, the last one zero padded.
+    for (size_t ii = 0; ii < m_k; ++ii)
+    {
+        size_t const off = ii * shsz;
+        if (off < i_size)
+            ACE_OS::memcpy(&o_shards[ii][0], data + off,
+                           min(shsz, i_size - off));
+    }
+
+    // Parity shards.
+    if (shsz == 0)
+        return;
+
+    for (size_t ii = m_k; ii < n(); ++ii)
+        for (size_t jj = 0; jj < m_k; ++jj)
+            gf_muladd(m_matrix[ii * m_k + jj],
+                      &o_shards[jj][0],
+                      &o_shards[ii][0],
+                      shsz);
+}
+
+void
+VBSErasureCode::decode(ShardSeq const & i_shards,
+                       size_t i_size,
+                       void * o_data) const
+    throw(InternalError)
+{
+    size_t const shsz = shard_size(i_size);
+    uint8 * data = (uint8 *) o_data;
+
+    if (i_shards.size() != n())
+        throwstream(InternalError, FILELINE
+                    << "expected " << n() << " shards, saw "
+                    << i_shards.size());
+
+    // Nothing to do for an empty block.
+    if (shsz == 0)
+        return;
+
+    // Pick the first k present shards, preferring data shards since
+    // they need no arithmetic.
+    vector<size_t> rows;
+    for (size_t ii = 0; ii < n() && rows.size() < m_k; ++ii)
+    {
+        if (i_shards[ii].empty())
+            continue;
+
+        if (i_shards[ii].size() < shsz)
+            throwstream(InternalError, FILELINE
+                        << "shard " << ii << " is " << i_shards[ii].size()
+                        << " bytes, expected " << shsz);
+
+        rows.push_back(ii);
+    }
+
+    if (rows.size() < m_k)
+        throwstream(InternalError, FILELINE
+                    << "only " << rows.size() << " of " << m_k
+                    << " shards needed to decode");
+
+    // Fast path, all the data shards are present.
+    bool alldata = true;
+    for (size_t ii = 0; ii < m_k; ++ii)
+        if (rows[ii] != ii)
+            alldata = false;
+
+    ShardSeq recovered;
+    ShardSeq const * shards = &i_shards;
+
+    if (!alldata)
+    {
+        // Invert the rows of the encoding matrix we have and apply
+        // it to the shards to get the data back.
+        vector<uint8> sub(m_k * m_k);
+        for (size_t ii = 0; ii < m_k; ++ii)
+            for (size_t jj = 0; jj < m_k; ++jj)
+                sub[ii * m_k + jj] = m_matrix[rows[ii] * m_k + jj];
+
+        if (!gf_invert(sub, m_k))
+            throwstream(InternalError, FILELINE
+                        << "singular erasure decode matrix");
+
+        recovered.assign(m_k, OctetSeq(shsz, 0));
+        for (size_t ii = 0; ii < m_k; ++ii)
+        {
+            // Data shards we have are copied as is.
+            if (!i_shards[ii].empty())
+            {
+                ACE_OS::memcpy(&recovered[ii][0], &i_shards[ii][0], shsz);
+                continue;
+            }
+
+            for (size_t jj = 0; jj < m_k && shsz; ++jj)
+                gf_muladd(sub[ii * m_k + jj],
+                          &i_shards[rows[jj]][0],
+                          &recovered[ii][0],
+                          shsz);
+        }
+        shards = &recovered;
+    }
+
+    // Concatenate the data shards.
+    for (size_t ii = 0; ii < m_k; ++ii)
+    {
+        size_t const off = ii * shsz;
+        if (off < i_size)
+            ACE_OS::memcpy(data + off, &(*shards)[ii][0],
+                           min(shsz, i_size - off));
+    }
+}
+
+} // namespace VBS
+
+// Local Variables:
+// mode: C++
+// tab-width: 4
+// c-basic-offset: 4
+// c-file-offsets: ((comment-intro . 0))
+// End:
@@ -0,0 +1,73 @@
+#ifndef VBSErasure_h__
+#define VBSErasure_h__
+
+/// @file VBSErasure.h
+/// Virtual BlockStore Reed-Solomon Erasure Code
+
+#include <vector>
+
+#include "Except.h"
+#include "RC.h"
+#include "Types.h"
+
+#include "vbsexp.h"
+
+namespace VBS {
+
+// Systematic Reed-Solomon code over GF(2^8).
+//
+// A block is split into k data shards and m parity shards; any k of
+// the k + m shards are enough to recover the block.  The parity rows
+// of the encoding matrix are a Cauchy matrix so every k x k
+// submatrix is invertible.
+//
+// The inner loops multiply a whole region by a constant using split
+// nibble tables.  When the module is built with SSSE3 or AVX2
+// enabled the table lookups are done 16 or 32 bytes at a time with
+// byte shuffles.
+//
+class VBS_EXP VBSErasureCode : public virtual utp::RCObj
+{
+public:
+    typedef std::vector<utp::OctetSeq> ShardSeq;
+
+    VBSErasureCode(size_t i_k, size_t i_m);
+
+    size_t k() const { return m_k; }
+
+    size_t m() const { return m_m; }
+
+    size_t n() const { return m_k + m_m; }
+
+    // Size of each shard for a block of the given size.
+    size_t shard_size(size_t i_blksize) const;
+
+    // Splits the block into n() shards of shard_size() bytes.  The
+    // first k() are the data, the remainder parity.
+    void encode(void const * i_data,
+                size_t i_size,
+                ShardSeq & o_shards) const;
+
+    // Recovers a block of i_size bytes from the shards.  Missing
+    // shards are empty; at least k() must be present.
+    void decode(ShardSeq const & i_shards,
+                size_t i_size,
+                void * o_data) const
+        throw(utp::InternalError);
+
+private:
+    size_t								m_k;
+    size_t								m_m;
+    std::vector<utp::uint8>				m_matrix;	// n x k, row major
+};
+
+} // namespace VBS
+
+// Local Variables:
+// mode: C++
+// tab-width: 4
+// c-basic-offset: 4
+// c-file-offsets: ((comment-intro . 0))
+// End:
+
+#endif // VBSErasure_h__
@@ -3,6 +3,7 @@
 #include "Log.h"
 
 #include "VBlockStore.h"
+#include "VBSBuffer.h"
 #include "VBSChild.h"
 #include "VBSGetRequest.h"
 #include "VBSPutRequest.h"
@@ -24,10 +25,17 @@ VBSGetRequest::VBSGetRequest(VBlockStore & i_vbs,
                              void const * i_argp)
     : VBSRequest(i_vbs, i_outstanding)
     , m_key((uint8 const *) i_keydata, (uint8 const *) i_keydata + i_keysize)
+    , m_direct(o_buffdata && i_outstanding == 1)
     , m_buffdata(o_buffdata)
     , m_buffsize(i_buffsize)
     , m_cmpl(i_cmpl)
     , m_argp(i_argp)
+    , m_needycmpl(NULL)
+    , m_upcalled(false)
+    , m_infallback(false)
+    , m_norepair(false)
+    , m_priority(PRI_INTERACTIVE)
+    , m_deadline(T64::now() + i_vbs.get_deadline())
 {
     LOG(lgr, 6, "GET @" << (void *) this << ' ' << keystr(m_key) << " CTOR");
 }
@@ -48,14 +56,27 @@ VBSGetRequest::initiate(VBSChild * i_cp, BlockStoreHandle const & i_bsh)
 {
     LOG(lgr, 6, *this << " initiate " << i_cp->instname());
 
+    // When only one child is asked at a time it can write straight
+    // into the caller's buffer.  Otherwise the children share a
+    // pooled buffer and the winner's copy is handed up.
+    //
+    void * buffdata;
     {
-        // Allocate our buffer now.
         ACE_Guard<ACE_Thread_Mutex> guard(m_vbsreqmutex);
-        m_blk.resize(m_buffsize);
+        if (m_direct)
+        {
+            buffdata = m_buffdata;
+        }
+        else
+        {
+            if (!m_buf)
+                m_buf = VBSBuffer::alloc(m_buffsize);
+            buffdata = m_buf->data();
+        }
     }
 
     i_bsh->bs_block_get_async(&m_key[0], m_key.size(),
-                              &m_blk[0], m_blk.size(),
+                              buffdata, m_buffsize,
                               *this, i_cp);
 }
 
@@ -70,27 +91,34 @@ VBSGetRequest::bg_complete(void const * i_keydata,
     LOG(lgr, 6, *this << ' ' << cp->instname() << " bg_complete");
 
     cp->report_get(i_blksize);
+    cp->report_done(SC_GET, *this, false);
 
     bool do_complete = false;
     bool do_done = false;
+    bool direct = false;
     VBSChildSeq needy;
+    WaiterSeq waiters;
     {
         ACE_Guard<ACE_Thread_Mutex> guard(m_vbsreqmutex);
 
+        direct = m_direct;
+
         // Are we the first successful completion?
         if (!m_succeeded)
         {
             // Make sure the buffer size was OK.
-            if (i_blksize > m_blk.size())
+            if (i_blksize > m_buffsize)
                 throwstream(InternalError, FILELINE
                             << "unexpected return of " << i_blksize
-                            << " bytes into buffer of size " << m_blk.size());
+                            << " bytes into buffer of size " << m_buffsize);
 
             m_retsize = i_blksize;
 
             do_complete = true;
             m_succeeded = true;
+            m_upcalled = true;
             needy.swap(m_needy);
+            waiters.swap(m_waiters);
         }
 
         // Are we the last completion?
@@ -102,13 +130,32 @@ VBSGetRequest::bg_complete(void const * i_keydata,
     // If we are the first child back with success we get
     // to tell the parent ...
     //
+    // Where the block ended up.
+    uint8 const * blkdata =
+        direct ? (uint8 const *) m_buffdata : m_buf->data();
+
     if (do_complete && m_cmpl)
     {
+        // No further gets can attach to us now.
+        m_vbs.forget_get(this);
+
         LOG(lgr, 6, *this << ' ' << "UPCALL GOOD");
 
-        // Copy the data into the parent buffer.
-        if (m_buffdata)
-            ACE_OS::memcpy(m_buffdata, &m_blk[0], i_blksize);
+        // Copy the data into the parent buffer, unless the child
+        // already put it there.
+        if (m_buffdata && !direct)
+            ACE_OS::memcpy(m_buffdata, blkdata, i_blksize);
+
+        // Complete any gets which were coalesced with us.  This is
+        // done before the parent's upcall since the parent may reuse
+        // its buffer as soon as it is called.
+        for (unsigned ii = 0; ii < waiters.size(); ++ii)
+        {
+            Waiter const & w = waiters[ii];
+            LOG(lgr, 6, *this << ' ' << "UPCALL GOOD COALESCED");
+            ACE_OS::memcpy(w.m_buffdata, blkdata, i_blksize);
+            w.m_cmpl->bg_complete(&m_key[0], m_key.size(), w.m_argp, i_blksize);
+        }
 
         m_cmpl->bg_complete(&m_key[0], m_key.size(), m_argp, i_blksize);
 
@@ -126,13 +173,18 @@ VBSGetRequest::bg_complete(void const * i_keydata,
 
         }
 
+        // Share our buffer with the put rather than copying it.
+        VBSBufferHandle bh =
+            direct ? VBSBuffer::copy(m_buffdata, m_retsize) : m_buf;
+
         VBSPutRequestHandle prh = new VBSPutRequest(m_vbs,
+                                                    needy.size(),
                                                     needy.size(),
                                                     &m_key[0],
                                                     m_key.size(),
-                                                    &m_blk[0],
+                                                    bh,
                                                     m_retsize,
-                                                    NULL,
+                                                    m_needycmpl,
                                                     NULL);
 
         m_vbs.insert_req(prh);
@@ -161,42 +213,100 @@ VBSGetRequest::bg_error(void const * i_keydata,
 
     LOG(lgr, 6, *this << ' ' << cp->instname() << " bg_error");
 
+    // A missing block isn't the child's fault.
+    cp->report_done(SC_GET, *this, i_exp.type() != Exception::T_NOTFOUND);
+
     bool do_complete = false;
     bool do_done = false;
+    bool isrepair = false;
+    bool wasfallback = false;
+    bool norepair = false;
+    VBSChildSeq fallback;
+    WaiterSeq waiters;
     {
         ACE_Guard<ACE_Thread_Mutex> guard(m_vbsreqmutex);
 
+        isrepair = !m_needy.empty();
+        wasfallback = m_infallback;
+        norepair = m_norepair;
+
         // Are we the last completion?
         --m_outstanding;
-        if (m_outstanding == 0)
+        if (m_outstanding == 0 && !m_succeeded && !m_fallback.empty())
+        {
+            // None of the owners had it, try everyone else.
+            fallback.swap(m_fallback);
+            m_outstanding = fallback.size();
+            m_infallback = true;
+
+            // Several children may be filling the buffer now.
+            if (fallback.size() > 1)
+                m_direct = false;
+        }
+        else if (m_outstanding == 0)
         {
             do_done = true;
 
             // If no other child succeeded send our status.
             if (!m_succeeded)
+            {
                 do_complete = true;
+                m_upcalled = true;
+                waiters.swap(m_waiters);
+            }
         }
     }
 
+    if (!fallback.empty())
+    {
+        LOG(lgr, 6, *this << ' ' << "FALLBACK to " << fallback.size()
+            << " non-owner children");
+    }
+
     // If we are the last child back with an exception we
     // get to tell the parent ...
     //
     if (do_complete && m_cmpl)
     {
+        // No further gets can attach to us now.
+        m_vbs.forget_get(this);
+
         LOG(lgr, 6, *this << ' ' << "UPCALL ERROR");
         m_cmpl->bg_error(&m_key[0], m_key.size(), m_argp, i_exp);
+
+        // Fail any gets which were coalesced with us.
+        for (unsigned ii = 0; ii < waiters.size(); ++ii)
+        {
+            Waiter const & w = waiters[ii];
+            LOG(lgr, 6, *this << ' ' << "UPCALL ERROR COALESCED");
+            w.m_cmpl->bg_error(&m_key[0], m_key.size(), w.m_argp, i_exp);
+        }
     }
 
-    if (i_exp.type() == Exception::T_NOTFOUND)
+    if (i_exp.type() == Exception::T_NOTFOUND &&
+        !isrepair && !wasfallback && !norepair)
     {
         // If we didn't find the block add it to our need list.
         //
         // Only do this if the error was NotFound, otherwise
         // we were canceled and we don't need to do this ...
         //
+        // Repair gets don't do this either, otherwise a block
+        // which is missing everywhere would bounce between the
+        // children's need lists forever.
+        //
+        // Non-owners which missed during a fallback don't need
+        // the block.
+        //
+        // Erasure coded fragments are never repaired by copying.
+        //
         cp->needed_keys_append(&m_key[0], m_key.size());
     }
 
+    // Send the request on to the non-owner children.
+    for (unsigned ii = 0; ii < fallback.size(); ++ii)
+        fallback[ii]->enqueue_get(this);
+
     // This likely results in our destruction, do it last and
     // don't touch anything afterwards!
     //
@@ -208,9 +318,72 @@ VBSGetRequest::bg_error(void const * i_keydata,
 }
 
 void
-VBSGetRequest::needy(VBSChildHandle const & i_needy)
+VBSGetRequest::needy(VBSChildHandle const & i_needy,
+                     BlockStore::BlockPutCompletion * i_cmpl)
 {
     m_needy.push_back(i_needy);
+    m_needycmpl = i_cmpl;
+}
+
+void
+VBSGetRequest::fallback(VBSChildSeq const & i_others)
+{
+    m_fallback = i_others;
+}
+
+bool
+VBSGetRequest::infallback()
+{
+    ACE_Guard<ACE_Thread_Mutex> guard(m_vbsreqmutex);
+    return m_infallback;
+}
+
+void
+VBSGetRequest::nofallback()
+{
+    ACE_Guard<ACE_Thread_Mutex> guard(m_vbsreqmutex);
+    m_fallback.clear();
+}
+
+void
+VBSGetRequest::background()
+{
+    m_priority = PRI_BACKGROUND;
+    m_deadline = T64();
+}
+
+void
+VBSGetRequest::norepair()
+{
+    m_norepair = true;
+}
+
+bool
+VBSGetRequest::attach(void * o_buffdata,
+                      size_t i_buffsize,
+                      BlockStore::BlockGetCompletion * i_cmpl,
+                      void const * i_argp)
+{
+    ACE_Guard<ACE_Thread_Mutex> guard(m_vbsreqmutex);
+
+    // Too late, the completions have already been made.
+    if (m_upcalled)
+        return false;
+
+    // The block may not fit in a smaller buffer.
+    if (i_buffsize < m_buffsize)
+        return false;
+
+    Waiter w;
+    w.m_buffdata = o_buffdata;
+    w.m_buffsize = i_buffsize;
+    w.m_cmpl = i_cmpl;
+    w.m_argp = i_argp;
+    m_waiters.push_back(w);
+
+    LOG(lgr, 6, *this << ' ' << "attached coalesced get");
+
+    return true;
 }
 
 } // namespace VBS
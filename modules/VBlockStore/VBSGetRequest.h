@@ -4,11 +4,15 @@
 /// @file VBSGetRequest.h
 /// Virtual BlockStore Get Request
 
+#include "T64.h"
+
 #include "VBSRequest.h"
 
 #include "vbsexp.h"
 #include "vbsfwd.h"
 
+#include <vector>
+
 namespace VBS {
 
 class VBS_EXP VBSGetRequest
@@ -16,6 +20,14 @@ class VBS_EXP VBSGetRequest
     , public utp::BlockStore::BlockGetCompletion
 {
 public:
+    // Interactive gets are served ahead of background ones and are
+    // scheduled immediately once their deadline passes.
+    enum Priority
+    {
+        PRI_BACKGROUND = 0,
+        PRI_INTERACTIVE = 1
+    };
+
     VBSGetRequest(VBlockStore & i_vbs,
                   long i_outstanding,
                   void const * i_keydata,
@@ -48,19 +60,76 @@ public:
 
     // VBSGetRequest
 
-    void needy(VBSChildHandle const & i_needy);
+    // Put the block to the child once it is found.  If i_cmpl is
+    // non-NULL it is completed with the outcome of the put.
+    void needy(VBSChildHandle const & i_needy,
+               utp::BlockStore::BlockPutCompletion * i_cmpl);
+
+    // Children to ask if none of the initial children have the
+    // block.  Used in placement mode when the block may still live
+    // on its previous owners.
+    void fallback(VBSChildSeq const & i_others);
+
+    // True once the initial children have missed and the fallback
+    // children are being asked.
+    bool infallback();
+
+    // Drop the fallback children, called when the block is no
+    // longer wanted so a canceled get doesn't go on to them.
+    void nofallback();
+
+    // Don't add the key to a child's needed keys when it is missing.
+    // Used for erasure coded fragments which no sibling holds.
+    void norepair();
+
+    // Attach another caller's get for the same key to this request.
+    // Returns false if the request has already completed or the
+    // caller's buffer is too small, in which case the caller needs
+    // to issue its own request.
+    bool attach(void * o_buffdata,
+                size_t i_buffsize,
+                utp::BlockStore::BlockGetCompletion * i_cmpl,
+                void const * i_argp);
+
+    // Marks this get as background work with no deadline.
+    void background();
+
+    Priority priority() const { return m_priority; }
+
+    // Time by which an interactive get should be started, zero if
+    // there is none.
+    utp::T64 const & deadline() const { return m_deadline; }
 
     utp::OctetSeq const & key() const { return m_key; }
 
 private:
+    struct Waiter
+    {
+        void *									m_buffdata;
+        size_t									m_buffsize;
+        utp::BlockStore::BlockGetCompletion *	m_cmpl;
+        void const *							m_argp;
+    };
+
+    typedef std::vector<Waiter> WaiterSeq;
+
     utp::OctetSeq							m_key;
-    utp::OctetSeq							m_blk;
+    VBSBufferHandle							m_buf;		// Unless direct
+    bool									m_direct;	// Child fills m_buffdata
     void *									m_buffdata;
     size_t									m_buffsize;
     utp::BlockStore::BlockGetCompletion *	m_cmpl;
     void const *							m_argp;
     size_t									m_retsize;
     VBSChildSeq								m_needy;
+    utp::BlockStore::BlockPutCompletion *	m_needycmpl;
+    WaiterSeq								m_waiters;	// Coalesced gets
+    bool									m_upcalled;
+    VBSChildSeq								m_fallback;
+    bool									m_infallback;
+    bool									m_norepair;
+    Priority								m_priority;
+    utp::T64								m_deadline;
 };
 
 } // namespace VBS
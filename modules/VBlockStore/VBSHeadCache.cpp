@@ -0,0 +1,361 @@
+#include <ace/Reactor.h>
+
+#include "Log.h"
+#include "Stats.h"
+
+#include "VBlockStore.h"
+#include "VBSHeadCache.h"
+#include "vbslog.h"
+
+using namespace std;
+using namespace utp;
+
+namespace {
+
+// Every this many periods reconcile from the roots.
+long const FULLEVERY = 10;
+
+// Collects the answer from the in-memory graph, which calls back
+// synchronously, so we can decide whether to use it before the
+// caller hears anything.
+//
+class NodeCollector : public BlockStore::HeadNodeTraverseFunc
+{
+public:
+    NodeCollector() : m_failed(false) {}
+
+    virtual void hnt_node(void const * i_argp, HeadNode const & i_hn)
+    {
+        m_nodes.push_back(i_hn);
+    }
+
+    virtual void hnt_complete(void const * i_argp)
+    {
+    }
+
+    virtual void hnt_error(void const * i_argp, Exception const & i_exp)
+    {
+        m_failed = true;
+    }
+
+    HeadNodeSeq			m_nodes;
+    bool				m_failed;
+};
+
+} // end namespace
+
+namespace VBS {
+
+VBSHeadCache::VBSHeadCache(VBlockStore & i_vbs, ACE_Reactor * i_reactor)
+    : m_vbs(i_vbs)
+    , m_reactor(i_reactor)
+    , m_running(false)
+    , m_period(0)
+    , m_ntimeouts(0)
+    , m_nhits(0)
+    , m_nmisses(0)
+    , m_nedges(0)
+    , m_nreconciled(0)
+    , m_nincremental(0)
+{
+    LOG(lgr, 4, "VBSHeadCache CTOR");
+}
+
+VBSHeadCache::~VBSHeadCache()
+{
+    LOG(lgr, 4, "VBSHeadCache DTOR");
+}
+
+int
+VBSHeadCache::handle_timeout(ACE_Time_Value const & current_time,
+                             void const * act)
+{
+    LOG(lgr, 9, "VBSHeadCache handle_timeout");
+
+    FSTagSet fstags;
+    bool full;
+    {
+        ACE_Guard<ACE_Thread_Mutex> guard(m_hcmutex);
+
+        if (!m_running)
+            return 0;
+
+        fstags = m_fstags;
+        full = ++m_ntimeouts % FULLEVERY == 0;
+    }
+
+    for (FSTagSet::const_iterator it = fstags.begin();
+         it != fstags.end();
+         ++it)
+        reconcile(*it, full);
+
+    return 0;
+}
+
+void
+VBSHeadCache::het_edge(void const * i_argp, SignedHeadEdge const & i_she)
+{
+    try
+    {
+        m_graph.insert_head(i_she);
+    }
+    catch (Exception const & ex)
+    {
+        LOG(lgr, 2, "VBSHeadCache het_edge: " << ex.what());
+    }
+
+    ACE_Guard<ACE_Thread_Mutex> guard(m_hcmutex);
+    ++m_nedges;
+}
+
+void
+VBSHeadCache::het_complete(void const * i_argp)
+{
+    string const & fstag = *(string const *) i_argp;
+
+    LOG(lgr, 6, "VBSHeadCache follow complete");
+
+    follow_done(fstag, false);
+}
+
+void
+VBSHeadCache::het_error(void const * i_argp, Exception const & i_exp)
+{
+    string const & fstag = *(string const *) i_argp;
+
+    LOG(lgr, 6, "VBSHeadCache follow failed: " << i_exp.what());
+
+    follow_done(fstag, true);
+}
+
+void
+VBSHeadCache::init(long i_period)
+{
+    LOG(lgr, 4, "VBSHeadCache init period=" << i_period);
+
+    {
+        ACE_Guard<ACE_Thread_Mutex> guard(m_hcmutex);
+        m_period = i_period;
+        if (!m_period)
+            return;
+        m_running = true;
+    }
+
+    ACE_Time_Value period;
+    period.set(double(i_period));
+    m_reactor->schedule_timer(this, NULL, period, period);
+}
+
+void
+VBSHeadCache::term()
+{
+    LOG(lgr, 4, "VBSHeadCache term");
+
+    {
+        ACE_Guard<ACE_Thread_Mutex> guard(m_hcmutex);
+        if (!m_running)
+            return;
+        m_running = false;
+    }
+
+    m_reactor->cancel_timer(this, DONT_CALL);
+}
+
+void
+VBSHeadCache::insert(SignedHeadEdge const & i_she)
+{
+    {
+        ACE_Guard<ACE_Thread_Mutex> guard(m_hcmutex);
+        if (!m_running)
+            return;
+    }
+
+    try
+    {
+        m_graph.insert_head(i_she);
+    }
+    catch (Exception const & ex)
+    {
+        LOG(lgr, 2, "VBSHeadCache insert: " << ex.what());
+    }
+}
+
+bool
+VBSHeadCache::furthest(HeadNode const & i_hn,
+                       BlockStore::HeadNodeTraverseFunc & i_func,
+                       void const * i_argp)
+{
+    bool valid;
+    {
+        ACE_Guard<ACE_Thread_Mutex> guard(m_hcmutex);
+
+        if (!m_running)
+            return false;
+
+        m_fstags.insert(i_hn.first);
+        valid = m_valid.find(i_hn.first) != m_valid.end();
+        if (!valid)
+            ++m_nmisses;
+    }
+
+    // The first query for a filesystem goes to the children and
+    // starts filling the cache for the next one.
+    if (!valid)
+    {
+        reconcile(i_hn.first, true);
+        return false;
+    }
+
+    NodeCollector nc;
+    m_graph.head_furthest_async(i_hn, nc, NULL);
+
+    // An empty answer means we haven't seen the seed, most likely it
+    // was inserted elsewhere since we last reconciled.
+    if (nc.m_failed || nc.m_nodes.empty())
+    {
+        {
+            ACE_Guard<ACE_Thread_Mutex> guard(m_hcmutex);
+            ++m_nmisses;
+        }
+        reconcile(i_hn.first, true);
+        return false;
+    }
+
+    {
+        ACE_Guard<ACE_Thread_Mutex> guard(m_hcmutex);
+        ++m_nhits;
+    }
+
+    LOG(lgr, 6, "VBSHeadCache furthest " << i_hn
+        << " answered locally, " << nc.m_nodes.size() << " nodes");
+
+    for (HeadNodeSeq::const_iterator it = nc.m_nodes.begin();
+         it != nc.m_nodes.end();
+         ++it)
+        i_func.hnt_node(i_argp, *it);
+
+    i_func.hnt_complete(i_argp);
+
+    return true;
+}
+
+void
+VBSHeadCache::reconcile(string const & i_fstag, bool i_full)
+{
+    string const * fstagp;
+    bool valid;
+    {
+        ACE_Guard<ACE_Thread_Mutex> guard(m_hcmutex);
+
+        if (!m_running)
+            return;
+
+        if (m_busy.find(i_fstag) != m_busy.end())
+            return;
+
+        // The set elements don't move, their address is a stable
+        // argument for the follow callbacks.
+        fstagp = &*m_fstags.insert(i_fstag).first;
+        valid = m_valid.find(i_fstag) != m_valid.end();
+
+        // Hold the slot while we look in the cache.
+        m_busy[i_fstag] = 1;
+        m_failed.erase(i_fstag);
+    }
+
+    // An empty reference follows from every root of the fstag.
+    HeadNodeSeq seeds;
+    if (valid && !i_full)
+    {
+        NodeCollector nc;
+        m_graph.head_furthest_async(HeadNode(i_fstag, ""), nc, NULL);
+        if (!nc.m_failed)
+            seeds = nc.m_nodes;
+    }
+
+    if (seeds.empty())
+    {
+        LOG(lgr, 6, "VBSHeadCache reconciling from the roots");
+        seeds.push_back(HeadNode(i_fstag, ""));
+    }
+    else
+    {
+        LOG(lgr, 6, "VBSHeadCache reconciling from "
+            << seeds.size() << " furthest nodes");
+
+        ACE_Guard<ACE_Thread_Mutex> guard(m_hcmutex);
+        ++m_nincremental;
+    }
+
+    {
+        ACE_Guard<ACE_Thread_Mutex> guard(m_hcmutex);
+        m_busy[i_fstag] = long(seeds.size());
+    }
+
+    for (HeadNodeSeq::const_iterator it = seeds.begin();
+         it != seeds.end();
+         ++it)
+        m_vbs.bs_head_follow_async(*it, *this, fstagp);
+}
+
+void
+VBSHeadCache::follow_done(string const & i_fstag, bool i_failed)
+{
+    ACE_Guard<ACE_Thread_Mutex> guard(m_hcmutex);
+
+    if (i_failed)
+        m_failed.insert(i_fstag);
+
+    FSTagCountMap::iterator pos = m_busy.find(i_fstag);
+    if (pos == m_busy.end() || --pos->second > 0)
+        return;
+
+    m_busy.erase(pos);
+
+    // Leave the validity alone on failure; a previously reconciled
+    // fstag keeps its edges and an unreconciled one keeps going to
+    // the children.
+    if (m_failed.erase(i_fstag))
+        return;
+
+    m_valid.insert(i_fstag);
+    ++m_nreconciled;
+}
+
+void
+VBSHeadCache::get_stats(StatSet & o_ss) const
+{
+    o_ss.set_name("headcache");
+
+    long period;
+    int64 nhits;
+    int64 nmisses;
+    int64 nedges;
+    int64 nreconciled;
+    int64 nincremental;
+    {
+        ACE_Guard<ACE_Thread_Mutex> guard(m_hcmutex);
+        period = m_period;
+        nhits = m_nhits;
+        nmisses = m_nmisses;
+        nedges = m_nedges;
+        nreconciled = m_nreconciled;
+        nincremental = m_nincremental;
+    }
+
+    Stats::set(o_ss, "hcper", period, 1.0, "%.0fs", SF_VALUE);
+    Stats::set(o_ss, "hchps", nhits, 1.0, "%.1f/s", SF_DELTA);
+    Stats::set(o_ss, "hcmps", nmisses, 1.0, "%.1f/s", SF_DELTA);
+    Stats::set(o_ss, "hceps", nedges, 1.0, "%.1f/s", SF_DELTA);
+    Stats::set(o_ss, "hcrec", nreconciled, 1.0, "%.0f", SF_VALUE);
+    Stats::set(o_ss, "hcinc", nincremental, 1.0, "%.0f", SF_VALUE);
+}
+
+} // namespace VBS
+
+// Local Variables:
+// mode: C++
+// tab-width: 4
+// c-basic-offset: 4
+// c-file-offsets: ((comment-intro . 0))
+// End:
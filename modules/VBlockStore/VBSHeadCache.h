@@ -0,0 +1,124 @@
+#ifndef VBSHeadCache_h__
+#define VBSHeadCache_h__
+
+/// @file VBSHeadCache.h
+/// Virtual BlockStore Merged HeadNode Graph Cache
+
+#include <map>
+#include <set>
+#include <string>
+
+#include <ace/Event_Handler.h>
+#include <ace/Thread_Mutex.h>
+
+#include "utpfwd.h"
+
+#include "BlockStore.h"
+#include "LameHeadNodeGraph.h"
+#include "Stats.h"
+
+#include "vbsexp.h"
+#include "vbsfwd.h"
+
+namespace VBS {
+
+// Keeps a merged copy of the children's head graphs so furthest
+// queries can be answered without a round trip to every child.
+//
+// The graph is fed by our own head inserts as they succeed and by a
+// periodic follow of each known fstag over all of the children,
+// which picks up edges inserted by other writers.  Once an fstag has
+// been reconciled the periodic follow starts from its furthest nodes
+// in the cache, so only new edges come back; every few periods, and
+// whenever a query misses, it is followed from its roots again to
+// pick up branches off older nodes.  An fstag is only answered
+// locally once it has been reconciled; until then, and whenever the
+// cache has no answer, the caller falls back to asking the children.
+//
+class VBS_EXP VBSHeadCache
+    : public ACE_Event_Handler
+    , public utp::BlockStore::HeadEdgeTraverseFunc
+{
+public:
+    VBSHeadCache(VBlockStore & i_vbs, ACE_Reactor * i_reactor);
+
+    virtual ~VBSHeadCache();
+
+    // ACE_Event_Handler
+
+    virtual int handle_timeout(ACE_Time_Value const & current_time,
+                               void const * act);
+
+    // HeadEdgeTraverseFunc
+
+    virtual void het_edge(void const * i_argp,
+                          utp::SignedHeadEdge const & i_she);
+
+    virtual void het_complete(void const * i_argp);
+
+    virtual void het_error(void const * i_argp,
+                           utp::Exception const & i_exp);
+
+    // VBSHeadCache
+
+    // Start periodic reconciliation.  A period of zero disables the
+    // cache entirely.
+    void init(long i_period);
+
+    void term();
+
+    // Add an edge which has been inserted on a child.
+    void insert(utp::SignedHeadEdge const & i_she);
+
+    // Answers the query from the cache if the fstag has been
+    // reconciled and the seed is known.  Returns false, having made
+    // no callbacks, if the caller needs to ask the children.
+    bool furthest(utp::HeadNode const & i_hn,
+                  utp::BlockStore::HeadNodeTraverseFunc & i_func,
+                  void const * i_argp);
+
+    void get_stats(utp::StatSet & o_ss) const;
+
+private:
+    typedef std::set<std::string> FSTagSet;
+
+    typedef std::map<std::string, long> FSTagCountMap;
+
+    // Starts a follow of the fstag unless one is already running.
+    // Unless i_full is set a reconciled fstag is followed from its
+    // furthest cached nodes.
+    void reconcile(std::string const & i_fstag, bool i_full);
+
+    // Called as each follow of a reconcile finishes.
+    void follow_done(std::string const & i_fstag, bool i_failed);
+
+    VBlockStore &						m_vbs;
+    ACE_Reactor *						m_reactor;
+    utp::LameHeadNodeGraph				m_graph;
+
+    mutable ACE_Thread_Mutex			m_hcmutex;
+    bool								m_running;
+    long								m_period;	// Seconds, 0 disables
+    FSTagSet							m_fstags;	// Everything seen
+    FSTagSet							m_valid;	// Reconciled at least once
+    FSTagCountMap						m_busy;		// Follows in flight
+    FSTagSet							m_failed;	// A follow in flight failed
+    long								m_ntimeouts;
+
+    utp::int64							m_nhits;
+    utp::int64							m_nmisses;
+    utp::int64							m_nedges;
+    utp::int64							m_nreconciled;
+    utp::int64							m_nincremental;
+};
+
+} // namespace VBS
+
+// Local Variables:
+// mode: C++
+// tab-width: 4
+// c-basic-offset: 4
+// c-file-offsets: ((comment-intro . 0))
+// End:
+
+#endif // VBSHeadCache_h__
@@ -54,6 +54,12 @@ VBSHeadInsertRequest::hei_complete(SignedHeadEdge const & i_she,
 
     LOG(lgr, 6, *this << ' ' << cp->instname() << " hei_complete");
 
+    cp->report_done(SC_HEADNODE, *this, false);
+
+    // Keep the merged head graph current before anyone can ask for
+    // the furthest node.
+    m_vbs.head_inserted(m_she);
+
     bool do_complete = false;
     bool do_done = false;
 
@@ -101,6 +107,8 @@ VBSHeadInsertRequest::hei_error(SignedHeadEdge const & i_she,
 
     LOG(lgr, 6, *this << ' ' << cp->instname() << " hei_error");
 
+    cp->report_done(SC_HEADNODE, *this, true);
+
     bool do_complete = false;
     bool do_done = false;
 
@@ -0,0 +1,101 @@
+#include "VBSLatency.h"
+
+using namespace std;
+using namespace utp;
+
+namespace VBS {
+
+VBSLatency::VBSLatency()
+    : m_count(0)
+{
+    for (size_t ii = 0; ii < NBUCKETS; ++ii)
+        m_buckets[ii] = 0;
+}
+
+void
+VBSLatency::record(int64 i_usec)
+{
+    ++m_buckets[bucket(i_usec)];
+    ++m_count;
+}
+
+int64
+VBSLatency::count() const
+{
+    return m_count.value();
+}
+
+int64
+VBSLatency::percentile(double i_pct) const
+{
+    // The buckets are read one at a time while others may be
+    // recording, which is close enough for reporting.
+    //
+    long counts[NBUCKETS];
+    int64 total = 0;
+    for (size_t ii = 0; ii < NBUCKETS; ++ii)
+    {
+        counts[ii] = m_buckets[ii].value();
+        total += counts[ii];
+    }
+
+    if (total == 0)
+        return 0;
+
+    int64 rank = int64(total * i_pct / 100.0 + 0.5);
+    if (rank < 1)
+        rank = 1;
+
+    int64 seen = 0;
+    for (size_t ii = 0; ii < NBUCKETS; ++ii)
+    {
+        seen += counts[ii];
+        if (seen >= rank)
+            return midpoint(ii);
+    }
+
+    return midpoint(NBUCKETS - 1);
+}
+
+size_t
+VBSLatency::bucket(int64 i_usec)
+{
+    if (i_usec < 0)
+        return 0;
+
+    // Small values get their own bucket.
+    if (i_usec < NLINEAR)
+        return size_t(i_usec);
+
+    // Otherwise the power of two and the next SUBBITS bits.
+    int msb = 0;
+    for (int64 vv = i_usec; vv > 1; vv >>= 1)
+        ++msb;
+
+    size_t const sub = size_t(i_usec >> (msb - SUBBITS)) & (NSUB - 1);
+    size_t const ndx = NLINEAR + (msb - (SUBBITS + 2)) * NSUB + sub;
+    return ndx < NBUCKETS ? ndx : NBUCKETS - 1;
+}
+
+int64
+VBSLatency::midpoint(size_t i_bucket)
+{
+    if (i_bucket < NLINEAR)
+        return int64(i_bucket);
+
+    size_t const off = i_bucket - NLINEAR;
+    int const msb = int(off / NSUB) + SUBBITS + 2;
+    int64 const sub = int64(off % NSUB);
+    int64 const width = int64(1) << (msb - SUBBITS);
+    int64 const low = (int64(NSUB) + sub) * width;
+    return low + width / 2;
+}
+
+} // namespace VBS
+
+// Local Variables:
+// mode: C++
+// tab-width: 4
+// c-basic-offset: 4
+// c-file-offsets: ((comment-intro . 0))
+// End:
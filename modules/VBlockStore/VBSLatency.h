@@ -0,0 +1,59 @@
+#ifndef VBSLatency_h__
+#define VBSLatency_h__
+
+/// @file VBSLatency.h
+/// Virtual BlockStore Latency Histogram
+
+#include "Types.h"
+
+#include "vbsexp.h"
+
+namespace VBS {
+
+// Log-linear latency histogram in the style of HdrHistogram.
+//
+// Values are microseconds.  Each power of two is split into eight
+// buckets so a percentile is within 12.5% of the true value.  The
+// buckets are atomic counters so recording never takes a lock.
+//
+class VBS_EXP VBSLatency
+{
+public:
+    VBSLatency();
+
+    void record(utp::int64 i_usec);
+
+    // Number of values recorded.
+    utp::int64 count() const;
+
+    // Value at the given percentile (0.0 - 100.0), zero if nothing
+    // has been recorded.
+    utp::int64 percentile(double i_pct) const;
+
+private:
+    enum
+    {
+        SUBBITS = 3,
+        NSUB = 1 << SUBBITS,
+        NLINEAR = NSUB << 2,					// Exact below this
+        NBUCKETS = NLINEAR + (63 - 5) * NSUB
+    };
+
+    static size_t bucket(utp::int64 i_usec);
+
+    static utp::int64 midpoint(size_t i_bucket);
+
+    utp::AtomicLong						m_buckets[NBUCKETS];
+    utp::AtomicLong						m_count;
+};
+
+} // namespace VBS
+
+// Local Variables:
+// mode: C++
+// tab-width: 4
+// c-basic-offset: 4
+// c-file-offsets: ((comment-intro . 0))
+// End:
+
+#endif // VBSLatency_h__
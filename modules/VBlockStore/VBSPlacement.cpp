@@ -0,0 +1,119 @@
+#include <algorithm>
+#include <sstream>
+
+#include "Digest.h"
+#include "Log.h"
+
+#include "VBSChild.h"
+#include "vbslog.h"
+#include "VBSPlacement.h"
+
+using namespace std;
+using namespace utp;
+
+namespace {
+
+// Number of points each child has on the ring.  More points give a
+// more even spread of keys.
+unsigned const NVPOINTS = 128;
+
+} // end namespace
+
+namespace VBS {
+
+VBSPlacement::VBSPlacement()
+{
+}
+
+VBSPlacement::~VBSPlacement()
+{
+}
+
+void
+VBSPlacement::rebuild(VBSChildMap const & i_children)
+{
+    m_ring.clear();
+    m_children.clear();
+
+    for (VBSChildMap::const_iterator it = i_children.begin();
+         it != i_children.end();
+         ++it)
+    {
+        m_children.push_back(it->second);
+
+        // The points are derived from the instance name so a child
+        // keeps its position across restarts.
+        for (unsigned ii = 0; ii < NVPOINTS; ++ii)
+        {
+            ostringstream ostrm;
+            ostrm << it->first << '#' << ii;
+            string const pt = ostrm.str();
+            m_ring.insert(make_pair(hash(pt.data(), pt.size()), it->second));
+        }
+    }
+
+    LOG(lgr, 4, "VBSPlacement rebuilt with " << m_children.size()
+        << " children, " << m_ring.size() << " points");
+}
+
+void
+VBSPlacement::owners(OctetSeq const & i_key,
+                     size_t i_nreplicas,
+                     VBSChildSeq & o_owners,
+                     VBSChildSeq * o_others) const
+{
+    size_t const nowners = min(i_nreplicas, m_children.size());
+
+    // Walk clockwise from the key's position collecting distinct
+    // children, wrapping around the end of the ring.
+    Ring::const_iterator it = m_ring.lower_bound(hash(&i_key[0], i_key.size()));
+    for (size_t nsteps = 0;
+         nsteps < m_ring.size() && o_owners.size() < nowners;
+         ++nsteps, ++it)
+    {
+        if (it == m_ring.end())
+            it = m_ring.begin();
+
+        bool seen = false;
+        for (size_t ii = 0; ii < o_owners.size(); ++ii)
+            if (o_owners[ii].same(it->second))
+                seen = true;
+
+        if (!seen)
+            o_owners.push_back(it->second);
+    }
+
+    if (o_others)
+    {
+        for (size_t ii = 0; ii < m_children.size(); ++ii)
+        {
+            bool isowner = false;
+            for (size_t jj = 0; jj < o_owners.size(); ++jj)
+                if (o_owners[jj].same(m_children[ii]))
+                    isowner = true;
+
+            if (!isowner)
+                o_others->push_back(m_children[ii]);
+        }
+    }
+}
+
+uint64
+VBSPlacement::hash(void const * i_data, size_t i_size)
+{
+    Digest dig(i_data, i_size);
+
+    uint64 val = 0;
+    for (size_t ii = 0; ii < sizeof(val); ++ii)
+        val = (val << 8) | dig.data()[ii];
+    return val;
+}
+
+} // namespace VBS
+
+// Local Variables:
+// mode: C++
+// tab-width: 4
+// c-basic-offset: 4
+// c-file-offsets: ((comment-intro . 0))
+// End:
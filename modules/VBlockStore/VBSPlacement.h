@@ -0,0 +1,59 @@
+#ifndef VBSPlacement_h__
+#define VBSPlacement_h__
+
+/// @file VBSPlacement.h
+/// Virtual BlockStore Consistent Hash Placement
+
+#include <map>
+
+#include "utpfwd.h"
+#include "Types.h"
+
+#include "vbsexp.h"
+#include "vbsfwd.h"
+
+namespace VBS {
+
+// Maps block keys onto children with a consistent hash ring.  Each
+// child owns a number of virtual points on the ring; a key is owned
+// by the first R distinct children found walking clockwise from the
+// key's hash.  Adding or removing a child only moves the keys
+// adjacent to its points.
+//
+class VBS_EXP VBSPlacement
+{
+public:
+    VBSPlacement();
+
+    ~VBSPlacement();
+
+    // Rebuild the ring from the current children.
+    void rebuild(VBSChildMap const & i_children);
+
+    // Fills o_owners with the i_nreplicas children which own the
+    // key.  If o_others is non-NULL it is filled with the remaining
+    // children.
+    void owners(utp::OctetSeq const & i_key,
+                size_t i_nreplicas,
+                VBSChildSeq & o_owners,
+                VBSChildSeq * o_others) const;
+
+private:
+    typedef std::map<utp::uint64, VBSChildHandle> Ring;
+
+    static utp::uint64 hash(void const * i_data, size_t i_size);
+
+    Ring								m_ring;
+    VBSChildSeq							m_children;
+};
+
+} // namespace VBS
+
+// Local Variables:
+// mode: C++
+// tab-width: 4
+// c-basic-offset: 4
+// c-file-offsets: ((comment-intro . 0))
+// End:
+
+#endif // VBSPlacement_h__
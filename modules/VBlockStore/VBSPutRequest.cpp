@@ -3,6 +3,7 @@
 #include "Log.h"
 
 #include "VBlockStore.h"
+#include "VBSBuffer.h"
 #include "VBSChild.h"
 #include "vbslog.h"
 #include "VBSPutRequest.h"
@@ -15,6 +16,7 @@ namespace VBS {
 
 VBSPutRequest::VBSPutRequest(VBlockStore & i_vbs,
                              long i_outstanding,
+                             long i_quorum,
                              void const * i_keydata,
                              size_t i_keysize,
                              void const * i_blkdata,
@@ -23,13 +25,42 @@ VBSPutRequest::VBSPutRequest(VBlockStore & i_vbs,
                              void const * i_argp)
     : VBSRequest(i_vbs, i_outstanding)
     , m_key((uint8 const *) i_keydata, (uint8 const *) i_keydata + i_keysize)
-    , m_blk((uint8 const *) i_blkdata, (uint8 const *) i_blkdata + i_blksize)
+    , m_buf(VBSBuffer::copy(i_blkdata, i_blksize))
+    , m_blksize(i_blksize)
     , m_cmpl(i_cmpl)
     , m_argp(i_argp)
+    , m_quorum(i_quorum)
+    , m_nacked(0)
+    , m_upcalled(false)
+    , m_catchup(false)
 {
     LOG(lgr, 6, "PUT @" << (void *) this << ' ' << keystr(m_key) << " CTOR");
 }
 
+VBSPutRequest::VBSPutRequest(VBlockStore & i_vbs,
+                             long i_outstanding,
+                             long i_quorum,
+                             void const * i_keydata,
+                             size_t i_keysize,
+                             VBSBufferHandle const & i_bh,
+                             size_t i_blksize,
+                             BlockStore::BlockPutCompletion * i_cmpl,
+                             void const * i_argp)
+    : VBSRequest(i_vbs, i_outstanding)
+    , m_key((uint8 const *) i_keydata, (uint8 const *) i_keydata + i_keysize)
+    , m_buf(i_bh)
+    , m_blksize(i_blksize)
+    , m_cmpl(i_cmpl)
+    , m_argp(i_argp)
+    , m_quorum(i_quorum)
+    , m_nacked(0)
+    , m_upcalled(false)
+    , m_catchup(false)
+{
+    LOG(lgr, 6, "PUT @" << (void *) this << ' ' << keystr(m_key)
+        << " CTOR shared");
+}
+
 VBSPutRequest::~VBSPutRequest()
 {
     LOG(lgr, 6, "PUT @" << (void *) this << ' ' << keystr(m_key) << " DTOR");
@@ -48,7 +79,7 @@ VBSPutRequest::initiate(VBSChild * i_cp,
     LOG(lgr, 6, *this << " initiate " << i_cp->instname());
 
     i_bsh->bs_block_put_async(&m_key[0], m_key.size(),
-                              &m_blk[0], m_blk.size(),
+                              m_buf->data(), m_blksize,
                               *this, i_cp);
 }
 
@@ -61,7 +92,8 @@ VBSPutRequest::bp_complete(void const * i_keydata,
 
     LOG(lgr, 6, *this << ' ' << cp->instname() << " bp_complete");
 
-    cp->report_put(m_blk.size());
+    cp->report_put(m_blksize);
+    cp->report_done(SC_PUT, *this, false);
 
     bool do_complete = false;
     bool do_done = false;
@@ -69,21 +101,37 @@ VBSPutRequest::bp_complete(void const * i_keydata,
     {
         ACE_Guard<ACE_Thread_Mutex> guard(m_vbsreqmutex);
 
-        // Are we the first successful completion?
-        if (!m_succeeded)
+        ++m_nacked;
+
+        // Does this completion satisfy the write quorum?
+        if (!m_upcalled && m_nacked >= m_quorum)
         {
             do_complete = true;
             m_succeeded = true;
+            m_upcalled = true;
         }
 
         // Are we the last completion?
         --m_outstanding;
         if (m_outstanding == 0)
             do_done = true;
+
+        // Once the caller is satisfied the remaining children are
+        // catching up in the background.
+        if (do_complete && !do_done)
+        {
+            m_vbs.catchup_begin();
+            m_catchup = true;
+        }
+        else if (do_done && m_catchup)
+        {
+            m_vbs.catchup_end();
+            m_catchup = false;
+        }
     }
 
-    // If we are the first child back with success we get
-    // to tell the parent ...
+    // If we are the child that completes the quorum we get to tell
+    // the parent ...
     //
     if (do_complete && m_cmpl)
     {
@@ -111,6 +159,8 @@ VBSPutRequest::bp_error(void const * i_keydata,
 
     LOG(lgr, 6, *this << ' ' << cp->instname() << " bp_error");
 
+    cp->report_done(SC_PUT, *this, true);
+
     bool do_complete = false;
     bool do_done = false;
 
@@ -120,17 +170,25 @@ VBSPutRequest::bp_error(void const * i_keydata,
         // Are we the last completion?
         --m_outstanding;
         if (m_outstanding == 0)
-        {
             do_done = true;
 
-            // If no other child succeeded send our status.
-            if (!m_succeeded)
-                do_complete = true;
+        // If too many children have failed to ever reach the quorum
+        // send our status.
+        if (!m_upcalled && m_nacked + m_outstanding < m_quorum)
+        {
+            do_complete = true;
+            m_upcalled = true;
+        }
+
+        if (do_done && m_catchup)
+        {
+            m_vbs.catchup_end();
+            m_catchup = false;
         }
     }
 
-    // If we are the last child back with an exception we
-    // get to tell the parent ...
+    // If we are the child that makes the quorum unreachable we get
+    // to tell the parent ...
     //
     if (do_complete && m_cmpl)
     {
@@ -138,6 +196,13 @@ VBSPutRequest::bp_error(void const * i_keydata,
         m_cmpl->bp_error(&m_key[0], m_key.size(), m_argp, i_exp);
     }
 
+    // The child is missing the block whether or not the put made
+    // its quorum elsewhere; remember it as a needed key so the block
+    // gets copied over later.
+    //
+    LOG(lgr, 6, *this << ' ' << cp->instname() << " NEEDS KEY");
+    cp->needed_keys_append(&m_key[0], m_key.size());
+
     // This likely results in our destruction, do it last and
     // don't touch anything afterwards!
     //
@@ -18,6 +18,7 @@ class VBS_EXP VBSPutRequest
 public:
     VBSPutRequest(VBlockStore & i_vbs,
                   long i_outstanding,
+                  long i_quorum,
                   void const * i_keydata,
                   size_t i_keysize,
                   void const * i_blkdata,
@@ -25,6 +26,18 @@ public:
                   utp::BlockStore::BlockPutCompletion * i_cmpl,
                   void const * i_argp);
 
+    // Puts the first i_blksize bytes of a buffer which is shared
+    // with another request instead of copying it.
+    VBSPutRequest(VBlockStore & i_vbs,
+                  long i_outstanding,
+                  long i_quorum,
+                  void const * i_keydata,
+                  size_t i_keysize,
+                  VBSBufferHandle const & i_bh,
+                  size_t i_blksize,
+                  utp::BlockStore::BlockPutCompletion * i_cmpl,
+                  void const * i_argp);
+
     virtual ~VBSPutRequest();
 
     // VBSRequest
@@ -47,9 +60,14 @@ public:
 
 private:
     utp::OctetSeq							m_key;
-    utp::OctetSeq							m_blk;
+    VBSBufferHandle							m_buf;
+    size_t									m_blksize;
     utp::BlockStore::BlockPutCompletion *	m_cmpl;
     void const *							m_argp;
+    long									m_quorum;	// Acks before upcall
+    long									m_nacked;
+    bool									m_upcalled;
+    bool									m_catchup;
 };
 
 } // namespace VBS
@@ -19,11 +19,15 @@ VBSRefreshBlockRequest::VBSRefreshBlockRequest(VBlockStore & i_vbs,
                                                uint64 i_rid,
                                                void const * i_keydata,
                                                size_t i_keysize,
+                                               VBSChildSeq const & i_owners,
+                                               VBSChildSeq const & i_others,
                                                RefreshBlockCompletion & i_cmpl,
                                                void const * i_argp)
     : VBSRequest(i_vbs, i_outstanding)
     , m_rid(i_rid)
     , m_key((uint8 const *) i_keydata, (uint8 const *) i_keydata + i_keysize)
+    , m_owners(i_owners)
+    , m_fallback(i_others)
     , m_cmpl(i_cmpl)
     , m_argp(i_argp)
 {
@@ -59,6 +63,8 @@ VBSRefreshBlockRequest::rb_complete(void const * i_keydata,
 
     LOG(lgr, 6, *this << ' ' << cp->instname() << " rb_complete");
 
+    cp->report_done(SC_REFRESH, *this, false);
+
     bool do_complete = false;
     bool do_done = false;
     {
@@ -71,6 +77,9 @@ VBSRefreshBlockRequest::rb_complete(void const * i_keydata,
             m_succeeded = true;
         }
 
+        // An owner has it, the others' copies can go.
+        m_fallback.clear();
+
         // Are we the last completion?
         --m_outstanding;
         if (m_outstanding == 0)
@@ -105,14 +114,23 @@ VBSRefreshBlockRequest::rb_missing(void const * i_keydata,
 
     LOG(lgr, 6, *this << ' ' << cp->instname() << " rb_missing");
 
+    cp->report_done(SC_REFRESH, *this, false);
+
     bool do_complete = false;
     bool do_done = false;
+    VBSChildSeq fallback;
     {
         ACE_Guard<ACE_Thread_Mutex> guard(m_vbsreqmutex);
 
         // Are we the last completion?
         --m_outstanding;
-        if (m_outstanding == 0)
+        if (m_outstanding == 0 && !m_succeeded && !m_fallback.empty())
+        {
+            // None of the owners had it, keep any other copies.
+            fallback.swap(m_fallback);
+            m_outstanding = fallback.size();
+        }
+        else if (m_outstanding == 0)
         {
             do_done = true;
 
@@ -122,6 +140,12 @@ VBSRefreshBlockRequest::rb_missing(void const * i_keydata,
         }
     }
 
+    if (!fallback.empty())
+    {
+        LOG(lgr, 6, *this << ' ' << "FALLBACK to " << fallback.size()
+            << " non-owner children");
+    }
+
     // If we are the last child back with an exception we
     // get to tell the parent ...
     //
@@ -131,9 +155,20 @@ VBSRefreshBlockRequest::rb_missing(void const * i_keydata,
         m_cmpl.rb_missing(i_keydata, i_keysize, m_argp);
     }
 
-    // Add this key to the child's needed list ...
+    // Add this key to the child's needed list if it is one of the
+    // owners ...
     //
-    cp->needed_keys_append(i_keydata, i_keysize);
+    bool isowner = false;
+    for (size_t ii = 0; ii < m_owners.size(); ++ii)
+        if (&*m_owners[ii] == cp)
+            isowner = true;
+
+    if (isowner)
+        cp->needed_keys_append(i_keydata, i_keysize);
+
+    // Send the request on to the non-owner children.
+    for (unsigned ii = 0; ii < fallback.size(); ++ii)
+        fallback[ii]->enqueue_refresh(this);
 
     // This likely results in our destruction, do it last and
     // don't touch anything afterwards!
@@ -13,6 +13,11 @@
 
 namespace VBS {
 
+// Refreshes a block on its owners.  If none of them has it the
+// request falls back to the other children, so copies which haven't
+// been moved to their owners yet outlive the refresh until they are
+// repaired over.
+//
 class VBS_EXP VBSRefreshBlockRequest
     : public VBSRequest
     , public utp::BlockStore::RefreshBlockCompletion
@@ -23,6 +28,8 @@ public:
                            utp::uint64 i_rid,
                            void const * i_keydata,
                            size_t i_keysize,
+                           VBSChildSeq const & i_owners,
+                           VBSChildSeq const & i_others,
                            utp::BlockStore::RefreshBlockCompletion & i_cmpl,
                            void const * i_argp);
 
@@ -48,6 +55,8 @@ public:
 private:
     utp::uint64									m_rid;
     utp::OctetSeq								m_key;
+    VBSChildSeq									m_owners;
+    VBSChildSeq									m_fallback;	// Non-owners
     utp::BlockStore::RefreshBlockCompletion	&	m_cmpl;
     void const *								m_argp;
 };
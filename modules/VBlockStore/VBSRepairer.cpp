@@ -0,0 +1,299 @@
+#include <algorithm>
+
+#include <ace/Reactor.h>
+
+#include "Log.h"
+#include "Stats.h"
+
+#include "VBlockStore.h"
+#include "VBSChild.h"
+#include "VBSRepairer.h"
+#include "vbslog.h"
+
+using namespace std;
+using namespace utp;
+
+namespace {
+
+// How often the repair cycle runs.
+double const TICKSECS = 0.1;
+
+// Maximum number of repairs we'll have outstanding at once.
+long const MAXINFLIGHT = 16;
+
+} // end namespace
+
+namespace VBS {
+
+VBSRepairer::VBSRepairer(VBlockStore & i_vbs, ACE_Reactor * i_reactor)
+    : m_vbs(i_vbs)
+    , m_reactor(i_reactor)
+    , m_running(false)
+    , m_iops(0)
+    , m_bps(0)
+    , m_iopstok(0.0)
+    , m_bpstok(0.0)
+    , m_inflight(0)
+    , m_nextchild(0)
+    , m_nrepaired(0)
+    , m_nbytes(0)
+    , m_nfailed(0)
+{
+    LOG(lgr, 4, "VBSRepairer CTOR");
+}
+
+VBSRepairer::~VBSRepairer()
+{
+    LOG(lgr, 4, "VBSRepairer DTOR");
+}
+
+int
+VBSRepairer::handle_timeout(ACE_Time_Value const & current_time,
+                            void const * act)
+{
+    LOG(lgr, 9, "VBSRepairer handle_timeout");
+
+    // Refill the token buckets.  We allow bursting up to one second
+    // worth of budget.
+    {
+        ACE_Guard<ACE_Thread_Mutex> guard(m_rprmutex);
+
+        if (!m_running)
+            return 0;
+
+        if (m_iops)
+            m_iopstok = min(m_iopstok + m_iops * TICKSECS, double(m_iops));
+        if (m_bps)
+            m_bpstok = min(m_bpstok + m_bps * TICKSECS, double(m_bps));
+    }
+
+    // There is nothing to copy from if we don't have siblings.
+    VBSChildSeq kids;
+    m_vbs.children(kids);
+    if (kids.size() < 2)
+        return 0;
+
+    // Only the keys queued now are tried this tick; a failed repair
+    // requeues its key and waits for the next one.
+    size_t nqueued = 0;
+    for (size_t ii = 0; ii < kids.size(); ++ii)
+        nqueued += kids[ii]->needed_keys_size();
+
+    // Visit the children round-robin, starting one repair at a time,
+    // until everyone is idle or we run out of budget.
+    //
+    size_t nidle = 0;
+    size_t nstarted = 0;
+    while (nidle < kids.size() && nstarted < nqueued)
+    {
+        VBSChildHandle ch;
+        {
+            ACE_Guard<ACE_Thread_Mutex> guard(m_rprmutex);
+
+            if (!m_running)
+                break;
+
+            if (m_inflight >= MAXINFLIGHT)
+                break;
+
+            if (m_iops && m_iopstok < 1.0)
+                break;
+
+            if (m_bps && m_bpstok <= 0.0)
+                break;
+
+            ch = kids[m_nextchild++ % kids.size()];
+        }
+
+        OctetSeq key;
+        if (!ch->needed_keys_pop(key))
+        {
+            ++nidle;
+            continue;
+        }
+
+        nidle = 0;
+        ++nstarted;
+
+        {
+            ACE_Guard<ACE_Thread_Mutex> guard(m_rprmutex);
+            ++m_inflight;
+            m_iopstok -= 1.0;
+        }
+
+        LOG(lgr, 6, "VBSRepairer repairing " << keystr(key)
+            << " on " << ch->instname());
+
+        if (!m_vbs.repair_key(ch, key, *this, *this))
+        {
+            ACE_Guard<ACE_Thread_Mutex> guard(m_rprmutex);
+            --m_inflight;
+            ++m_nfailed;
+        }
+    }
+
+    return 0;
+}
+
+void
+VBSRepairer::bg_complete(void const * i_keydata,
+                         size_t i_keysize,
+                         void const * i_argp,
+                         size_t i_blksize)
+{
+    LOG(lgr, 6, "VBSRepairer fetched " << keystr(i_keydata, i_keysize));
+
+    OctetSeq key((uint8 const *) i_keydata,
+                 (uint8 const *) i_keydata + i_keysize);
+
+    // The put to the needy child follows, the repair stays in flight
+    // until it completes.
+    ACE_Guard<ACE_Thread_Mutex> guard(m_rprmutex);
+    m_putsizes.insert(make_pair(key, i_blksize));
+
+    // The bytes are charged after the fact; the bucket may go
+    // negative which holds off further repairs until it refills.
+    if (m_bps)
+        m_bpstok -= double(i_blksize);
+}
+
+void
+VBSRepairer::bg_error(void const * i_keydata,
+                      size_t i_keysize,
+                      void const * i_argp,
+                      Exception const & i_exp)
+{
+    VBSChild * cp = (VBSChild *) i_argp;
+
+    LOG(lgr, 6, "VBSRepairer repair of " << keystr(i_keydata, i_keysize)
+        << " failed: " << i_exp.what());
+
+    // If no sibling has the block there is nothing to copy, otherwise
+    // try again later.
+    if (i_exp.type() != Exception::T_NOTFOUND)
+        cp->needed_keys_append(i_keydata, i_keysize);
+
+    ACE_Guard<ACE_Thread_Mutex> guard(m_rprmutex);
+    --m_inflight;
+    ++m_nfailed;
+}
+
+void
+VBSRepairer::bp_complete(void const * i_keydata,
+                         size_t i_keysize,
+                         void const * i_argp)
+{
+    LOG(lgr, 6, "VBSRepairer repaired " << keystr(i_keydata, i_keysize));
+
+    OctetSeq key((uint8 const *) i_keydata,
+                 (uint8 const *) i_keydata + i_keysize);
+
+    ACE_Guard<ACE_Thread_Mutex> guard(m_rprmutex);
+    --m_inflight;
+    ++m_nrepaired;
+
+    SizeMap::iterator pos = m_putsizes.find(key);
+    if (pos != m_putsizes.end())
+    {
+        m_nbytes += pos->second;
+        m_putsizes.erase(pos);
+    }
+}
+
+void
+VBSRepairer::bp_error(void const * i_keydata,
+                      size_t i_keysize,
+                      void const * i_argp,
+                      Exception const & i_exp)
+{
+    // The put request has already put the key back on the child's
+    // needed queue.
+    LOG(lgr, 6, "VBSRepairer put of " << keystr(i_keydata, i_keysize)
+        << " failed: " << i_exp.what());
+
+    OctetSeq key((uint8 const *) i_keydata,
+                 (uint8 const *) i_keydata + i_keysize);
+
+    ACE_Guard<ACE_Thread_Mutex> guard(m_rprmutex);
+    --m_inflight;
+    ++m_nfailed;
+
+    SizeMap::iterator pos = m_putsizes.find(key);
+    if (pos != m_putsizes.end())
+        m_putsizes.erase(pos);
+}
+
+void
+VBSRepairer::init(long i_iops, long i_bps)
+{
+    LOG(lgr, 4, "VBSRepairer init iops=" << i_iops << " bps=" << i_bps);
+
+    {
+        ACE_Guard<ACE_Thread_Mutex> guard(m_rprmutex);
+        m_iops = i_iops;
+        m_bps = i_bps;
+        m_iopstok = 0.0;
+        m_bpstok = 0.0;
+        m_running = true;
+    }
+
+    ACE_Time_Value period;
+    period.set(TICKSECS);
+    m_reactor->schedule_timer(this, NULL, period, period);
+}
+
+void
+VBSRepairer::term()
+{
+    LOG(lgr, 4, "VBSRepairer term");
+
+    {
+        ACE_Guard<ACE_Thread_Mutex> guard(m_rprmutex);
+        if (!m_running)
+            return;
+        m_running = false;
+    }
+
+    m_reactor->cancel_timer(this, DONT_CALL);
+}
+
+void
+VBSRepairer::get_stats(StatSet & o_ss) const
+{
+    o_ss.set_name("repair");
+
+    long iops;
+    long bps;
+    long inflight;
+    int64 nrepaired;
+    int64 nbytes;
+    int64 nfailed;
+    {
+        ACE_Guard<ACE_Thread_Mutex> guard(m_rprmutex);
+        iops = m_iops;
+        bps = m_bps;
+        inflight = m_inflight;
+        nrepaired = m_nrepaired;
+        nbytes = m_nbytes;
+        nfailed = m_nfailed;
+    }
+
+    // Configured budgets.
+    Stats::set(o_ss, "riops", iops, 1.0, "%.0f/s", SF_VALUE);
+    Stats::set(o_ss, "rbps", bps, 1.0/1024.0, "%.1fKB/s", SF_VALUE);
+
+    // Progress.
+    Stats::set(o_ss, "rifl", inflight, 1.0, "%.0f", SF_VALUE);
+    Stats::set(o_ss, "rrps", nrepaired, 1.0, "%.1f/s", SF_DELTA);
+    Stats::set(o_ss, "rkbps", nbytes, 1.0/1024.0, "%.1fKB/s", SF_DELTA);
+    Stats::set(o_ss, "rfail", nfailed, 1.0, "%.0f", SF_VALUE);
+}
+
+} // namespace VBS
+
+// Local Variables:
+// mode: C++
+// tab-width: 4
+// c-basic-offset: 4
+// c-file-offsets: ((comment-intro . 0))
+// End:
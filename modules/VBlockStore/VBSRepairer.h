@@ -0,0 +1,109 @@
+#ifndef VBSRepairer_h__
+#define VBSRepairer_h__
+
+/// @file VBSRepairer.h
+/// Virtual BlockStore Background Repairer
+
+#include <map>
+
+#include <ace/Event_Handler.h>
+#include <ace/Thread_Mutex.h>
+
+#include "utpfwd.h"
+
+#include "BlockStore.h"
+#include "Stats.h"
+
+#include "vbsexp.h"
+#include "vbsfwd.h"
+
+namespace VBS {
+
+// Drains the children's needed-key queues in the background, copying
+// each missing block over from a sibling.  The work is metered by a
+// token bucket so repair traffic stays within a blocks-per-second and
+// bytes-per-second budget.  A repair is counted once the put to the
+// needy child has succeeded.  A repair which fails goes back on the
+// child's queue, unless no sibling has the block, and is tried again
+// on a later tick.
+//
+class VBS_EXP VBSRepairer
+    : public ACE_Event_Handler
+    , public utp::BlockStore::BlockGetCompletion
+    , public utp::BlockStore::BlockPutCompletion
+{
+public:
+    VBSRepairer(VBlockStore & i_vbs, ACE_Reactor * i_reactor);
+
+    virtual ~VBSRepairer();
+
+    // ACE_Event_Handler
+
+    virtual int handle_timeout(ACE_Time_Value const & current_time,
+                               void const * act);
+
+    // BlockGetCompletion
+
+    virtual void bg_complete(void const * i_keydata,
+                             size_t i_keysize,
+                             void const * i_argp,
+                             size_t i_blksize);
+
+    virtual void bg_error(void const * i_keydata,
+                          size_t i_keysize,
+                          void const * i_argp,
+                          utp::Exception const & i_exp);
+
+    // BlockPutCompletion
+
+    virtual void bp_complete(void const * i_keydata,
+                             size_t i_keysize,
+                             void const * i_argp);
+
+    virtual void bp_error(void const * i_keydata,
+                          size_t i_keysize,
+                          void const * i_argp,
+                          utp::Exception const & i_exp);
+
+    // VBSRepairer
+
+    // Start the periodic repair cycle.  A budget of zero means
+    // unlimited.
+    void init(long i_iops, long i_bps);
+
+    void term();
+
+    void get_stats(utp::StatSet & o_ss) const;
+
+private:
+    // Sizes of the blocks fetched and being put, by key.
+    typedef std::multimap<utp::OctetSeq, size_t> SizeMap;
+
+    VBlockStore &						m_vbs;
+    ACE_Reactor *						m_reactor;
+
+    mutable ACE_Thread_Mutex			m_rprmutex;
+    bool								m_running;
+    long								m_iops;		// Budget, blocks/sec
+    long								m_bps;		// Budget, bytes/sec
+    double								m_iopstok;	// Available blocks
+    double								m_bpstok;	// Available bytes
+    long								m_inflight;
+    size_t								m_nextchild;	// Round-robin cursor
+    SizeMap								m_putsizes;
+
+    utp::int64							m_nrepaired;
+    utp::int64							m_nbytes;
+    utp::int64							m_nfailed;
+};
+
+} // namespace VBS
+
+// Local Variables:
+// mode: C++
+// tab-width: 4
+// c-basic-offset: 4
+// c-file-offsets: ((comment-intro . 0))
+// End:
+
+#endif // VBSRepairer_h__
@@ -36,6 +36,29 @@ VBSRequest::done()
     m_vbs.remove_req(this);
 }
 
+void
+VBSRequest::started(VBSChild const * i_cp)
+{
+    ACE_Guard<ACE_Thread_Mutex> guard(m_vbsreqmutex);
+    m_started.push_back(make_pair(i_cp, T64::now()));
+}
+
+T64
+VBSRequest::elapsed(VBSChild const * i_cp)
+{
+    T64 const now = T64::now();
+
+    ACE_Guard<ACE_Thread_Mutex> guard(m_vbsreqmutex);
+
+    // Only a handful of children so a linear search is fine.  The
+    // latest start wins in case a child was asked twice.
+    for (size_t ii = m_started.size(); ii > 0; --ii)
+        if (m_started[ii - 1].first == i_cp)
+            return now - m_started[ii - 1].second;
+
+    return T64(-1);
+}
+
 ostream & operator<<(ostream & ostrm, VBSRequest const & i_req)
 {
     i_req.stream_insert(ostrm);
@@ -5,6 +5,8 @@
 /// Virtual BlockStore Request Base Class
 
 #include <iosfwd>
+#include <utility>
+#include <vector>
 
 #include <ace/Thread_Mutex.h>
 
@@ -12,6 +14,7 @@
 #include "utpfwd.h"
 
 #include "RC.h"
+#include "T64.h"
 
 #include "vbsexp.h"
 #include "vbsfwd.h"
@@ -36,12 +39,24 @@ public:
 
     virtual void done();
 
+    // Notes when the request was handed to a child.
+    void started(VBSChild const * i_cp);
+
+    // How long the request has been running on the child; negative
+    // if it was never started there (eg. it was canceled).
+    utp::T64 elapsed(VBSChild const * i_cp);
+
 protected:
     VBlockStore &					m_vbs;
 
     ACE_Thread_Mutex				m_vbsreqmutex;
     bool							m_succeeded;
     long							m_outstanding;
+
+private:
+    typedef std::vector<std::pair<VBSChild const *, utp::T64> > StartSeq;
+
+    StartSeq						m_started;
 };
 
 std::ostream & operator<<(std::ostream & ostrm, VBSRequest const & i_req);
@@ -1,5 +1,9 @@
+#include <algorithm>
+#include <cstdlib>
+#include <sstream>
 #include <vector>
 
+#include <ace/OS_NS_unistd.h>
 #include <ace/TP_Reactor.h>
 
 #include "Base32.h"
@@ -8,7 +12,11 @@
 #include "BlockStoreFactory.h"
 
 #include "VBlockStore.h"
+#include "VBSBuffer.h"
 #include "VBSChild.h"
+#include "VBSECGetRequest.h"
+#include "VBSECPutRequest.h"
+#include "VBSECRefreshReq.h"
 #include "VBSGetRequest.h"
 #include "VBSHeadFollowRequest.h"
 #include "VBSHeadFurthestTopReq.h"
@@ -23,6 +31,117 @@
 using namespace std;
 using namespace utp;
 
+namespace {
+
+// Parses the non-negative numeric value of a "--name=value" argument.
+long
+parse_count(string const & i_arg, string const & i_prefix)
+{
+    string const val = i_arg.substr(i_prefix.length());
+    char * endp;
+    long count = strtol(val.c_str(), &endp, 10);
+    if (val.empty() || *endp != '\0' || count < 0)
+        throwstream(ValueError, "bad VBS parameter: " << i_arg);
+    return count;
+}
+
+// Parses the "K+M" value of an "--erasure=K+M" argument.
+void
+parse_erasure(string const & i_arg,
+              string const & i_prefix,
+              size_t & o_k,
+              size_t & o_m)
+{
+    string const val = i_arg.substr(i_prefix.length());
+    char * endp;
+    long k = strtol(val.c_str(), &endp, 10);
+    if (endp == val.c_str() || *endp != '+')
+        throwstream(ValueError, "bad VBS parameter: " << i_arg);
+
+    char const * mp = endp + 1;
+    long m = strtol(mp, &endp, 10);
+    if (endp == mp || *endp != '\0')
+        throwstream(ValueError, "bad VBS parameter: " << i_arg);
+
+    // Fragments are numbered with a single key byte.
+    if (k < 1 || m < 0 || k + m > 255)
+        throwstream(ValueError, "bad VBS parameter: " << i_arg);
+
+    o_k = size_t(k);
+    o_m = size_t(m);
+}
+
+// A child's needed keys are kept on its siblings in blocks of up to
+// this size.
+size_t const NEEDEDBLKSZ = 32 * 1024;
+
+// Largest block a repair can copy, the largest data block UTFS
+// writes.
+size_t const REPAIRBLKSZ = 1024 * 1024;
+
+// Key of the i_ndx'th block of a child's needed keys.
+OctetSeq
+needed_blkkey(string const & i_instname, size_t i_ndx)
+{
+    ostringstream ostrm;
+    ostrm << "VBS needed keys " << i_instname << ' ' << i_ndx;
+    string const str = ostrm.str();
+    return OctetSeq(str.begin(), str.end());
+}
+
+// Packs the keys into blocks.  Each block starts with a byte which is
+// set if another block follows, then each key prefixed by its two
+// byte length.  There is always at least one block.
+void
+needed_pack(vector<OctetSeq> const & i_keys, vector<OctetSeq> & o_blks)
+{
+    o_blks.push_back(OctetSeq(1, 0));
+    for (size_t ii = 0; ii < i_keys.size(); ++ii)
+    {
+        OctetSeq const & key = i_keys[ii];
+        if (key.empty() || key.size() > 0xffff)
+            continue;
+
+        if (o_blks.back().size() + 2 + key.size() > NEEDEDBLKSZ)
+        {
+            o_blks.back()[0] = 1;
+            o_blks.push_back(OctetSeq(1, 0));
+        }
+
+        OctetSeq & blk = o_blks.back();
+        blk.push_back(uint8(key.size() >> 8));
+        blk.push_back(uint8(key.size() & 0xff));
+        blk.insert(blk.end(), key.begin(), key.end());
+    }
+}
+
+// Adds the keys in a block to o_keys, returns true if another block
+// follows.
+bool
+needed_unpack(OctetSeq const & i_blk, size_t i_size, set<OctetSeq> & o_keys)
+{
+    if (i_size < 1)
+        return false;
+
+    size_t off = 1;
+    while (off + 2 <= i_size)
+    {
+        size_t len = (size_t(i_blk[off]) << 8) | i_blk[off + 1];
+        off += 2;
+
+        // A damaged block, keep what we have.
+        if (len == 0 || off + len > i_size)
+            return false;
+
+        o_keys.insert(OctetSeq(i_blk.begin() + off,
+                               i_blk.begin() + off + len));
+        off += len;
+    }
+    return i_blk[0] != 0;
+}
+
+} // end namespace
+
 namespace VBS {
 
 void
@@ -38,9 +157,31 @@ VBlockStore::VBlockStore(string const & i_instname)
     , m_vbsthreadpool(m_vbsreactor, "vbs")
     , m_vbscond(m_vbsmutex)
     , m_waiting(false)
+    , m_wquorum(1)
+    , m_ncatchup(0)
+    , m_ncoalesced(0)
+    , m_nrebuilt(0)
+    , m_repairiops(100)
+    , m_repairbps(4 * 1024 * 1024)
+    , m_repairer(*this, m_vbsreactor)
+    , m_headperiod(30)
+    , m_headcache(*this, m_vbsreactor)
+    , m_replicas(0)
+    , m_getdeadline(50)
+    , m_brkerrors(50)
+    , m_brklatency(2000)
+    , m_eck(0)
+    , m_ecm(0)
 {
     LOG(lgr, 4, m_instname << ' ' << "CTOR");
 
+    // Gets get the largest share so reads stay responsive while
+    // refresh and replication traffic is running.
+    m_weights[SC_REFRESH] = 1;
+    m_weights[SC_HEADNODE] = 4;
+    m_weights[SC_GET] = 8;
+    m_weights[SC_PUT] = 2;
+
     m_vbsthreadpool.init(ACE_OS::num_processors_online() * 2);
 }
 
@@ -48,6 +189,9 @@ VBlockStore::~VBlockStore()
 {
     LOG(lgr, 4, m_instname << ' ' << "DTOR");
 
+    m_repairer.term();
+    m_headcache.term();
+
     m_vbsthreadpool.term();
 }
 
@@ -75,13 +219,62 @@ VBlockStore::bs_open(StringSeq const & i_args)
 {
     LOG(lgr, 4, m_instname << ' ' << "bs_open");
 
+    StringSeq children;
+    parse_params(i_args, children);
+
+    if (m_replicas > long(children.size()))
+        throwstream(ValueError,
+                    "VBS replicas " << m_replicas
+                    << " exceeds number of children " << children.size());
+
+    for (int sc = 0; sc < SC_NCLASSES; ++sc)
+        if (m_weights[sc] < 1)
+            throwstream(ValueError, "VBS scheduling weights must be positive");
+
+    if (m_eck && m_replicas)
+        throwstream(ValueError,
+                    "VBS erasure coding and replicas are exclusive");
+
+    if (m_eck + m_ecm > children.size())
+        throwstream(ValueError,
+                    "VBS erasure fragments " << m_eck + m_ecm
+                    << " exceeds number of children " << children.size());
+
+    // Each block is written to this many children.
+    long ncopies = long(children.size());
+    if (m_replicas)
+        ncopies = m_replicas;
+    else if (m_eck)
+        ncopies = long(m_eck + m_ecm);
+
+    if (m_wquorum > ncopies)
+        throwstream(ValueError,
+                    "VBS write quorum " << m_wquorum
+                    << " exceeds number of copies " << ncopies);
+
     // Insert each of the child blockstores in our collection.
-    for (size_t ii = 0; ii < i_args.size(); ++ii)
+    for (size_t ii = 0; ii < children.size(); ++ii)
     {
-        string const & instname = i_args[ii];
+        string const & instname = children[ii];
         m_children.insert(make_pair(instname,
                                     new VBSChild(*this, m_vbsreactor, instname)));
     }
+
+    if (m_eck)
+        m_ec = new VBSErasureCode(m_eck, m_ecm);
+
+    // Lay out the placement ring.
+    if (m_replicas || m_eck)
+        m_placement.rebuild(m_children);
+
+    // Pick up the repairs owed from before a restart.
+    load_needed();
+
+    // Start copying needed keys between the children.
+    m_repairer.init(m_repairiops, m_repairbps);
+
+    // Start reconciling the merged head graph.
+    m_headcache.init(m_headperiod);
 }
 
 void
@@ -90,6 +283,20 @@ VBlockStore::bs_close()
 {
     LOG(lgr, 4, m_instname << ' ' << "bs_close");
 
+    // Stop starting new repairs, any in progress are waited for
+    // below.
+    m_repairer.term();
+
+    // Stop reconciling the head graph, furthest queries go to the
+    // children from here on.
+    m_headcache.term();
+
+    // Stop the children's health probes.
+    for (VBSChildMap::const_iterator it = m_children.begin();
+         it != m_children.end();
+         ++it)
+        it->second->term();
+
     // We have to wait here until all requests are finished, otherwise
     // blamo ...
     //
@@ -126,6 +333,9 @@ VBlockStore::bs_stat(Stat & o_stat)
     o_stat.bss_size = 0;
     o_stat.bss_free = 0;
 
+    off_t sumsize = 0;
+    off_t sumfree = 0;
+
     for (VBSChildMap::const_iterator it = m_children.begin();
          it != m_children.end();
          ++it)
@@ -134,6 +344,9 @@ VBlockStore::bs_stat(Stat & o_stat)
         Stat stat;
         it->second->bs()->bs_stat(stat);
 
+        sumsize += stat.bss_size;
+        sumfree += stat.bss_free;
+
         // Is this bigger then what we have so far?
         if (o_stat.bss_size < stat.bss_size)
         {
@@ -141,6 +354,21 @@ VBlockStore::bs_stat(Stat & o_stat)
             o_stat.bss_free = stat.bss_free;
         }
     }
+
+    // When blocks are spread across the children the capacity is
+    // the total divided by the number of copies.
+    if (m_replicas)
+    {
+        o_stat.bss_size = sumsize / m_replicas;
+        o_stat.bss_free = sumfree / m_replicas;
+    }
+
+    // Erasure coding stores n fragments for k fragments of data.
+    if (m_ec)
+    {
+        o_stat.bss_size = sumsize * m_ec->k() / m_ec->n();
+        o_stat.bss_free = sumfree * m_ec->k() / m_ec->n();
+    }
 }
 
 void
@@ -154,32 +382,39 @@ VBlockStore::bs_sync()
     bool clean;
     do
     {
-        ACE_Guard<ACE_Thread_Mutex> guard(m_vbsmutex);
-
-        clean = true;
-
-        // Make sure all the kids are sync'd first.
-        for (VBSChildMap::const_iterator it = m_children.begin();
-             it != m_children.end();
-             ++it)
-        {
-            // Release the lock while we call the child.
-            ACE_Reverse_Lock<ACE_Thread_Mutex> revmutex(m_vbsmutex);
-            ACE_Guard<ACE_Reverse_Lock<ACE_Thread_Mutex> > unguard(revmutex);
-
-            it->second->bs()->bs_sync();
-        }
-
-        // Make sure we have no requests left.
-        while (!m_requests.empty())
         {
-            clean = false;
-            m_waiting = true;
-            m_vbscond.wait();
+            ACE_Guard<ACE_Thread_Mutex> guard(m_vbsmutex);
+
+            clean = true;
+
+            // Make sure all the kids are sync'd first.
+            for (VBSChildMap::const_iterator it = m_children.begin();
+                 it != m_children.end();
+                 ++it)
+            {
+                // Release the lock while we call the child.
+                ACE_Reverse_Lock<ACE_Thread_Mutex> revmutex(m_vbsmutex);
+                ACE_Guard<ACE_Reverse_Lock<ACE_Thread_Mutex> >
+                    unguard(revmutex);
+
+                it->second->bs()->bs_sync();
+            }
+
+            // Make sure we have no requests left.
+            while (!m_requests.empty())
+            {
+                clean = false;
+                m_waiting = true;
+                m_vbscond.wait();
+            }
         }
     }
     while (!clean);
 
+    // Repairs go on in the background at their own budget; the ones
+    // still owed are saved instead so a restart doesn't forget them.
+    save_needed();
+
     --m_nwaitsyn;
 
     LOG(lgr, 6, m_instname << ' ' << "bs_sync finished");
@@ -195,9 +430,76 @@ VBlockStore::bs_block_get_async(void const * i_keydata,
     throw(InternalError,
           ValueError)
 {
+    OctetSeq key((uint8 const *) i_keydata,
+                 (uint8 const *) i_keydata + i_keysize);
+
+    // Erasure coded blocks are gathered from their fragments.
+    if (m_ec)
+    {
+        VBSChildSeq owners;
+        VBSChildSeq others;
+        placement(key, owners, &others);
+
+        VBSECGetRequestHandle egrh = new VBSECGetRequest(*this,
+                                                         *m_ec,
+                                                         i_keydata,
+                                                         i_keysize,
+                                                         o_buffdata,
+                                                         i_buffsize,
+                                                         &i_cmpl,
+                                                         i_argp);
+
+        LOG(lgr, 6, m_instname << ' ' << "bs_block_get_async " << *egrh);
+
+        insert_req(egrh);
+
+        // This request type issues subrequests to the children ...
+        egrh->init(owners, others);
+        return;
+    }
+
+    // Is there already a get in flight for this key?  If so just
+    // ride along with it.
+    {
+        ACE_Guard<ACE_Thread_Mutex> guard(m_vbsmutex);
+        VBSGetRequestMap::const_iterator pos = m_getsinflight.find(key);
+        if (pos != m_getsinflight.end() &&
+            pos->second->attach(o_buffdata, i_buffsize, &i_cmpl, i_argp))
+        {
+            LOG(lgr, 6, m_instname << ' '
+                << "bs_block_get_async coalesced " << *pos->second);
+            ++m_ncoalesced;
+            return;
+        }
+    }
+
+    // Which children should have this block?
+    VBSChildSeq owners;
+    VBSChildSeq others;
+    placement(key, owners, &others);
+
+    // Children whose circuit breaker is open are only asked after
+    // the healthy ones, unless no one is healthy.
+    VBSChildSeq healthy;
+    VBSChildSeq tripped;
+    for (size_t ii = 0; ii < owners.size(); ++ii)
+    {
+        if (owners[ii]->healthy())
+            healthy.push_back(owners[ii]);
+        else
+            tripped.push_back(owners[ii]);
+    }
+    if (!healthy.empty() && !tripped.empty())
+    {
+        LOG(lgr, 6, m_instname << ' ' << "bs_block_get_async skipping "
+            << tripped.size() << " unhealthy children");
+        owners.swap(healthy);
+        others.insert(others.end(), tripped.begin(), tripped.end());
+    }
+
     // Create a VBSGetRequest.
     VBSGetRequestHandle grh = new VBSGetRequest(*this,
-                                                m_children.size(),
+                                                owners.size(),
                                                 i_keydata,
                                                 i_keysize,
                                                 o_buffdata,
@@ -205,20 +507,24 @@ VBlockStore::bs_block_get_async(void const * i_keydata,
                                                 &i_cmpl,
                                                 i_argp);
 
+    // If the owners don't have it the block may not have been moved
+    // to them yet.
+    grh->fallback(others);
+
      LOG(lgr, 6, m_instname << ' ' << "bs_block_get_async " << *grh);
 
-    // Insert this request in our request list.  We need to do this
-    // first in case the request completes synchrounously below.
+    // Insert this request in our request list and make it available
+    // for coalescing.  We need to do this first in case the request
+    // completes synchrounously below.
     {
         ACE_Guard<ACE_Thread_Mutex> guard(m_vbsmutex);
         m_requests.insert(grh);
+        m_getsinflight[key] = grh;
     }
 
-    // Enqueue the request w/ all of the kids.
-    for (VBSChildMap::const_iterator it = m_children.begin();
-         it != m_children.end();
-         ++it)
-        it->second->enqueue_get(grh);
+    // Enqueue the request w/ the owning kids.
+    for (size_t ii = 0; ii < owners.size(); ++ii)
+        owners[ii]->enqueue_get(grh);
 }
 
 void
@@ -231,9 +537,43 @@ VBlockStore::bs_block_put_async(void const * i_keydata,
     throw(InternalError,
           ValueError)
 {
+    // Which children should store this block?
+    VBSChildSeq owners;
+    placement(OctetSeq((uint8 const *) i_keydata,
+                       (uint8 const *) i_keydata + i_keysize),
+              owners,
+              NULL);
+
+    // Erasure coded blocks are split into fragments.  The block is
+    // readable once any k fragments are stored.
+    if (m_ec)
+    {
+        long const quorum =
+            max(long(m_ec->k()), write_quorum(long(m_ec->n())));
+
+        VBSECPutRequestHandle eprh = new VBSECPutRequest(*this,
+                                                         *m_ec,
+                                                         quorum,
+                                                         i_keydata,
+                                                         i_keysize,
+                                                         i_blkdata,
+                                                         i_blksize,
+                                                         &i_cmpl,
+                                                         i_argp);
+
+        LOG(lgr, 6, m_instname << ' ' << "bs_block_put_async " << *eprh);
+
+        insert_req(eprh);
+
+        // This request type issues subrequests to the children ...
+        eprh->init(owners);
+        return;
+    }
+
     // Create a VBSPutRequest.
     VBSPutRequestHandle prh = new VBSPutRequest(*this,
-                                                m_children.size(),
+                                                owners.size(),
+                                                write_quorum(owners.size()),
                                                 i_keydata,
                                                 i_keysize,
                                                 i_blkdata,
@@ -247,11 +587,9 @@ VBlockStore::bs_block_put_async(void const * i_keydata,
     // first in case the request completes synchrounously below.
     insert_req(prh);
 
-    // Enqueue the request w/ all of the kids.
-    for (VBSChildMap::const_iterator it = m_children.begin();
-         it != m_children.end();
-         ++it)
-        it->second->enqueue_put(prh);
+    // Enqueue the request w/ the owning kids.
+    for (size_t ii = 0; ii < owners.size(); ++ii)
+        owners[ii]->enqueue_put(prh);
 }
 
 void
@@ -290,13 +628,46 @@ VBlockStore::bs_refresh_block_async(uint64 i_rid,
     throw(InternalError,
           NotFoundError)
 {
+    // Only the owners are asked, and repaired if they are missing
+    // the block.  The other children keep their copies only while
+    // no owner has one.
+    VBSChildSeq owners;
+    VBSChildSeq others;
+    placement(OctetSeq((uint8 const *) i_keydata,
+                       (uint8 const *) i_keydata + i_keysize),
+              owners,
+              &others);
+
+    // Each fragment of an erasure coded block is refreshed on its
+    // own child.
+    if (m_ec)
+    {
+        VBSECRefreshReqHandle errh = new VBSECRefreshReq(*this,
+                                                         *m_ec,
+                                                         i_rid,
+                                                         i_keydata,
+                                                         i_keysize,
+                                                         i_cmpl,
+                                                         i_argp);
+
+        LOG(lgr, 6, m_instname << ' ' << "bs_refresh_block_async " << *errh);
+
+        insert_req(errh);
+
+        // This request type issues subrequests to the children ...
+        errh->init(owners);
+        return;
+    }
+
     // Create a request.
     VBSRefreshBlockRequestHandle rrh =
         new VBSRefreshBlockRequest(*this,
-                                   m_children.size(),
+                                   owners.size(),
                                    i_rid,
                                    i_keydata,
                                    i_keysize,
+                                   owners,
+                                   others,
                                    i_cmpl,
                                    i_argp);
 
@@ -306,11 +677,9 @@ VBlockStore::bs_refresh_block_async(uint64 i_rid,
     // first in case the request completes synchrounously below.
     insert_req(rrh);
 
-    // Enqueue the request w/ all of the kids.
-    for (VBSChildMap::const_iterator it = m_children.begin();
-         it != m_children.end();
-         ++it)
-        it->second->enqueue_refresh(rrh);
+    // Enqueue the request w/ the owners.
+    for (size_t ii = 0; ii < owners.size(); ++ii)
+        owners[ii]->enqueue_refresh(rrh);
 }
         
 void
@@ -329,6 +698,15 @@ VBlockStore::bs_refresh_finish_async(uint64 i_rid,
 
     LOG(lgr, 6, m_instname << ' ' << "bs_refresh_finish_async " << *rrh);
 
+    // The saved needed keys aren't referenced by the filesystem, so
+    // unless they were written since the refresh started it lets
+    // them go.  Write them again at the next sync.  Forgetting them
+    // any earlier could miss a save which raced the refresh start.
+    {
+        ACE_Guard<ACE_Thread_Mutex> guard(m_needmutex);
+        m_neededsaved.clear();
+    }
+
     // Insert this request in our request list.  We need to do this
     // first in case the request completes synchrounously below.
     insert_req(rrh);
@@ -400,6 +778,14 @@ VBlockStore::bs_head_furthest_async(HeadNode const & i_hn,
                                     void const * i_argp)
     throw(InternalError)
 {
+    // Answer from the merged head graph if we can.
+    if (m_headcache.furthest(i_hn, i_func, i_argp))
+    {
+        LOG(lgr, 6, m_instname << ' '
+            << "bs_head_furthest_async " << i_hn << " from cache");
+        return;
+    }
+
     // Create a VBSHeadFurthestTopReq.
     VBSHeadFurthestTopReqHandle hftrh =
         new VBSHeadFurthestTopReq(*this,
@@ -465,8 +851,40 @@ VBlockStore::bs_get_stats(StatSet & o_ss) const
         nkql += it->second->needed_keys_size();
     }
 
+    // Background repair progress.
+    m_repairer.get_stats(*o_ss.add_subset());
+
+    // Merged head graph.
+    m_headcache.get_stats(*o_ss.add_subset());
+
     Stats::set(o_ss, "nreqs", nreqs + nkql, 1.0, "%.0f", SF_VALUE);
     Stats::set(o_ss, "dnreqs", int64_t(nreqs + nkql), 1.0, "%.0f", SF_DELTA);
+
+    // Puts which have met the write quorum but are still pending on
+    // some children.
+    Stats::set(o_ss, "cql", m_ncatchup.value(), 1.0, "%.0f", SF_VALUE);
+
+    // Gets which rode along on a request already in flight.
+    Stats::set(o_ss, "cgps", m_ncoalesced.value(), 1.0, "%.1f/s", SF_DELTA);
+
+    // Erasure coded fragments rebuilt onto their owners.
+    Stats::set(o_ss, "frps", m_nrebuilt.value(), 1.0, "%.1f/s", SF_DELTA);
+
+    // Block buffer pool.
+    int64 nbphits;
+    int64 nbpmisses;
+    size_t nbpooled;
+    VBSBuffer::pool_stats(nbphits, nbpmisses, nbpooled);
+    Stats::set(o_ss, "bphps", nbphits, 1.0, "%.1f/s", SF_DELTA);
+    Stats::set(o_ss, "bpmps", nbpmisses, 1.0, "%.1f/s", SF_DELTA);
+    Stats::set(o_ss, "bpsz", nbpooled, 1.0, "%.0f", SF_VALUE);
+
+    // Scheduling configuration.
+    Stats::set(o_ss, "wref", m_weights[SC_REFRESH], 1.0, "%.0f", SF_VALUE);
+    Stats::set(o_ss, "whed", m_weights[SC_HEADNODE], 1.0, "%.0f", SF_VALUE);
+    Stats::set(o_ss, "wget", m_weights[SC_GET], 1.0, "%.0f", SF_VALUE);
+    Stats::set(o_ss, "wput", m_weights[SC_PUT], 1.0, "%.0f", SF_VALUE);
+    Stats::set(o_ss, "gdln", m_getdeadline, 1.0, "%.0fms", SF_VALUE);
 }
 
 bool
@@ -522,7 +940,7 @@ VBlockStore::cancel_get(VBSChild * i_hadit, utp::OctetSeq const & i_key)
 {
     LOG(lgr, 6, m_instname << ' '
         << "cancel_get " << keystr(i_key)
-        << ", " << i_hadit->instname() << " had it");
+        << ", " << (i_hadit ? i_hadit->instname() : "nobody") << " had it");
 
     vector<pair<VBSChildHandle, VBSGetRequestHandle> > reqs;
     {
@@ -554,9 +972,11 @@ VBlockStore::cancel_get(VBSChild * i_hadit, utp::OctetSeq const & i_key)
     }
 }
 
-void
-VBlockStore::enqueue_needy_get(VBSGetRequestHandle const & i_grh,
-                               VBSChildHandle i_nh)
+bool
+VBlockStore::repair_key(VBSChildHandle const & i_nh,
+                        OctetSeq const & i_key,
+                        BlockGetCompletion & i_gcmpl,
+                        BlockPutCompletion & i_pcmpl)
 {
     // Fill a collection with the "other" children, who might
     // have the item we need ...
@@ -576,20 +996,326 @@ VBlockStore::enqueue_needy_get(VBSGetRequestHandle const & i_grh,
         }
     }
 
-    // If there are now other children we're out of luck
-    // and done, just let the request drop ...
+    // If there are no other children we're out of luck.
     //
     if (others.empty())
-        return;
+        return false;
+
+    VBSGetRequestHandle grh = new VBSGetRequest(*this,
+                                                others.size(),
+                                                &i_key[0],
+                                                i_key.size(),
+                                                NULL,
+                                                REPAIRBLKSZ,
+                                                &i_gcmpl,
+                                                &*i_nh);
+    grh->needy(i_nh, &i_pcmpl);
+
+    // Repairs shouldn't hold up interactive reads.
+    grh->background();
 
     // Insert this request into our list.
     //
-    insert_req(i_grh);
+    insert_req(grh);
 
     // With the lock released, enqueue the get with the others.
     //
     for (unsigned ii = 0; ii < others.size(); ++ii)
-        others[ii]->enqueue_get(i_grh);
+        others[ii]->enqueue_get(grh);
+
+    return true;
+}
+
+void
+VBlockStore::placement(OctetSeq const & i_key,
+                       VBSChildSeq & o_owners,
+                       VBSChildSeq * o_others) const
+{
+    // In placement mode consult the ring.
+    if (m_replicas)
+    {
+        m_placement.owners(i_key, m_replicas, o_owners, o_others);
+        return;
+    }
+
+    // Erasure coded fragments are spread over n distinct children.
+    if (m_ec)
+    {
+        m_placement.owners(i_key, m_ec->n(), o_owners, o_others);
+        return;
+    }
+
+    // Otherwise every child mirrors every block.
+    for (VBSChildMap::const_iterator it = m_children.begin();
+         it != m_children.end();
+         ++it)
+        o_owners.push_back(it->second);
+}
+
+void
+VBlockStore::children(VBSChildSeq & o_children) const
+{
+    ACE_Guard<ACE_Thread_Mutex> guard(m_vbsmutex);
+    for (VBSChildMap::const_iterator it = m_children.begin();
+         it != m_children.end();
+         ++it)
+        o_children.push_back(it->second);
+}
+
+void
+VBlockStore::forget_get(VBSGetRequest * i_grp)
+{
+    ACE_Guard<ACE_Thread_Mutex> guard(m_vbsmutex);
+
+    // Only remove the entry if it is still us, a later request
+    // for the same key may have replaced us.
+    VBSGetRequestMap::iterator pos = m_getsinflight.find(i_grp->key());
+    if (pos != m_getsinflight.end() && &*pos->second == i_grp)
+        m_getsinflight.erase(pos);
+}
+
+long
+VBlockStore::sched_weight(VBSSchedClass i_sc) const
+{
+    return m_weights[i_sc];
+}
+
+T64
+VBlockStore::get_deadline() const
+{
+    return T64::usec(int64(m_getdeadline) * 1000LL);
+}
+
+void
+VBlockStore::breaker_limits(double & o_errors, T64 & o_latency) const
+{
+    o_errors = m_brkerrors / 100.0;
+    o_latency = T64::usec(int64(m_brklatency) * 1000LL);
+}
+
+long
+VBlockStore::write_quorum(long i_nchildren) const
+{
+    // A quorum of zero (or one larger than we have) means everyone.
+    if (m_wquorum <= 0 || m_wquorum > i_nchildren)
+        return i_nchildren;
+    else
+        return m_wquorum;
+}
+
+void
+VBlockStore::head_inserted(SignedHeadEdge const & i_she)
+{
+    m_headcache.insert(i_she);
+}
+
+void
+VBlockStore::catchup_begin()
+{
+    ++m_ncatchup;
+}
+
+void
+VBlockStore::catchup_end()
+{
+    --m_ncatchup;
+}
+
+void
+VBlockStore::fragments_rebuilt(size_t i_nfrags)
+{
+    m_nrebuilt += long(i_nfrags);
+}
+
+void
+VBlockStore::parse_params(StringSeq const & i_args, StringSeq & o_children)
+{
+    string const WQUORUM = "--write-quorum=";
+    string const REPAIR_IOPS = "--repair-iops=";
+    string const REPAIR_BPS = "--repair-bps=";
+    string const REPLICAS = "--replicas=";
+    string const ERASURE = "--erasure=";
+    string const WREFRESH = "--weight-refresh=";
+    string const WHEADNODE = "--weight-headnode=";
+    string const WGET = "--weight-get=";
+    string const WPUT = "--weight-put=";
+    string const GDEADLINE = "--get-deadline=";
+    string const BRKERRORS = "--breaker-errors=";
+    string const BRKLATENCY = "--breaker-latency=";
+    string const HEADRECONCILE = "--head-reconcile=";
+
+    for (unsigned i = 0; i < i_args.size(); ++i)
+    {
+        if (i_args[i].find(WQUORUM) == 0)
+            m_wquorum = parse_count(i_args[i], WQUORUM);
+
+        else if (i_args[i].find(REPAIR_IOPS) == 0)
+            m_repairiops = parse_count(i_args[i], REPAIR_IOPS);
+
+        else if (i_args[i].find(REPAIR_BPS) == 0)
+            m_repairbps = parse_count(i_args[i], REPAIR_BPS);
+
+        else if (i_args[i].find(REPLICAS) == 0)
+            m_replicas = parse_count(i_args[i], REPLICAS);
+
+        else if (i_args[i].find(ERASURE) == 0)
+            parse_erasure(i_args[i], ERASURE, m_eck, m_ecm);
+
+        else if (i_args[i].find(WREFRESH) == 0)
+            m_weights[SC_REFRESH] = parse_count(i_args[i], WREFRESH);
+
+        else if (i_args[i].find(WHEADNODE) == 0)
+            m_weights[SC_HEADNODE] = parse_count(i_args[i], WHEADNODE);
+
+        else if (i_args[i].find(WGET) == 0)
+            m_weights[SC_GET] = parse_count(i_args[i], WGET);
+
+        else if (i_args[i].find(WPUT) == 0)
+            m_weights[SC_PUT] = parse_count(i_args[i], WPUT);
+
+        else if (i_args[i].find(GDEADLINE) == 0)
+            m_getdeadline = parse_count(i_args[i], GDEADLINE);
+
+        else if (i_args[i].find(BRKERRORS) == 0)
+            m_brkerrors = parse_count(i_args[i], BRKERRORS);
+
+        else if (i_args[i].find(BRKLATENCY) == 0)
+            m_brklatency = parse_count(i_args[i], BRKLATENCY);
+
+        else if (i_args[i].find(HEADRECONCILE) == 0)
+            m_headperiod = parse_count(i_args[i], HEADRECONCILE);
+
+        else if (i_args[i].find("--") == 0)
+            throwstream(ValueError,
+                        "unknown option VBS parameter: " << i_args[i]);
+
+        // Everything else is a child blockstore name.
+        else
+            o_children.push_back(i_args[i]);
+    }
+}
+
+void
+VBlockStore::load_needed()
+{
+    VBSChildSeq kids;
+    children(kids);
+
+    ACE_Guard<ACE_Thread_Mutex> guard(m_needmutex);
+
+    OctetSeq buf(NEEDEDBLKSZ);
+    for (size_t ii = 0; ii < kids.size(); ++ii)
+    {
+        VBSChildHandle const & ch = kids[ii];
+
+        // Every sibling holds a copy; one which missed a save is
+        // stale, so take the union.
+        set<OctetSeq> keys;
+        for (size_t jj = 0; jj < kids.size(); ++jj)
+        {
+            if (jj == ii)
+                continue;
+
+            try
+            {
+                for (size_t nn = 0; true; ++nn)
+                {
+                    OctetSeq const key = needed_blkkey(ch->instname(), nn);
+                    size_t sz = kids[jj]->bs()->bs_block_get(&key[0],
+                                                            key.size(),
+                                                            &buf[0],
+                                                            buf.size());
+                    if (!needed_unpack(buf, sz, keys))
+                        break;
+                }
+            }
+            catch (NotFoundError const & ex)
+            {
+                // Never saved here.
+            }
+            catch (Exception const & ex)
+            {
+                LOG(lgr, 2, m_instname << ' '
+                    << "load_needed " << ch->instname()
+                    << " from " << kids[jj]->instname()
+                    << ": " << ex.what());
+            }
+        }
+
+        if (!keys.empty())
+            LOG(lgr, 4, m_instname << ' ' << ch->instname()
+                << " still needs " << keys.size() << " keys");
+
+        for (set<OctetSeq>::const_iterator it = keys.begin();
+             it != keys.end();
+             ++it)
+            ch->needed_keys_append(&(*it)[0], it->size());
+
+        // These are what the siblings hold now.
+        m_neededsaved[ch->instname()].assign(keys.begin(), keys.end());
+    }
+}
+
+void
+VBlockStore::save_needed()
+{
+    VBSChildSeq kids;
+    children(kids);
+
+    // A single child has nowhere else to keep them, and nothing to
+    // repair from anyway.
+    if (kids.size() < 2)
+        return;
+
+    ACE_Guard<ACE_Thread_Mutex> guard(m_needmutex);
+
+    for (size_t ii = 0; ii < kids.size(); ++ii)
+    {
+        VBSChildHandle const & ch = kids[ii];
+
+        vector<OctetSeq> keys;
+        ch->needed_keys_copy(keys);
+
+        // Nothing to do if they haven't changed since the last save.
+        NeededKeysMap::const_iterator pos =
+            m_neededsaved.find(ch->instname());
+        if (pos != m_neededsaved.end() && pos->second == keys)
+            continue;
+
+        vector<OctetSeq> blks;
+        needed_pack(keys, blks);
+
+        bool saved = true;
+        for (size_t jj = 0; jj < kids.size(); ++jj)
+        {
+            if (jj == ii)
+                continue;
+
+            try
+            {
+                for (size_t nn = 0; nn < blks.size(); ++nn)
+                {
+                    OctetSeq const key = needed_blkkey(ch->instname(), nn);
+                    kids[jj]->bs()->bs_block_put(&key[0],
+                                                 key.size(),
+                                                 &blks[nn][0],
+                                                 blks[nn].size());
+                }
+            }
+            catch (Exception const & ex)
+            {
+                LOG(lgr, 2, m_instname << ' '
+                    << "save_needed " << ch->instname()
+                    << " to " << kids[jj]->instname()
+                    << ": " << ex.what());
+                saved = false;
+            }
+        }
+
+        // If a sibling missed them try again at the next sync.
+        if (saved)
+            m_neededsaved[ch->instname()].swap(keys);
+    }
 }
 
 // FIXME - Why do I have to copy this here from BlockStore.cpp?
@@ -17,9 +17,14 @@
 #include "BlockStore.h"
 #include "ThreadPool.h"
 #include "RC.h"
+#include "T64.h"
 
 #include "vbsexp.h"
 #include "vbsfwd.h"
+#include "VBSErasure.h"
+#include "VBSHeadCache.h"
+#include "VBSPlacement.h"
+#include "VBSRepairer.h"
 
 namespace VBS {
 
@@ -126,15 +131,79 @@ public:
 
     void remove_req(VBSRequestHandle const & i_rh);
 
-    // Called when a child has gotten a block to cancel other child gets.
+    // Called when a child has gotten a block to cancel other child
+    // gets.  If i_hadit is NULL the get is canceled on every child.
     void cancel_get(VBSChild * i_hadit, utp::OctetSeq const & i_key);
 
-    void enqueue_needy_get(VBSGetRequestHandle const & i_grh,
-                           VBSChildHandle i_nh);
+    // Fetch a block the needy child is missing from the other
+    // children and put it to the needy child.  i_gcmpl is completed
+    // with the outcome of the fetch and, if that succeeds, i_pcmpl
+    // with the outcome of the put.  The fetch completion's argument
+    // is the needy VBSChild.  Returns false if there is no one to
+    // fetch from.
+    bool repair_key(VBSChildHandle const & i_nh,
+                    utp::OctetSeq const & i_key,
+                    utp::BlockStore::BlockGetCompletion & i_gcmpl,
+                    utp::BlockStore::BlockPutCompletion & i_pcmpl);
+
+    // Returns a snapshot of the children.
+    void children(VBSChildSeq & o_children) const;
+
+    // Fills o_owners with the children which hold the key.  In
+    // mirror mode this is every child.  In erasure mode fragment i
+    // lives on o_owners[i].  If o_others is non-NULL it is filled
+    // with the remaining children.
+    void placement(utp::OctetSeq const & i_key,
+                   VBSChildSeq & o_owners,
+                   VBSChildSeq * o_others) const;
+
+    // Called when a get has completed so later gets for the same key
+    // are no longer coalesced with it.
+    void forget_get(VBSGetRequest * i_grp);
+
+    // Number of child acks a put needs before the caller is completed.
+    long write_quorum(long i_nchildren) const;
+
+    // Relative share of a child's request slots given to the class.
+    long sched_weight(VBSSchedClass i_sc) const;
+
+    // How long an interactive get may wait in a child's queue before
+    // it is scheduled ahead of everything else.
+    utp::T64 get_deadline() const;
+
+    // Error fraction and smoothed latency past which a child's
+    // circuit breaker trips; zero disables the check.
+    void breaker_limits(double & o_errors, utp::T64 & o_latency) const;
+
+    // Called when a head edge has been inserted on a child so the
+    // merged head graph reflects it.
+    void head_inserted(utp::SignedHeadEdge const & i_she);
+
+    // Called when a put has completed to the caller but still has
+    // children catching up in the background.
+    void catchup_begin();
+
+    void catchup_end();
+
+    // Called when an erasure coded get has put back fragments their
+    // owners were missing.
+    void fragments_rebuilt(size_t i_nfrags);
 
 protected:
+    void parse_params(utp::StringSeq const & i_args,
+                      utp::StringSeq & o_children);
+
+    // The children's needed keys are kept on their siblings so the
+    // repairs still owed survive a restart.  They are loaded at open
+    // and saved at a sync when they have changed.
+    void load_needed();
+
+    void save_needed();
+
 
 private:
+    typedef std::map<std::string, std::vector<utp::OctetSeq> > NeededKeysMap;
+
     std::string						m_instname;
     VBSChildMap						m_children;
     ACE_Reactor *					m_vbsreactor;
@@ -144,6 +213,35 @@ private:
     ACE_Condition_Thread_Mutex		m_vbscond;
     bool							m_waiting;
     VBSRequestSet					m_requests;
+    VBSGetRequestMap				m_getsinflight;
+
+    long							m_wquorum;	// 0 means all children
+    utp::AtomicLong					m_ncatchup;	// Puts still catching up
+    utp::AtomicLong					m_ncoalesced;	// Gets coalesced
+    utp::AtomicLong					m_nrebuilt;	// Fragments put back
+
+    long							m_repairiops;	// 0 means unlimited
+    long							m_repairbps;	// 0 means unlimited
+    VBSRepairer						m_repairer;
+
+    ACE_Thread_Mutex				m_needmutex;	// Serializes saves
+    NeededKeysMap					m_neededsaved;	// Keys last saved
+
+    long							m_headperiod;	// secs, 0 disables cache
+    VBSHeadCache					m_headcache;
+
+    long							m_replicas;	// 0 means mirror to all
+    VBSPlacement					m_placement;
+
+    long							m_weights[SC_NCLASSES];
+    long							m_getdeadline;	// msec
+
+    long							m_brkerrors;	// Percent, 0 disables
+    long							m_brklatency;	// msec, 0 disables
+
+    size_t							m_eck;		// 0 means no erasure coding
+    size_t							m_ecm;
+    VBSErasureCodeHandle			m_ec;
 };
 
 // FIXME - Why can't I use the one in utp::BlockStore?
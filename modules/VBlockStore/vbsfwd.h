@@ -3,8 +3,12 @@
 
 /// @file vbsfwd.h
 
+#include <map>
+#include <set>
+#include <string>
 #include <vector>
 
+#include "BlockStore.h"
 #include "Log.h"
 #include "RC.h"
 
@@ -22,6 +26,10 @@ typedef std::map<std::string, VBSChildHandle> VBSChildMap;
 /// Map of children to HeadNode sets.
 typedef std::map<VBSChild *, utp::HeadNodeSet> ChildNodeSetMap;
 
+class VBSBuffer;
+/// Handle to VBSBuffer object.
+typedef utp::RCPtr<VBSBuffer> VBSBufferHandle;
+
 class VBSRequest;
 /// Handle to VBSRequest object.
 typedef utp::RCPtr<VBSRequest> VBSRequestHandle;
@@ -33,6 +41,9 @@ class VBSGetRequest;
 /// Handle to VBSGetRequest object.
 typedef utp::RCPtr<VBSGetRequest> VBSGetRequestHandle;
 
+/// Map of in-flight get requests by key.
+typedef std::map<utp::OctetSeq, VBSGetRequestHandle> VBSGetRequestMap;
+
 class VBSPutRequest;
 /// Handle to VBSPutRequest object.
 typedef utp::RCPtr<VBSPutRequest> VBSPutRequestHandle;
@@ -65,9 +76,35 @@ class VBSHeadFollowRequest;
 /// Handle to VBSHeadFollowRequest object.
 typedef utp::RCPtr<VBSHeadFollowRequest> VBSHeadFollowRequestHandle;
 
+class VBSECGetRequest;
+/// Handle to VBSECGetRequest object.
+typedef utp::RCPtr<VBSECGetRequest> VBSECGetRequestHandle;
+
+class VBSECPutRequest;
+/// Handle to VBSECPutRequest object.
+typedef utp::RCPtr<VBSECPutRequest> VBSECPutRequestHandle;
+
+class VBSECRefreshReq;
+/// Handle to VBSECRefreshReq object.
+typedef utp::RCPtr<VBSECRefreshReq> VBSECRefreshReqHandle;
+
+class VBSErasureCode;
+/// Handle to VBSErasureCode object.
+typedef utp::RCPtr<VBSErasureCode> VBSErasureCodeHandle;
+
 /// Sequence of child handles.
 typedef std::vector<VBSChildHandle>	VBSChildSeq;
 
+/// Classes of requests each child schedules between.
+enum VBSSchedClass
+{
+    SC_REFRESH = 0,
+    SC_HEADNODE,
+    SC_GET,
+    SC_PUT,
+    SC_NCLASSES
+};
+
 } // end namespace VBS
 
 // Local Variables:
@@ -0,0 +1,25 @@
+# Helpers for tests which read back a file of numbered blocks.
+#
+# Each 8K block holds its own number on every line so a read at any
+# offset can tell which block it landed in.
+
+import CONFIG
+
+from lenhack import *
+
+BLKSZ = 8192
+
+def bigfile_block(i):
+    return ("%08d\n" % (i)) * 910 + "\n" * 2
+
+def bigfile_write(fs, path, nblks):
+    fs.fs_mknod(path, 0666, 0, CONFIG.UNAME, CONFIG.GNAME)
+    for i in range(0, nblks):
+        blk = bigfile_block(i)
+        assert lenhack(blk) == BLKSZ
+        rv = fs.fs_write(path, buffer(blk), i * BLKSZ)
+        assert rv == BLKSZ
+
+def bigfile_check(buf, i):
+    assert str(buf)[0:9] == "%08d\n" % (i)
+    assert str(buf)[BLKSZ-2-9:BLKSZ-2] == "%08d\n" % (i)
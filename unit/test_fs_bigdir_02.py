@@ -0,0 +1,187 @@
+import sys
+import random
+import py
+
+from os import *
+from stat import *
+from errno import *
+
+import CONFIG
+import utp
+import utp.BlockStore
+import utp.FileSystem
+
+import utp.PyDirEntryFunc
+
+# This test checks that a directory which outgrows a single block, and
+# is stored hashed, finds and removes its entries across remounts, and
+# that an insert which splits a bucket rewrites only that bucket.
+
+# This callback counts entries.
+class DirEntryCounter(utp.PyDirEntryFunc.PyDirEntryFunc):
+  def __init__(self):
+    utp.PyDirEntryFunc.PyDirEntryFunc.__init__(self)
+    self.count = 0
+
+  def def_entry(self, name, statbuf, offset):
+    self.count += 1
+
+class Test_fs_bigdir_02:
+
+  def setup_class(self):
+    self.bspath = "fs_bigdir_02.bs"
+
+  def teardown_class(self):
+    CONFIG.unmap_bs("rootbs")
+    CONFIG.remove_bs(self.bspath)
+
+  def remount(self):
+    self.fs.fs_umount()
+    self.bs.bs_close()
+    bsargs = CONFIG.BSARGS(self.bspath)
+    self.bs = utp.BlockStore.open(CONFIG.BSTYPE, "rootbs", bsargs)
+    self.fs = utp.FileSystem.mount(CONFIG.FSTYPE, self.bs,
+                                   "", "", CONFIG.FSARGS)
+
+  def count(self, path):
+    cntr = DirEntryCounter()
+    self.fs.fs_readdir(path, 0, cntr)
+    return cntr.count
+
+  def puts(self):
+    return self.fs.fs_get_stats()["prps"]
+
+  def test_hashed(self):
+
+    # Remove any prexisting blockstore.
+    CONFIG.unmap_bs("rootbs")
+    CONFIG.remove_bs(self.bspath)
+
+    # Create the filesystem
+    bsargs = CONFIG.BSARGS(self.bspath)
+    self.bs = utp.BlockStore.create(CONFIG.BSTYPE,
+                                    "rootbs",
+                                    CONFIG.BSSIZE,
+                                    bsargs)
+    self.fs = utp.FileSystem.mkfs(CONFIG.FSTYPE,
+                                  self.bs,
+                                  "",
+                                  "",
+                                  CONFIG.UNAME,
+                                  CONFIG.GNAME,
+                                  CONFIG.FSARGS)
+
+    self.fs.fs_mkdir("/spool", 0755, CONFIG.UNAME, CONFIG.GNAME)
+
+    # Long names so the directory needs many buckets.
+    nfiles = 2048
+    names = ["message-%06d.eml" % (ndx,) for ndx in range(0, nfiles)]
+
+    # Create them, syncing part way so some buckets are already stored
+    # when the buckets split again.
+    for ndx in range(0, nfiles):
+      self.fs.fs_mknod("/spool/" + names[ndx], 0644, 0,
+                       CONFIG.UNAME, CONFIG.GNAME)
+      if ndx == nfiles / 4:
+        self.fs.fs_sync()
+
+    assert self.count("/spool") == nfiles + 2
+
+    self.remount()
+
+    assert self.count("/spool") == nfiles + 2
+
+    # Every entry is found.
+    for name in names:
+      st = self.fs.fs_getattr("/spool/" + name)
+      assert S_ISREG(st[ST_MODE])
+
+    # Remove every other entry.
+    for ndx in range(0, nfiles, 2):
+      self.fs.fs_unlink("/spool/" + names[ndx])
+
+    self.remount()
+
+    assert self.count("/spool") == nfiles / 2 + 2
+
+    # Some random lookups for good measure.
+    for n in range(0, 256):
+      ndx = random.randrange(0, nfiles)
+      try:
+        st = self.fs.fs_getattr("/spool/" + names[ndx])
+        assert ndx % 2 == 1
+      except OSError, ex:
+        assert ex.errno == ENOENT
+        assert ndx % 2 == 0
+
+    # A name which was never there isn't found.
+    try:
+      st = self.fs.fs_getattr("/spool/message-999999.eml")
+      assert False
+    except OSError, ex:
+      assert ex.errno == ENOENT
+
+    # The directory can be emptied and removed.
+    for ndx in range(1, nfiles, 2):
+      self.fs.fs_unlink("/spool/" + names[ndx])
+    assert self.count("/spool") == 2
+    self.fs.fs_rmdir("/spool")
+
+    # WORKAROUND - py.test doesn't correctly capture the DTOR logging.
+    self.bs.bs_close()
+    self.bs = None
+    self.fs = None
+
+  def test_split_local(self):
+
+    # Remove any prexisting blockstore.
+    CONFIG.unmap_bs("rootbs")
+    CONFIG.remove_bs(self.bspath)
+
+    # Create the filesystem
+    bsargs = CONFIG.BSARGS(self.bspath)
+    self.bs = utp.BlockStore.create(CONFIG.BSTYPE,
+                                    "rootbs",
+                                    CONFIG.BSSIZE,
+                                    bsargs)
+    self.fs = utp.FileSystem.mkfs(CONFIG.FSTYPE,
+                                  self.bs,
+                                  "",
+                                  "",
+                                  CONFIG.UNAME,
+                                  CONFIG.GNAME,
+                                  CONFIG.FSARGS)
+
+    self.fs.fs_mkdir("/spool", 0755, CONFIG.UNAME, CONFIG.GNAME)
+
+    # Enough entries for a dozen or more buckets.
+    nfiles = 2048
+    names = ["message-%06d.eml" % (ndx,) for ndx in range(0, nfiles * 3 / 2)]
+    for ndx in range(0, nfiles):
+      self.fs.fs_mknod("/spool/" + names[ndx], 0644, 0,
+                       CONFIG.UNAME, CONFIG.GNAME)
+    self.fs.fs_sync()
+
+    # Grow it by half again, a sync after each insert.  Some of the
+    # inserts split a bucket; the sync after it writes the two halves,
+    # the new inode and the path up to the root, not every bucket.
+    maxputs = 0
+    for ndx in range(nfiles, nfiles * 3 / 2):
+      nputs = self.puts()
+      self.fs.fs_mknod("/spool/" + names[ndx], 0644, 0,
+                       CONFIG.UNAME, CONFIG.GNAME)
+      self.fs.fs_sync()
+      maxputs = max(maxputs, self.puts() - nputs)
+    assert maxputs < 16
+
+    self.remount()
+
+    assert self.count("/spool") == nfiles * 3 / 2 + 2
+    for name in names:
+      st = self.fs.fs_getattr("/spool/" + name)
+      assert S_ISREG(st[ST_MODE])
+
+    # WORKAROUND - py.test doesn't correctly capture the DTOR logging.
+    self.bs.bs_close()
+    self.bs = None
+    self.fs = None
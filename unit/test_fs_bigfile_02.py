@@ -0,0 +1,83 @@
+import sys
+import random
+import py
+
+
+from os import *
+from stat import *
+
+import CONFIG
+import utp
+import utp.BlockStore
+import utp.FileSystem
+
+from lenhack import *
+
+# This test checks that a sync of a file spanning the direct and
+# indirect blocks, which persists the data blocks in parallel, stores
+# every block.
+
+class Test_fs_bigfile_02:
+
+  def setup_class(self):
+    self.bspath = "fs_bigfile_02.bs"
+
+  def teardown_class(self):
+    CONFIG.unmap_bs("rootbs")
+    CONFIG.remove_bs(self.bspath)
+
+  def test_sync_bigfile(self):
+
+    # Remove any prexisting blockstore.
+    CONFIG.unmap_bs("rootbs")
+    CONFIG.remove_bs(self.bspath)
+
+    # Create the filesystem
+    bsargs = CONFIG.BSARGS(self.bspath)
+    self.bs = utp.BlockStore.create(CONFIG.BSTYPE,
+                                    "rootbs",
+                                    CONFIG.BSSIZE,
+                                    bsargs)
+    self.fs = utp.FileSystem.mkfs(CONFIG.FSTYPE, self.bs, "", "",
+                                  CONFIG.UNAME, CONFIG.GNAME, CONFIG.FSARGS)
+
+    # Create a new file.
+    self.fs.fs_mknod("/bigfile", 0666, 0, CONFIG.UNAME, CONFIG.GNAME)
+
+    # Each block gets distinct contents so a misplaced reference
+    # shows up.
+    nblks = 64
+    for i in range(0, nblks):
+      blk = ("%08d\n" % (i)) * 910 + "\n" * 2
+      assert lenhack(blk) == 8192
+      rv = self.fs.fs_write("/bigfile", buffer(blk), i * 8192)
+      assert rv == 8192
+
+    self.fs.fs_sync()
+
+    # Now we unmount the filesystem.
+    self.fs.fs_umount()
+    self.bs.bs_close()
+
+    # Now mount it again.
+    bsargs = CONFIG.BSARGS(self.bspath)
+    self.bs = utp.BlockStore.open(CONFIG.BSTYPE,
+                                  "rootbs",
+                                  bsargs)
+    self.fs = utp.FileSystem.mount(CONFIG.FSTYPE, self.bs,
+                                   "", "", CONFIG.FSARGS)
+
+    st = self.fs.fs_getattr("/bigfile");
+    assert st[ST_SIZE] == nblks * 8192
+
+    # Every block should read back.
+    self.fs.fs_open("/bigfile", O_RDONLY)
+    for i in range(0, nblks):
+      buf = self.fs.fs_read("/bigfile", 8192, i * 8192)
+      assert str(buf)[0:9] == "%08d\n" % (i)
+      assert str(buf)[8190-9:8190] == "%08d\n" % (i)
+
+    # WORKAROUND - py.test doesn't correctly capture the DTOR logging.
+    self.bs.bs_close()
+    self.bs = None
+    self.fs = None
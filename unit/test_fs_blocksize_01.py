@@ -0,0 +1,134 @@
+import sys
+import random
+import py
+
+
+from os import *
+from stat import *
+
+import CONFIG
+import utp
+import utp.BlockStore
+import utp.FileSystem
+
+from lenhack import *
+
+# This test checks that a filesystem made with a larger block size
+# stores files in blocks of that size, through the direct and the
+# single indirect blocks, and that a remount picks the size up from
+# the filesystem.
+
+class Test_fs_blocksize_01:
+
+  def setup_class(self):
+    self.bspath = "fs_blocksize_01.bs"
+
+  def teardown_class(self):
+    CONFIG.unmap_bs("rootbs")
+    CONFIG.remove_bs(self.bspath)
+
+  def mkfs(self, args):
+
+    # Remove any prexisting blockstore.
+    CONFIG.unmap_bs("rootbs")
+    CONFIG.remove_bs(self.bspath)
+
+    # Create the filesystem
+    bsargs = CONFIG.BSARGS(self.bspath)
+    self.bs = utp.BlockStore.create(CONFIG.BSTYPE,
+                                    "rootbs",
+                                    CONFIG.BSSIZE,
+                                    bsargs)
+    return utp.FileSystem.mkfs(CONFIG.FSTYPE, self.bs, "", "",
+                               CONFIG.UNAME, CONFIG.GNAME, args)
+
+  def check(self, path, expect):
+    off = 0
+    while off < lenhack(expect):
+      buf = self.fs.fs_read(path, 65536, off)
+      assert str(buf) == expect[off:off+65536]
+      off += 65536
+
+  def test_64k(self):
+    blksz = 64 * 1024
+    self.fs = self.mkfs(("blocksize=64K",))
+
+    # Past the 20 direct blocks into the single indirect block.
+    data = "".join([chr(random.randrange(0, 256))
+                    for x in range(0, 24 * blksz)])
+    self.fs.fs_mknod("/big", 0666, 0, CONFIG.UNAME, CONFIG.GNAME)
+    rv = self.fs.fs_write("/big", buffer(data), 0)
+    assert rv == lenhack(data)
+
+    # The inode, 20 direct blocks, the indirect block and 4 beneath
+    # it, all but the inode counted at the block size.
+    st = self.fs.fs_getattr("/big")
+    assert st[ST_SIZE] == lenhack(data)
+    assert st.st_blocks == (1 + 20 + 1 + 4) * blksz / 512
+
+    self.check("/big", data)
+
+    # A sparse hole reads as zeros.
+    self.fs.fs_mknod("/sparse", 0666, 0, CONFIG.UNAME, CONFIG.GNAME)
+    self.fs.fs_write("/sparse", buffer("end"), 30 * blksz)
+    buf = self.fs.fs_read("/sparse", 100, 25 * blksz)
+    assert str(buf) == "\0" * 100
+
+    # Truncate inside a block.
+    self.fs.fs_truncate("/big", 21 * blksz + 1000)
+    data = data[:21 * blksz + 1000]
+    self.check("/big", data)
+
+    self.fs.fs_sync()
+
+    # Now we unmount the filesystem.
+    self.fs.fs_umount()
+    self.bs.bs_close()
+
+    # The block size is chosen at mkfs.
+    bsargs = CONFIG.BSARGS(self.bspath)
+    self.bs = utp.BlockStore.open(CONFIG.BSTYPE,
+                                  "rootbs",
+                                  bsargs)
+    py.test.raises(Exception, utp.FileSystem.mount,
+                   CONFIG.FSTYPE, self.bs, "", "",
+                   ("blocksize=64K",))
+
+    self.fs = utp.FileSystem.mount(CONFIG.FSTYPE, self.bs,
+                                   "", "", CONFIG.FSARGS)
+
+    self.check("/big", data)
+    buf = self.fs.fs_read("/sparse", 3, 30 * blksz)
+    assert str(buf) == "end"
+
+    # Writes after the remount use the same size.
+    self.fs.fs_write("/big", buffer("more"), lenhack(data))
+    self.check("/big", data + "more")
+
+    # WORKAROUND - py.test doesn't correctly capture the DTOR logging.
+    self.bs.bs_close()
+    self.bs = None
+    self.fs = None
+
+  def test_1m(self):
+    self.fs = self.mkfs(("blocksize=1M",))
+
+    data = "".join([chr(random.randrange(0, 256))
+                    for x in range(0, 3 * 1024 * 1024 + 123)])
+    self.fs.fs_mknod("/big", 0666, 0, CONFIG.UNAME, CONFIG.GNAME)
+    rv = self.fs.fs_write("/big", buffer(data), 0)
+    assert rv == lenhack(data)
+    self.fs.fs_sync()
+
+    self.check("/big", data)
+
+    # WORKAROUND - py.test doesn't correctly capture the DTOR logging.
+    self.bs.bs_close()
+    self.bs = None
+    self.fs = None
+
+  def test_bad(self):
+    for size in ("4K", "2M", "12345", "64X", ""):
+      py.test.raises(Exception, self.mkfs, ("blocksize=%s" % size,))
+      self.bs.bs_close()
+      self.bs = None
@@ -0,0 +1,151 @@
+import sys
+import random
+import py
+
+
+from os import *
+from stat import *
+
+import CONFIG
+import utp
+import utp.BlockStore
+import utp.FileSystem
+
+from bigfile import *
+
+# This test checks that a filesystem whose node cache is far smaller
+# than the file it reads still reads it correctly as nodes are
+# evicted, and that a bad cache size is refused.  It also checks that
+# blocks used more than once are promoted out of reach of a scan.
+
+class Test_fs_cache_01:
+
+  def setup_class(self):
+    self.bspath = "fs_cache_01.bs"
+
+  def teardown_class(self):
+    CONFIG.unmap_bs("rootbs")
+    CONFIG.remove_bs(self.bspath)
+
+  def readall(self, path, nblks):
+    for i in range(0, nblks):
+      buf = self.fs.fs_read(path, 8192, i * 8192)
+      bigfile_check(buf, i)
+
+  def misses(self):
+    return self.fs.fs_get_stats()["bncmps"]
+
+  def evictions(self):
+    return self.fs.fs_get_stats()["bnceps"]
+
+  def test_small_cache(self):
+
+    # Remove any prexisting blockstore.
+    CONFIG.unmap_bs("rootbs")
+    CONFIG.remove_bs(self.bspath)
+
+    # Create the filesystem
+    bsargs = CONFIG.BSARGS(self.bspath)
+    self.bs = utp.BlockStore.create(CONFIG.BSTYPE,
+                                    "rootbs",
+                                    CONFIG.BSSIZE,
+                                    bsargs)
+    self.fs = utp.FileSystem.mkfs(CONFIG.FSTYPE, self.bs, "", "",
+                                  CONFIG.UNAME, CONFIG.GNAME,
+                                  ("cachesize=64K",))
+
+    nblks = 96
+    bigfile_write(self.fs, "/bigfile", nblks)
+
+    self.fs.fs_umount()
+    self.bs.bs_close()
+
+    bsargs = CONFIG.BSARGS(self.bspath)
+    self.bs = utp.BlockStore.open(CONFIG.BSTYPE,
+                                  "rootbs",
+                                  bsargs)
+
+    # A bad size is refused.
+    py.test.raises(Exception, utp.FileSystem.mount,
+                   CONFIG.FSTYPE, self.bs, "", "", ("cachesize=lots",))
+
+    self.fs = utp.FileSystem.mount(CONFIG.FSTYPE, self.bs, "", "",
+                                   ("cachesize=64K",))
+
+    # Read it all twice, the second pass finds little in the cache.
+    nmisses = self.misses()
+    nevicts = self.evictions()
+    self.readall("/bigfile", nblks)
+    assert self.misses() > nmisses
+
+    nmisses = self.misses()
+    self.readall("/bigfile", nblks)
+    assert self.misses() > nmisses
+
+    # The cache holds 8 blocks; nearly all that came in went out.
+    assert self.evictions() - nevicts >= nblks
+
+    # Some random reads for good measure.
+    for n in range(0, 64):
+      i = random.randrange(0, nblks)
+      buf = self.fs.fs_read("/bigfile", 8192, i * 8192)
+      assert str(buf)[0:9] == "%08d\n" % (i)
+
+    # WORKAROUND - py.test doesn't correctly capture the DTOR logging.
+    self.bs.bs_close()
+    self.bs = None
+    self.fs = None
+
+  def test_scan_resistance(self):
+
+    # Remove any prexisting blockstore.
+    CONFIG.unmap_bs("rootbs")
+    CONFIG.remove_bs(self.bspath)
+
+    # Create the filesystem
+    bsargs = CONFIG.BSARGS(self.bspath)
+    self.bs = utp.BlockStore.create(CONFIG.BSTYPE,
+                                    "rootbs",
+                                    CONFIG.BSSIZE,
+                                    bsargs)
+    self.fs = utp.FileSystem.mkfs(CONFIG.FSTYPE, self.bs, "", "",
+                                  CONFIG.UNAME, CONFIG.GNAME,
+                                  ("cachesize=2M",))
+
+    # Two small files and one twice the size of the cache.
+    bigfile_write(self.fs, "/hot", 8)
+    bigfile_write(self.fs, "/once", 8)
+    bigfile_write(self.fs, "/scan", 512)
+
+    self.fs.fs_umount()
+    self.bs.bs_close()
+
+    bsargs = CONFIG.BSARGS(self.bspath)
+    self.bs = utp.BlockStore.open(CONFIG.BSTYPE,
+                                  "rootbs",
+                                  bsargs)
+    self.fs = utp.FileSystem.mount(CONFIG.FSTYPE, self.bs, "", "",
+                                   ("cachesize=2M",))
+
+    # The second pass references the blocks the first brought in.
+    self.readall("/hot", 8)
+    self.readall("/hot", 8)
+    self.readall("/once", 8)
+
+    # The eviction hand promotes the referenced blocks as the scan
+    # pushes the cache over budget.
+    self.readall("/scan", 512)
+
+    # So they are all still there.
+    nmisses = self.misses()
+    self.readall("/hot", 8)
+    assert self.misses() == nmisses
+
+    # The blocks read once went out with the scan.
+    self.readall("/once", 8)
+    assert self.misses() > nmisses
+
+    # WORKAROUND - py.test doesn't correctly capture the DTOR logging.
+    self.bs.bs_close()
+    self.bs = None
+    self.fs = None
@@ -0,0 +1,100 @@
+import sys
+import random
+import threading
+import py
+
+
+from os import *
+from stat import *
+
+import CONFIG
+import utp
+import utp.BlockStore
+import utp.FileSystem
+
+from bigfile import *
+
+# This test checks that readers faulting the same blocks into a cold
+# cache at the same time share one fetch of each block: the others wait
+# on it (bncwps) instead of fetching it again (bncfps).
+
+class Test_fs_cache_02:
+
+  def setup_class(self):
+    self.bspath = "fs_cache_02.bs"
+
+  def teardown_class(self):
+    CONFIG.unmap_bs("rootbs")
+    CONFIG.remove_bs(self.bspath)
+
+  def stat(self, name):
+    return self.fs.fs_get_stats()[name]
+
+  def reader(self, path, nblks, start, errors):
+    try:
+      start.wait()
+      for i in range(0, nblks):
+        buf = self.fs.fs_read(path, BLKSZ, i * BLKSZ)
+        bigfile_check(buf, i)
+    except Exception, ex:
+      errors.append(ex)
+
+  def test_shared_faults(self):
+
+    # Remove any prexisting blockstore.
+    CONFIG.unmap_bs("rootbs")
+    CONFIG.remove_bs(self.bspath)
+
+    # Create the filesystem
+    bsargs = CONFIG.BSARGS(self.bspath)
+    self.bs = utp.BlockStore.create(CONFIG.BSTYPE,
+                                    "rootbs",
+                                    CONFIG.BSSIZE,
+                                    bsargs)
+    self.fs = utp.FileSystem.mkfs(CONFIG.FSTYPE, self.bs, "", "",
+                                  CONFIG.UNAME, CONFIG.GNAME, CONFIG.FSARGS)
+
+    nblks = 64
+    bigfile_write(self.fs, "/bigfile", nblks)
+
+    # Each round starts with a cold cache and has all the readers read
+    # the whole file from the front at once.  Whether any of them
+    # catches another's fetch in flight is up to the scheduler, so
+    # give it a few tries.
+    nthreads = 8
+    nwaits = 0
+    for nround in range(0, 8):
+      self.fs.fs_umount()
+      self.fs = utp.FileSystem.mount(CONFIG.FSTYPE, self.bs,
+                                     "", "", CONFIG.FSARGS)
+
+      nfaults0 = self.stat("bncfps")
+      nwaits0 = self.stat("bncwps")
+
+      start = threading.Event()
+      errors = []
+      threads = []
+      for n in range(0, nthreads):
+        th = threading.Thread(target=self.reader,
+                              args=("/bigfile", nblks, start, errors))
+        th.start()
+        threads.append(th)
+      start.set()
+      for th in threads:
+        th.join()
+      assert errors == []
+
+      # Each block was fetched at most once, the file's blocks and the
+      # few nodes above them, however many readers wanted it.
+      assert self.stat("bncfps") - nfaults0 <= nblks + 8
+
+      nwaits += self.stat("bncwps") - nwaits0
+      if nwaits > 0:
+        break
+
+    assert nwaits > 0
+
+    # WORKAROUND - py.test doesn't correctly capture the DTOR logging.
+    self.bs.bs_close()
+    self.bs = None
+    self.fs = None
@@ -0,0 +1,133 @@
+import sys
+import random
+import py
+
+
+from os import *
+from stat import *
+
+import CONFIG
+import utp
+import utp.BlockStore
+import utp.FileSystem
+
+from lenhack import *
+
+# This test checks that a filesystem made with compression stores
+# compressible files in fewer blockstore bytes, and that they read back
+# after a remount, which picks the method up from the filesystem.
+
+class Test_fs_compress_01:
+
+  def setup_class(self):
+    self.bspath = "fs_compress_01.bs"
+
+  def teardown_class(self):
+    CONFIG.unmap_bs("rootbs")
+    CONFIG.remove_bs(self.bspath)
+
+  def used(self):
+    bss = self.bs.bs_stat()
+    return bss.bss_size - bss.bss_free
+
+  def check(self, path, expect):
+    off = 0
+    while off < lenhack(expect):
+      buf = self.fs.fs_read(path, 8192, off)
+      assert str(buf) == expect[off:off+8192]
+      off += 8192
+
+  def method(self, method):
+
+    # Remove any prexisting blockstore.
+    CONFIG.unmap_bs("rootbs")
+    CONFIG.remove_bs(self.bspath)
+
+    # Create the filesystem
+    bsargs = CONFIG.BSARGS(self.bspath)
+    self.bs = utp.BlockStore.create(CONFIG.BSTYPE,
+                                    "rootbs",
+                                    CONFIG.BSSIZE,
+                                    bsargs)
+    self.fs = utp.FileSystem.mkfs(CONFIG.FSTYPE, self.bs, "", "",
+                                  CONFIG.UNAME, CONFIG.GNAME,
+                                  ("compress=%s" % method,))
+
+    before = self.used()
+
+    # Text compresses well.
+    text = ""
+    i = 0
+    while lenhack(text) < 1024 * 1024:
+      text += "line %d of some compressible text\n" % (i)
+      i += 1
+    self.fs.fs_mknod("/text", 0666, 0, CONFIG.UNAME, CONFIG.GNAME)
+    rv = self.fs.fs_write("/text", buffer(text), 0)
+    assert rv == lenhack(text)
+
+    # Random data doesn't, it's stored as is.
+    rand = "".join([chr(random.randrange(0, 256)) for x in range(0, 65536)])
+    self.fs.fs_mknod("/rand", 0666, 0, CONFIG.UNAME, CONFIG.GNAME)
+    rv = self.fs.fs_write("/rand", buffer(rand), 0)
+    assert rv == lenhack(rand)
+
+    self.fs.fs_sync()
+
+    assert self.used() - before < (lenhack(text) / 2) + lenhack(rand) + 64 * 1024
+
+    self.check("/text", text)
+    self.check("/rand", rand)
+
+    # Now we unmount the filesystem.
+    self.fs.fs_umount()
+    self.bs.bs_close()
+
+    # Compression is chosen at mkfs.
+    bsargs = CONFIG.BSARGS(self.bspath)
+    self.bs = utp.BlockStore.open(CONFIG.BSTYPE,
+                                  "rootbs",
+                                  bsargs)
+    py.test.raises(Exception, utp.FileSystem.mount,
+                   CONFIG.FSTYPE, self.bs, "", "",
+                   ("compress=%s" % method,))
+
+    self.fs = utp.FileSystem.mount(CONFIG.FSTYPE, self.bs,
+                                   "", "", CONFIG.FSARGS)
+
+    self.check("/text", text)
+    self.check("/rand", rand)
+
+    # New blocks are compressed too.
+    before = self.used()
+    self.fs.fs_mknod("/text2", 0666, 0, CONFIG.UNAME, CONFIG.GNAME)
+    rv = self.fs.fs_write("/text2", buffer(text), 0)
+    assert rv == lenhack(text)
+    self.fs.fs_sync()
+    assert self.used() - before < lenhack(text) / 2
+
+    self.check("/text2", text)
+
+    # WORKAROUND - py.test doesn't correctly capture the DTOR logging.
+    self.bs.bs_close()
+    self.bs = None
+    self.fs = None
+
+  def test_lz4(self):
+    self.method("lz4")
+
+  def test_zstd(self):
+    self.method("zstd")
+
+  def test_unknown(self):
+    CONFIG.unmap_bs("rootbs")
+    CONFIG.remove_bs(self.bspath)
+    bsargs = CONFIG.BSARGS(self.bspath)
+    self.bs = utp.BlockStore.create(CONFIG.BSTYPE,
+                                    "rootbs",
+                                    CONFIG.BSSIZE,
+                                    bsargs)
+    py.test.raises(Exception, utp.FileSystem.mkfs,
+                   CONFIG.FSTYPE, self.bs, "", "",
+                   CONFIG.UNAME, CONFIG.GNAME, ("compress=gzip",))
+    self.bs.bs_close()
+    self.bs = None
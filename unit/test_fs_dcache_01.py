@@ -0,0 +1,186 @@
+import sys
+import random
+import py
+
+from os import *
+from stat import *
+from errno import *
+
+import CONFIG
+import utp
+import utp.BlockStore
+import utp.FileSystem
+
+# This test checks that paths resolved through the dentry cache follow
+# creates, removals, renames and syncs, and that updates made through
+# it to an already dirty file are stored.
+
+class Test_fs_dcache_01:
+
+  def setup_class(self):
+    self.bspath = "fs_dcache_01.bs"
+
+  def teardown_class(self):
+    CONFIG.unmap_bs("rootbs")
+    CONFIG.remove_bs(self.bspath)
+
+  def remount(self):
+    self.fs.fs_umount()
+    self.bs.bs_close()
+    bsargs = CONFIG.BSARGS(self.bspath)
+    self.bs = utp.BlockStore.open(CONFIG.BSTYPE, "rootbs", bsargs)
+    self.fs = utp.FileSystem.mount(CONFIG.FSTYPE, self.bs,
+                                   "", "", ("dcachesize=64",))
+
+  def missing(self, path):
+    try:
+      st = self.fs.fs_getattr(path)
+      return False
+    except OSError, ex:
+      assert ex.errno == ENOENT
+      return True
+
+  def test_dcache(self):
+
+    # Remove any prexisting blockstore.
+    CONFIG.unmap_bs("rootbs")
+    CONFIG.remove_bs(self.bspath)
+
+    # Create the filesystem
+    bsargs = CONFIG.BSARGS(self.bspath)
+    self.bs = utp.BlockStore.create(CONFIG.BSTYPE,
+                                    "rootbs",
+                                    CONFIG.BSSIZE,
+                                    bsargs)
+
+    # A bad size is refused.
+    py.test.raises(Exception, utp.FileSystem.mkfs,
+                   CONFIG.FSTYPE, self.bs, "", "",
+                   CONFIG.UNAME, CONFIG.GNAME, ("dcachesize=many",))
+
+    self.fs = utp.FileSystem.mkfs(CONFIG.FSTYPE, self.bs, "", "",
+                                  CONFIG.UNAME, CONFIG.GNAME,
+                                  ("dcachesize=64",))
+
+    # A missing path stays missing until it's created.
+    assert self.missing("/dir/file")
+    assert self.missing("/dir/file")
+    self.fs.fs_mkdir("/dir", 0755, CONFIG.UNAME, CONFIG.GNAME)
+    assert self.missing("/dir/file")
+    self.fs.fs_mknod("/dir/file", 0644, 0, CONFIG.UNAME, CONFIG.GNAME)
+    st = self.fs.fs_getattr("/dir/file")
+    assert S_ISREG(st[ST_MODE])
+
+    # Writes show through the cached path.
+    self.fs.fs_write("/dir/file", buffer("hello"), 0)
+    st = self.fs.fs_getattr("/dir/file")
+    assert st[ST_SIZE] == 5
+
+    # Renaming the directory moves everything beneath it.
+    self.fs.fs_rename("/dir", "/moved")
+    assert self.missing("/dir")
+    assert self.missing("/dir/file")
+    st = self.fs.fs_getattr("/moved/file")
+    assert st[ST_SIZE] == 5
+
+    # A sync replaces the live nodes, the cached paths follow.
+    self.fs.fs_sync()
+    self.fs.fs_write("/moved/file", buffer("hello world"), 0)
+    st = self.fs.fs_getattr("/moved/file")
+    assert st[ST_SIZE] == 11
+    self.fs.fs_sync()
+
+    # Removing one link to a file leaves the other current.
+    self.fs.fs_link("/moved/file", "/other")
+    st = self.fs.fs_getattr("/other")
+    assert st[ST_SIZE] == 11
+    self.fs.fs_unlink("/moved/file")
+    assert self.missing("/moved/file")
+    self.fs.fs_write("/other", buffer("hello again world"), 0)
+    st = self.fs.fs_getattr("/other")
+    assert st[ST_SIZE] == 17
+    buf = self.fs.fs_read("/other", 5, 0)
+    assert str(buf) == "hello"
+
+    # Doubled slashes name the same path.
+    self.fs.fs_mknod("/moved/twice", 0644, 0, CONFIG.UNAME, CONFIG.GNAME)
+    st = self.fs.fs_getattr("/moved/twice")
+    assert S_ISREG(st[ST_MODE])
+    self.fs.fs_unlink("/moved//twice")
+    assert self.missing("/moved/twice")
+    self.fs.fs_mknod("/moved//twice", 0644, 0, CONFIG.UNAME, CONFIG.GNAME)
+    st = self.fs.fs_getattr("/moved/twice")
+    assert S_ISREG(st[ST_MODE])
+    self.fs.fs_unlink("/moved/twice")
+
+    # Many more paths than the cache holds.
+    for ndx in range(0, 256):
+      self.fs.fs_mknod("/moved/%03d" % (ndx,), 0644, 0,
+                       CONFIG.UNAME, CONFIG.GNAME)
+    for n in range(0, 1024):
+      ndx = random.randrange(0, 256)
+      st = self.fs.fs_getattr("/moved/%03d" % (ndx,))
+      assert S_ISREG(st[ST_MODE])
+
+    # Removed directories are gone.
+    for ndx in range(0, 256):
+      self.fs.fs_unlink("/moved/%03d" % (ndx,))
+    self.fs.fs_rmdir("/moved")
+    assert self.missing("/moved")
+
+    # WORKAROUND - py.test doesn't correctly capture the DTOR logging.
+    self.bs.bs_close()
+    self.bs = None
+    self.fs = None
+
+  def test_dirty_updates(self):
+
+    # Remove any prexisting blockstore.
+    CONFIG.unmap_bs("rootbs")
+    CONFIG.remove_bs(self.bspath)
+
+    # Create the filesystem
+    bsargs = CONFIG.BSARGS(self.bspath)
+    self.bs = utp.BlockStore.create(CONFIG.BSTYPE,
+                                    "rootbs",
+                                    CONFIG.BSSIZE,
+                                    bsargs)
+    self.fs = utp.FileSystem.mkfs(CONFIG.FSTYPE, self.bs, "", "",
+                                  CONFIG.UNAME, CONFIG.GNAME,
+                                  ("dcachesize=64",))
+
+    # A file a few directories down.
+    self.fs.fs_mkdir("/a", 0755, CONFIG.UNAME, CONFIG.GNAME)
+    self.fs.fs_mkdir("/a/b", 0755, CONFIG.UNAME, CONFIG.GNAME)
+    self.fs.fs_mknod("/a/b/file", 0644, 0, CONFIG.UNAME, CONFIG.GNAME)
+
+    # The first write dirties it, the rest update it in place.
+    for ndx in range(0, 64):
+      self.fs.fs_write("/a/b/file", buffer("%04d" % (ndx,)), ndx * 4)
+    self.fs.fs_sync()
+
+    # Again once the sync has made it clean, and the other updates.
+    for ndx in range(0, 64, 2):
+      self.fs.fs_write("/a/b/file", buffer("X%03d" % (ndx,)), ndx * 4)
+    self.fs.fs_chmod("/a/b/file", 0600)
+    self.fs.fs_utime("/a/b/file", 1000, 2000)
+    self.fs.fs_truncate("/a/b/file", 200)
+    self.fs.fs_sync()
+
+    # All of it is there after a remount.
+    self.remount()
+    st = self.fs.fs_getattr("/a/b/file")
+    assert st[ST_SIZE] == 200
+    assert S_IMODE(st[ST_MODE]) == 0600
+    assert st[ST_MTIME] == 2000
+    for ndx in range(0, 50):
+      buf = self.fs.fs_read("/a/b/file", 4, ndx * 4)
+      if ndx % 2:
+        assert str(buf) == "%04d" % (ndx,)
+      else:
+        assert str(buf) == "X%03d" % (ndx,)
+
+    # WORKAROUND - py.test doesn't correctly capture the DTOR logging.
+    self.bs.bs_close()
+    self.bs = None
+    self.fs = None
@@ -0,0 +1,189 @@
+import sys
+import random
+import threading
+import py
+
+
+from os import *
+from stat import *
+
+import CONFIG
+import utp
+import utp.BlockStore
+import utp.FileSystem
+
+from lenhack import *
+
+# This test checks that a convergent filesystem stores the data blocks
+# of identical files once, and that modifying or truncating one of the
+# files leaves the other alone, before and after a remount.  A refresh
+# suspends the dedup index, so copies written while it runs are stored
+# and survive it.
+
+class Test_fs_dedup_01:
+
+  def setup_class(self):
+    self.bspath = "fs_dedup_01.bs"
+
+    # Remove any prexisting blockstore.
+    CONFIG.unmap_bs("rootbs")
+    CONFIG.remove_bs(self.bspath)
+
+    # Create the filesystem
+    bsargs = CONFIG.BSARGS(self.bspath)
+    self.bs = utp.BlockStore.create(CONFIG.BSTYPE,
+                                    "rootbs",
+                                    CONFIG.BSSIZE,
+                                    bsargs)
+    self.fs = utp.FileSystem.mkfs(CONFIG.FSTYPE, self.bs, "", "",
+                                  CONFIG.UNAME, CONFIG.GNAME,
+                                  ("convergent=1",))
+
+  def teardown_class(self):
+    CONFIG.unmap_bs("rootbs")
+    CONFIG.remove_bs(self.bspath)
+
+  def used(self):
+    bss = self.bs.bs_stat()
+    return bss.bss_size - bss.bss_free
+
+  def check(self, path, expect):
+    off = 0
+    while off < lenhack(expect):
+      buf = self.fs.fs_read(path, 8192, off)
+      assert str(buf) == expect[off:off+8192]
+      off += 8192
+
+  def test_dedup(self):
+
+    # Random data so compression doesn't muddy the sizes.
+    data = "".join([chr(random.randrange(0, 256))
+                    for x in range(0, 256 * 1024)])
+
+    self.fs.fs_mknod("/a", 0666, 0, CONFIG.UNAME, CONFIG.GNAME)
+    rv = self.fs.fs_write("/a", buffer(data), 0)
+    assert rv == lenhack(data)
+    self.fs.fs_sync()
+
+    # The second copy only stores its metadata.
+    before = self.used()
+    self.fs.fs_mknod("/b", 0666, 0, CONFIG.UNAME, CONFIG.GNAME)
+    rv = self.fs.fs_write("/b", buffer(data), 0)
+    assert rv == lenhack(data)
+    self.fs.fs_sync()
+    assert self.used() - before < lenhack(data) / 4
+
+    self.check("/a", data)
+    self.check("/b", data)
+
+    # Change the first block of /b, /a keeps its data.
+    self.fs.fs_write("/b", buffer("changed"), 100)
+    changed = data[:100] + "changed" + data[107:]
+    self.check("/a", data)
+    self.check("/b", changed)
+
+    # Truncate /a inside a shared block, /b keeps its data.
+    self.fs.fs_truncate("/a", 12345)
+    self.check("/a", data[:12345])
+    self.check("/b", changed)
+
+    self.fs.fs_sync()
+
+    # Now we unmount the filesystem.
+    self.fs.fs_umount()
+    self.bs.bs_close()
+
+    # Convergence is chosen at mkfs.
+    bsargs = CONFIG.BSARGS(self.bspath)
+    self.bs = utp.BlockStore.open(CONFIG.BSTYPE,
+                                  "rootbs",
+                                  bsargs)
+    py.test.raises(Exception, utp.FileSystem.mount,
+                   CONFIG.FSTYPE, self.bs, "", "",
+                   ("convergent=1",))
+
+    self.fs = utp.FileSystem.mount(CONFIG.FSTYPE, self.bs,
+                                   "", "", CONFIG.FSARGS)
+
+    self.check("/a", data[:12345])
+    self.check("/b", changed)
+
+    # Blocks read back after the remount are known to be stored.
+    before = self.used()
+    self.fs.fs_mknod("/c", 0666, 0, CONFIG.UNAME, CONFIG.GNAME)
+    rv = self.fs.fs_write("/c", buffer(changed), 0)
+    assert rv == lenhack(changed)
+    self.fs.fs_sync()
+    assert self.used() - before < lenhack(data) / 4
+
+    self.check("/c", changed)
+
+    # WORKAROUND - py.test doesn't correctly capture the DTOR logging.
+    self.bs.bs_close()
+    self.bs = None
+    self.fs = None
+
+  def copier(self, data, paths, errors):
+    try:
+      for path in paths:
+        self.fs.fs_mknod(path, 0666, 0, CONFIG.UNAME, CONFIG.GNAME)
+        self.fs.fs_write(path, buffer(data), 0)
+    except Exception, ex:
+      errors.append(ex)
+
+  def test_refresh(self):
+
+    # Start over with a fresh filesystem.
+    CONFIG.unmap_bs("rootbs")
+    CONFIG.remove_bs(self.bspath)
+    bsargs = CONFIG.BSARGS(self.bspath)
+    self.bs = utp.BlockStore.create(CONFIG.BSTYPE,
+                                    "rootbs",
+                                    CONFIG.BSSIZE,
+                                    bsargs)
+    self.fs = utp.FileSystem.mkfs(CONFIG.FSTYPE, self.bs, "", "",
+                                  CONFIG.UNAME, CONFIG.GNAME,
+                                  ("convergent=1",))
+
+    data = "".join([chr(random.randrange(0, 256))
+                    for x in range(0, 64 * 1024)])
+
+    # Store the data once, then drop it from the tree.  The index
+    # still remembers its blocks.
+    self.fs.fs_mknod("/old", 0666, 0, CONFIG.UNAME, CONFIG.GNAME)
+    self.fs.fs_write("/old", buffer(data), 0)
+    self.fs.fs_sync()
+    assert self.fs.fs_get_stats()["ddsz"] > 0
+    self.fs.fs_unlink("/old")
+    self.fs.fs_sync()
+
+    # Copies written while refreshes run can't be skipped on the
+    # strength of those blocks, which the refreshes collect.
+    paths = ["/copy%d" % i for i in range(0, 20)]
+    errors = []
+    th = threading.Thread(target=self.copier,
+                          args=(data, paths, errors))
+    th.start()
+    while th.isAlive():
+      self.fs.fs_refresh()
+    th.join()
+    assert errors == []
+
+    # Afterwards the index starts out empty.
+    self.fs.fs_refresh()
+    assert self.fs.fs_get_stats()["ddsz"] == 0
+
+    # Everything the tree refers to is still there after another
+    # refresh and a remount.
+    self.fs.fs_sync()
+    self.fs.fs_refresh()
+    self.fs.fs_umount()
+    self.fs = utp.FileSystem.mount(CONFIG.FSTYPE, self.bs,
+                                   "", "", CONFIG.FSARGS)
+    for path in paths:
+      self.check(path, data)
+
+    # WORKAROUND - py.test doesn't correctly capture the DTOR logging.
+    self.bs.bs_close()
+    self.bs = None
+    self.fs = None
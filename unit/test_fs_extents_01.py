@@ -0,0 +1,154 @@
+import sys
+import random
+import py
+
+
+from os import *
+from stat import *
+
+import CONFIG
+import utp
+import utp.BlockStore
+import utp.FileSystem
+
+from lenhack import *
+
+# This test checks that a filesystem made with extents stores a file's
+# data in chunks of up to a megabyte, that a sparse file with many
+# records grows the extent tree past the inode, and that a remount
+# reads both back.
+
+class Test_fs_extents_01:
+
+  def setup_class(self):
+    self.bspath = "fs_extents_01.bs"
+
+  def teardown_class(self):
+    CONFIG.unmap_bs("rootbs")
+    CONFIG.remove_bs(self.bspath)
+
+  def mkfs(self, args):
+
+    # Remove any prexisting blockstore.
+    CONFIG.unmap_bs("rootbs")
+    CONFIG.remove_bs(self.bspath)
+
+    # Create the filesystem
+    bsargs = CONFIG.BSARGS(self.bspath)
+    self.bs = utp.BlockStore.create(CONFIG.BSTYPE,
+                                    "rootbs",
+                                    CONFIG.BSSIZE,
+                                    bsargs)
+    return utp.FileSystem.mkfs(CONFIG.FSTYPE, self.bs, "", "",
+                               CONFIG.UNAME, CONFIG.GNAME, args)
+
+  def check(self, path, expect):
+    off = 0
+    while off < lenhack(expect):
+      buf = self.fs.fs_read(path, 65536, off)
+      assert str(buf) == expect[off:off+65536]
+      off += 65536
+
+  def test_extents(self):
+    blksz = 8192
+    chunk = 1024 * 1024
+    self.fs = self.mkfs(("extents=1",))
+
+    data = "".join([chr(random.randrange(0, 256))
+                    for x in range(0, 3 * chunk + 123)])
+    self.fs.fs_mknod("/big", 0666, 0, CONFIG.UNAME, CONFIG.GNAME)
+    rv = self.fs.fs_write("/big", buffer(data), 0)
+    assert rv == lenhack(data)
+
+    # The inode and three chunks after the inline data, the last
+    # rounded up to whole blocks.
+    st = self.fs.fs_getattr("/big")
+    assert st[ST_SIZE] == lenhack(data)
+    assert st.st_blocks == (1 + 3 * chunk / blksz) * blksz / 512
+
+    self.check("/big", data)
+
+    # Sequential writes grow each chunk until it's full.
+    self.fs.fs_mknod("/seq", 0666, 0, CONFIG.UNAME, CONFIG.GNAME)
+    off = 0
+    while off < lenhack(data):
+      self.fs.fs_write("/seq", buffer(data[off:off+65536]), off)
+      off += 65536
+    st = self.fs.fs_getattr("/seq")
+    assert st.st_blocks == (1 + 3 * chunk / blksz) * blksz / 512
+
+    self.check("/seq", data)
+
+    # More records than the inode holds, the root moves down a level
+    # and the nodes beneath it split.
+    self.fs.fs_mknod("/sparse", 0666, 0, CONFIG.UNAME, CONFIG.GNAME)
+    nrecs = 400
+    for i in range(1, nrecs + 1):
+      self.fs.fs_write("/sparse", buffer("rec%07d" % i), i * 2 * chunk)
+    for i in range(1, nrecs + 1):
+      buf = self.fs.fs_read("/sparse", 10, i * 2 * chunk)
+      assert str(buf) == "rec%07d" % i
+
+    # The holes read as zeros.
+    buf = self.fs.fs_read("/sparse", 100, 3 * chunk)
+    assert str(buf) == "\0" * 100
+    buf = self.fs.fs_read("/sparse", 20, 4 * chunk - 10)
+    assert str(buf) == "\0" * 10 + "rec0000002"
+
+    # Truncate inside a chunk and inside a record.
+    whole = data
+    self.fs.fs_truncate("/big", chunk + 1000)
+    data = data[:chunk + 1000]
+    self.check("/big", data)
+
+    self.fs.fs_truncate("/sparse", 200 * 2 * chunk + 5)
+    st = self.fs.fs_getattr("/sparse")
+    assert st[ST_SIZE] == 200 * 2 * chunk + 5
+    buf = self.fs.fs_read("/sparse", 10, 200 * 2 * chunk)
+    assert str(buf) == "rec00"
+
+    # Extending again past the truncated chunk reads zeros between.
+    self.fs.fs_write("/sparse", buffer("again"), 200 * 2 * chunk + 100)
+    buf = self.fs.fs_read("/sparse", 105, 200 * 2 * chunk)
+    assert str(buf) == "rec00" + "\0" * 95 + "again"
+
+    self.fs.fs_sync()
+
+    # Now we unmount the filesystem.
+    self.fs.fs_umount()
+    self.bs.bs_close()
+
+    # Extents are chosen at mkfs.
+    bsargs = CONFIG.BSARGS(self.bspath)
+    self.bs = utp.BlockStore.open(CONFIG.BSTYPE,
+                                  "rootbs",
+                                  bsargs)
+    py.test.raises(Exception, utp.FileSystem.mount,
+                   CONFIG.FSTYPE, self.bs, "", "",
+                   ("extents=1",))
+
+    self.fs = utp.FileSystem.mount(CONFIG.FSTYPE, self.bs,
+                                   "", "", CONFIG.FSARGS)
+
+    self.check("/big", data)
+    self.check("/seq", whole)
+    for i in range(1, 200):
+      buf = self.fs.fs_read("/sparse", 10, i * 2 * chunk)
+      assert str(buf) == "rec%07d" % i
+    buf = self.fs.fs_read("/sparse", 105, 200 * 2 * chunk)
+    assert str(buf) == "rec00" + "\0" * 95 + "again"
+
+    # Writes after the remount extend the tree.
+    self.fs.fs_write("/big", buffer("more"), lenhack(data))
+    self.check("/big", data + "more")
+
+    # WORKAROUND - py.test doesn't correctly capture the DTOR logging.
+    self.bs.bs_close()
+    self.bs = None
+    self.fs = None
+
+  def test_bad(self):
+    for val in ("2", "yes", ""):
+      py.test.raises(Exception, self.mkfs, ("extents=%s" % val,))
+      self.bs.bs_close()
+      self.bs = None
@@ -111,3 +111,26 @@ class Test_fs_link_01:
       assert False
     except OSError, ex:
       assert ex.errno == ENOENT
+
+  def test_link_fileid(self):
+
+    # Files report an ID as their inode number, hard links share it.
+    self.fs.fs_mknod("/one", 0666, 0, CONFIG.UNAME, CONFIG.GNAME)
+    self.fs.fs_mknod("/two", 0666, 0, CONFIG.UNAME, CONFIG.GNAME)
+    self.fs.fs_link("/one", "/alsoone")
+
+    ino1 = self.fs.fs_getattr("/one")[ST_INO]
+    ino2 = self.fs.fs_getattr("/two")[ST_INO]
+    assert ino1 != 0
+    assert ino2 != 0
+    assert ino1 != ino2
+    assert self.fs.fs_getattr("/alsoone")[ST_INO] == ino1
+
+    # The ID is stored with the file.
+    self.fs.fs_sync()
+    assert self.fs.fs_getattr("/one")[ST_INO] == ino1
+    assert self.fs.fs_getattr("/alsoone")[ST_INO] == ino1
+
+    self.fs.fs_unlink("/one")
+    self.fs.fs_unlink("/two")
+    self.fs.fs_unlink("/alsoone")
@@ -0,0 +1,83 @@
+import sys
+import random
+import py
+
+
+from os import *
+from stat import *
+
+import CONFIG
+import utp
+import utp.BlockStore
+import utp.FileSystem
+
+from bigfile import *
+
+# This test checks that reads with readahead running return the right
+# data: sequential reads which run ahead of the blocks they need and
+# random reads which reset the window.
+
+class Test_fs_readahead_01:
+
+  def setup_class(self):
+    self.bspath = "fs_readahead_01.bs"
+
+  def teardown_class(self):
+    CONFIG.unmap_bs("rootbs")
+    CONFIG.remove_bs(self.bspath)
+
+  def test_readahead(self):
+
+    # Remove any prexisting blockstore.
+    CONFIG.unmap_bs("rootbs")
+    CONFIG.remove_bs(self.bspath)
+
+    # Create the filesystem
+    bsargs = CONFIG.BSARGS(self.bspath)
+    self.bs = utp.BlockStore.create(CONFIG.BSTYPE,
+                                    "rootbs",
+                                    CONFIG.BSSIZE,
+                                    bsargs)
+    self.fs = utp.FileSystem.mkfs(CONFIG.FSTYPE, self.bs, "", "",
+                                  CONFIG.UNAME, CONFIG.GNAME, CONFIG.FSARGS)
+
+    # Create a file reaching into the single indirect blocks.
+    nblks = 96
+    bigfile_write(self.fs, "/bigfile", nblks)
+
+    # Remount so nothing is cached.
+    self.fs.fs_umount()
+    self.bs.bs_close()
+
+    bsargs = CONFIG.BSARGS(self.bspath)
+    self.bs = utp.BlockStore.open(CONFIG.BSTYPE,
+                                  "rootbs",
+                                  bsargs)
+    self.fs = utp.FileSystem.mount(CONFIG.FSTYPE, self.bs,
+                                   "", "", CONFIG.FSARGS)
+
+    self.fs.fs_open("/bigfile", O_RDONLY)
+
+    # Sequential reads, smaller than a block so the window grows
+    # over several reads.
+    for off in range(0, nblks * 8192, 4096):
+      buf = self.fs.fs_read("/bigfile", 4096, off)
+      i = off / 8192
+      if off % 8192 == 0:
+        assert str(buf)[0:9] == "%08d\n" % (i)
+      else:
+        assert str(buf)[4096-9-2:4096-2] == "%08d\n" % (i)
+
+    # The window ran ahead of the reader.
+    assert self.fs.fs_get_stats()["rains"] > 0
+
+    # Random reads.
+    for n in range(0, 64):
+      i = random.randrange(0, nblks)
+      buf = self.fs.fs_read("/bigfile", 8192, i * 8192)
+      bigfile_check(buf, i)
+
+    # WORKAROUND - py.test doesn't correctly capture the DTOR logging.
+    self.bs.bs_close()
+    self.bs = None
+    self.fs = None
@@ -0,0 +1,134 @@
+import sys
+import random
+import py
+
+
+from os import *
+from stat import *
+
+import CONFIG
+import utp
+import utp.BlockStore
+import utp.FileSystem
+
+from lenhack import *
+
+# This test checks that fs_read_vec, which passes the blocks in place
+# instead of copying them, returns the same data as fs_read.  It reads
+# across the inline data, sparse blocks and the end of the file, with
+# and without buffered writes pending.
+
+class Test_fs_readvec_01:
+
+  def setup_class(self):
+    self.bspath = "fs_readvec_01.bs"
+
+  def teardown_class(self):
+    CONFIG.unmap_bs("rootbs")
+    CONFIG.remove_bs(self.bspath)
+
+  def check(self, expect):
+    for i in range(0, 200):
+      off = random.randrange(0, lenhack(expect) + 100)
+      size = random.randrange(0, 64 * 1024)
+      buf = self.fs.fs_read_vec("/file", size, off)
+      assert str(buf) == expect[off:off+size]
+      assert str(buf) == str(self.fs.fs_read("/file", size, off))
+
+  def test_readvec(self):
+
+    # Remove any prexisting blockstore.
+    CONFIG.unmap_bs("rootbs")
+    CONFIG.remove_bs(self.bspath)
+
+    # Create the filesystem
+    bsargs = CONFIG.BSARGS(self.bspath)
+    self.bs = utp.BlockStore.create(CONFIG.BSTYPE,
+                                    "rootbs",
+                                    CONFIG.BSSIZE,
+                                    bsargs)
+    self.fs = utp.FileSystem.mkfs(CONFIG.FSTYPE, self.bs, "", "",
+                                  CONFIG.UNAME, CONFIG.GNAME, CONFIG.FSARGS)
+
+    self.fs.fs_mknod("/file", 0666, 0, CONFIG.UNAME, CONFIG.GNAME)
+
+    # Large writes go straight to the blocks, leave a hole between
+    # them.
+    expect = ""
+    for i in range(0, 4):
+      data = "%c" % (ord('a') + i) * (32 * 1024)
+      rv = self.fs.fs_write("/file", buffer(data), lenhack(expect))
+      assert rv == lenhack(data)
+      expect += data
+    expect += "\0" * (100 * 1024)
+    data = "z" * (40 * 1024 + 17)
+    rv = self.fs.fs_write("/file", buffer(data), lenhack(expect))
+    assert rv == lenhack(data)
+    expect += data
+
+    self.check(expect)
+
+    self.fs.fs_sync()
+
+    self.check(expect)
+
+    # A small write is buffered.
+    self.fs.fs_write("/file", buffer("small"), 5000)
+    expect = expect[0:5000] + "small" + expect[5005:]
+
+    self.check(expect)
+
+    # Reading a missing file fails.
+    py.test.raises(OSError, self.fs.fs_read_vec, "/missing", 100, 0)
+
+    # WORKAROUND - py.test doesn't correctly capture the DTOR logging.
+    self.bs.bs_close()
+    self.bs = None
+    self.fs = None
+
+  def test_smallcache(self):
+
+    # Remove any prexisting blockstore.
+    CONFIG.unmap_bs("rootbs")
+    CONFIG.remove_bs(self.bspath)
+
+    # A 64K cache holds a handful of blocks, far fewer than a read
+    # across all the direct blocks visits.
+    bsargs = CONFIG.BSARGS(self.bspath)
+    self.bs = utp.BlockStore.create(CONFIG.BSTYPE,
+                                    "rootbs",
+                                    CONFIG.BSSIZE,
+                                    bsargs)
+    self.fs = utp.FileSystem.mkfs(CONFIG.FSTYPE, self.bs, "", "",
+                                  CONFIG.UNAME, CONFIG.GNAME,
+                                  ("cachesize=64K",))
+
+    self.fs.fs_mknod("/file", 0666, 0, CONFIG.UNAME, CONFIG.GNAME)
+
+    # Give each block its own contents, past the direct blocks.
+    expect = ""
+    for i in range(0, 24):
+      data = "%c" % (ord('A') + i) * (8 * 1024)
+      rv = self.fs.fs_write("/file", buffer(data), lenhack(expect))
+      assert rv == lenhack(data)
+      expect += data
+
+    self.fs.fs_sync()
+    self.fs.fs_umount()
+    self.fs = None
+
+    # Remount so every block is faulted in by the read itself.
+    self.fs = utp.FileSystem.mount(CONFIG.FSTYPE, self.bs, "", "",
+                                   ("cachesize=64K",))
+
+    # Read the whole file in one call, and again at odd offsets.
+    buf = self.fs.fs_read_vec("/file", lenhack(expect), 0)
+    assert str(buf) == expect
+    for off in (1, 4097, 8191, 100 * 1024 + 3):
+      buf = self.fs.fs_read_vec("/file", lenhack(expect), off)
+      assert str(buf) == expect[off:]
+
+    # WORKAROUND - py.test doesn't correctly capture the DTOR logging.
+    self.bs.bs_close()
+    self.bs = None
+    self.fs = None
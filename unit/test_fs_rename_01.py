@@ -79,3 +79,37 @@ class Test_fs_rename_01:
     self.fs.fs_mkdir("/adir", 0555, CONFIG.UNAME, CONFIG.GNAME)
     self.fs.fs_rename("/bar/blat", "/adir/blat")
     st = self.fs.fs_getattr("/adir/blat");
+
+  def test_rename_samedir(self):
+
+    print "Create two files in one directory."
+    self.fs.fs_mkdir("/sdir", 0755, CONFIG.UNAME, CONFIG.GNAME)
+    self.fs.fs_mknod("/sdir/one", 0666, 0, CONFIG.UNAME, CONFIG.GNAME)
+    self.fs.fs_write("/sdir/one", buffer("onedata"))
+    self.fs.fs_mknod("/sdir/two", 0666, 0, CONFIG.UNAME, CONFIG.GNAME)
+    self.fs.fs_write("/sdir/two", buffer("twodata"))
+
+    print "Renaming over an existing file replaces it."
+    self.fs.fs_rename("/sdir/one", "/sdir/two")
+    assert str(self.fs.fs_read("/sdir/two", 4096)) == "onedata"
+    try:
+      st = self.fs.fs_getattr("/sdir/one");
+      assert False
+    except OSError, ex:
+      assert ex.errno == ENOENT
+
+    print "Renaming a file to itself does nothing."
+    self.fs.fs_rename("/sdir/two", "/sdir/two")
+    assert str(self.fs.fs_read("/sdir/two", 4096)) == "onedata"
+
+    print "Renaming a missing file fails."
+    try:
+      self.fs.fs_rename("/sdir/missing", "/sdir/other")
+      assert False
+    except OSError, ex:
+      assert ex.errno == ENOENT
+    try:
+      st = self.fs.fs_getattr("/sdir/other");
+      assert False
+    except OSError, ex:
+      assert ex.errno == ENOENT
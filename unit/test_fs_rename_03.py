@@ -0,0 +1,160 @@
+import sys
+import random
+import threading
+import py
+
+from os import *
+from stat import *
+from errno import *
+
+import CONFIG
+import utp
+import utp.BlockStore
+import utp.FileSystem
+
+import utp.PyDirEntryFunc
+
+from lenhack import *
+
+# This test checks renames and links within one directory made by many
+# threads at once.  These lock only the directory, not the tree, so
+# they have to serialize on it: every entry ends up where the last
+# operation on it put it, and of several links to one name only one
+# is made.
+
+# This callback counts entries.
+class DirEntryCounter(utp.PyDirEntryFunc.PyDirEntryFunc):
+  def __init__(self):
+    utp.PyDirEntryFunc.PyDirEntryFunc.__init__(self)
+    self.count = 0
+
+  def def_entry(self, name, statbuf, offset):
+    self.count += 1
+
+class Test_fs_rename_03:
+
+  def setup_class(self):
+    self.bspath = "fs_rename_03.bs"
+
+  def teardown_class(self):
+    CONFIG.unmap_bs("rootbs")
+    CONFIG.remove_bs(self.bspath)
+
+  def count(self, path):
+    cntr = DirEntryCounter()
+    self.fs.fs_readdir(path, 0, cntr)
+    return cntr.count
+
+  def missing(self, path):
+    try:
+      st = self.fs.fs_getattr(path)
+      return False
+    except OSError, ex:
+      assert ex.errno == ENOENT
+      return True
+
+  def content(self, path):
+    return str(self.fs.fs_read(path, 4096, 0))
+
+  def worker(self, n, niters, start, linked, errors):
+    try:
+      start.wait()
+
+      # Everyone links to the same name, only one of them can.
+      try:
+        self.fs.fs_link("/dir/f%d" % (n,), "/dir/winner")
+        linked.append(n)
+      except OSError, ex:
+        assert ex.errno == EEXIST
+
+      for i in range(0, niters):
+        # Move our file around under other names and back.
+        self.fs.fs_rename("/dir/f%d" % (n,), "/dir/g%d" % (n,))
+        self.fs.fs_link("/dir/g%d" % (n,), "/dir/h%d" % (n,))
+        self.fs.fs_unlink("/dir/g%d" % (n,))
+        self.fs.fs_rename("/dir/h%d" % (n,), "/dir/f%d" % (n,))
+
+        # Everyone renames a new file over the same name.
+        path = "/dir/t%d" % (n,)
+        self.fs.fs_mknod(path, 0666, 0, CONFIG.UNAME, CONFIG.GNAME)
+        self.fs.fs_write(path, buffer("t%d-%d" % (n, i)), 0)
+        self.fs.fs_rename(path, "/dir/shared")
+
+        # Our other file in the directory is written meanwhile.
+        self.fs.fs_write("/dir/w%d" % (n,), buffer("w%d-%d" % (n, i)), 0)
+    except Exception, ex:
+      errors.append(ex)
+
+  def check(self, nthreads, niters, winner):
+    # Each file is back under its own name, and nothing else is left.
+    for n in range(0, nthreads):
+      assert self.content("/dir/f%d" % (n,)) == "f%d" % (n,)
+      assert self.content("/dir/w%d" % (n,)) == "w%d-%d" % (n, niters - 1)
+      assert self.missing("/dir/g%d" % (n,))
+      assert self.missing("/dir/h%d" % (n,))
+      assert self.missing("/dir/t%d" % (n,))
+    assert self.content("/dir/winner") == "f%d" % (winner,)
+
+    # The shared name holds the last file of one of the threads.
+    shared = self.content("/dir/shared")
+    assert shared in ["t%d-%d" % (n, niters - 1) for n in range(0, nthreads)]
+
+    assert self.count("/dir") == 2 * nthreads + 2 + 2
+
+  def test_rename_samedir_threads(self):
+
+    # Remove any prexisting blockstore.
+    CONFIG.unmap_bs("rootbs")
+    CONFIG.remove_bs(self.bspath)
+
+    # Create the filesystem
+    bsargs = CONFIG.BSARGS(self.bspath)
+    self.bs = utp.BlockStore.create(CONFIG.BSTYPE,
+                                    "rootbs",
+                                    CONFIG.BSSIZE,
+                                    bsargs)
+    self.fs = utp.FileSystem.mkfs(CONFIG.FSTYPE, self.bs, "", "",
+                                  CONFIG.UNAME, CONFIG.GNAME, CONFIG.FSARGS)
+
+    # Two files per thread in one directory.
+    nthreads = 8
+    niters = 32
+    self.fs.fs_mkdir("/dir", 0755, CONFIG.UNAME, CONFIG.GNAME)
+    for n in range(0, nthreads):
+      for name in ("f%d" % (n,), "w%d" % (n,)):
+        path = "/dir/" + name
+        self.fs.fs_mknod(path, 0666, 0, CONFIG.UNAME, CONFIG.GNAME)
+        self.fs.fs_write(path, buffer(name), 0)
+
+    start = threading.Event()
+    linked = []
+    errors = []
+    threads = []
+    for n in range(0, nthreads):
+      th = threading.Thread(target=self.worker,
+                            args=(n, niters, start, linked, errors))
+      th.start()
+      threads.append(th)
+    start.set()
+    for th in threads:
+      th.join()
+    assert errors == []
+
+    assert lenhack(linked) == 1
+    winner = linked[0]
+    self.check(nthreads, niters, winner)
+
+    # The same once it's stored.
+    self.fs.fs_sync()
+    self.fs.fs_umount()
+    self.bs.bs_close()
+    bsargs = CONFIG.BSARGS(self.bspath)
+    self.bs = utp.BlockStore.open(CONFIG.BSTYPE, "rootbs", bsargs)
+    self.fs = utp.FileSystem.mount(CONFIG.FSTYPE, self.bs,
+                                   "", "", CONFIG.FSARGS)
+    self.check(nthreads, niters, winner)
+
+    # WORKAROUND - py.test doesn't correctly capture the DTOR logging.
+    self.bs.bs_close()
+    self.bs = None
+    self.fs = None
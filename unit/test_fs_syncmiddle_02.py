@@ -0,0 +1,110 @@
+import sys
+import random
+import threading
+import py
+
+from os import *
+from stat import *
+from errno import *
+
+import CONFIG
+import utp
+import utp.BlockStore
+import utp.FileSystem
+
+# This test checks that writes and overwrites of the same blocks made
+# while a sync runs on another thread are all stored.  The sync flushes
+# a frozen copy of the tree without the tree lock, so the writes land
+# in the live nodes in the middle of it.
+
+def mkbuffer(npass, ndx, bufsz):
+  chr = "abcdefghijklmnopqrstuvwxyz"[(npass + ndx) % 26]
+  return buffer(chr * bufsz)
+
+class Test_fs_syncmiddle_02:
+
+  def setup_class(self):
+    self.bspath = "fs_syncmiddle_02.bs"
+
+  def teardown_class(self):
+    CONFIG.unmap_bs("rootbs")
+    CONFIG.remove_bs(self.bspath)
+
+  def syncer(self, done, counts, errors):
+    try:
+      while not done.isSet():
+        self.fs.fs_sync()
+        counts.append(1)
+    except Exception, ex:
+      errors.append(ex)
+
+  def check(self, paths, npasses, nblks, bufsz):
+    for path in paths:
+      for ndx in range(0, nblks):
+        nbuf = self.fs.fs_read(path, bufsz, ndx * bufsz)
+        assert nbuf == mkbuffer(npasses - 1, ndx, bufsz)
+
+  def test_syncmiddle(self):
+
+    # Remove any prexisting blockstore.
+    CONFIG.unmap_bs("rootbs")
+    CONFIG.remove_bs(self.bspath)
+
+    # Create the filesystem
+    bsargs = CONFIG.BSARGS(self.bspath)
+    self.bs = utp.BlockStore.create(CONFIG.BSTYPE,
+                                    "rootbs",
+                                    CONFIG.BSSIZE,
+                                    bsargs)
+    self.fs = utp.FileSystem.mkfs(CONFIG.FSTYPE, self.bs, "", "",
+                                  CONFIG.UNAME, CONFIG.GNAME, CONFIG.FSARGS)
+
+    # A file at the top and one a directory down.
+    self.fs.fs_mkdir("/dir", 0755, CONFIG.UNAME, CONFIG.GNAME)
+    paths = ["/middle", "/dir/middle"]
+    for path in paths:
+      self.fs.fs_mknod(path, 0666, 0, CONFIG.UNAME, CONFIG.GNAME)
+
+    # Sync over and over while every pass rewrites the same blocks
+    # with different contents.
+    bufsz = 4 * 1024
+    nblks = 16
+    npasses = 32
+    done = threading.Event()
+    counts = []
+    errors = []
+    th = threading.Thread(target=self.syncer, args=(done, counts, errors))
+    th.start()
+    try:
+      for npass in range(0, npasses):
+        for path in paths:
+          for ndx in range(0, nblks):
+            self.fs.fs_write(path, mkbuffer(npass, ndx, bufsz),
+                             ndx * bufsz)
+    finally:
+      done.set()
+      th.join()
+    assert errors == []
+    assert sum(counts) > 1
+
+    # The last pass is what's there.
+    self.check(paths, npasses, nblks, bufsz)
+    self.fs.fs_sync()
+    self.check(paths, npasses, nblks, bufsz)
+
+    # And what was stored.
+    self.fs.fs_umount()
+    self.bs.bs_close()
+    bsargs = CONFIG.BSARGS(self.bspath)
+    self.bs = utp.BlockStore.open(CONFIG.BSTYPE, "rootbs", bsargs)
+    self.fs = utp.FileSystem.mount(CONFIG.FSTYPE, self.bs,
+                                   "", "", CONFIG.FSARGS)
+    for path in paths:
+      st = self.fs.fs_getattr(path)
+      assert st[ST_SIZE] == nblks * bufsz
+    self.check(paths, npasses, nblks, bufsz)
+
+    # WORKAROUND - py.test doesn't correctly capture the DTOR logging.
+    self.bs.bs_close()
+    self.bs = None
+    self.fs = None
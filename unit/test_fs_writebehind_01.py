@@ -0,0 +1,118 @@
+import sys
+import random
+import py
+
+
+from os import *
+from stat import *
+
+import CONFIG
+import utp
+import utp.BlockStore
+import utp.FileSystem
+
+from lenhack import *
+
+# This test checks that small, unaligned and overlapping writes, which
+# are buffered and merged before they reach the blocks, read back
+# correctly before a sync, after a sync and after a remount.
+
+class Test_fs_writebehind_01:
+
+  def setup_class(self):
+    self.bspath = "fs_writebehind_01.bs"
+
+  def teardown_class(self):
+    CONFIG.unmap_bs("rootbs")
+    CONFIG.remove_bs(self.bspath)
+
+  def check(self, expect):
+    st = self.fs.fs_getattr("/logfile");
+    assert st[ST_SIZE] == lenhack(expect)
+    off = 0
+    while off < lenhack(expect):
+      buf = self.fs.fs_read("/logfile", 8192, off)
+      assert str(buf) == expect[off:off+8192]
+      off += 8192
+
+  def test_writebehind(self):
+
+    # Remove any prexisting blockstore.
+    CONFIG.unmap_bs("rootbs")
+    CONFIG.remove_bs(self.bspath)
+
+    # Create the filesystem
+    bsargs = CONFIG.BSARGS(self.bspath)
+    self.bs = utp.BlockStore.create(CONFIG.BSTYPE,
+                                    "rootbs",
+                                    CONFIG.BSSIZE,
+                                    bsargs)
+    self.fs = utp.FileSystem.mkfs(CONFIG.FSTYPE, self.bs, "", "",
+                                  CONFIG.UNAME, CONFIG.GNAME, CONFIG.FSARGS)
+
+    self.fs.fs_mknod("/logfile", 0666, 0, CONFIG.UNAME, CONFIG.GNAME)
+
+    # Append short records, enough to write back several times.
+    expect = ""
+    for i in range(0, 40000):
+      rec = "record %d\n" % (i)
+      rv = self.fs.fs_write("/logfile", buffer(rec), lenhack(expect))
+      assert rv == lenhack(rec)
+      expect += rec
+
+    self.check(expect)
+
+    # Overwrite random short ranges, some of them past the end.
+    for i in range(0, 2000):
+      off = random.randrange(0, lenhack(expect) + 100)
+      data = "%c" % (ord('a') + i % 26) * random.randrange(1, 300)
+      rv = self.fs.fs_write("/logfile", buffer(data), off)
+      assert rv == lenhack(data)
+      if off > lenhack(expect):
+        expect += "\0" * (off - lenhack(expect))
+      expect = expect[0:off] + data + expect[off+lenhack(data):]
+
+    self.check(expect)
+
+    # The sync takes the buffered writes with its frozen copy.
+    self.fs.fs_sync()
+
+    self.check(expect)
+
+    # Writes buffered after it are left for the next sync.
+    for i in range(0, 100):
+      rec = "again %d\n" % (i)
+      rv = self.fs.fs_write("/logfile", buffer(rec), lenhack(expect))
+      assert rv == lenhack(rec)
+      expect += rec
+    assert self.fs.fs_get_stats()["wbuf"] > 0
+
+    self.fs.fs_sync()
+
+    self.check(expect)
+
+    # Buffered writes don't survive truncation.
+    self.fs.fs_write("/logfile", buffer("tail"), lenhack(expect))
+    self.fs.fs_truncate("/logfile", lenhack(expect) - 10)
+    expect = expect[0:lenhack(expect) - 10]
+
+    self.check(expect)
+
+    # Now we unmount the filesystem.
+    self.fs.fs_umount()
+    self.bs.bs_close()
+
+    # Now mount it again.
+    bsargs = CONFIG.BSARGS(self.bspath)
+    self.bs = utp.BlockStore.open(CONFIG.BSTYPE,
+                                  "rootbs",
+                                  bsargs)
+    self.fs = utp.FileSystem.mount(CONFIG.FSTYPE, self.bs,
+                                   "", "", CONFIG.FSARGS)
+
+    self.check(expect)
+
+    # WORKAROUND - py.test doesn't correctly capture the DTOR logging.
+    self.bs.bs_close()
+    self.bs = None
+    self.fs = None
@@ -0,0 +1,111 @@
+import sys
+import random
+import time
+import py
+
+import utp
+import utp.BlockStore
+
+import CONFIG
+from lenhack import *
+
+# A child whose requests keep failing is tripped out of read routing
+# by its circuit breaker.  Once the cooldown passes a probe finds it
+# answering again and puts it back.
+
+class Test_vbs_breaker_01:
+
+  def setup_class(self):
+    self.bs1 = None
+    self.bs2 = None
+    self.vbs = None
+    pass
+
+  def teardown_class(self):
+    if self.vbs:
+      self.vbs.bs_close()
+      self.vbs = None
+    if self.bs2:
+      self.bs2.bs_close()
+      self.bs2 = None
+    if self.bs1:
+      self.bs1.bs_close()
+      self.bs1 = None
+
+  def breaker(self, name):
+    stats = self.vbs.bs_get_stats()
+    child = stats["c." + name]
+    return child["brk"], child["btrip"]
+
+  def test_trip_and_reset(self):
+    print "test_trip_and_reset"
+
+    print "The first child only has room for a few blocks."
+    bspath1 = "vbs_breaker_01_c1"
+    CONFIG.unmap_bs("child1")
+    CONFIG.remove_bs(bspath1)
+    self.bs1 = utp.BlockStore.create(CONFIG.BSTYPE,
+                                     "child1",
+                                     16 * 1024,
+                                     CONFIG.BSARGS(bspath1))
+
+    bspath2 = "vbs_breaker_01_c2"
+    CONFIG.unmap_bs("child2")
+    CONFIG.remove_bs(bspath2)
+    self.bs2 = utp.BlockStore.create(CONFIG.BSTYPE,
+                                     "child2",
+                                     CONFIG.BSSIZE,
+                                     CONFIG.BSARGS(bspath2))
+
+    # Only errors trip the breaker, a slow machine shouldn't.  The
+    # failed puts are queued for repair, which would keep failing on
+    # the full child, so the repair budget holds off all but one.
+    CONFIG.unmap_bs("rootbs")
+    self.vbs = utp.BlockStore.open("VBS",
+                                   "rootbs",
+                                   ("child1", "child2",
+                                    "--write-quorum=2",
+                                    "--breaker-latency=0",
+                                    "--repair-iops=1",
+                                    "--repair-bps=1"))
+    assert self.breaker("child1") == (0, 0)
+
+    print "Puts fail once the first child is full."
+    blocks = {}
+    nfailed = 0
+    for i in range(80):
+      key = buffer("key%d" % i)
+      val = buffer(("val%d" % i) * 200)
+      try:
+        self.vbs.bs_block_put(key, val)
+      except utp.NoSpaceError:
+        nfailed += 1
+      blocks[key] = val
+    self.vbs.bs_sync()
+    assert nfailed > 40
+
+    print "The failures trip the full child's breaker."
+    brk, btrip = self.breaker("child1")
+    assert brk != 0
+    assert btrip == 1
+    assert self.breaker("child2") == (0, 0)
+
+    print "Reads are served by the other child meanwhile."
+    for key, val in blocks.items():
+      assert self.vbs.bs_block_get(key) == val
+
+    print "The probe after the cooldown finds the child answering."
+    deadline = time.time() + 30
+    while self.breaker("child1")[0] != 0 and time.time() < deadline:
+      time.sleep(0.5)
+    assert self.breaker("child1") == (0, 1)
+
+    print "Close for good."
+    self.vbs.bs_close()
+    self.vbs = None
+    self.bs2.bs_close()
+    self.bs2 = None
+    self.bs1.bs_close()
+    self.bs1 = None
+    CONFIG.remove_bs(bspath2)
+    CONFIG.remove_bs(bspath1)
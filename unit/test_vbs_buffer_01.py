@@ -0,0 +1,120 @@
+import sys
+import random
+import py
+
+import utp
+import utp.BlockStore
+
+import CONFIG
+from lenhack import *
+
+# Gets which ask a single child have it write straight into the
+# caller's buffer; gets which ask several share a pooled buffer.
+# These check the data comes back intact either way.
+
+class Test_vbs_buffer_01:
+
+  def setup_class(self):
+    self.bs = {}
+    self.vbs = None
+    pass
+
+  def teardown_class(self):
+    if self.vbs:
+      self.vbs.bs_close()
+      self.vbs = None
+    for name, bs in self.bs.items():
+      bs.bs_close()
+    self.bs = {}
+
+  def create_child(self, name):
+    bspath = "vbs_buffer_01_%s" % name
+    CONFIG.unmap_bs(name)
+    CONFIG.remove_bs(bspath)
+    self.bs[name] = utp.BlockStore.create(CONFIG.BSTYPE,
+                                          name,
+                                          CONFIG.BSSIZE,
+                                          CONFIG.BSARGS(bspath))
+
+  def destroy_child(self, name):
+    self.bs[name].bs_close()
+    del self.bs[name]
+    CONFIG.remove_bs("vbs_buffer_01_%s" % name)
+
+  def randval(self, size):
+    return buffer("".join([chr(random.randrange(0, 256))
+                           for x in range(0, size)]))
+
+  def test_direct_single_child(self):
+    print "test_direct_single_child"
+    self.create_child("child1")
+
+    CONFIG.unmap_bs("rootbs")
+    self.vbs = utp.BlockStore.open("VBS", "rootbs", ("child1",))
+
+    print "Put blocks of assorted sizes."
+    blocks = {}
+    for size in (1, 100, 4096, 8192, 8193, 30000, 32 * 1024):
+      key = buffer("key%d" % size)
+      val = self.randval(size)
+      self.vbs.bs_block_put(key, val)
+      blocks[key] = val
+    self.vbs.bs_sync()
+
+    print "Each comes back whole, a smaller block after a larger one too."
+    for size in (32 * 1024, 1, 30000, 100, 8193, 4096, 8192):
+      key = buffer("key%d" % size)
+      blk = self.vbs.bs_block_get(key)
+      assert lenhack(blk) == size
+      assert blk == blocks[key]
+
+    print "A miss doesn't disturb the next get."
+    py.test.raises(utp.NotFoundError,
+                   self.vbs.bs_block_get, buffer("nokey"))
+    key = buffer("key100")
+    assert self.vbs.bs_block_get(key) == blocks[key]
+
+    print "Close for good."
+    self.vbs.bs_close()
+    self.vbs = None
+    self.destroy_child("child1")
+
+  def test_direct_one_replica(self):
+    print "test_direct_one_replica"
+    names = ("child1", "child2", "child3")
+    for name in names:
+      self.create_child(name)
+
+    CONFIG.unmap_bs("rootbs")
+    self.vbs = utp.BlockStore.open("VBS",
+                                   "rootbs",
+                                   names + ("--replicas=1",))
+
+    print "Each block has a single owner, which fills the caller's buffer."
+    blocks = {}
+    for i in range(40):
+      key = buffer("key%d" % i)
+      val = self.randval(random.randrange(1, 16 * 1024))
+      self.vbs.bs_block_put(key, val)
+      blocks[key] = val
+    self.vbs.bs_sync()
+
+    for key, val in blocks.items():
+      assert self.vbs.bs_block_get(key) == val
+
+    print "Blocks on a non-owner are found by asking the others."
+    strays = {}
+    for i in range(10):
+      key = buffer("stray%d" % i)
+      val = self.randval(random.randrange(1, 16 * 1024))
+      self.bs["child1"].bs_block_put(key, val)
+      strays[key] = val
+
+    for key, val in strays.items():
+      assert self.vbs.bs_block_get(key) == val
+
+    print "Close for good."
+    self.vbs.bs_close()
+    self.vbs = None
+    for name in names:
+      self.destroy_child(name)
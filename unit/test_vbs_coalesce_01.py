@@ -0,0 +1,111 @@
+import sys
+import random
+import threading
+import py
+
+import utp
+import utp.BlockStore
+
+import CONFIG
+from lenhack import *
+
+# Gets for a key which already has a get in flight ride along with it
+# instead of asking the children again; the riders get their own copy
+# of the block, or of the error.
+
+class Test_vbs_coalesce_01:
+
+  def setup_class(self):
+    self.bs1 = None
+    self.vbs = None
+    pass
+
+  def teardown_class(self):
+    if self.vbs:
+      self.vbs.bs_close()
+      self.vbs = None
+    if self.bs1:
+      self.bs1.bs_close()
+      self.bs1 = None
+
+  def randval(self, size):
+    return buffer("".join([chr(random.randrange(0, 256))
+                           for x in range(0, size)]))
+
+  def getter(self, keys, blocks, errors):
+    try:
+      for key in keys:
+        try:
+          blk = self.vbs.bs_block_get(key)
+          if blk != blocks[key]:
+            errors.append("bad data for %s" % key)
+        except utp.NotFoundError:
+          if key in blocks:
+            errors.append("missing %s" % key)
+    except Exception, ex:
+      errors.append(str(ex))
+
+  def test_concurrent_gets(self):
+    print "test_concurrent_gets"
+    bspath1 = "vbs_coalesce_01_c1"
+    CONFIG.unmap_bs("child1")
+    CONFIG.remove_bs(bspath1)
+    self.bs1 = utp.BlockStore.create(CONFIG.BSTYPE,
+                                     "child1",
+                                     CONFIG.BSSIZE,
+                                     CONFIG.BSARGS(bspath1))
+
+    CONFIG.unmap_bs("rootbs")
+    self.vbs = utp.BlockStore.open("VBS", "rootbs", ("child1",))
+
+    print "Put a few blocks of assorted sizes."
+    blocks = {}
+    for i in range(4):
+      key = buffer("key%d" % i)
+      val = self.randval(random.randrange(1, 32 * 1024))
+      self.vbs.bs_block_put(key, val)
+      blocks[key] = val
+    self.vbs.bs_sync()
+
+    print "Many threads get the same few keys, and one missing key."
+    keys = blocks.keys() + [buffer("nokey")]
+    nthreads = 8
+    nrounds = 200
+    errors = []
+    threads = []
+    for t in range(nthreads):
+      seq = [keys[(t + i) % lenhack(keys)] for i in range(nrounds)]
+      th = threading.Thread(target=self.getter,
+                            args=(seq, blocks, errors))
+      threads.append(th)
+    for th in threads:
+      th.start()
+    for th in threads:
+      th.join()
+    assert errors == []
+
+    print "Every get was served by a child request or rode along on one."
+    self.vbs.bs_sync()
+    stats = self.vbs.bs_get_stats()
+    nhits = nthreads * nrounds * lenhack(blocks) / lenhack(keys)
+    ngets = stats["c.child1"]["grps"]
+    ncoalesced = stats["cgps"]
+    assert ncoalesced > 0
+    assert ngets < nhits
+    assert nhits <= ngets + ncoalesced <= nthreads * nrounds
+    assert stats["nreqs"] == 0
+
+    print "Later gets for the same key ask the child again."
+    before = self.vbs.bs_get_stats()["c.child1"]["grps"]
+    for key, val in blocks.items():
+      assert self.vbs.bs_block_get(key) == val
+    after = self.vbs.bs_get_stats()
+    assert after["c.child1"]["grps"] == before + lenhack(blocks)
+    assert after["cgps"] == ncoalesced
+
+    print "Close for good."
+    self.vbs.bs_close()
+    self.vbs = None
+    self.bs1.bs_close()
+    self.bs1 = None
+    CONFIG.remove_bs(bspath1)
@@ -0,0 +1,191 @@
+import sys
+import random
+import py
+
+import utp
+import utp.BlockStore
+
+import CONFIG
+from lenhack import *
+
+class Test_vbs_erasure_01:
+
+  def setup_class(self):
+    self.bs = {}
+    self.vbs = None
+    pass
+
+  def teardown_class(self):
+    if self.vbs:
+      self.vbs.bs_close()
+      self.vbs = None
+    for name, bs in self.bs.items():
+      bs.bs_close()
+    self.bs = {}
+
+  def create_child(self, name):
+    bspath = "vbs_erasure_01_%s" % name
+    CONFIG.unmap_bs(name)
+    CONFIG.remove_bs(bspath)
+    self.bs[name] = utp.BlockStore.create(CONFIG.BSTYPE,
+                                          name,
+                                          CONFIG.BSSIZE,
+                                          CONFIG.BSARGS(bspath))
+
+  def destroy_child(self, name):
+    self.bs[name].bs_close()
+    del self.bs[name]
+    CONFIG.remove_bs("vbs_erasure_01_%s" % name)
+
+  def nfrags(self, name, keys):
+    nfound = 0
+    for key in keys:
+      for i in range(3):
+        try:
+          self.bs[name].bs_block_get(buffer(str(key) + chr(i)))
+          nfound += 1
+        except utp.NotFoundError:
+          pass
+    return nfound
+
+  def test_bad_erasure(self):
+    print "test_bad_erasure"
+    for name in ("child1", "child2"):
+      self.create_child(name)
+    CONFIG.unmap_bs("rootbs")
+    py.test.raises(utp.ValueError,
+                   utp.BlockStore.open,
+                   "VBS", "rootbs", ("child1", "child2", "--erasure=2+1"))
+    CONFIG.unmap_bs("rootbs")
+    py.test.raises(utp.ValueError,
+                   utp.BlockStore.open,
+                   "VBS", "rootbs", ("child1", "child2", "--erasure=0+1"))
+    CONFIG.unmap_bs("rootbs")
+    py.test.raises(utp.ValueError,
+                   utp.BlockStore.open,
+                   "VBS", "rootbs", ("child1", "child2", "--erasure=2"))
+    for name in ("child1", "child2"):
+      self.destroy_child(name)
+
+  def test_erasure_lose_one(self):
+    print "test_erasure_lose_one"
+    for name in ("child1", "child2", "child3"):
+      self.create_child(name)
+
+    CONFIG.unmap_bs("rootbs")
+    self.vbs = utp.BlockStore.open("VBS",
+                                   "rootbs",
+                                   ("child1", "child2", "child3",
+                                    "--erasure=2+1"))
+
+    print "Capacity is scaled by the code rate."
+    bss = self.vbs.bs_stat();
+    assert bss.bss_size == 3 * CONFIG.BSSIZE * 2 / 3
+
+    print "Put some blocks of data, including odd and empty sizes."
+    blocks = {}
+    for i in range(40):
+      key = buffer("key%d" % i)
+      val = buffer(''.join(chr(random.randint(0, 255))
+                           for j in range(random.randint(0, 3000))))
+      self.vbs.bs_block_put(key, val)
+      blocks[key] = val
+    self.vbs.bs_sync()
+
+    print "The whole block isn't stored on any child."
+    for key, val in blocks.items():
+      for name, bs in self.bs.items():
+        py.test.raises(utp.NotFoundError, bs.bs_block_get, key)
+
+    print "Read them back."
+    for key, val in blocks.items():
+      assert self.vbs.bs_block_get(key) == val
+
+    print "Lose a child, the blocks should still be readable."
+    self.vbs.bs_close()
+    self.destroy_child("child2")
+    self.create_child("child2")
+    CONFIG.unmap_bs("rootbs")
+    self.vbs = utp.BlockStore.open("VBS",
+                                   "rootbs",
+                                   ("child1", "child2", "child3",
+                                    "--erasure=2+1"))
+    for key, val in blocks.items():
+      assert self.vbs.bs_block_get(key) == val
+
+    print "The reads put the lost fragments back."
+    for i in range(5):
+      self.vbs.bs_sync()
+      if self.nfrags("child2", blocks.keys()) == lenhack(blocks):
+        break
+      for key, val in blocks.items():
+        assert self.vbs.bs_block_get(key) == val
+    assert self.nfrags("child2", blocks.keys()) == lenhack(blocks)
+    assert self.vbs.bs_get_stats()["frps"] >= lenhack(blocks)
+
+    print "So losing another child is survived too."
+    self.vbs.bs_close()
+    self.destroy_child("child1")
+    self.create_child("child1")
+    CONFIG.unmap_bs("rootbs")
+    self.vbs = utp.BlockStore.open("VBS",
+                                   "rootbs",
+                                   ("child1", "child2", "child3",
+                                    "--erasure=2+1"))
+    for key, val in blocks.items():
+      assert self.vbs.bs_block_get(key) == val
+
+    print "Missing blocks are still not found."
+    py.test.raises(utp.NotFoundError,
+                   self.vbs.bs_block_get, buffer("nosuchkey"))
+
+    print "Close for good."
+    self.vbs.bs_close()
+    self.vbs = None
+    for name in ("child1", "child2", "child3"):
+      self.destroy_child(name)
+
+  def test_erasure_add_child(self):
+    print "test_erasure_add_child"
+    names = ("child1", "child2", "child3", "child4")
+    for name in names:
+      self.create_child(name)
+
+    CONFIG.unmap_bs("rootbs")
+    self.vbs = utp.BlockStore.open("VBS",
+                                   "rootbs",
+                                   names[:3] + ("--erasure=2+1",))
+
+    print "Put some blocks across three children."
+    blocks = {}
+    for i in range(40):
+      key = buffer("key%d" % i)
+      val = buffer(''.join(chr(random.randint(0, 255))
+                           for j in range(random.randint(1, 3000))))
+      self.vbs.bs_block_put(key, val)
+      blocks[key] = val
+    self.vbs.bs_sync()
+    self.vbs.bs_close()
+
+    print "Add a fourth, some fragments now belong to other children."
+    CONFIG.unmap_bs("rootbs")
+    self.vbs = utp.BlockStore.open("VBS",
+                                   "rootbs",
+                                   names + ("--erasure=2+1",))
+    assert self.nfrags("child4", blocks.keys()) == 0
+
+    print "Fragments are found where they were and moved to their owners."
+    for key, val in blocks.items():
+      assert self.vbs.bs_block_get(key) == val
+    self.vbs.bs_sync()
+    assert self.vbs.bs_get_stats()["frps"] > 0
+    assert self.nfrags("child4", blocks.keys()) > 0
+
+    for key, val in blocks.items():
+      assert self.vbs.bs_block_get(key) == val
+
+    print "Close for good."
+    self.vbs.bs_close()
+    self.vbs = None
+    for name in names:
+      self.destroy_child(name)
@@ -0,0 +1,130 @@
+import sys
+import random
+import py
+import time
+
+import utp
+import utp.BlockStore
+
+import CONFIG
+from lenhack import *
+
+# This test makes sure furthest queries answered from the VBS merged
+# head graph see our own inserts immediately and other writers'
+# inserts after reconciliation.
+
+class Test_vbs_head_05:
+
+  def setup_class(self):
+    self.bs1 = None
+    self.bs2 = None
+    self.vbs = None
+    pass
+
+  def teardown_class(self):
+    if self.vbs:
+      self.vbs.bs_close()
+      self.vbs = None
+    if self.bs2:
+      self.bs2.bs_close()
+      self.bs2 = None
+    if self.bs1:
+      self.bs1.bs_close()
+      self.bs1 = None
+
+  def test_cached_furthest(self):
+
+    print "test_cached_furthest starting"
+
+    # First child.
+    bspath1 = "vbs_head_05_c1"
+    CONFIG.unmap_bs("child1")
+    CONFIG.remove_bs(bspath1)
+    self.bs1 = utp.BlockStore.create(CONFIG.BSTYPE,
+                                     "child1",
+                                     CONFIG.BSSIZE,
+                                     CONFIG.BSARGS(bspath1))
+
+    # Second child.
+    bspath2 = "vbs_head_05_c2"
+    CONFIG.unmap_bs("child2")
+    CONFIG.remove_bs(bspath2)
+    self.bs2 = utp.BlockStore.create(CONFIG.BSTYPE,
+                                     "child2",
+                                     CONFIG.BSSIZE,
+                                     CONFIG.BSARGS(bspath2))
+
+    # Open the virtual block store, reconciling every second.
+    CONFIG.unmap_bs("rootbs")
+    self.vbs = utp.BlockStore.open("VBS",
+                                   "rootbs",
+                                   ("child1", "child2",
+                                    "--head-reconcile=1"))
+
+    seed0 = (buffer("fsid"), buffer(""))
+
+    node1 = utp.SignedHeadEdge(("fsid", "node1", 0,
+                                time.time() * 1e6, 0, 0))
+    self.vbs.bs_head_insert(node1)
+
+    # The first query goes to the children and primes the cache.
+    shes = self.vbs.bs_head_furthest(seed0)
+    assert lenhack(shes) == 1
+    assert shes[0] == (buffer("fsid"), buffer("node1"))
+    self.vbs.bs_sync()
+
+    # Our own inserts are seen right away.
+    node2 = utp.SignedHeadEdge(("fsid", "node2", "node1",
+                                time.time() * 1e6, 0, 0))
+    self.vbs.bs_head_insert(node2)
+
+    shes = self.vbs.bs_head_furthest(seed0)
+    assert lenhack(shes) == 1
+    assert shes[0] == (buffer("fsid"), buffer("node2"))
+
+    # Someone else inserts directly into a child.
+    node3 = utp.SignedHeadEdge(("fsid", "node3", "node2",
+                                time.time() * 1e6, 0, 0))
+    self.bs1.bs_head_insert(node3)
+
+    # After a reconcile it shows up.
+    time.sleep(2)
+    self.vbs.bs_sync()
+
+    shes = self.vbs.bs_head_furthest(seed0)
+    assert lenhack(shes) == 1
+    assert shes[0] == (buffer("fsid"), buffer("node3"))
+
+    # The periodic reconcile followed on from what we had.
+    stats = self.vbs.bs_get_stats()["headcache"]
+    assert stats["hcinc"] > 0
+
+    # And picks up the next edge the same way.
+    node4 = utp.SignedHeadEdge(("fsid", "node4", "node3",
+                                time.time() * 1e6, 0, 0))
+    self.bs2.bs_head_insert(node4)
+    time.sleep(2)
+    self.vbs.bs_sync()
+
+    shes = self.vbs.bs_head_furthest(seed0)
+    assert lenhack(shes) == 1
+    assert shes[0] == (buffer("fsid"), buffer("node4"))
+    assert self.vbs.bs_get_stats()["headcache"]["hcinc"] > stats["hcinc"]
+
+    # Seeded queries follow from the seed.
+    seed1 = (buffer("fsid"), buffer("node1"))
+    shes = self.vbs.bs_head_furthest(seed1)
+    assert lenhack(shes) == 1
+    assert shes[0] == (buffer("fsid"), buffer("node4"))
+
+    # Close for good.
+    self.vbs.bs_close()
+    self.vbs = None
+    self.bs2.bs_close()
+    self.bs2 = None
+    self.bs1.bs_close()
+    self.bs1 = None
+    CONFIG.remove_bs(bspath2)
+    CONFIG.remove_bs(bspath1)
+
+    print "test_cached_furthest finished"
@@ -0,0 +1,188 @@
+import sys
+import random
+import time
+import py
+
+import utp
+import utp.BlockStore
+
+import CONFIG
+from lenhack import *
+
+# Blocks a child is missing are copied over from a sibling by the
+# background repairer, which keeps to its blocks and bytes per second
+# budget.  A repair only counts once the block is on the child, and
+# one which fails is queued again.  Sync doesn't wait for them.
+
+class Test_vbs_repair_01:
+
+  def setup_class(self):
+    self.bs = {}
+    self.vbs = None
+    pass
+
+  def teardown_class(self):
+    if self.vbs:
+      self.vbs.bs_close()
+      self.vbs = None
+    for name, bs in self.bs.items():
+      bs.bs_close()
+    self.bs = {}
+
+  def create_child(self, name, size):
+    bspath = "vbs_repair_01_%s" % name
+    CONFIG.unmap_bs(name)
+    CONFIG.remove_bs(bspath)
+    self.bs[name] = utp.BlockStore.create(CONFIG.BSTYPE,
+                                          name,
+                                          size,
+                                          CONFIG.BSARGS(bspath))
+
+  def destroy_child(self, name):
+    self.bs[name].bs_close()
+    del self.bs[name]
+    CONFIG.remove_bs("vbs_repair_01_%s" % name)
+
+  def open_vbs(self, args):
+    CONFIG.unmap_bs("rootbs")
+    self.vbs = utp.BlockStore.open("VBS",
+                                   "rootbs",
+                                   ("child1", "child2") + args)
+
+  def close_vbs(self):
+    self.vbs.bs_close()
+    self.vbs = None
+
+  def put_strays(self):
+    # Blocks only on the first child; with a single replica the
+    # ones the second child owns are missed there and queued.
+    strays = {}
+    for i in range(20):
+      key = buffer("stray%d" % i)
+      val = buffer(("stray%d" % i) * random.randrange(1, 200))
+      self.bs["child1"].bs_block_put(key, val)
+      strays[key] = val
+    return strays
+
+  def wait_repairs(self, done):
+    deadline = time.time() + 30
+    while time.time() < deadline:
+      stats = self.vbs.bs_get_stats()
+      if done(stats):
+        return stats
+      time.sleep(0.1)
+    assert False, "repairs didn't settle"
+
+  def get_strays(self, strays):
+    for key, val in strays.items():
+      assert self.vbs.bs_block_get(key) == val
+    stats = self.vbs.bs_get_stats()
+    return stats["c.child1"]["nql"] + stats["c.child2"]["nql"]
+
+  def test_budget(self):
+    print "test_budget"
+    self.create_child("child1", CONFIG.BSSIZE)
+    self.create_child("child2", CONFIG.BSSIZE)
+
+    print "The default budget is 100 blocks and 4 MB per second."
+    self.open_vbs(())
+    stats = self.vbs.bs_get_stats()["repair"]
+    assert stats["riops"] == 100
+    assert stats["rbps"] == 4 * 1024 * 1024
+    self.close_vbs()
+
+    print "Zero means unlimited."
+    self.open_vbs(("--repair-iops=0", "--repair-bps=0"))
+    stats = self.vbs.bs_get_stats()["repair"]
+    assert stats["riops"] == 0
+    assert stats["rbps"] == 0
+    self.close_vbs()
+
+    print "Bad budgets are rejected."
+    for arg in ("--repair-iops=-1", "--repair-bps=lots"):
+      CONFIG.unmap_bs("rootbs")
+      py.test.raises(utp.ValueError,
+                     utp.BlockStore.open,
+                     "VBS", "rootbs", ("child1", "child2", arg))
+
+    self.destroy_child("child2")
+    self.destroy_child("child1")
+
+  def test_repaired(self):
+    print "test_repaired"
+    self.create_child("child1", CONFIG.BSSIZE)
+    self.create_child("child2", CONFIG.BSSIZE)
+
+    strays = self.put_strays()
+    self.open_vbs(("--replicas=1",))
+    nneeded = self.get_strays(strays)
+    assert nneeded > 0
+
+    print "The repairs count once they're put."
+    self.wait_repairs(lambda stats:
+                        stats["c.child1"]["nql"] + stats["c.child2"]["nql"] +
+                        stats["repair"]["rifl"] == 0)
+    self.vbs.bs_sync()
+    nbytes = 0
+    ncopied = 0
+    for key, val in strays.items():
+      try:
+        assert self.bs["child2"].bs_block_get(key) == val
+        nbytes += lenhack(val)
+        ncopied += 1
+      except utp.NotFoundError:
+        pass
+    assert ncopied == nneeded
+
+    stats = self.vbs.bs_get_stats()
+    assert stats["c.child1"]["nql"] + stats["c.child2"]["nql"] == 0
+    assert stats["repair"]["rrps"] == nneeded
+    assert stats["repair"]["rkbps"] == nbytes
+    assert stats["repair"]["rfail"] == 0
+    assert stats["repair"]["rifl"] == 0
+
+    self.close_vbs()
+    self.destroy_child("child2")
+    self.destroy_child("child1")
+
+  def test_put_fails(self):
+    print "test_put_fails"
+    self.create_child("child1", CONFIG.BSSIZE)
+    self.create_child("child2", 16 * 1024)
+
+    print "Fill the second child."
+    i = 0
+    while True:
+      try:
+        self.bs["child2"].bs_block_put(buffer("fill%d" % i),
+                                       buffer("x" * 4096))
+      except utp.NoSpaceError:
+        break
+      i += 1
+
+    strays = self.put_strays()
+    self.open_vbs(("--replicas=1",))
+    nneeded = self.get_strays(strays)
+    assert nneeded > 0
+
+    print "Repairs which can't be put count as failures."
+    stats = self.wait_repairs(lambda stats:
+                                stats["repair"]["rfail"] >= 2 * nneeded)
+    assert stats["repair"]["rrps"] == 0
+    assert stats["repair"]["rkbps"] == 0
+
+    print "They are queued again, and sync doesn't wait for them."
+    self.vbs.bs_sync()
+    stats = self.vbs.bs_get_stats()
+    assert stats["c.child2"]["nql"] + stats["repair"]["rifl"] > 0
+    assert stats["repair"]["rrps"] == 0
+
+    print "So they are still owed after a restart."
+    self.close_vbs()
+    self.open_vbs(("--replicas=1", "--repair-iops=1"))
+    stats = self.vbs.bs_get_stats()
+    assert stats["c.child2"]["nql"] > 0
+
+    self.close_vbs()
+    self.destroy_child("child2")
+    self.destroy_child("child1")
@@ -0,0 +1,155 @@
+import sys
+import random
+import threading
+import py
+
+import utp
+import utp.BlockStore
+
+import CONFIG
+from lenhack import *
+
+# Each child serves its refresh, headnode, get and put queues in
+# proportion to the configured weights.  These tests check the
+# weights are taken and reported, that every request is served and
+# counted in its class, and that a long refresh pass doesn't hold up
+# gets until it is done.
+
+class Test_vbs_sched_01:
+
+  def setup_class(self):
+    self.bs1 = None
+    self.vbs = None
+    self.bspath1 = "vbs_sched_01_c1"
+    CONFIG.unmap_bs("child1")
+    CONFIG.remove_bs(self.bspath1)
+    self.bs1 = utp.BlockStore.create(CONFIG.BSTYPE,
+                                     "child1",
+                                     CONFIG.BSSIZE,
+                                     CONFIG.BSARGS(self.bspath1))
+
+  def teardown_class(self):
+    if self.vbs:
+      self.vbs.bs_close()
+      self.vbs = None
+    if self.bs1:
+      self.bs1.bs_close()
+      self.bs1 = None
+    CONFIG.remove_bs(self.bspath1)
+
+  def open_vbs(self, args):
+    CONFIG.unmap_bs("rootbs")
+    self.vbs = utp.BlockStore.open("VBS", "rootbs", ("child1",) + args)
+
+  def close_vbs(self):
+    self.vbs.bs_close()
+    self.vbs = None
+
+  def served(self):
+    stats = self.vbs.bs_get_stats()["c.child1"]
+    return (stats["srps"], stats["shps"], stats["sgps"], stats["spps"])
+
+  def test_weights(self):
+    print "test_weights"
+
+    print "Weights must be positive numbers."
+    for arg in ("--weight-refresh=0",
+                "--weight-headnode=-1",
+                "--weight-get=lots",
+                "--weight-put=0"):
+      CONFIG.unmap_bs("rootbs")
+      py.test.raises(utp.ValueError,
+                     utp.BlockStore.open,
+                     "VBS", "rootbs", ("child1", arg))
+
+    print "The defaults favor gets, then headnodes, puts and refreshes."
+    self.open_vbs(())
+    stats = self.vbs.bs_get_stats()
+    assert stats["wref"] == 1
+    assert stats["whed"] == 4
+    assert stats["wget"] == 8
+    assert stats["wput"] == 2
+    assert stats["gdln"] == 50
+    self.close_vbs()
+
+    print "Configured weights are reported."
+    self.open_vbs(("--weight-refresh=3",
+                   "--weight-headnode=2",
+                   "--weight-get=16",
+                   "--weight-put=5",
+                   "--get-deadline=20"))
+    stats = self.vbs.bs_get_stats()
+    assert stats["wref"] == 3
+    assert stats["whed"] == 2
+    assert stats["wget"] == 16
+    assert stats["wput"] == 5
+    assert stats["gdln"] == 20
+    self.close_vbs()
+
+  def test_served(self):
+    print "test_served"
+    self.open_vbs(())
+
+    print "Every request is served once, in its own class."
+    srps, shps, sgps, spps = self.served()
+    for i in range(30):
+      self.vbs.bs_block_put(buffer("served%d" % i), buffer("val%d" % i))
+    for i in range(20):
+      assert (self.vbs.bs_block_get(buffer("served%d" % i)) ==
+              buffer("val%d" % i))
+    keys = [buffer("served%d" % i) for i in range(10)]
+    self.vbs.bs_refresh_start(1)
+    assert self.vbs.bs_refresh_blocks(1, keys) == []
+    self.vbs.bs_refresh_finish(1)
+
+    # The refresh start and finish are served with the blocks.
+    srps2, shps2, sgps2, spps2 = self.served()
+    assert spps2 - spps == 30
+    assert sgps2 - sgps == 20
+    assert srps2 - srps == 10 + 2
+
+    # Gets which come straight to a queue nothing else is using are
+    # never late.
+    assert self.vbs.bs_get_stats()["c.child1"]["gdlm"] == 0
+
+    self.close_vbs()
+
+  def refresher(self, keys, errors):
+    try:
+      self.vbs.bs_refresh_start(2)
+      self.vbs.bs_refresh_blocks(2, keys)
+      self.vbs.bs_refresh_finish(2)
+    except Exception, ex:
+      errors.append(ex)
+
+  def test_refresh_shares(self):
+    print "test_refresh_shares"
+    self.open_vbs(("--weight-refresh=1", "--weight-get=64"))
+
+    blocks = {}
+    for i in range(20):
+      key = buffer("shared%d" % i)
+      val = buffer("val%d" % i)
+      self.vbs.bs_block_put(key, val)
+      blocks[key] = val
+
+    print "Start a long refresh pass."
+    nkeys = 20000
+    keys = [buffer("rkey%d" % i) for i in range(nkeys)]
+    srps = self.served()[0]
+    errors = []
+    th = threading.Thread(target=self.refresher, args=(keys, errors))
+    th.start()
+    while self.served()[0] == srps and th.isAlive():
+      pass
+
+    print "Gets are served while it is still going."
+    for key, val in blocks.items():
+      assert self.vbs.bs_block_get(key) == val
+    assert self.served()[0] - srps < nkeys + 2
+
+    th.join()
+    assert errors == []
+    assert self.served()[0] - srps == nkeys + 2
+
+    self.close_vbs()
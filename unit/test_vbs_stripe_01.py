@@ -0,0 +1,155 @@
+import sys
+import random
+import time
+import py
+
+import utp
+import utp.BlockStore
+
+import CONFIG
+from lenhack import *
+
+class Test_vbs_stripe_01:
+
+  def setup_class(self):
+    self.bs = {}
+    self.vbs = None
+    pass
+
+  def teardown_class(self):
+    if self.vbs:
+      self.vbs.bs_close()
+      self.vbs = None
+    for name, bs in self.bs.items():
+      bs.bs_close()
+    self.bs = {}
+
+  def create_child(self, name):
+    bspath = "vbs_stripe_01_%s" % name
+    CONFIG.unmap_bs(name)
+    CONFIG.remove_bs(bspath)
+    self.bs[name] = utp.BlockStore.create(CONFIG.BSTYPE,
+                                          name,
+                                          CONFIG.BSSIZE,
+                                          CONFIG.BSARGS(bspath))
+
+  def destroy_child(self, name):
+    self.bs[name].bs_close()
+    del self.bs[name]
+    CONFIG.remove_bs("vbs_stripe_01_%s" % name)
+
+  def ncopies(self, key):
+    count = 0
+    for name, bs in self.bs.items():
+      try:
+        bs.bs_block_get(key)
+        count += 1
+      except utp.NotFoundError:
+        pass
+    return count
+
+  def used(self):
+    total = 0
+    for name, bs in self.bs.items():
+      bss = bs.bs_stat()
+      total += bss.bss_size - bss.bss_free
+    return total
+
+  def refresh(self, rid, keys):
+    self.vbs.bs_refresh_start(rid)
+    missing = self.vbs.bs_refresh_blocks(rid, keys)
+    self.vbs.bs_refresh_finish(rid)
+    return missing
+
+  def wait_repairs(self):
+    deadline = time.time() + 30
+    while time.time() < deadline:
+      stats = self.vbs.bs_get_stats()
+      owed = stats["repair"]["rifl"]
+      for name in self.bs.keys():
+        owed += stats["c." + name]["nql"]
+      if owed == 0:
+        return
+      time.sleep(0.1)
+    assert False, "repairs didn't finish"
+
+  def test_too_many_replicas(self):
+    print "test_too_many_replicas"
+    self.create_child("child1")
+    CONFIG.unmap_bs("rootbs")
+    py.test.raises(utp.ValueError,
+                   utp.BlockStore.open,
+                   "VBS", "rootbs", ("child1", "--replicas=2"))
+    self.destroy_child("child1")
+
+  def test_stripe_three_children(self):
+    print "test_stripe_three_children"
+    for name in ("child1", "child2", "child3"):
+      self.create_child(name)
+
+    CONFIG.unmap_bs("rootbs")
+    self.vbs = utp.BlockStore.open("VBS",
+                                   "rootbs",
+                                   ("child1", "child2", "child3",
+                                    "--replicas=2"))
+
+    print "Capacity is the total divided by the number of copies."
+    bss = self.vbs.bs_stat()
+    assert bss.bss_size == 3 * CONFIG.BSSIZE / 2
+
+    print "Put some blocks of data."
+    blocks = {}
+    for i in range(60):
+      key = buffer("key%d" % i)
+      val = buffer("val%d" % i)
+      self.vbs.bs_block_put(key, val)
+      blocks[key] = val
+    self.vbs.bs_sync()
+
+    print "Each block should be on exactly two children."
+    for key, val in blocks.items():
+      assert self.ncopies(key) == 2
+      assert self.vbs.bs_block_get(key) == val
+
+    print "Add a fourth child, existing blocks should still be found."
+    self.vbs.bs_close()
+    self.create_child("child4")
+    CONFIG.unmap_bs("rootbs")
+    self.vbs = utp.BlockStore.open("VBS",
+                                   "rootbs",
+                                   ("child1", "child2", "child3", "child4",
+                                    "--replicas=2"))
+    for key, val in blocks.items():
+      assert self.vbs.bs_block_get(key) == val
+
+    print "A refresh finds the new child's blocks missing and repairs them."
+    assert self.refresh(1, blocks.keys()) == []
+    self.wait_repairs()
+    self.vbs.bs_sync()
+    nmoved = 0
+    for key, val in blocks.items():
+      try:
+        assert self.bs["child4"].bs_block_get(key) == val
+        nmoved += 1
+      except utp.NotFoundError:
+        pass
+    assert nmoved > 0
+
+    print "The next refresh only keeps the owners' copies."
+    before = self.used()
+    assert self.refresh(2, blocks.keys()) == []
+    assert self.used() < before
+    stats = self.vbs.bs_get_stats()
+    for name in self.bs.keys():
+      assert stats["c." + name]["nql"] == 0
+
+    print "Every block is still found on its owners."
+    for key, val in blocks.items():
+      assert self.vbs.bs_block_get(key) == val
+      assert self.ncopies(key) >= 2
+
+    print "Close for good."
+    self.vbs.bs_close()
+    self.vbs = None
+    for name in ("child1", "child2", "child3", "child4"):
+      self.destroy_child(name)
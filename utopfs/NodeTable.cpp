@@ -0,0 +1,313 @@
+#include <vector>
+
+#include <ace/Guard_T.h>
+
+#include "fuselog.h"
+
+#include "NodeTable.h"
+
+using namespace std;
+using namespace utp;
+
+NodeTable::NodeTable()
+    : m_nextid(ROOT + 1)
+{
+    LOG(lgr, 6, "NodeTable CTOR");
+
+    Node root;
+    root.m_path = "/";
+    root.m_fileid = 0;
+    root.m_nlookup = 0;
+    root.m_nchildren = 0;
+    m_nodes.insert(make_pair(NodeId(ROOT), root));
+}
+
+NodeTable::~NodeTable()
+{
+    LOG(lgr, 6, "NodeTable DTOR");
+}
+
+bool
+NodeTable::path(NodeId i_id, string & o_path) const
+{
+    ACE_Guard<ACE_Thread_Mutex> guard(m_ntmutex);
+
+    NodeMap::const_iterator pos = m_nodes.find(i_id);
+    if (pos == m_nodes.end() || pos->second.m_path.empty())
+        return false;
+
+    o_path = pos->second.m_path;
+    return true;
+}
+
+bool
+NodeTable::path(NodeId i_parent,
+                string const & i_name,
+                string & o_path) const
+{
+    if (!path(i_parent, o_path))
+        return false;
+
+    if (o_path.size() > 1)
+        o_path += '/';
+    o_path += i_name;
+    return true;
+}
+
+NodeTable::NodeId
+NodeTable::lookup(NodeId i_parent, string const & i_name, uint64 i_fileid)
+{
+    ACE_Guard<ACE_Thread_Mutex> guard(m_ntmutex);
+
+    EntryKey key(i_parent, i_name);
+    EntryMap::iterator epos = m_entries.find(key);
+    if (epos != m_entries.end())
+    {
+        Node & node = m_nodes[epos->second];
+        if (!i_fileid || !node.m_fileid || node.m_fileid == i_fileid)
+        {
+            ++node.m_nlookup;
+            return epos->second;
+        }
+
+        // The name is another file's now.
+        unlink(epos);
+    }
+
+    NodeMap::const_iterator ppos = m_nodes.find(i_parent);
+    if (ppos == m_nodes.end() || ppos->second.m_path.empty())
+        return 0;
+
+    // Another link of a file we know?
+    if (i_fileid)
+    {
+        FileIdMap::const_iterator fpos = m_fileids.find(i_fileid);
+        if (fpos != m_fileids.end())
+        {
+            NodeId id = fpos->second;
+            link(key, id);
+            ++m_nodes[id].m_nlookup;
+
+            LOG(lgr, 6, "node " << id << " linked: "
+                << i_parent << ' ' << i_name);
+
+            return id;
+        }
+    }
+
+    Node node;
+    node.m_fileid = i_fileid;
+    node.m_nlookup = 1;
+    node.m_nchildren = 0;
+
+    NodeId id = m_nextid++;
+    m_nodes.insert(make_pair(id, node));
+    if (i_fileid)
+        m_fileids.insert(make_pair(i_fileid, id));
+    link(key, id);
+
+    LOG(lgr, 6, "node " << id << ": " << i_parent << ' ' << i_name);
+
+    return id;
+}
+
+void
+NodeTable::forget(NodeId i_id, unsigned long i_nlookup)
+{
+    ACE_Guard<ACE_Thread_Mutex> guard(m_ntmutex);
+
+    NodeMap::iterator pos = m_nodes.find(i_id);
+    if (pos == m_nodes.end())
+        return;
+
+    Node & node = pos->second;
+    node.m_nlookup -= min(i_nlookup, node.m_nlookup);
+
+    release(i_id);
+}
+
+void
+NodeTable::remove(NodeId i_parent, string const & i_name)
+{
+    ACE_Guard<ACE_Thread_Mutex> guard(m_ntmutex);
+
+    EntryMap::iterator epos = m_entries.find(EntryKey(i_parent, i_name));
+    if (epos != m_entries.end())
+        unlink(epos);
+}
+
+void
+NodeTable::rename(NodeId i_parent,
+                  string const & i_name,
+                  NodeId i_newparent,
+                  string const & i_newname)
+{
+    ACE_Guard<ACE_Thread_Mutex> guard(m_ntmutex);
+
+    EntryMap::iterator epos = m_entries.find(EntryKey(i_parent, i_name));
+    NodeId id = epos == m_entries.end() ? 0 : epos->second;
+
+    // Renaming a link over another of the same file leaves both.
+    EntryKey newkey(i_newparent, i_newname);
+    EntryMap::iterator npos = m_entries.find(newkey);
+    if (npos != m_entries.end())
+    {
+        if (npos->second == id)
+            return;
+
+        // Whatever had the new name is gone.
+        unlink(npos);
+    }
+
+    if (!id)
+        return;
+
+    // Dropping the other entry may have freed the new parent, never
+    // our entry, but look again rather than count on it.
+    epos = m_entries.find(EntryKey(i_parent, i_name));
+    if (epos == m_entries.end())
+        return;
+
+    // The kernel won't rename into a directory it doesn't know.
+    NodeMap::const_iterator ppos = m_nodes.find(i_newparent);
+    if (ppos == m_nodes.end() || ppos->second.m_path.empty())
+    {
+        unlink(epos);
+        return;
+    }
+
+    // Link the new name first, dropping the old one may free the old
+    // parent but not us.
+    link(newkey, id);
+    unlink(epos);
+}
+
+NodeTable::NodeId
+NodeTable::find(NodeId i_parent, string const & i_name) const
+{
+    ACE_Guard<ACE_Thread_Mutex> guard(m_ntmutex);
+
+    EntryMap::const_iterator epos = m_entries.find(EntryKey(i_parent, i_name));
+    return epos == m_entries.end() ? 0 : epos->second;
+}
+
+size_t
+NodeTable::size() const
+{
+    ACE_Guard<ACE_Thread_Mutex> guard(m_ntmutex);
+    return m_nodes.size();
+}
+
+void
+NodeTable::link(EntryKey const & i_key, NodeId i_id)
+{
+    m_entries.insert(make_pair(i_key, i_id));
+    m_nodes[i_id].m_links.insert(i_key);
+    ++m_nodes[i_key.first].m_nchildren;
+
+    repath(i_id);
+}
+
+void
+NodeTable::unlink(EntryMap::iterator i_epos)
+{
+    EntryKey key = i_epos->first;
+    NodeId id = i_epos->second;
+
+    m_entries.erase(i_epos);
+    m_nodes[id].m_links.erase(key);
+    --m_nodes[key.first].m_nchildren;
+
+    repath(id);
+
+    release(id);
+    release(key.first);
+}
+
+void
+NodeTable::repath(NodeId i_id)
+{
+    vector<NodeId> work(1, i_id);
+    while (!work.empty())
+    {
+        NodeId id = work.back();
+        work.pop_back();
+
+        NodeMap::iterator pos = m_nodes.find(id);
+        if (pos == m_nodes.end() || id == ROOT)
+            continue;
+
+        // Through the first link whose parent is attached.
+        Node & node = pos->second;
+        string path;
+        for (LinkSet::const_iterator it = node.m_links.begin();
+             it != node.m_links.end();
+             ++it)
+        {
+            string const & ppath = m_nodes[it->first].m_path;
+            if (ppath.empty())
+                continue;
+
+            path = ppath;
+            if (path.size() > 1)
+                path += '/';
+            path += it->second;
+            break;
+        }
+
+        if (path == node.m_path)
+            continue;
+
+        node.m_path = path;
+
+        // The nodes beneath follow.  Their links are the entries
+        // which name us the parent.
+        for (EntryMap::const_iterator it =
+                 m_entries.lower_bound(EntryKey(id, string()));
+             it != m_entries.end() && it->first.first == id;
+             ++it)
+            work.push_back(it->second);
+    }
+}
+
+void
+NodeTable::release(NodeId i_id)
+{
+    // Freeing a node may free its parents in turn.
+    vector<NodeId> work(1, i_id);
+    while (!work.empty())
+    {
+        NodeId id = work.back();
+        work.pop_back();
+
+        NodeMap::iterator pos = m_nodes.find(id);
+        if (pos == m_nodes.end() || id == ROOT)
+            continue;
+
+        Node & node = pos->second;
+        if (node.m_nlookup || node.m_nchildren)
+            continue;
+
+        for (LinkSet::const_iterator it = node.m_links.begin();
+             it != node.m_links.end();
+             ++it)
+        {
+            m_entries.erase(*it);
+            --m_nodes[it->first].m_nchildren;
+            work.push_back(it->first);
+        }
+
+        if (node.m_fileid)
+            m_fileids.erase(node.m_fileid);
+
+        LOG(lgr, 6, "node " << id << " freed");
+        m_nodes.erase(pos);
+    }
+}
+
+// Local Variables:
+// mode: C++
+// tab-width: 4
+// c-basic-offset: 4
+// c-file-offsets: ((comment-intro . 0))
+// End:
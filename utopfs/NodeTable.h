@@ -0,0 +1,133 @@
+#ifndef NodeTable_h__
+#define NodeTable_h__
+
+/// @file NodeTable.h
+/// Utopia FileSystem FUSE Node Table.
+///
+/// Node IDs for the FUSE low-level interface.
+
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+
+#include <ace/Thread_Mutex.h>
+
+#include "Types.h"
+
+// Maps the node IDs handed to the kernel to the entries they name.
+//
+// The FileSystem interface is path based; UTFS can't change a node
+// without marking the directories above it dirty, so it has to be
+// reached through them.  Each node keeps its full path, the path of
+// its parent and its name in it, so an operation on it costs a string
+// copy however deep it is.  Renaming or detaching a directory redoes
+// the paths of the nodes beneath it which are in the table.  The
+// FileSystem resolves the path through its dentry cache.
+//
+// A node is the file, not the name.  Nodes are keyed by the file ID
+// the FileSystem reports as st_ino, so the hard links of a file share
+// one node and the kernel sees one inode; each name is a link of the
+// node and the path goes through the first whose parent is attached.
+// Files without an ID get a node per name.
+//
+// IDs are never reused, so the generation is always zero.  A node
+// lives until the kernel forgets every lookup of it and no link names
+// it the parent.  Removing or renaming over an entry drops its link,
+// once a node has none left operations on it fail with ESTALE.
+//
+class NodeTable
+{
+public:
+    // Same as fuse_ino_t.
+    typedef unsigned long NodeId;
+
+    // The root's ID (FUSE_ROOT_ID).
+    static NodeId const ROOT = 1;
+
+    NodeTable();
+
+    ~NodeTable();
+
+    // Sets the node's path, false if the node isn't known or was
+    // detached.
+    bool path(NodeId i_id, std::string & o_path) const;
+
+    // Sets the path of the entry in the parent, false as above.
+    bool path(NodeId i_parent,
+              std::string const & i_name,
+              std::string & o_path) const;
+
+    // Returns the entry's node, making it or linking the file's node
+    // if need be, and counts a lookup of it by the kernel.  i_fileid
+    // is the file's st_ino, 0 if it has none.  Returns 0 if the
+    // parent isn't known or was detached.
+    //
+    NodeId lookup(NodeId i_parent,
+                  std::string const & i_name,
+                  utp::uint64 i_fileid);
+
+    // The kernel dropped i_nlookup lookups of the node.
+    void forget(NodeId i_id, unsigned long i_nlookup);
+
+    // The entry was removed.
+    void remove(NodeId i_parent, std::string const & i_name);
+
+    // The entry was renamed, replacing any entry of the new name.
+    void rename(NodeId i_parent,
+                std::string const & i_name,
+                NodeId i_newparent,
+                std::string const & i_newname);
+
+    // Returns the entry's node if there is one, 0 otherwise.
+    NodeId find(NodeId i_parent, std::string const & i_name) const;
+
+    // Number of nodes.
+    size_t size() const;
+
+private:
+    typedef std::pair<NodeId, std::string> EntryKey;
+    typedef std::set<EntryKey> LinkSet;
+
+    struct Node
+    {
+        LinkSet					m_links;		// Entries naming us
+        std::string				m_path;			// Empty if detached
+        utp::uint64				m_fileid;		// 0 if unknown
+        unsigned long			m_nlookup;
+        unsigned long			m_nchildren;	// Links naming us parent
+    };
+
+    typedef std::map<NodeId, Node> NodeMap;
+    typedef std::map<EntryKey, NodeId> EntryMap;
+    typedef std::map<utp::uint64, NodeId> FileIdMap;
+
+    // IMPORTANT - The following need m_ntmutex held.
+
+    // Adds the entry as a link of the node.
+    void link(EntryKey const & i_key, NodeId i_id);
+
+    // Drops the entry's link, freeing what nothing holds anymore.
+    void unlink(EntryMap::iterator i_epos);
+
+    // Redoes the node's path, and those beneath it if it changed.
+    void repath(NodeId i_id);
+
+    // Frees the node if nothing holds it, and then its parents.
+    void release(NodeId i_id);
+
+    mutable ACE_Thread_Mutex	m_ntmutex;
+    NodeMap						m_nodes;
+    EntryMap					m_entries;
+    FileIdMap					m_fileids;
+    NodeId						m_nextid;
+};
+
+// Local Variables:
+// mode: C++
+// tab-width: 4
+// c-basic-offset: 4
+// c-file-offsets: ((comment-intro . 0))
+// End:
+
+#endif // NodeTable_h__
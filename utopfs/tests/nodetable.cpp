@@ -0,0 +1,163 @@
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "NodeTable.h"
+
+using namespace std;
+
+namespace {
+
+int g_nfailed = 0;
+
+void
+check(bool i_ok, char const * i_what)
+{
+    if (!i_ok)
+    {
+        cerr << "FAILED: " << i_what << endl;
+        ++g_nfailed;
+    }
+}
+
+// Returns the node's path, "" if it has none.
+string
+pathof(NodeTable const & i_nt, NodeTable::NodeId i_id)
+{
+    string path;
+    return i_nt.path(i_id, path) ? path : string();
+}
+
+void
+test_paths()
+{
+    NodeTable nt;
+
+    NodeTable::NodeId dir = nt.lookup(NodeTable::ROOT, "dir", 10);
+    NodeTable::NodeId sub = nt.lookup(dir, "sub", 11);
+    NodeTable::NodeId file = nt.lookup(sub, "file", 12);
+
+    check(pathof(nt, NodeTable::ROOT) == "/", "root path");
+    check(pathof(nt, file) == "/dir/sub/file", "nested path");
+
+    string path;
+    check(nt.path(sub, "new", path) && path == "/dir/sub/new",
+          "entry path");
+
+    // Another lookup of the entry is the same node.
+    check(nt.lookup(sub, "file", 12) == file, "lookup again");
+    check(nt.find(sub, "file") == file, "find");
+    check(nt.find(sub, "none") == 0, "find missing");
+
+    // Renaming a directory moves everything beneath it.
+    nt.rename(NodeTable::ROOT, "dir", NodeTable::ROOT, "moved");
+    check(pathof(nt, sub) == "/moved/sub", "renamed directory");
+    check(pathof(nt, file) == "/moved/sub/file", "beneath renamed");
+
+    nt.rename(sub, "file", NodeTable::ROOT, "top");
+    check(pathof(nt, file) == "/top", "renamed file");
+    check(nt.find(sub, "file") == 0, "old name gone");
+
+    // Removing a directory detaches what is beneath it.
+    NodeTable::NodeId leaf = nt.lookup(sub, "leaf", 13);
+    nt.remove(dir, "sub");
+    check(pathof(nt, sub).empty(), "removed directory");
+    check(pathof(nt, leaf).empty(), "beneath removed");
+    check(nt.lookup(sub, "other", 14) == 0, "lookup in removed");
+}
+
+void
+test_links()
+{
+    NodeTable nt;
+
+    NodeTable::NodeId dir = nt.lookup(NodeTable::ROOT, "dir", 10);
+    NodeTable::NodeId file = nt.lookup(NodeTable::ROOT, "a", 20);
+
+    // A hard link is the same node.
+    check(nt.lookup(dir, "b", 20) == file, "link shares node");
+    check(nt.find(dir, "b") == file, "find link");
+    check(nt.size() == 3, "link adds no node");
+
+    // Either name leads to the file.
+    check(pathof(nt, file) == "/a", "first link path");
+    nt.remove(NodeTable::ROOT, "a");
+    check(pathof(nt, file) == "/dir/b", "other link path");
+
+    // Renaming one link over another of the same file leaves both.
+    check(nt.lookup(NodeTable::ROOT, "c", 20) == file, "third link");
+    nt.rename(dir, "b", NodeTable::ROOT, "c");
+    check(nt.find(dir, "b") == file, "rename over link");
+
+    nt.remove(dir, "b");
+    nt.remove(NodeTable::ROOT, "c");
+    check(pathof(nt, file).empty(), "all links removed");
+
+    // Files without an ID get a node per name.
+    NodeTable::NodeId x = nt.lookup(NodeTable::ROOT, "x", 0);
+    NodeTable::NodeId y = nt.lookup(NodeTable::ROOT, "y", 0);
+    check(x != y, "no ID, no sharing");
+
+    // A name which is another file's now gets another node.
+    NodeTable::NodeId z = nt.lookup(NodeTable::ROOT, "z", 30);
+    check(nt.lookup(NodeTable::ROOT, "z", 31) != z, "replaced file");
+    check(pathof(nt, z).empty(), "replaced file detached");
+}
+
+void
+test_forget()
+{
+    NodeTable nt;
+
+    NodeTable::NodeId dir = nt.lookup(NodeTable::ROOT, "dir", 10);
+    NodeTable::NodeId file = nt.lookup(dir, "file", 11);
+    nt.lookup(dir, "file", 11);
+    check(nt.size() == 3, "three nodes");
+
+    // The directory is held by its child.
+    nt.forget(dir, 1);
+    check(nt.size() == 3, "parent held");
+    check(pathof(nt, file) == "/dir/file", "path after forget");
+
+    // Until every lookup of the child is forgotten.
+    nt.forget(file, 1);
+    check(nt.size() == 3, "child still looked up");
+    nt.forget(file, 1);
+    check(nt.size() == 1, "all freed");
+    check(nt.find(NodeTable::ROOT, "dir") == 0, "entry freed");
+
+    // A freed file's ID makes a new node.
+    NodeTable::NodeId again = nt.lookup(NodeTable::ROOT, "file", 11);
+    check(again != file, "IDs aren't reused");
+
+    // A detached node lives until it's forgotten.
+    nt.remove(NodeTable::ROOT, "file");
+    check(nt.size() == 2, "detached kept");
+    nt.forget(again, 1);
+    check(nt.size() == 1, "detached freed");
+}
+
+} // end namespace
+
+int
+main(int argc, char ** argv)
+{
+    test_paths();
+    test_links();
+    test_forget();
+
+    if (g_nfailed)
+    {
+        cerr << g_nfailed << " checks failed" << endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+// Local Variables:
+// mode: C++
+// tab-width: 4
+// c-basic-offset: 4
+// c-file-offsets: ((comment-intro . 0))
+// End:
@@ -6,6 +6,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include <iostream>
@@ -20,6 +21,7 @@
 #define FUSE_USE_VERSION 26
 
 #include <fuse.h>
+#include <fuse_lowlevel.h>
 #include <fuse/fuse_opt.h>
 
 #include <google/protobuf/stubs/common.h>
@@ -32,6 +34,7 @@
 #include "FileSystem.h"
 #include "fuselog.h"
 #include "Log.h"
+#include "NodeTable.h"
 #include "StatsLogger.h"
 #include "ThreadPool.h"
 
@@ -79,6 +82,10 @@ struct utopfs
     Controller * control;
     StatsLogger * statslog;
     ThreadPool * thrpool;
+    bool lowlevel;
+    double entrysecs;
+    double attrsecs;
+    NodeTable * nodes;
 };
 
 static struct utopfs utopfs;
@@ -552,6 +559,656 @@ utopfs_utimens(char const * i_path, struct timespec const i_tv[2])
     }
 }
 
+// ----------------------------------------------------------------
+// Low-level interface, see NodeTable.
+// ----------------------------------------------------------------
+
+// Replies with the entry's attributes and node.  If i_negok is set a
+// missing entry is a negative entry the kernel caches.
+//
+static void
+ll_reply_entry(fuse_req_t req,
+               fuse_ino_t i_parent,
+               char const * i_name,
+               bool i_negok)
+{
+    string path;
+    if (!utopfs.nodes->path(i_parent, i_name, path))
+    {
+        fuse_reply_err(req, ESTALE);
+        return;
+    }
+
+    struct fuse_entry_param e;
+    memset(&e, 0, sizeof(e));
+    e.attr_timeout = utopfs.attrsecs;
+    e.entry_timeout = utopfs.entrysecs;
+
+    int rv = utopfs.assembly->fsh()->fs_getattr(path, &e.attr);
+    if (rv == -ENOENT && i_negok)
+    {
+        e.ino = 0;
+        fuse_reply_entry(req, &e);
+        return;
+    }
+    if (rv < 0)
+    {
+        fuse_reply_err(req, -rv);
+        return;
+    }
+
+    // The filesystem's st_ino identifies the file, its hard links
+    // share a node.
+    e.ino = utopfs.nodes->lookup(i_parent, i_name, e.attr.st_ino);
+    if (!e.ino)
+    {
+        fuse_reply_err(req, ESTALE);
+        return;
+    }
+
+    e.attr.st_ino = e.ino;
+    fuse_reply_entry(req, &e);
+}
+
+static void
+ll_reply_attr(fuse_req_t req, fuse_ino_t i_ino, string const & i_path)
+{
+    struct stat stbuf;
+    memset(&stbuf, 0, sizeof(stbuf));
+
+    int rv = utopfs.assembly->fsh()->fs_getattr(i_path, &stbuf);
+    if (rv < 0)
+    {
+        fuse_reply_err(req, -rv);
+        return;
+    }
+
+    stbuf.st_ino = i_ino;
+    fuse_reply_attr(req, &stbuf, utopfs.attrsecs);
+}
+
+static void
+ll_init(void * userdata, struct fuse_conn_info * conn)
+{
+    utopfs_init(conn);
+}
+
+static void
+ll_destroy(void * userdata)
+{
+    utopfs_destroy(userdata);
+}
+
+static void
+ll_lookup(fuse_req_t req, fuse_ino_t parent, char const * name)
+{
+    try
+    {
+        ll_reply_entry(req, parent, name, true);
+    }
+    catch (utp::Exception const & ex)
+    {
+        fatal(ex.what());
+    }
+}
+
+static void
+ll_forget(fuse_req_t req, fuse_ino_t ino, unsigned long nlookup)
+{
+    utopfs.nodes->forget(ino, nlookup);
+    fuse_reply_none(req);
+}
+
+static void
+ll_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info * fi)
+{
+    try
+    {
+        string path;
+        if (!utopfs.nodes->path(ino, path))
+        {
+            fuse_reply_err(req, ESTALE);
+            return;
+        }
+
+        ll_reply_attr(req, ino, path);
+    }
+    catch (utp::Exception const & ex)
+    {
+        fatal(ex.what());
+    }
+}
+
+static void
+ll_setattr(fuse_req_t req,
+           fuse_ino_t ino,
+           struct stat * attr,
+           int to_set,
+           struct fuse_file_info * fi)
+{
+    try
+    {
+        string path;
+        if (!utopfs.nodes->path(ino, path))
+        {
+            fuse_reply_err(req, ESTALE);
+            return;
+        }
+
+        FileSystemHandle fsh = utopfs.assembly->fsh();
+        int rv = 0;
+
+        if (to_set & FUSE_SET_ATTR_MODE)
+            rv = fsh->fs_chmod(path, attr->st_mode);
+
+        if (rv == 0 && (to_set & (FUSE_SET_ATTR_UID | FUSE_SET_ATTR_GID)))
+        {
+            // Keep whichever isn't being set.
+            struct stat stbuf;
+            rv = fsh->fs_getattr(path, &stbuf);
+            if (rv == 0)
+            {
+                uid_t uid = (to_set & FUSE_SET_ATTR_UID)
+                    ? attr->st_uid : stbuf.st_uid;
+                gid_t gid = (to_set & FUSE_SET_ATTR_GID)
+                    ? attr->st_gid : stbuf.st_gid;
+                rv = fsh->fs_chown(path,
+                                   FileSystemFactory::mapuid(uid),
+                                   FileSystemFactory::mapgid(gid));
+            }
+        }
+
+        if (rv == 0 && (to_set & FUSE_SET_ATTR_SIZE))
+            rv = fsh->fs_truncate(path, attr->st_size);
+
+        if (rv == 0 && (to_set & (FUSE_SET_ATTR_ATIME | FUSE_SET_ATTR_MTIME)))
+        {
+            struct stat stbuf;
+            rv = fsh->fs_getattr(path, &stbuf);
+            if (rv == 0)
+            {
+                rv = fsh->fs_utime(path,
+                                   (to_set & FUSE_SET_ATTR_ATIME)
+                                   ? attr->st_atim : stbuf.st_atim,
+                                   (to_set & FUSE_SET_ATTR_MTIME)
+                                   ? attr->st_mtim : stbuf.st_mtim);
+            }
+        }
+
+        if (rv < 0)
+            fuse_reply_err(req, -rv);
+        else
+            ll_reply_attr(req, ino, path);
+    }
+    catch (utp::Exception const & ex)
+    {
+        fatal(ex.what());
+    }
+}
+
+static void
+ll_readlink(fuse_req_t req, fuse_ino_t ino)
+{
+    try
+    {
+        string path;
+        if (!utopfs.nodes->path(ino, path))
+        {
+            fuse_reply_err(req, ESTALE);
+            return;
+        }
+
+        char buf[PATH_MAX + 1];
+        int rv = utopfs.assembly->fsh()->fs_readlink(path, buf, sizeof(buf));
+        if (rv < 0)
+        {
+            fuse_reply_err(req, -rv);
+            return;
+        }
+
+        buf[sizeof(buf) - 1] = '\0';
+        fuse_reply_readlink(req, buf);
+    }
+    catch (utp::Exception const & ex)
+    {
+        fatal(ex.what());
+    }
+}
+
+static void
+ll_mknod(fuse_req_t req,
+         fuse_ino_t parent,
+         char const * name,
+         mode_t mode,
+         dev_t rdev)
+{
+    try
+    {
+        string path;
+        if (!utopfs.nodes->path(parent, name, path))
+        {
+            fuse_reply_err(req, ESTALE);
+            return;
+        }
+
+        struct fuse_ctx const * fctxtp = fuse_req_ctx(req);
+
+        string uname = FileSystemFactory::mapuid(fctxtp->uid);
+        string gname = FileSystemFactory::mapgid(fctxtp->gid);
+
+        int rv = utopfs.assembly->fsh()->fs_mknod(path, mode, rdev,
+                                                  uname, gname);
+        if (rv < 0)
+            fuse_reply_err(req, -rv);
+        else
+            ll_reply_entry(req, parent, name, false);
+    }
+    catch (utp::Exception const & ex)
+    {
+        fatal(ex.what());
+    }
+}
+
+static void
+ll_mkdir(fuse_req_t req, fuse_ino_t parent, char const * name, mode_t mode)
+{
+    try
+    {
+        string path;
+        if (!utopfs.nodes->path(parent, name, path))
+        {
+            fuse_reply_err(req, ESTALE);
+            return;
+        }
+
+        struct fuse_ctx const * fctxtp = fuse_req_ctx(req);
+
+        string uname = FileSystemFactory::mapuid(fctxtp->uid);
+        string gname = FileSystemFactory::mapgid(fctxtp->gid);
+
+        int rv = utopfs.assembly->fsh()->fs_mkdir(path, mode, uname, gname);
+        if (rv < 0)
+            fuse_reply_err(req, -rv);
+        else
+            ll_reply_entry(req, parent, name, false);
+    }
+    catch (utp::Exception const & ex)
+    {
+        fatal(ex.what());
+    }
+}
+
+static void
+ll_unlink(fuse_req_t req, fuse_ino_t parent, char const * name)
+{
+    try
+    {
+        string path;
+        if (!utopfs.nodes->path(parent, name, path))
+        {
+            fuse_reply_err(req, ESTALE);
+            return;
+        }
+
+        int rv = utopfs.assembly->fsh()->fs_unlink(path);
+        if (rv == 0)
+            utopfs.nodes->remove(parent, name);
+        fuse_reply_err(req, -rv);
+    }
+    catch (utp::Exception const & ex)
+    {
+        fatal(ex.what());
+    }
+}
+
+static void
+ll_rmdir(fuse_req_t req, fuse_ino_t parent, char const * name)
+{
+    try
+    {
+        string path;
+        if (!utopfs.nodes->path(parent, name, path))
+        {
+            fuse_reply_err(req, ESTALE);
+            return;
+        }
+
+        int rv = utopfs.assembly->fsh()->fs_rmdir(path);
+        if (rv == 0)
+            utopfs.nodes->remove(parent, name);
+        fuse_reply_err(req, -rv);
+    }
+    catch (utp::Exception const & ex)
+    {
+        fatal(ex.what());
+    }
+}
+
+static void
+ll_symlink(fuse_req_t req,
+           char const * link,
+           fuse_ino_t parent,
+           char const * name)
+{
+    try
+    {
+        string path;
+        if (!utopfs.nodes->path(parent, name, path))
+        {
+            fuse_reply_err(req, ESTALE);
+            return;
+        }
+
+        int rv = utopfs.assembly->fsh()->fs_symlink(link, path);
+        if (rv < 0)
+            fuse_reply_err(req, -rv);
+        else
+            ll_reply_entry(req, parent, name, false);
+    }
+    catch (utp::Exception const & ex)
+    {
+        fatal(ex.what());
+    }
+}
+
+static void
+ll_rename(fuse_req_t req,
+          fuse_ino_t parent,
+          char const * name,
+          fuse_ino_t newparent,
+          char const * newname)
+{
+    try
+    {
+        string opath;
+        string npath;
+        if (!utopfs.nodes->path(parent, name, opath) ||
+            !utopfs.nodes->path(newparent, newname, npath))
+        {
+            fuse_reply_err(req, ESTALE);
+            return;
+        }
+
+        int rv = utopfs.assembly->fsh()->fs_rename(opath, npath);
+        if (rv == 0)
+            utopfs.nodes->rename(parent, name, newparent, newname);
+        fuse_reply_err(req, -rv);
+    }
+    catch (utp::Exception const & ex)
+    {
+        fatal(ex.what());
+    }
+}
+
+static void
+ll_link(fuse_req_t req,
+        fuse_ino_t ino,
+        fuse_ino_t newparent,
+        char const * newname)
+{
+    try
+    {
+        string opath;
+        string npath;
+        if (!utopfs.nodes->path(ino, opath) ||
+            !utopfs.nodes->path(newparent, newname, npath))
+        {
+            fuse_reply_err(req, ESTALE);
+            return;
+        }
+
+        // The new name is another link of the file's node.
+        int rv = utopfs.assembly->fsh()->fs_link(opath, npath);
+        if (rv < 0)
+            fuse_reply_err(req, -rv);
+        else
+            ll_reply_entry(req, newparent, newname, false);
+    }
+    catch (utp::Exception const & ex)
+    {
+        fatal(ex.what());
+    }
+}
+
+static void
+ll_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info * fi)
+{
+    try
+    {
+        string path;
+        if (!utopfs.nodes->path(ino, path))
+        {
+            fuse_reply_err(req, ESTALE);
+            return;
+        }
+
+        int rv = utopfs.assembly->fsh()->fs_open(path, fi->flags);
+        if (rv < 0)
+            fuse_reply_err(req, -rv);
+        else
+            fuse_reply_open(req, fi);
+    }
+    catch (utp::Exception const & ex)
+    {
+        fatal(ex.what());
+    }
+}
+
+// Replies to a read with the pieces fs_read_vec passes, while they
+// are still in place.
+//
+struct LLReadVecFunc : public utp::FileSystem::ReadVecFunc
+{
+    fuse_req_t			m_req;
+    vector<iovec>		m_iov;
+
+    LLReadVecFunc(fuse_req_t i_req) : m_req(i_req) {}
+
+    virtual void rv_segment(void const * i_data, size_t i_size)
+    {
+        iovec iov;
+        iov.iov_base = const_cast<void *>(i_data);
+        iov.iov_len = i_size;
+        m_iov.push_back(iov);
+    }
+
+    virtual void rv_done()
+    {
+        if (m_iov.empty())
+            fuse_reply_buf(m_req, NULL, 0);
+        else
+            fuse_reply_iov(m_req, &m_iov[0], m_iov.size());
+    }
+};
+
+static void
+ll_read(fuse_req_t req,
+        fuse_ino_t ino,
+        size_t size,
+        off_t off,
+        struct fuse_file_info * fi)
+{
+    try
+    {
+        string path;
+        if (!utopfs.nodes->path(ino, path))
+        {
+            fuse_reply_err(req, ESTALE);
+            return;
+        }
+
+        // The reply is written from the filesystem's blocks.
+        LLReadVecFunc lrvf(req);
+        int rv = utopfs.assembly->fsh()->fs_read_vec(path, size, off, lrvf);
+        if (rv < 0)
+            fuse_reply_err(req, -rv);
+    }
+    catch (utp::Exception const & ex)
+    {
+        fatal(ex.what());
+    }
+}
+
+static void
+ll_write(fuse_req_t req,
+         fuse_ino_t ino,
+         char const * buf,
+         size_t size,
+         off_t off,
+         struct fuse_file_info * fi)
+{
+    try
+    {
+        string path;
+        if (!utopfs.nodes->path(ino, path))
+        {
+            fuse_reply_err(req, ESTALE);
+            return;
+        }
+
+        int rv = utopfs.assembly->fsh()->fs_write(path, buf, size, off);
+        if (rv < 0)
+            fuse_reply_err(req, -rv);
+        else
+            fuse_reply_write(req, rv);
+    }
+    catch (utp::Exception const & ex)
+    {
+        fatal(ex.what());
+    }
+}
+
+// Collects a directory's listing when it's opened, readdir replies
+// with slices of it.
+//
+struct LLDirEntryFunc : public utp::FileSystem::DirEntryFunc
+{
+    fuse_req_t			m_req;
+    fuse_ino_t			m_ino;
+    vector<char>		m_buf;
+
+    LLDirEntryFunc(fuse_req_t i_req, fuse_ino_t i_ino)
+        : m_req(i_req), m_ino(i_ino) {}
+
+    virtual bool def_entry(string const & i_name,
+                           struct stat const * i_stbuf,
+                           off_t i_off)
+    {
+        // Nodes we've handed out keep their IDs, the kernel looks up
+        // the rest.
+        struct stat stbuf;
+        memset(&stbuf, 0, sizeof(stbuf));
+        if (i_name == ".")
+            stbuf.st_ino = m_ino;
+        else
+            stbuf.st_ino = utopfs.nodes->find(m_ino, i_name);
+        if (!stbuf.st_ino)
+            stbuf.st_ino = 0xffffffff;	// Unknown
+
+        size_t oldsize = m_buf.size();
+        size_t entsize =
+            fuse_add_direntry(m_req, NULL, 0, i_name.c_str(), NULL, 0);
+        m_buf.resize(oldsize + entsize);
+        fuse_add_direntry(m_req, &m_buf[oldsize], entsize,
+                          i_name.c_str(), &stbuf, m_buf.size());
+        return false;
+    }
+};
+
+static void
+ll_opendir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info * fi)
+{
+    try
+    {
+        string path;
+        if (!utopfs.nodes->path(ino, path))
+        {
+            fuse_reply_err(req, ESTALE);
+            return;
+        }
+
+        LLDirEntryFunc * ldefp = new LLDirEntryFunc(req, ino);
+        int rv = utopfs.assembly->fsh()->fs_readdir(path, 0, *ldefp);
+        if (rv < 0)
+        {
+            delete ldefp;
+            fuse_reply_err(req, -rv);
+            return;
+        }
+
+        fi->fh = (uint64_t) ldefp;
+        if (fuse_reply_open(req, fi) != 0)
+            delete ldefp;
+    }
+    catch (utp::Exception const & ex)
+    {
+        fatal(ex.what());
+    }
+}
+
+static void
+ll_readdir(fuse_req_t req,
+           fuse_ino_t ino,
+           size_t size,
+           off_t off,
+           struct fuse_file_info * fi)
+{
+    LLDirEntryFunc * ldefp = (LLDirEntryFunc *) fi->fh;
+
+    if (size_t(off) >= ldefp->m_buf.size())
+        fuse_reply_buf(req, NULL, 0);
+    else
+        fuse_reply_buf(req, &ldefp->m_buf[off],
+                       min(ldefp->m_buf.size() - off, size));
+}
+
+static void
+ll_releasedir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info * fi)
+{
+    delete (LLDirEntryFunc *) fi->fh;
+    fuse_reply_err(req, 0);
+}
+
+static void
+ll_statfs(fuse_req_t req, fuse_ino_t ino)
+{
+    try
+    {
+        struct statvfs stvbuf;
+        int rv = utopfs.assembly->fsh()->fs_statfs(&stvbuf);
+        if (rv < 0)
+            fuse_reply_err(req, -rv);
+        else
+            fuse_reply_statfs(req, &stvbuf);
+    }
+    catch (utp::Exception const & ex)
+    {
+        fatal(ex.what());
+    }
+}
+
+static void
+ll_access(fuse_req_t req, fuse_ino_t ino, int mask)
+{
+    try
+    {
+        string path;
+        if (!utopfs.nodes->path(ino, path))
+        {
+            fuse_reply_err(req, ESTALE);
+            return;
+        }
+
+        fuse_reply_err(req, -utopfs.assembly->fsh()->fs_access(path, mask));
+    }
+    catch (utp::Exception const & ex)
+    {
+        fatal(ex.what());
+    }
+}
+
+static struct fuse_lowlevel_ops utopfs_ll_oper;
+
 static struct fuse_operations utopfs_oper;
 
 } // end extern "C"
@@ -570,6 +1227,9 @@ enum {
 	KEY_VERSION,
 	KEY_SYNCSECS,
 	KEY_FOREGROUND,
+	KEY_LOWLEVEL,
+	KEY_ENTRYSECS,
+	KEY_ATTRSECS,
 };
 
 #define CPP_FUSE_OPT_END	{ NULL, 0, 0 }
@@ -589,6 +1249,9 @@ static struct fuse_opt utopfs_opts[] = {
 	FUSE_OPT_KEY("debug",			KEY_FOREGROUND),
 	FUSE_OPT_KEY("-d",				KEY_FOREGROUND),
 	FUSE_OPT_KEY("-f",				KEY_FOREGROUND),
+	FUSE_OPT_KEY("--lowlevel",		KEY_LOWLEVEL),
+	FUSE_OPT_KEY("--entrysecs ",	KEY_ENTRYSECS),
+	FUSE_OPT_KEY("--attrsecs ",		KEY_ATTRSECS),
 	CPP_FUSE_OPT_END
 };
 
@@ -649,6 +1312,18 @@ static int utopfs_opt_proc(void * data,
         utopfs.syncsecs = atof(&arg[2]);
         return 0;
 
+    case KEY_LOWLEVEL:
+        utopfs.lowlevel = true;
+        return 0;
+
+    case KEY_ENTRYSECS:
+        utopfs.entrysecs = atof(&arg[strlen("--entrysecs")]);
+        return 0;
+
+    case KEY_ATTRSECS:
+        utopfs.attrsecs = atof(&arg[strlen("--attrsecs")]);
+        return 0;
+
 	case FUSE_OPT_KEY_OPT:
 		if (is_utop_opt(arg))
         {
@@ -681,6 +1356,80 @@ static int utopfs_opt_proc(void * data,
 	}
 }
 
+// Runs the low-level session, as fuse_main does for the path based
+// interface.
+//
+static int
+ll_main(struct fuse_args * args)
+{
+    utopfs_ll_oper.init			= ll_init;
+    utopfs_ll_oper.destroy		= ll_destroy;
+    utopfs_ll_oper.lookup		= ll_lookup;
+    utopfs_ll_oper.forget		= ll_forget;
+    utopfs_ll_oper.getattr		= ll_getattr;
+    utopfs_ll_oper.setattr		= ll_setattr;
+    utopfs_ll_oper.readlink		= ll_readlink;
+    utopfs_ll_oper.mknod		= ll_mknod;
+    utopfs_ll_oper.mkdir		= ll_mkdir;
+    utopfs_ll_oper.unlink		= ll_unlink;
+    utopfs_ll_oper.rmdir		= ll_rmdir;
+    utopfs_ll_oper.symlink		= ll_symlink;
+    utopfs_ll_oper.rename		= ll_rename;
+    utopfs_ll_oper.link			= ll_link;
+    utopfs_ll_oper.open			= ll_open;
+    utopfs_ll_oper.read			= ll_read;
+    utopfs_ll_oper.write		= ll_write;
+    utopfs_ll_oper.opendir		= ll_opendir;
+    utopfs_ll_oper.readdir		= ll_readdir;
+    utopfs_ll_oper.releasedir	= ll_releasedir;
+    utopfs_ll_oper.statfs		= ll_statfs;
+    utopfs_ll_oper.access		= ll_access;
+
+    utopfs.nodes = new NodeTable;
+
+    char * mountpoint;
+    int multithreaded;
+    int foreground;
+    if (fuse_parse_cmdline(args, &mountpoint, &multithreaded, &foreground))
+        return 1;
+
+    int rv = 1;
+    struct fuse_chan * ch = fuse_mount(mountpoint, args);
+    if (ch)
+    {
+        struct fuse_session * se = fuse_lowlevel_new(args,
+                                                     &utopfs_ll_oper,
+                                                     sizeof(utopfs_ll_oper),
+                                                     NULL);
+        if (se)
+        {
+            if (fuse_set_signal_handlers(se) == 0)
+            {
+                fuse_session_add_chan(se, ch);
+                if (fuse_daemonize(foreground) == 0)
+                {
+                    if (multithreaded)
+                        rv = fuse_session_loop_mt(se);
+                    else
+                        rv = fuse_session_loop(se);
+                }
+                fuse_remove_signal_handlers(se);
+                fuse_session_remove_chan(ch);
+            }
+            fuse_session_destroy(se);
+        }
+        fuse_unmount(mountpoint, ch);
+    }
+
+    free(mountpoint);
+    fuse_opt_free_args(args);
+
+    delete utopfs.nodes;
+    utopfs.nodes = NULL;
+
+    return rv ? 1 : 0;
+}
+
 int
 main(int argc, char ** argv)
 {
@@ -694,6 +1443,10 @@ main(int argc, char ** argv)
     utopfs.loglevel = -1;
     utopfs.size = 0;
     utopfs.syncsecs = 10.0;
+    utopfs.lowlevel = false;
+    utopfs.entrysecs = 1.0;
+    utopfs.attrsecs = 1.0;
+    utopfs.nodes = NULL;
 
 	struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
 
@@ -744,6 +1497,9 @@ main(int argc, char ** argv)
         utopfs.mntpath = cwd + '/' + utopfs.mntpath;
     }
 
+    if (utopfs.lowlevel)
+        return ll_main(&args);
+
     utopfs_oper.init		= utopfs_init;
     utopfs_oper.destroy		= utopfs_destroy;
     utopfs_oper.getattr		= utopfs_getattr;